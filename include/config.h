@@ -5,11 +5,36 @@
 // USB Driver Configuration
 //
 #define MAX_USB_DEVICES             32
+#define MAX_USB_HOST_CONTROLLERS    8
 #define USB_TRANSFER_TIMEOUT        5000    // 5 seconds in milliseconds
-#define USB_MAX_PACKET_SIZE         64
+#define USB_MAX_PACKET_SIZE         64      // Full/high-speed control endpoint
+#define USB_SS_MAX_PACKET_SIZE      1024    // SuperSpeed bulk endpoint
+#define USB_SS_MAX_BURST            16      // Packets per SuperSpeed burst
 #define USB_CONTROL_TIMEOUT         1000    // 1 second
 #define USB_BULK_TIMEOUT            3000    // 3 seconds
 #define USB_INTERRUPT_TIMEOUT       100     // 100ms
+#define USB_BULK_MAX_TRANSFER_SIZE  (64 * 1024)     // Largest single UsbBulkTransfer call
+#define USB_SS_BULK_MAX_TRANSFER_SIZE (256 * 1024)  // Same, for SuperSpeed endpoints
+#define USB_TRANSFER_QUEUE_DEPTH    8               // Queued transfers per device
+#define USB_ASYNC_POLL_INTERVAL     10000           // Transfer pump period (100ns units, 1ms)
+#define USB_ASYNC_SLICE_TIMEOUT     1               // Bulk slice timeout per pump tick (ms)
+#define USB_DESCRIPTOR_CACHE_ENTRIES 32             // Interfaces remembered across probes
+#define USB_DESCRIPTOR_CACHE_PERSIST TRUE           // Keep the cache in NVRAM between boots
+#define USB_MSC_MAX_TRANSFER_SIZE   (512 * 1024)    // Data bytes per BOT command
+#define USB_MSC_READY_RETRIES       10
+#define USB_MSC_READY_DELAY         100000          // Microseconds between TEST UNIT READY
+#define USB_DMA_REGION_SIZE         (4 * 1024 * 1024)   // Common buffer mapped per host controller
+#define USB_HID_MAX_REPORT_DESCRIPTOR 1024          // Largest report descriptor compiled
+#define USB_HID_MAX_FIELDS          32              // Compiled input fields per device
+#define USB_HID_MAX_REPORT_SIZE     64              // Bytes of the last report kept per device
+#define USB_HID_KEY_BUFFER_SIZE     32              // Key presses buffered for the console
+
+//
+// Scheduler Configuration
+//
+#define SCHEDULER_MAX_TASKS         16
+#define SCHEDULER_WATCHDOG_TIMEOUT  300             // Seconds; 0 leaves the firmware watchdog alone
+#define SCHEDULER_WATCHDOG_PERIOD   600000000       // Watchdog kick period (100ns units, 60s)
 
 //
 // Memory Configuration
@@ -17,6 +42,47 @@
 #define DEFAULT_BUFFER_SIZE         4096
 #define MAX_BUFFER_SIZE             65536
 #define MEMORY_ALIGNMENT            16
+#define MEMORY_MAX_ARENAS           16              // Subsystem arenas registered at once
+#define MEMORY_POOL_SLAB_SIZE       (64 * 1024)     // Slab size and alignment; power of two
+#define MEMORY_POOL_MIN_BLOCK       16              // Smallest size class
+#define MEMORY_POOL_MAX_BLOCK       4096            // Largest size class; bigger requests get pages
+#define MEMORY_POOL_CLASSES         9               // log2(MAX_BLOCK / MIN_BLOCK) + 1
+
+//
+// Flash Configuration
+//
+#ifndef MAX_FLASH_REGIONS
+#define MAX_FLASH_REGIONS           64              // Region table entries; may be set at build time
+#endif
+#define FLASH_MAX_TRANSFER_SIZE     (1024 * 1024)   // Largest single FVB Read/Write call
+#define FLASH_LARGE_ERASE_SIZE      (64 * 1024)     // 64KB block erase
+#define FLASH_MEDIUM_ERASE_SIZE     (32 * 1024)     // 32KB block erase
+#define FLASH_DELTA_READ_SIZE       (64 * 1024)     // Read-back batch for delta updates
+#define FLASH_READ_CACHE            TRUE            // Sector cache in front of FVB reads
+#define FLASH_CACHE_SIZE            (256 * 1024)    // Bytes of cached sectors
+#define FLASH_CACHE_MAX_ENTRIES     64
+#define FLASH_CACHE_BUCKETS         128             // LBA hash buckets; must be a power of two
+#define FLASH_CACHE_MAX_READ        (32 * 1024)     // Larger reads go straight to FVB
+#define FLASH_CACHE_READ_AHEAD      8               // Sectors prefetched when reads are sequential
+
+//
+// Firmware Streaming Configuration
+//
+#define FIRMWARE_STREAM_CHUNK_SIZE  (64 * 1024)     // Bytes per File->Read
+#define FIRMWARE_STREAM_BUFFERS     4               // Default ring depth
+#define FIRMWARE_STREAM_MAX_BUFFERS 16
+#define FIRMWARE_USB_STREAM_CHUNK_SIZE USB_MSC_MAX_TRANSFER_SIZE  // One BOT command per chunk
+#define FIRMWARE_PACKAGE_MAX_REGIONS 16             // Region table entries per package
+#define FIRMWARE_DECOMPRESS_WINDOW  (128 * 1024)    // LZ4 history plus flush chunk
+#define FIRMWARE_ERASED_SKIP_SIZE   256             // Shortest erased run left unprogrammed
+#define FIRMWARE_VALIDATE_MIN_SLICE (1024 * 1024)   // Smallest CRC32C slice given to a processor
+
+//
+// Worker Pool Configuration
+//
+#define WORKER_POOL_MAX_PROCESSORS  32              // Processors given a work descriptor
+#define WORKER_POOL_SCRATCH_SIZE    FIRMWARE_DECOMPRESS_WINDOW  // Per-processor scratch (LZ4 window)
+#define WORKER_POOL_IDLE_SPINS      0x100000        // CpuPause loops before an idle AP returns to the firmware
 
 //
 // Debug Configuration
@@ -31,6 +97,32 @@
     #define DEBUG_BUFFER_SIZE       256
 #endif
 
+//
+// Trace Configuration
+//
+#define ENABLE_TRACE                TRUE            // FALSE compiles every trace point out
+#define TRACE_RING_ENTRIES          1024            // Records kept; must be a power of two
+#define TRACE_DUMP_RECORDS          32              // Newest records shown by the 'd' command
+#define TRACE_DEFAULT_CATEGORIES    (DEBUG_CAT_FIRMWARE | DEBUG_CAT_USB | DEBUG_CAT_CALLS)
+
+//
+// Metrics Configuration
+//
+#define METRICS_FIXED_ENTRIES       16              // USB transfer types, HID interrupt, loader stages, tests
+#define METRICS_MAX_ENTRIES         (3 * (MAX_FLASH_REGIONS + 1) + METRICS_FIXED_ENTRIES)  // Flash read/write/erase per region and "other"
+#define METRICS_NAME_LENGTH         48              // Characters per metric name, terminator included
+#define METRICS_BUCKETS             40              // log2(ns) histogram buckets, up to ~18 minutes
+#define METRICS_CALIBRATE_US        1000            // Stall used to measure the TSC rate
+
+//
+// Benchmark Configuration (tests/benchmarks.c, built by "make benchmark")
+//
+#define BENCH_ITERATIONS            16              // Timed repetitions per case
+#define BENCH_VALIDATE_MAX_SIZE     (16 * 1024 * 1024)  // Largest buffer hashed
+#ifndef BENCH_DESTRUCTIVE
+    #define BENCH_DESTRUCTIVE       FALSE           // TRUE erases and reprograms one sector per writable region
+#endif
+
 //
 // Firmware Configuration
 //
@@ -43,6 +135,8 @@
 #define FIRMWARE_VENDOR             L"Research Project"
 #define FIRMWARE_COPYRIGHT          L"(C) 2025 PhD Project"
 
+#define FIRMWARE_VALIDATE_SHA256    TRUE    // Hash images in addition to CRC32C
+
 //
 // AMD Ryzen/AM5 Specific Configuration
 //
@@ -71,6 +165,8 @@
 #define AUTO_BOOT_TIMEOUT           10      // seconds
 #define ENABLE_SHELL_ACCESS         TRUE
 #define ENABLE_REMOTE_DEBUG         TRUE
+#define FAST_BOOT                   TRUE    // Initialize USB, worker pool and loader on first use; reuse cached probes
+#define BOOT_CACHE_SLOT_SIZE        512     // Bytes per cached probe result
 
 //
 // Hardware Specific Settings
@@ -86,6 +182,14 @@
 #define REQUIRE_AUTHENTICATION      FALSE   // Disabled for debugging
 #define ENABLE_AUDIT_LOGGING        TRUE
 
+//
+// NVRAM Variables
+//
+#define FIRMWARE_VARIABLE_GUID \
+    { 0x6F1C2A3E, 0x8B4D, 0x4E5A, { 0x9C, 0x1D, 0x2B, 0x7E, 0x43, 0xA8, 0x5F, 0x10 } }
+#define USB_DESCRIPTOR_CACHE_VARIABLE L"UsbDescriptorCache"
+#define BOOT_CACHE_VARIABLE         L"FastBootCache"
+
 //
 // Performance Configuration
 //
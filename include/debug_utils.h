@@ -25,37 +25,107 @@
 #define DEBUG_CAT_BOOT              0x00000080
 #define DEBUG_CAT_NETWORK           0x00000100
 
+#define DEBUG_CAT_CALLS             0x00000200  // Function entry/exit trace records
+
 //
 // Global debug control
 //
 extern UINT32 gDebugLevel;
 extern UINT32 gDebugCategories;
+extern UINT32 gTraceCategories;
 
 //
-// Enhanced debug macros
+// Filter checks, evaluated at the call site so a disabled message costs a
+// load and a branch instead of a call and its argument evaluation
 //
-#if ENABLE_USB_DEBUG
+#define DEBUG_ENABLED(Level, Category) \
+    (((gDebugLevel & (Level)) != 0) && ((gDebugCategories & (Category)) != 0))
 
-#define DBG_ENTER()                 DebugPrint(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "ENTER: %a\n", __FUNCTION__)
-#define DBG_EXIT()                  DebugPrint(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "EXIT:  %a\n", __FUNCTION__)
-#define DBG_EXIT_STATUS(Status)     DebugPrint(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "EXIT:  %a - Status: %r\n", __FUNCTION__, Status)
+#define TRACE_ENABLED(Category)     ((gTraceCategories & (Category)) != 0)
 
-#define DBG_USB_ERROR(...)          DebugPrint(DEBUG_LEVEL_ERROR, DEBUG_CAT_USB, __VA_ARGS__)
-#define DBG_USB_WARN(...)           DebugPrint(DEBUG_LEVEL_WARN, DEBUG_CAT_USB, __VA_ARGS__)
-#define DBG_USB_INFO(...)           DebugPrint(DEBUG_LEVEL_INFO, DEBUG_CAT_USB, __VA_ARGS__)
-#define DBG_USB_VERBOSE(...)        DebugPrint(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, __VA_ARGS__)
+//
+// Binary Trace Events
+// Each record holds the TSC, an event id and up to TRACE_MAX_ARGS raw
+// arguments; formatting happens only when the ring is dumped.
+//
+#define TRACE_MAX_ARGS              3
 
-#define DBG_FIRMWARE_ERROR(...)     DebugPrint(DEBUG_LEVEL_ERROR, DEBUG_CAT_FIRMWARE, __VA_ARGS__)
-#define DBG_FIRMWARE_INFO(...)      DebugPrint(DEBUG_LEVEL_INFO, DEBUG_CAT_FIRMWARE, __VA_ARGS__)
+typedef enum {
+    TraceEventEnter,                    // Function name
+    TraceEventExit,                     // Function name, status
+    TraceEventFlashRead,                // Address, size, status
+    TraceEventFlashWrite,               // Address, size, status
+    TraceEventFlashErase,               // Address, size, status
+    TraceEventFlashDelta,               // Address, size, status
+    TraceEventUsbTransfer,              // Device id, length
+    TraceEventCount
+} DEBUG_TRACE_EVENT;
 
-#define DBG_UEFI_ERROR(...)         DebugPrint(DEBUG_LEVEL_ERROR, DEBUG_CAT_UEFI, __VA_ARGS__)
-#define DBG_UEFI_INFO(...)          DebugPrint(DEBUG_LEVEL_INFO, DEBUG_CAT_UEFI, __VA_ARGS__)
+typedef struct {
+    UINT64 Tsc;
+    UINT32 Sequence;                    // Ring position + 1, written last
+    UINT16 Event;                       // DEBUG_TRACE_EVENT
+    UINT16 Reserved;
+    UINT64 Args[TRACE_MAX_ARGS];
+} DEBUG_TRACE_RECORD;
+
+#if ENABLE_TRACE
+#define TRACE_EVENT(Category, Event, Arg0, Arg1, Arg2) \
+    do { \
+        if (TRACE_ENABLED(Category)) { \
+            DebugTraceRecord((Event), (UINT64)(Arg0), (UINT64)(Arg1), (UINT64)(Arg2)); \
+        } \
+    } while (0)
+#else
+#define TRACE_EVENT(Category, Event, Arg0, Arg1, Arg2)
+#endif
+
+//
+// Enhanced debug macros
+//
+#if ENABLE_TRACE
+
+#define DBG_ENTER()                 TRACE_EVENT(DEBUG_CAT_CALLS, TraceEventEnter, (UINTN)__FUNCTION__, 0, 0)
+#define DBG_EXIT()                  TRACE_EVENT(DEBUG_CAT_CALLS, TraceEventExit, (UINTN)__FUNCTION__, EFI_SUCCESS, 0)
+#define DBG_EXIT_STATUS(Status)     TRACE_EVENT(DEBUG_CAT_CALLS, TraceEventExit, (UINTN)__FUNCTION__, (Status), 0)
+
+#elif ENABLE_USB_DEBUG
+
+#define DBG_ENTER()                 DBG_PRINT(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "ENTER: %a\n", __FUNCTION__)
+#define DBG_EXIT()                  DBG_PRINT(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "EXIT:  %a\n", __FUNCTION__)
+#define DBG_EXIT_STATUS(Status)     DBG_PRINT(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, "EXIT:  %a - Status: %r\n", __FUNCTION__, Status)
 
 #else
 
 #define DBG_ENTER()
 #define DBG_EXIT()
 #define DBG_EXIT_STATUS(Status)
+
+#endif
+
+#if ENABLE_USB_DEBUG
+
+#define DBG_PRINT(Level, Category, ...) \
+    do { \
+        if (DEBUG_ENABLED(Level, Category)) { \
+            DebugPrint((Level), (Category), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define DBG_USB_ERROR(...)          DBG_PRINT(DEBUG_LEVEL_ERROR, DEBUG_CAT_USB, __VA_ARGS__)
+#define DBG_USB_WARN(...)           DBG_PRINT(DEBUG_LEVEL_WARN, DEBUG_CAT_USB, __VA_ARGS__)
+#define DBG_USB_INFO(...)           DBG_PRINT(DEBUG_LEVEL_INFO, DEBUG_CAT_USB, __VA_ARGS__)
+#define DBG_USB_VERBOSE(...)        DBG_PRINT(DEBUG_LEVEL_VERBOSE, DEBUG_CAT_USB, __VA_ARGS__)
+
+#define DBG_FIRMWARE_ERROR(...)     DBG_PRINT(DEBUG_LEVEL_ERROR, DEBUG_CAT_FIRMWARE, __VA_ARGS__)
+#define DBG_FIRMWARE_INFO(...)      DBG_PRINT(DEBUG_LEVEL_INFO, DEBUG_CAT_FIRMWARE, __VA_ARGS__)
+
+#define DBG_UEFI_ERROR(...)         DBG_PRINT(DEBUG_LEVEL_ERROR, DEBUG_CAT_UEFI, __VA_ARGS__)
+#define DBG_UEFI_INFO(...)          DBG_PRINT(DEBUG_LEVEL_INFO, DEBUG_CAT_UEFI, __VA_ARGS__)
+
+#else
+
+#define DBG_PRINT(Level, Category, ...)
 #define DBG_USB_ERROR(...)
 #define DBG_USB_WARN(...)
 #define DBG_USB_INFO(...)
@@ -137,4 +207,35 @@ DebugTimerEnd(
     IN OUT DEBUG_TIMER *Timer
     );
 
-#endif // _DEBUG_UTILS_H_
\ No newline at end of file
+//
+// Binary trace ring (lock-free; safe to call from APs)
+//
+VOID
+EFIAPI
+DebugTraceRecord(
+    IN UINT16 Event,
+    IN UINT64 Arg0,
+    IN UINT64 Arg1,
+    IN UINT64 Arg2
+    );
+
+UINTN
+EFIAPI
+DebugTraceExport(
+    OUT DEBUG_TRACE_RECORD *Records,
+    IN UINTN MaxRecords
+    );
+
+VOID
+EFIAPI
+DebugTraceDump(
+    IN UINTN MaxRecords
+    );
+
+VOID
+EFIAPI
+DebugTraceReset(
+    VOID
+    );
+
+#endif // _DEBUG_UTILS_H_
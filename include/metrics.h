@@ -0,0 +1,191 @@
+/**
+ * @file metrics.h
+ * @brief Latency histograms and byte counters for flash, USB and loader operations
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <Uefi.h>
+#include "config.h"
+#include "debug_utils.h"
+
+#define METRICS_INVALID_ID          ((UINTN)-1)
+
+//
+// One named metric
+// Latencies are kept as TSC ticks and bucketed by log2 of nanoseconds:
+// bucket n counts operations that took [2^n, 2^(n+1)) ns.
+//
+typedef struct {
+    CHAR16 Name[METRICS_NAME_LENGTH];
+    UINT64 Count;
+    UINT64 Bytes;
+    UINT64 TotalTicks;
+    UINT64 MinTicks;
+    UINT64 MaxTicks;
+    UINT64 Samples;                     // Operations with a latency; Count also includes byte-only updates
+    UINT32 Buckets[METRICS_BUCKETS];
+} METRICS_ENTRY;
+
+//
+// Function Prototypes
+//
+
+/**
+ * Calibrate the TSC against gBS->Stall and clear every metric
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_init(
+    VOID
+    );
+
+/**
+ * Find a metric by name, creating it on first use
+ * @details Registration is idempotent, so a subsystem may register its
+ *          metrics every time it is initialized.
+ * @param Name - Metric name, e.g. L"flash.erase.NVRAM"
+ * @param MetricId - Receives the metric id
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES when METRICS_MAX_ENTRIES are in use
+ */
+EFI_STATUS
+EFIAPI
+metrics_register(
+    IN CONST CHAR16 *Name,
+    OUT UINTN *MetricId
+    );
+
+/**
+ * Record one operation timed with DebugTimerStart
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Timer - Timer started before the operation; its EndTick is set
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_record(
+    IN UINTN MetricId,
+    IN OUT DEBUG_TIMER *Timer,
+    IN UINT64 Bytes
+    );
+
+/**
+ * Record one operation whose duration was measured elsewhere (e.g. on an AP)
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Ticks - Duration in TSC ticks
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_record_ticks(
+    IN UINTN MetricId,
+    IN UINT64 Ticks,
+    IN UINT64 Bytes
+    );
+
+/**
+ * Count an operation without a latency, e.g. a completed interrupt report
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_count(
+    IN UINTN MetricId,
+    IN UINT64 Bytes
+    );
+
+/**
+ * Get the measured TSC rate, calibrating on first use
+ * @return UINT64 - TSC ticks per millisecond
+ */
+UINT64
+EFIAPI
+metrics_get_ticks_per_ms(
+    VOID
+    );
+
+/**
+ * Convert TSC ticks to nanoseconds
+ * @param Ticks - TSC ticks
+ * @return UINT64 - Nanoseconds
+ */
+UINT64
+EFIAPI
+metrics_ticks_to_ns(
+    IN UINT64 Ticks
+    );
+
+/**
+ * Estimate a latency percentile from the histogram
+ * @param MetricId - Metric id
+ * @param Percent - Percentile, 1..100
+ * @return UINT64 - Upper bound of the bucket holding the percentile in ns, 0 if no samples
+ */
+UINT64
+EFIAPI
+metrics_get_percentile(
+    IN UINTN MetricId,
+    IN UINTN Percent
+    );
+
+/**
+ * Get a copy of a metric
+ * @param MetricId - Metric id
+ * @param Entry - Receives the metric
+ * @return EFI_STATUS - EFI_NOT_FOUND for an unknown id
+ */
+EFI_STATUS
+EFIAPI
+metrics_get_entry(
+    IN UINTN MetricId,
+    OUT METRICS_ENTRY *Entry
+    );
+
+/**
+ * Clear the counters and histograms of every metric, keeping the ids
+ */
+VOID
+EFIAPI
+metrics_reset(
+    VOID
+    );
+
+/**
+ * Print a table of every metric with throughput and latency percentiles
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_status(
+    VOID
+    );
+
+/**
+ * Print every metric as CSV, histogram included, for offline comparison
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_dump(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+UINTN
+MetricsBucket(
+    IN UINT64 Ticks
+    );
+
+STATIC
+UINT64
+MetricsKilobytesPerSecond(
+    IN CONST METRICS_ENTRY *Entry
+    );
+
+#endif // _METRICS_H_
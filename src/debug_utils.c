@@ -8,8 +8,11 @@
 #include <Library/DebugLib.h>
 #include <Library/PrintLib.h>
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
 // Avoid TimerLib dependency; use TSC via BaseLib for lightweight timing
 
+#include "../include/common.h"
 #include "../include/debug_utils.h"
 #include "../include/config.h"
 
@@ -19,6 +22,14 @@
 extern UINT32 gDebugLevel;
 extern UINT32 gDebugCategories;
 
+//
+// Trace ring
+// Writers claim a slot by atomically advancing mTraceHead, so recording
+// takes no lock and works on any processor.
+//
+STATIC DEBUG_TRACE_RECORD mTraceRing[TRACE_RING_ENTRIES];
+STATIC volatile UINT32 mTraceHead = 0;
+
 /**
  * Print hex dump of memory
  */
@@ -195,15 +206,16 @@ DebugTimerStart(
     IN CONST CHAR8 *Description
 )
 {
-#if ENABLE_USB_DEBUG
     if (Timer == NULL) {
         return;
     }
     
+    // Always timestamp; metrics_record relies on StartTick in release builds
     Timer->Description = Description;
     Timer->StartTick = AsmReadTsc();
     Timer->EndTick = 0;
     
+#if ENABLE_USB_DEBUG
     DBG_USB_VERBOSE("Timer started: %a\n", Description ? Description : "Unknown");
 #endif
 }
@@ -217,17 +229,151 @@ DebugTimerEnd(
     IN OUT DEBUG_TIMER *Timer
 )
 {
-#if ENABLE_USB_DEBUG
-    UINT64 ElapsedTicks;
-    
     if (Timer == NULL || Timer->StartTick == 0) {
         return;
     }
     
     Timer->EndTick = AsmReadTsc();
-    ElapsedTicks = Timer->EndTick - Timer->StartTick;
+#if ENABLE_USB_DEBUG
     DBG_USB_INFO("Timer ended: %a - Elapsed: %ld ticks\n",
                 Timer->Description ? Timer->Description : "Unknown",
-                ElapsedTicks);
+                Timer->EndTick - Timer->StartTick);
 #endif
 }
+
+/**
+ * Append a record to the trace ring
+ * @details Overwrites the oldest record once the ring is full. The sequence
+ *          is written last so readers can skip a record still being filled.
+ */
+VOID
+EFIAPI
+DebugTraceRecord(
+    IN UINT16 Event,
+    IN UINT64 Arg0,
+    IN UINT64 Arg1,
+    IN UINT64 Arg2
+)
+{
+    DEBUG_TRACE_RECORD *Record;
+    UINT32 Position;
+    
+    Position = InterlockedIncrement(&mTraceHead) - 1;
+    Record = &mTraceRing[Position & (TRACE_RING_ENTRIES - 1)];
+    
+    Record->Sequence = 0;
+    MemoryFence();
+    
+    Record->Tsc = AsmReadTsc();
+    Record->Event = Event;
+    Record->Args[0] = Arg0;
+    Record->Args[1] = Arg1;
+    Record->Args[2] = Arg2;
+    
+    MemoryFence();
+    Record->Sequence = Position + 1;
+}
+
+/**
+ * Copy the newest trace records out of the ring, oldest first
+ * @return UINTN - Number of records copied
+ */
+UINTN
+EFIAPI
+DebugTraceExport(
+    OUT DEBUG_TRACE_RECORD *Records,
+    IN UINTN MaxRecords
+)
+{
+    UINT32 Head;
+    UINT32 Position;
+    UINTN Available;
+    UINTN Count;
+    
+    if (Records == NULL || MaxRecords == 0) {
+        return 0;
+    }
+    
+    Head = mTraceHead;
+    Available = MIN((UINTN)Head, (UINTN)TRACE_RING_ENTRIES);
+    Available = MIN(Available, MaxRecords);
+    
+    Count = 0;
+    for (Position = Head - (UINT32)Available; Position != Head; Position++) {
+        CopyMemory(&Records[Count], &mTraceRing[Position & (TRACE_RING_ENTRIES - 1)],
+                   sizeof(DEBUG_TRACE_RECORD));
+        MemoryFence();
+        
+        // Skip records being written or already overwritten by a newer one
+        if (Records[Count].Sequence == Position + 1 &&
+            mTraceRing[Position & (TRACE_RING_ENTRIES - 1)].Sequence == Position + 1) {
+            Count++;
+        }
+    }
+    
+    return Count;
+}
+
+/**
+ * Format and print the newest trace records
+ */
+VOID
+EFIAPI
+DebugTraceDump(
+    IN UINTN MaxRecords
+)
+{
+    DEBUG_TRACE_RECORD Records[TRACE_DUMP_RECORDS];
+    DEBUG_TRACE_RECORD *Record;
+    UINTN Count;
+    UINTN Index;
+    
+    Count = DebugTraceExport(Records, MIN(MaxRecords, (UINTN)TRACE_DUMP_RECORDS));
+    
+    Print(L"Trace: %d records logged, showing %d (categories 0x%08X)\n",
+          mTraceHead, Count, gTraceCategories);
+    
+    for (Index = 0; Index < Count; Index++) {
+        Record = &Records[Index];
+        
+        // Times are TSC ticks since the oldest record shown
+        Print(L"  %12ld  ", Record->Tsc - Records[0].Tsc);
+        
+        switch (Record->Event) {
+            case TraceEventEnter:
+                Print(L"enter %a\n", (CONST CHAR8 *)(UINTN)Record->Args[0]);
+                break;
+            case TraceEventExit:
+                Print(L"exit  %a: %r\n", (CONST CHAR8 *)(UINTN)Record->Args[0], (EFI_STATUS)Record->Args[1]);
+                break;
+            case TraceEventFlashRead:
+            case TraceEventFlashWrite:
+            case TraceEventFlashErase:
+            case TraceEventFlashDelta:
+                Print(L"flash %s 0x%08lX, %ld bytes: %r\n",
+                      Record->Event == TraceEventFlashRead ? L"read" :
+                      Record->Event == TraceEventFlashWrite ? L"write" :
+                      Record->Event == TraceEventFlashErase ? L"erase" : L"delta",
+                      Record->Args[0], Record->Args[1], (EFI_STATUS)Record->Args[2]);
+                break;
+            case TraceEventUsbTransfer:
+                Print(L"usb device %ld transfer, %ld bytes\n", Record->Args[0], Record->Args[1]);
+                break;
+            default:
+                Print(L"event %d: 0x%lX 0x%lX 0x%lX\n",
+                      Record->Event, Record->Args[0], Record->Args[1], Record->Args[2]);
+                break;
+        }
+    }
+}
+
+/**
+ * Discard every trace record
+ */
+VOID
+EFIAPI
+DebugTraceReset(VOID)
+{
+    ZeroMemory(mTraceRing, sizeof(mTraceRing));
+    mTraceHead = 0;
+}
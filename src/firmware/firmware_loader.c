@@ -13,6 +13,15 @@
 #include <Protocol/LoadedImage.h>
 
 #include "firmware_loader.h"
+#include "firmware_pipeline.h"
+#include "flash_manager.h"
+#include "lz4_decoder.h"
+#include "../usb/usb_mass_storage.h"
+#include "../usb/usb_dma.h"
+#include "../uefi/boot_services.h"
+#include "../uefi/memory_pool.h"
+#include "../uefi/uefi_interface.h"
+#include "../uefi/worker_pool.h"
 #include "../../include/common.h"
 #include "../../include/config.h"
 #include "../../include/debug_utils.h"
@@ -24,6 +33,7 @@ STATIC BOOLEAN mFirmwareLoaderInitialized = FALSE;
 STATIC FIRMWARE_INFO mFirmwareInfo;
 STATIC EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *mFileSystem = NULL;
 STATIC EFI_HANDLE mFileSystemHandle = NULL;
+STATIC MEMORY_ARENA mLoaderArena;               // Decompression windows, rewound per image
 
 /**
  * Initialize firmware loader
@@ -35,6 +45,8 @@ firmware_loader_init(VOID)
 {
     EFI_STATUS Status;
     EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+    UEFI_SYSTEM_INFO SystemInfo;
+    UINT32 CpuFeatures;
     
     DBG_ENTER();
     
@@ -46,6 +58,21 @@ firmware_loader_init(VOID)
     // Initialize firmware info structure
     ZeroMemory(&mFirmwareInfo, sizeof(FIRMWARE_INFO));
     
+    Status = memory_arena_init(&mLoaderArena, L"loader", FIRMWARE_DECOMPRESS_WINDOW);
+    CHECK_STATUS(Status, "Failed to initialize loader arena");
+    
+    // Pick CRC32C/SHA-256 paths from the CPUID results gathered at startup
+    CpuFeatures = 0;
+    if (!EFI_ERROR(uefi_get_system_info(&SystemInfo))) {
+        if (SystemInfo.CpuFeatures & UEFI_CPU_FEATURE_SSE42) {
+            CpuFeatures |= INTEGRITY_CPU_SSE42;
+        }
+        if (SystemInfo.CpuFeatures & UEFI_CPU_FEATURE_SHA) {
+            CpuFeatures |= INTEGRITY_CPU_SHA;
+        }
+    }
+    integrity_init(CpuFeatures);
+    
     // Get loaded image protocol
     Status = gBS->OpenProtocol(
         gImageHandle,
@@ -148,48 +175,43 @@ PopulateFirmwareInfo(VOID)
 }
 
 /**
- * Load firmware from file
+ * Open a firmware file on the boot volume and query its size
+ * @details EFI_FILE_INFO carries the file name inline, so the info buffer is
+ *          sized from the EFI_BUFFER_TOO_SMALL reply rather than guessed.
  * @param FileName - Firmware file name
- * @param Buffer - Pointer to receive firmware data
- * @param Size - Pointer to receive firmware size
+ * @param Root - Pointer to receive the opened root directory
+ * @param File - Pointer to receive the opened file
+ * @param FileSize - Pointer to receive the file size
  * @return EFI_STATUS - Success or error code
  */
+STATIC
 EFI_STATUS
-EFIAPI
-firmware_load_from_file(
+OpenFirmwareFile(
     IN CHAR16 *FileName,
-    OUT VOID **Buffer,
-    OUT UINTN *Size
+    OUT EFI_FILE_PROTOCOL **Root,
+    OUT EFI_FILE_PROTOCOL **File,
+    OUT UINT64 *FileSize
 )
 {
     EFI_STATUS Status;
-    EFI_FILE_PROTOCOL *Root;
-    EFI_FILE_PROTOCOL *File;
     EFI_FILE_INFO *FileInfo;
     UINTN FileInfoSize;
-    UINTN ReadSize;
-    VOID *FileBuffer;
-    
-    DBG_ENTER();
-    
-    if (FileName == NULL || Buffer == NULL || Size == NULL) {
-        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
-        return EFI_INVALID_PARAMETER;
-    }
     
     if (!mFirmwareLoaderInitialized || mFileSystem == NULL) {
-        DBG_EXIT_STATUS(EFI_NOT_READY);
         return EFI_NOT_READY;
     }
     
     // Open root directory
-    Status = mFileSystem->OpenVolume(mFileSystem, &Root);
-    CHECK_STATUS(Status, "Failed to open root volume");
+    Status = mFileSystem->OpenVolume(mFileSystem, Root);
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Failed to open root volume: %r\n", Status);
+        return Status;
+    }
     
     // Open firmware file
-    Status = Root->Open(
-        Root,
-        &File,
+    Status = (*Root)->Open(
+        *Root,
+        File,
         FileName,
         EFI_FILE_MODE_READ,
         0
@@ -197,48 +219,101 @@ firmware_load_from_file(
     
     if (EFI_ERROR(Status)) {
         LOG_ERROR("Failed to open firmware file %s: %r\n", FileName, Status);
-        Root->Close(Root);
-        DBG_EXIT_STATUS(Status);
+        (*Root)->Close(*Root);
         return Status;
     }
     
-    // Get file information
-    FileInfoSize = sizeof(EFI_FILE_INFO) + 512;
-    FileInfo = AllocatePool(FileInfoSize);
-    if (FileInfo == NULL) {
-        File->Close(File);
-        Root->Close(Root);
-        DBG_EXIT_STATUS(EFI_OUT_OF_RESOURCES);
-        return EFI_OUT_OF_RESOURCES;
+    // Ask for the required info size first
+    FileInfoSize = 0;
+    FileInfo = NULL;
+    Status = (*File)->GetInfo(*File, &gEfiFileInfoGuid, &FileInfoSize, NULL);
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+        FileInfo = memory_pool_alloc(FileInfoSize);
+        if (FileInfo == NULL) {
+            Status = EFI_OUT_OF_RESOURCES;
+        } else {
+            Status = (*File)->GetInfo(*File, &gEfiFileInfoGuid, &FileInfoSize, FileInfo);
+        }
     }
     
-    Status = File->GetInfo(File, &gEfiFileInfoGuid, &FileInfoSize, FileInfo);
     if (EFI_ERROR(Status)) {
         LOG_ERROR("Failed to get file info: %r\n", Status);
-        FreePool(FileInfo);
-        File->Close(File);
-        Root->Close(Root);
+        if (FileInfo != NULL) {
+            memory_pool_free(FileInfo);
+        }
+        (*File)->Close(*File);
+        (*Root)->Close(*Root);
+        return Status;
+    }
+    
+    *FileSize = FileInfo->FileSize;
+    memory_pool_free(FileInfo);
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Load firmware from file
+ * @param FileName - Firmware file name
+ * @param Buffer - Pointer to receive firmware data
+ * @param Size - Pointer to receive firmware size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_load_from_file(
+    IN CHAR16 *FileName,
+    OUT VOID **Buffer,
+    OUT UINTN *Size
+)
+{
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *Root;
+    EFI_FILE_PROTOCOL *File;
+    UINT64 FileSize;
+    UINT64 Offset;
+    UINTN ReadSize;
+    VOID *FileBuffer;
+    FIRMWARE_VALIDATE_CONTEXT Validate;
+    
+    DBG_ENTER();
+    
+    if (FileName == NULL || Buffer == NULL || Size == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = OpenFirmwareFile(FileName, &Root, &File, &FileSize);
+    if (EFI_ERROR(Status)) {
         DBG_EXIT_STATUS(Status);
         return Status;
     }
     
     // Allocate buffer for file content
-    FileBuffer = AllocatePool(FileInfo->FileSize);
+    FileBuffer = AllocatePool((UINTN)FileSize);
     if (FileBuffer == NULL) {
-        FreePool(FileInfo);
+        LOG_ERROR("Cannot buffer %ld byte image, use firmware_stream_from_file\n", FileSize);
         File->Close(File);
         Root->Close(Root);
         DBG_EXIT_STATUS(EFI_OUT_OF_RESOURCES);
         return EFI_OUT_OF_RESOURCES;
     }
     
-    // Read file content
-    ReadSize = FileInfo->FileSize;
-    Status = File->Read(File, &ReadSize, FileBuffer);
+    // Read in chunks so each one is validated while still in cache
+    firmware_validate_begin(&Validate);
+    for (Offset = 0; Offset < FileSize; Offset += ReadSize) {
+        ReadSize = (UINTN)MIN(FileSize - Offset, (UINT64)FIRMWARE_STREAM_CHUNK_SIZE);
+        Status = File->Read(File, &ReadSize, (UINT8 *)FileBuffer + Offset);
+        if (EFI_ERROR(Status) || ReadSize == 0) {
+            break;
+        }
+        firmware_validate_update(&Validate, (UINT8 *)FileBuffer + Offset, ReadSize);
+    }
+    ReadSize = (UINTN)Offset;
+    
     if (EFI_ERROR(Status)) {
         LOG_ERROR("Failed to read firmware file: %r\n", Status);
         FreePool(FileBuffer);
-        FreePool(FileInfo);
         File->Close(File);
         Root->Close(Root);
         DBG_EXIT_STATUS(Status);
@@ -246,23 +321,30 @@ firmware_load_from_file(
     }
     
     // Verify file was read completely
-    if (ReadSize != FileInfo->FileSize) {
+    if (ReadSize != FileSize) {
         LOG_ERROR("Partial file read: expected %ld, got %ld\n", 
-                  FileInfo->FileSize, ReadSize);
+                  FileSize, ReadSize);
         FreePool(FileBuffer);
-        FreePool(FileInfo);
         File->Close(File);
         Root->Close(Root);
         DBG_EXIT_STATUS(EFI_ABORTED);
         return EFI_ABORTED;
     }
     
+    Status = firmware_validate_final(&Validate, NULL);
+    if (EFI_ERROR(Status)) {
+        FreePool(FileBuffer);
+        File->Close(File);
+        Root->Close(Root);
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
     // Return results
     *Buffer = FileBuffer;
     *Size = ReadSize;
     
     // Cleanup
-    FreePool(FileInfo);
     File->Close(File);
     Root->Close(Root);
     
@@ -273,124 +355,1770 @@ firmware_load_from_file(
 }
 
 /**
- * Validate firmware integrity
- * @param Buffer - Firmware data buffer
- * @param Size - Firmware data size
+ * Allocate a ring of page-aligned streaming buffers
+ * @param ChunkSize - Bytes per buffer (rounded up to a page)
+ * @param Count - Number of buffers (1..FIRMWARE_STREAM_MAX_BUFFERS)
+ * @param Ring - Ring to initialize
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS
 EFIAPI
-firmware_validate(
-    IN VOID *Buffer,
-    IN UINTN Size
+firmware_stream_ring_create(
+    IN UINTN ChunkSize,
+    IN UINTN Count,
+    OUT FIRMWARE_STREAM_RING *Ring
 )
 {
-    UINT32 Checksum;
-    UINT8 *Data;
+    EFI_STATUS Status;
     UINTN Index;
     
-    DBG_ENTER();
-    
-    if (Buffer == NULL || Size == 0) {
-        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+    if (Ring == NULL || ChunkSize == 0 || Count == 0 ||
+        Count > FIRMWARE_STREAM_MAX_BUFFERS) {
         return EFI_INVALID_PARAMETER;
     }
     
-    // Simple checksum validation
-    Checksum = 0;
-    Data = (UINT8 *)Buffer;
+    ZeroMemory(Ring, sizeof(FIRMWARE_STREAM_RING));
+    Ring->ChunkSize = ALIGN_UP(ChunkSize, EFI_PAGE_SIZE);
+    
+    for (Index = 0; Index < Count; Index++) {
+        Status = AllocateAlignedMemory(
+            EfiBootServicesData,
+            Ring->ChunkSize,
+            EFI_PAGE_SIZE,
+            &Ring->Buffers[Index]
+        );
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Failed to allocate stream buffer %ld: %r\n", Index, Status);
+            firmware_stream_ring_destroy(Ring);
+            return Status;
+        }
+        Ring->Count++;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Allocate a streaming ring for reads from one USB device
+ * @param DeviceId - USB device the ring is read from
+ * @param ChunkSize - Bytes per buffer (rounded up to a page)
+ * @param Count - Number of buffers (1..FIRMWARE_STREAM_MAX_BUFFERS)
+ * @param Ring - Ring to initialize
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_ring_create_usb(
+    IN UINTN DeviceId,
+    IN UINTN ChunkSize,
+    IN UINTN Count,
+    OUT FIRMWARE_STREAM_RING *Ring
+)
+{
+    EFI_STATUS Status;
+    UINTN Index;
+    UINTN Mapped;
     
-    for (Index = 0; Index < Size; Index++) {
-        Checksum += Data[Index];
+    if (Ring == NULL || ChunkSize == 0 || Count == 0 ||
+        Count > FIRMWARE_STREAM_MAX_BUFFERS) {
+        return EFI_INVALID_PARAMETER;
     }
     
-    LOG_INFO("Firmware validation: size=%ld, checksum=0x%08X\n", Size, Checksum);
+    ZeroMemory(Ring, sizeof(FIRMWARE_STREAM_RING));
+    Ring->ChunkSize = ALIGN_UP(ChunkSize, EFI_PAGE_SIZE);
+    Mapped = 0;
     
-    // Store validation results
-    mFirmwareInfo.Status = FIRMWARE_STATUS_VALIDATED;
-    mFirmwareInfo.Checksum = Checksum;
-    mFirmwareInfo.Size = Size;
+    for (Index = 0; Index < Count; Index++) {
+        Status = usb_dma_alloc(DeviceId, Ring->ChunkSize, &Ring->Buffers[Index], NULL);
+        if (!EFI_ERROR(Status)) {
+            Mapped++;
+        } else {
+            Status = AllocateAlignedMemory(
+                EfiBootServicesData,
+                Ring->ChunkSize,
+                EFI_PAGE_SIZE,
+                &Ring->Buffers[Index]
+            );
+        }
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Failed to allocate stream buffer %ld: %r\n", Index, Status);
+            firmware_stream_ring_destroy(Ring);
+            return Status;
+        }
+        Ring->Count++;
+    }
+    
+    if (Mapped != Count) {
+        LOG_INFO("USB device %d: %d of %d stream buffers pre-mapped for DMA\n", DeviceId, Mapped, Count);
+    }
     
-    DBG_EXIT_STATUS(EFI_SUCCESS);
     return EFI_SUCCESS;
 }
 
 /**
- * Get firmware information
- * @param Info - Pointer to receive firmware info
+ * Free the buffers of a streaming ring
+ * @param Ring - Ring created by firmware_stream_ring_create
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS
 EFIAPI
-firmware_get_info(
-    OUT FIRMWARE_INFO *Info
+firmware_stream_ring_destroy(
+    IN OUT FIRMWARE_STREAM_RING *Ring
 )
 {
-    if (Info == NULL || !mFirmwareLoaderInitialized) {
+    UINTN Index;
+    
+    if (Ring == NULL) {
         return EFI_INVALID_PARAMETER;
     }
     
-    CopyMemory(Info, &mFirmwareInfo, sizeof(FIRMWARE_INFO));
+    for (Index = 0; Index < Ring->Count; Index++) {
+        // DMA slices of a USB ring go back to their region
+        if (usb_dma_free(Ring->Buffers[Index]) == EFI_NOT_FOUND) {
+            FreeAlignedMemory(Ring->Buffers[Index], Ring->ChunkSize);
+        }
+        Ring->Buffers[Index] = NULL;
+    }
+    
+    Ring->Count = 0;
+    Ring->Next = 0;
+    
     return EFI_SUCCESS;
 }
 
 /**
- * Display firmware loader status
+ * Stream a firmware file through a handler one chunk at a time
+ * @details Peak memory is the ring itself; the file is never held whole.
+ * @param FileName - Firmware file name
+ * @param Ring - Buffer ring to read into
+ * @param Handler - Called for every chunk in file order
+ * @param Context - Passed to Handler
+ * @param FileSize - Optional pointer to receive the file size
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS
 EFIAPI
-firmware_loader_status(VOID)
+firmware_stream_from_file(
+    IN CHAR16 *FileName,
+    IN FIRMWARE_STREAM_RING *Ring,
+    IN FIRMWARE_STREAM_HANDLER Handler,
+    IN VOID *Context,
+    OUT UINT64 *FileSize OPTIONAL
+)
 {
-    if (!mFirmwareLoaderInitialized) {
-        Print(L"Firmware Loader: Not initialized\n");
-        return EFI_NOT_READY;
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *Root;
+    EFI_FILE_PROTOCOL *File;
+    UINT64 TotalSize;
+    UINT64 Offset;
+    UINTN ReadSize;
+    VOID *Chunk;
+    
+    DBG_ENTER();
+    
+    if (FileName == NULL || Ring == NULL || Ring->Count == 0 || Handler == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
     }
     
-    Print(L"Firmware Loader Status:\n");
-    Print(L"  Name: %s\n", mFirmwareInfo.Name);
-    Print(L"  Vendor: %s\n", mFirmwareInfo.Vendor);
-    Print(L"  Version: %d.%d.%d.%d\n", 
-          mFirmwareInfo.MajorVersion, mFirmwareInfo.MinorVersion,
-          mFirmwareInfo.PatchVersion, mFirmwareInfo.BuildNumber);
-    Print(L"  Status: %s\n", 
-          mFirmwareInfo.Status == FIRMWARE_STATUS_LOADED ? L"Loaded" :
-          mFirmwareInfo.Status == FIRMWARE_STATUS_VALIDATED ? L"Validated" : L"Unknown");
-    Print(L"  Capabilities: 0x%08X\n", mFirmwareInfo.Capabilities);
-    Print(L"  File System: %s\n", mFileSystem != NULL ? L"Available" : L"Not Available");
+    Status = OpenFirmwareFile(FileName, &Root, &File, &TotalSize);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
     
-    return EFI_SUCCESS;
+    for (Offset = 0; Offset < TotalSize; Offset += ReadSize) {
+        Chunk = Ring->Buffers[Ring->Next];
+        Ring->Next = (Ring->Next + 1) % Ring->Count;
+        
+        ReadSize = Ring->ChunkSize;
+        if (ReadSize > TotalSize - Offset) {
+            ReadSize = (UINTN)(TotalSize - Offset);
+        }
+        
+        Status = File->Read(File, &ReadSize, Chunk);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Failed to read firmware file at 0x%lx: %r\n", Offset, Status);
+            break;
+        }
+        
+        if (ReadSize == 0) {
+            LOG_ERROR("Firmware file truncated at 0x%lx of 0x%lx\n", Offset, TotalSize);
+            Status = EFI_END_OF_FILE;
+            break;
+        }
+        
+        Status = Handler(Context, Offset, Chunk, ReadSize);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Stream handler failed at 0x%lx: %r\n", Offset, Status);
+            break;
+        }
+    }
+    
+    File->Close(File);
+    Root->Close(Root);
+    
+    if (!EFI_ERROR(Status)) {
+        LOG_INFO("Streamed firmware file %s (%ld bytes)\n", FileName, TotalSize);
+        if (FileSize != NULL) {
+            *FileSize = TotalSize;
+        }
+    }
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
 }
 
 /**
- * Cleanup firmware loader resources
+ * Validate and program a firmware file without loading it whole
+ * @details Reads, hashing and programming overlap in a firmware_pipeline,
+ *          which reads the file twice so the package is checked before
+ *          the first write.
+ * @param FileName - Firmware file name
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Optional buffer ring; a default ring is used when NULL
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS
 EFIAPI
-firmware_loader_cleanup(VOID)
+firmware_flash_from_file(
+    IN CHAR16 *FileName,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring OPTIONAL
+)
 {
+    EFI_STATUS Status;
+    FIRMWARE_STREAM_RING DefaultRing;
+    FIRMWARE_PIPELINE Pipeline;
+    EFI_FILE_PROTOCOL *Root;
+    EFI_FILE_PROTOCOL *File;
+    UINT64 FileSize;
+    
     DBG_ENTER();
     
-    if (!mFirmwareLoaderInitialized) {
-        DBG_EXIT_STATUS(EFI_NOT_READY);
-        return EFI_NOT_READY;
+    if (FileName == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
     }
     
-    // Close file system protocol
-    if (mFileSystem != NULL && mFileSystemHandle != NULL) {
-        gBS->CloseProtocol(
-            mFileSystemHandle,
-            &gEfiSimpleFileSystemProtocolGuid,
-            gImageHandle,
-            NULL
+    Status = OpenFirmwareFile(FileName, &Root, &File, &FileSize);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    if (Ring == NULL) {
+        Status = firmware_stream_ring_create(
+            FIRMWARE_STREAM_CHUNK_SIZE,
+            FIRMWARE_STREAM_BUFFERS,
+            &DefaultRing
         );
-        mFileSystem = NULL;
-        mFileSystemHandle = NULL;
+        if (EFI_ERROR(Status)) {
+            File->Close(File);
+            Root->Close(Root);
+            DBG_EXIT_STATUS(Status);
+            return Status;
+        }
     }
     
-    // Clear firmware info
-    ZeroMemory(&mFirmwareInfo, sizeof(FIRMWARE_INFO));
+    ZeroMemory(&Pipeline, sizeof(Pipeline));
+    Status = firmware_pipeline_begin_file(
+        &Pipeline,
+        File,
+        FileSize,
+        FlashAddress,
+        (Ring != NULL) ? Ring : &DefaultRing
+    );
+    if (!EFI_ERROR(Status)) {
+        Status = firmware_pipeline_run(&Pipeline);
+    }
+    
+    File->Close(File);
+    Root->Close(Root);
+    
+    if (Ring == NULL) {
+        firmware_stream_ring_destroy(&DefaultRing);
+    }
+    
+    if (EFI_ERROR(Status)) {
+        mFirmwareInfo.Status = FIRMWARE_STATUS_CORRUPTED;
+        LOG_ERROR("Streamed flash of %s failed after %ld bytes programmed: %r\n",
+                  FileName, Pipeline.Verified ? Pipeline.NextProgram : 0, Status);
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    LOG_INFO("Flashed %s: %ld bytes, crc32c=0x%08X (%ld skipped, %ld erased, %ld programmed)\n",
+             FileName, FileSize, Pipeline.Checksum, Pipeline.Stats.Delta.SectorsSkipped,
+             Pipeline.Stats.Delta.SectorsErased, Pipeline.Stats.Delta.SectorsProgrammed);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Stream a raw image from a USB mass storage device one chunk at a time
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param Ring - Buffer ring; ChunkSize must be a multiple of the block size
+ * @param Handler - Called for every chunk in image order
+ * @param Context - Passed to Handler
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_from_usb(
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN FIRMWARE_STREAM_RING *Ring,
+    IN FIRMWARE_STREAM_HANDLER Handler,
+    IN VOID *Context
+)
+{
+    EFI_STATUS Status;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    UINT64 Offset;
+    UINTN Length;
+    VOID *Chunk;
+    
+    DBG_ENTER();
+    
+    if (Ring == NULL || Ring->Count == 0 || Handler == NULL || Size == 0) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = usb_msc_get_capacity(DeviceId, &BlockSize, &BlockCount);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    if (Ring->ChunkSize % BlockSize != 0 ||
+        StartLba >= BlockCount || DivU64x32(Size + BlockSize - 1, BlockSize) > BlockCount - StartLba) {
+        LOG_ERROR("USB image of %ld bytes at LBA 0x%lx does not fit the device or ring\n", Size, StartLba);
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (Offset = 0; Offset < Size; Offset += Length) {
+        Chunk = Ring->Buffers[Ring->Next];
+        Ring->Next = (Ring->Next + 1) % Ring->Count;
+        
+        Length = Ring->ChunkSize;
+        if (Length > Size - Offset) {
+            Length = (UINTN)(Size - Offset);
+        }
+        
+        // The tail is read as whole blocks; only Length bytes are handed on
+        Status = usb_msc_read(
+            DeviceId,
+            StartLba + DivU64x32(Offset, BlockSize),
+            (Length + BlockSize - 1) / BlockSize,
+            Chunk
+        );
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+        
+        Status = Handler(Context, Offset, Chunk, Length);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Stream handler failed at 0x%lx: %r\n", Offset, Status);
+            break;
+        }
+    }
+    
+    if (!EFI_ERROR(Status)) {
+        LOG_INFO("Streamed %ld bytes from USB device %d\n", Size, DeviceId);
+    }
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Validate and program a raw image read from a USB mass storage device
+ * @details BOT reads block the BSP, so only the hashing overlaps them. The
+ *          image is read twice so the package is checked before the first write.
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Optional buffer ring; a FIRMWARE_USB_STREAM_CHUNK_SIZE ring is used when NULL
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_flash_from_usb(
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_STREAM_RING DefaultRing;
+    FIRMWARE_PIPELINE Pipeline;
+    
+    DBG_ENTER();
+    
+    if (Ring == NULL) {
+        Status = firmware_stream_ring_create_usb(
+            DeviceId,
+            FIRMWARE_USB_STREAM_CHUNK_SIZE,
+            FIRMWARE_STREAM_BUFFERS,
+            &DefaultRing
+        );
+        if (EFI_ERROR(Status)) {
+            DBG_EXIT_STATUS(Status);
+            return Status;
+        }
+    }
+    
+    ZeroMemory(&Pipeline, sizeof(Pipeline));
+    Status = firmware_pipeline_begin_usb(
+        &Pipeline,
+        DeviceId,
+        StartLba,
+        Size,
+        FlashAddress,
+        (Ring != NULL) ? Ring : &DefaultRing
+    );
+    if (!EFI_ERROR(Status)) {
+        Status = firmware_pipeline_run(&Pipeline);
+    }
+    
+    if (Ring == NULL) {
+        firmware_stream_ring_destroy(&DefaultRing);
+    }
+    
+    if (EFI_ERROR(Status)) {
+        mFirmwareInfo.Status = FIRMWARE_STATUS_CORRUPTED;
+        LOG_ERROR("Flash from USB device %d failed after %ld bytes programmed: %r\n",
+                  DeviceId, Pipeline.Verified ? Pipeline.NextProgram : 0, Status);
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    LOG_INFO("Flashed %ld bytes from USB device %d, crc32c=0x%08X (%ld skipped, %ld erased, %ld programmed)\n",
+             Size, DeviceId, Pipeline.Checksum, Pipeline.Stats.Delta.SectorsSkipped,
+             Pipeline.Stats.Delta.SectorsErased, Pipeline.Stats.Delta.SectorsProgrammed);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Validate firmware integrity
+ * @param Buffer - Firmware data buffer
+ * @param Size - Firmware data size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate(
+    IN VOID *Buffer,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_VALIDATE_CONTEXT Context;
+    
+    DBG_ENTER();
+    
+    if (Buffer == NULL || Size == 0) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    firmware_validate_begin(&Context);
+    
+    Status = EFI_UNSUPPORTED;
+    if (worker_pool_get_processor_count() > 1 && Size >= 2 * FIRMWARE_VALIDATE_MIN_SLICE) {
+        Status = ValidateParallel(&Context, (CONST UINT8 *)Buffer, Size);
+        if (EFI_ERROR(Status)) {
+            firmware_validate_begin(&Context);
+        }
+    }
+    
+    // Otherwise a single-chunk run of the incremental validator
+    if (EFI_ERROR(Status)) {
+        firmware_validate_update(&Context, Buffer, Size);
+    }
+    Status = firmware_validate_final(&Context, NULL);
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+//
+// Span of an image hashed on one processor
+//
+typedef struct {
+    CONST UINT8 *Data;
+    UINTN Size;
+    UINT32 Crc;
+    INTEGRITY_SHA256_CONTEXT *Sha256;   // Set to hash the span instead of checksumming it
+} FIRMWARE_HASH_SLICE;
+
+/**
+ * Worker job: CRC32C or SHA-256 of one span
+ * @param Job - Job whose context is a FIRMWARE_HASH_SLICE
+ * @param Scratch - Unused
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+ValidateHashSliceJob(
+    IN OUT WORKER_JOB *Job,
+    IN VOID *Scratch
+)
+{
+    FIRMWARE_HASH_SLICE *Slice;
+    
+    Slice = (FIRMWARE_HASH_SLICE *)Job->Context;
+    if (Slice->Sha256 != NULL) {
+        integrity_sha256_update(Slice->Sha256, Slice->Data, Slice->Size);
+    } else {
+        Slice->Crc = integrity_crc32c(0, Slice->Data, Slice->Size);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Insert a cut into a sorted list of slice boundaries
+ * @param Cuts - Sorted boundaries
+ * @param CutCount - Number of boundaries, updated
+ * @param Cut - Boundary to add; 0 and duplicates are ignored
+ */
+STATIC
+VOID
+ValidateAddCut(
+    IN OUT UINTN *Cuts,
+    IN OUT UINTN *CutCount,
+    IN UINTN Cut
+)
+{
+    UINTN Index;
+    UINTN Move;
+    
+    Index = *CutCount;
+    while (Index > 0 && Cuts[Index - 1] > Cut) {
+        Index--;
+    }
+    if (Cut == 0 || (Index > 0 && Cuts[Index - 1] == Cut)) {
+        return;
+    }
+    
+    for (Move = *CutCount; Move > Index; Move--) {
+        Cuts[Move] = Cuts[Move - 1];
+    }
+    Cuts[Index] = Cut;
+    (*CutCount)++;
+}
+
+/**
+ * Validate a whole in-memory image across the worker pool
+ * @details The CRC32C is computed in slices and combined; slices are also
+ *          cut at the package payload bounds so the payload checksum comes
+ *          from the same slices. SHA-256 chains every block into the next,
+ *          so the image digest runs as one job beside the CRC slices.
+ * @param Context - Freshly begun validation context
+ * @param Data - Image
+ * @param Size - Image size
+ * @return EFI_STATUS - Error if the batch could not be run; Context is then undefined
+ */
+STATIC
+EFI_STATUS
+ValidateParallel(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST UINT8 *Data,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_HASH_SLICE Slices[WORKER_POOL_MAX_PROCESSORS + 3];
+    WORKER_JOB Jobs[WORKER_POOL_MAX_PROCESSORS + 3];
+    UINTN Cuts[WORKER_POOL_MAX_PROCESSORS + 2];
+    UINTN CutCount;
+    UINTN JobCount;
+    UINTN Pieces;
+    UINTN PayloadStart;
+    UINTN PayloadEnd;
+    UINTN Start;
+    UINTN Index;
+    UINT32 Crc;
+    UINT32 PayloadCrc;
+    
+    // Only the leading bytes matter for the package header
+    ValidateCaptureHeader(Context, Data, Size);
+    
+    PayloadStart = 0;
+    PayloadEnd = 0;
+    if (Context->IsPackage) {
+        PayloadStart = MIN((UINTN)Context->Header.HeaderSize, Size);
+        PayloadEnd = MIN((UINTN)Context->Header.PackageSize, Size);
+    }
+    
+    Pieces = MIN(worker_pool_get_processor_count(), Size / FIRMWARE_VALIDATE_MIN_SLICE);
+    Pieces = MIN(MAX(Pieces, 1), WORKER_POOL_MAX_PROCESSORS);
+    
+    CutCount = 0;
+    for (Index = 1; Index < Pieces; Index++) {
+        ValidateAddCut(Cuts, &CutCount, (Size / Pieces) * Index);
+    }
+    ValidateAddCut(Cuts, &CutCount, PayloadStart);
+    ValidateAddCut(Cuts, &CutCount, PayloadEnd);
+    ValidateAddCut(Cuts, &CutCount, Size);
+    
+    // The digest is the longest job, so it is claimed first
+    JobCount = 0;
+    if (FIRMWARE_VALIDATE_SHA256) {
+        Slices[JobCount].Data = Data;
+        Slices[JobCount].Size = Size;
+        Slices[JobCount].Sha256 = &Context->Sha256;
+        JobCount++;
+    }
+    
+    Start = 0;
+    for (Index = 0; Index < CutCount; Index++) {
+        Slices[JobCount].Data = Data + Start;
+        Slices[JobCount].Size = Cuts[Index] - Start;
+        Slices[JobCount].Sha256 = NULL;
+        JobCount++;
+        Start = Cuts[Index];
+    }
+    
+    for (Index = 0; Index < JobCount; Index++) {
+        Jobs[Index].Function = ValidateHashSliceJob;
+        Jobs[Index].Context = &Slices[Index];
+    }
+    
+    Status = worker_pool_run(Jobs, JobCount);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Crc = 0;
+    PayloadCrc = 0;
+    Start = 0;
+    for (Index = 0; Index < JobCount; Index++) {
+        if (Slices[Index].Sha256 != NULL) {
+            continue;
+        }
+        Crc = integrity_crc32c_combine(Crc, Slices[Index].Crc, Slices[Index].Size);
+        if (Start >= PayloadStart && Start < PayloadEnd) {
+            PayloadCrc = integrity_crc32c_combine(PayloadCrc, Slices[Index].Crc, Slices[Index].Size);
+        }
+        Start += Slices[Index].Size;
+    }
+    
+    Context->Crc = Crc;
+    Context->PayloadCrc = PayloadCrc;
+    Context->Offset = Size;
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Start an incremental firmware validation
+ * @param Context - Validation context to initialize
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_begin(
+    OUT FIRMWARE_VALIDATE_CONTEXT *Context
+)
+{
+    if (Context == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    ZeroMemory(Context, sizeof(FIRMWARE_VALIDATE_CONTEXT));
+    if (FIRMWARE_VALIDATE_SHA256) {
+        integrity_sha256_init(&Context->Sha256);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Capture the leading bytes of an image in case it is a package
+ * @param Context - Validation context
+ * @param Data - Chunk data
+ * @param Size - Chunk size
+ */
+STATIC
+VOID
+ValidateCaptureHeader(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST UINT8 *Data,
+    IN UINTN Size
+)
+{
+    UINTN Take;
+    
+    if (Context->HeaderUsed >= sizeof(FIRMWARE_PACKAGE_HEADER)) {
+        return;
+    }
+    
+    Take = MIN(sizeof(FIRMWARE_PACKAGE_HEADER) - Context->HeaderUsed, Size);
+    CopyMemory((UINT8 *)&Context->Header + Context->HeaderUsed, Data, Take);
+    Context->HeaderUsed += Take;
+    
+    if (Context->HeaderUsed == sizeof(FIRMWARE_PACKAGE_HEADER) &&
+        Context->Header.Signature == FIRMWARE_PACKAGE_SIGNATURE) {
+        if (IsPackageHeaderConsistent(&Context->Header)) {
+            Context->IsPackage = TRUE;
+        } else {
+            Context->HeaderCorrupted = TRUE;
+        }
+    }
+}
+
+/**
+ * Feed the next chunk of a firmware image into a validation
+ * @param Context - Validation context
+ * @param Buffer - Chunk data, in image order
+ * @param Size - Chunk size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_update(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+)
+{
+    CONST UINT8 *Data;
+    UINT64 Start;
+    UINT64 End;
+    
+    if (Context == NULL || (Buffer == NULL && Size != 0)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Size == 0) {
+        return EFI_SUCCESS;
+    }
+    
+    Data = (CONST UINT8 *)Buffer;
+    
+    Context->Crc = integrity_crc32c(Context->Crc, Data, Size);
+    if (FIRMWARE_VALIDATE_SHA256) {
+        integrity_sha256_update(&Context->Sha256, Data, Size);
+    }
+    
+    ValidateCaptureHeader(Context, Data, Size);
+    
+    // Payload checksum covers [HeaderSize, PackageSize) only
+    if (Context->IsPackage) {
+        Start = MAX(Context->Offset, (UINT64)Context->Header.HeaderSize);
+        End = MIN(Context->Offset + Size, (UINT64)Context->Header.PackageSize);
+        if (Start < End) {
+            Context->PayloadCrc = integrity_crc32c(
+                Context->PayloadCrc,
+                Data + (Start - Context->Offset),
+                (UINTN)(End - Start)
+            );
+        }
+    }
+    
+    Context->Offset += Size;
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Finish an incremental firmware validation
+ * @param Context - Validation context
+ * @param Checksum - Optional pointer to receive the image CRC32C
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_final(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    OUT UINT32 *Checksum OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    
+    if (Context == NULL || Context->Offset == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = EFI_SUCCESS;
+    
+    if (Context->HeaderCorrupted) {
+        LOG_ERROR("Firmware package header has inconsistent sizes\n");
+        Status = EFI_VOLUME_CORRUPTED;
+    } else if (Context->IsPackage) {
+        if (Context->Offset < Context->Header.PackageSize) {
+            LOG_ERROR("Firmware package truncated: %ld of %d bytes\n",
+                      Context->Offset, Context->Header.PackageSize);
+            Status = EFI_VOLUME_CORRUPTED;
+        } else if (Context->PayloadCrc != Context->Header.Checksum) {
+            LOG_ERROR("Firmware package checksum mismatch: 0x%08X != 0x%08X\n",
+                      Context->PayloadCrc, Context->Header.Checksum);
+            Status = EFI_CRC_ERROR;
+        }
+    }
+    
+    // Store validation results
+    mFirmwareInfo.Status = EFI_ERROR(Status) ? FIRMWARE_STATUS_CORRUPTED : FIRMWARE_STATUS_VALIDATED;
+    mFirmwareInfo.Checksum = Context->Crc;
+    mFirmwareInfo.Size = (UINTN)Context->Offset;
+    ZeroMemory(mFirmwareInfo.Digest, sizeof(mFirmwareInfo.Digest));
+    if (FIRMWARE_VALIDATE_SHA256) {
+        integrity_sha256_final(&Context->Sha256, mFirmwareInfo.Digest);
+    }
+    
+    if (Checksum != NULL) {
+        *Checksum = Context->Crc;
+    }
+    
+    LOG_INFO("Firmware validation: size=%ld, crc32c=0x%08X%s: %r\n",
+             Context->Offset, Context->Crc,
+             Context->IsPackage ? L" (package)" : L"", Status);
+    
+    return Status;
+}
+
+/**
+ * Check the size fields of a package header against each other
+ * @param Header - Package header with a matching signature
+ * @return BOOLEAN - TRUE if HeaderSize and PackageSize are consistent
+ */
+STATIC
+BOOLEAN
+IsPackageHeaderConsistent(
+    IN CONST FIRMWARE_PACKAGE_HEADER *Header
+)
+{
+    return (Header->HeaderSize >= sizeof(FIRMWARE_PACKAGE_HEADER) &&
+            Header->PackageSize >= Header->HeaderSize) ? TRUE : FALSE;
+}
+
+/**
+ * Validate firmware package
+ * @details Checks the header in place and the payload CRC32C in one pass; the
+ *          returned header points into the caller's buffer.
+ * @param Package - Firmware package data
+ * @param PackageSize - Package size
+ * @param Header - Pointer to receive package header
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_package(
+    IN VOID *Package,
+    IN UINTN PackageSize,
+    OUT FIRMWARE_PACKAGE_HEADER **Header
+)
+{
+    FIRMWARE_PACKAGE_HEADER *PackageHeader;
+    UINT32 Checksum;
+    
+    DBG_ENTER();
+    
+    if (Package == NULL || Header == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (PackageSize < sizeof(FIRMWARE_PACKAGE_HEADER)) {
+        LOG_ERROR("Firmware package too small: %ld bytes\n", PackageSize);
+        DBG_EXIT_STATUS(EFI_BAD_BUFFER_SIZE);
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    PackageHeader = (FIRMWARE_PACKAGE_HEADER *)Package;
+    
+    if (PackageHeader->Signature != FIRMWARE_PACKAGE_SIGNATURE) {
+        LOG_ERROR("Invalid firmware package signature: 0x%08X\n", PackageHeader->Signature);
+        DBG_EXIT_STATUS(EFI_UNSUPPORTED);
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (!IsPackageHeaderConsistent(PackageHeader) || PackageHeader->PackageSize > PackageSize) {
+        LOG_ERROR("Firmware package sizes invalid: header %d, package %d, buffer %ld\n",
+                  PackageHeader->HeaderSize, PackageHeader->PackageSize, PackageSize);
+        DBG_EXIT_STATUS(EFI_VOLUME_CORRUPTED);
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    Checksum = integrity_crc32c(
+        0,
+        (UINT8 *)Package + PackageHeader->HeaderSize,
+        PackageHeader->PackageSize - PackageHeader->HeaderSize
+    );
+    
+    if (Checksum != PackageHeader->Checksum) {
+        LOG_ERROR("Firmware package checksum mismatch: 0x%08X != 0x%08X\n",
+                  Checksum, PackageHeader->Checksum);
+        DBG_EXIT_STATUS(EFI_CRC_ERROR);
+        return EFI_CRC_ERROR;
+    }
+    
+    *Header = PackageHeader;
+    
+    LOG_INFO("Firmware package valid: version 0x%08X, payload %d bytes\n",
+             PackageHeader->Version, PackageHeader->PackageSize - PackageHeader->HeaderSize);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Extract firmware from package
+ * @details Returns a view into the package buffer; nothing is allocated or
+ *          copied. The view is only valid while the package buffer is, and
+ *          must not be freed on its own.
+ * @param Package - Firmware package data
+ * @param PackageSize - Package size
+ * @param FirmwareBuffer - Pointer to receive firmware
+ * @param FirmwareSize - Pointer to receive firmware size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_extract_from_package(
+    IN VOID *Package,
+    IN UINTN PackageSize,
+    OUT VOID **FirmwareBuffer,
+    OUT UINTN *FirmwareSize
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_PACKAGE_HEADER *Header;
+    
+    DBG_ENTER();
+    
+    if (FirmwareBuffer == NULL || FirmwareSize == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = firmware_validate_package(Package, PackageSize, &Header);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    *FirmwareBuffer = (UINT8 *)Package + Header->HeaderSize;
+    *FirmwareSize = Header->PackageSize - Header->HeaderSize;
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Parse the manifest of a multi-region package
+ * @param Package - Package data
+ * @param PackageSize - Package buffer size
+ * @param View - View to initialize; aliases Package
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_open(
+    IN CONST VOID *Package,
+    IN UINTN PackageSize,
+    OUT FIRMWARE_PACKAGE_VIEW *View
+)
+{
+    CONST FIRMWARE_PACKAGE_HEADER *Header;
+    CONST FIRMWARE_PACKAGE_MANIFEST *Manifest;
+    CONST FIRMWARE_REGION_ENTRY *Entry;
+    UINTN ManifestSize;
+    UINT32 Checksum;
+    UINTN i;
+    
+    DBG_ENTER();
+    
+    if (Package == NULL || View == NULL) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (PackageSize < sizeof(FIRMWARE_PACKAGE_HEADER) + sizeof(FIRMWARE_PACKAGE_MANIFEST)) {
+        LOG_ERROR("Firmware package too small: %ld bytes\n", PackageSize);
+        DBG_EXIT_STATUS(EFI_BAD_BUFFER_SIZE);
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    Header = (CONST FIRMWARE_PACKAGE_HEADER *)Package;
+    Manifest = (CONST FIRMWARE_PACKAGE_MANIFEST *)(Header + 1);
+    
+    if (Header->Signature != FIRMWARE_PACKAGE_V2_SIGNATURE) {
+        LOG_ERROR("Not a multi-region package: 0x%08X\n", Header->Signature);
+        DBG_EXIT_STATUS(EFI_UNSUPPORTED);
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (Manifest->FormatVersion != FIRMWARE_PACKAGE_FORMAT_V2) {
+        LOG_ERROR("Unsupported package format %d\n", Manifest->FormatVersion);
+        DBG_EXIT_STATUS(EFI_INCOMPATIBLE_VERSION);
+        return EFI_INCOMPATIBLE_VERSION;
+    }
+    
+    ManifestSize = sizeof(FIRMWARE_PACKAGE_MANIFEST) +
+                   Manifest->RegionCount * sizeof(FIRMWARE_REGION_ENTRY);
+    
+    if (!IsPackageHeaderConsistent(Header) ||
+        Header->PackageSize > PackageSize ||
+        Header->HeaderSize < sizeof(FIRMWARE_PACKAGE_HEADER) + ManifestSize ||
+        Manifest->RegionCount == 0 ||
+        Manifest->RegionCount > FIRMWARE_PACKAGE_MAX_REGIONS) {
+        LOG_ERROR("Package manifest invalid: header %d, package %d, %d regions\n",
+                  Header->HeaderSize, Header->PackageSize, Manifest->RegionCount);
+        DBG_EXIT_STATUS(EFI_VOLUME_CORRUPTED);
+        return EFI_VOLUME_CORRUPTED;
+    }
+    
+    Checksum = integrity_crc32c(
+        0,
+        Manifest,
+        Header->HeaderSize - sizeof(FIRMWARE_PACKAGE_HEADER)
+    );
+    if (Checksum != Header->Checksum) {
+        LOG_ERROR("Package manifest checksum mismatch: 0x%08X != 0x%08X\n",
+                  Checksum, Header->Checksum);
+        DBG_EXIT_STATUS(EFI_CRC_ERROR);
+        return EFI_CRC_ERROR;
+    }
+    
+    Entry = (CONST FIRMWARE_REGION_ENTRY *)(Manifest + 1);
+    for (i = 0; i < Manifest->RegionCount; i++) {
+        if (Entry[i].Offset < Header->HeaderSize ||
+            (UINT64)Entry[i].Offset + Entry[i].Size > Header->PackageSize ||
+            (Entry[i].Flags & ~FIRMWARE_REGION_FLAGS_KNOWN) != 0 ||
+            ((Entry[i].Flags & FIRMWARE_REGION_FLAG_LZ4) == 0 &&
+             Entry[i].UncompressedSize != Entry[i].Size)) {
+            LOG_ERROR("Package region %ld invalid: offset 0x%08X, size %d, flags 0x%08X\n",
+                      i, Entry[i].Offset, Entry[i].Size, Entry[i].Flags);
+            DBG_EXIT_STATUS(EFI_VOLUME_CORRUPTED);
+            return EFI_VOLUME_CORRUPTED;
+        }
+    }
+    
+    View->Base = (CONST UINT8 *)Package;
+    View->Size = Header->PackageSize;
+    View->Header = Header;
+    View->Regions = Entry;
+    View->RegionCount = Manifest->RegionCount;
+    
+    LOG_INFO("Opened package version 0x%08X with %ld regions\n",
+             Header->Version, View->RegionCount);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Find the first package region targeting a flash region type
+ * @param View - Package view
+ * @param Type - Flash region type
+ * @param Index - Pointer to receive the region index
+ * @return EFI_STATUS - EFI_NOT_FOUND if the package has no such region
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_find_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN FLASH_REGION_TYPE Type,
+    OUT UINTN *Index
+)
+{
+    UINTN i;
+    
+    if (View == NULL || View->Regions == NULL || Index == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (i = 0; i < View->RegionCount; i++) {
+        if (View->Regions[i].RegionType == (UINT32)Type) {
+            *Index = i;
+            return EFI_SUCCESS;
+        }
+    }
+    
+    return EFI_NOT_FOUND;
+}
+
+/**
+ * Get a region entry and a view of its stored payload
+ * @param View - Package view
+ * @param Index - Region index
+ * @param Entry - Optional pointer to receive the region entry
+ * @param Payload - Pointer to receive the payload (aliases the package)
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_get_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINTN Index,
+    OUT CONST FIRMWARE_REGION_ENTRY **Entry OPTIONAL,
+    OUT CONST VOID **Payload
+)
+{
+    if (View == NULL || View->Regions == NULL || Payload == NULL ||
+        Index >= View->RegionCount) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Entry != NULL) {
+        *Entry = &View->Regions[Index];
+    }
+    *Payload = View->Base + View->Regions[Index].Offset;
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Check a region payload against its CRC32C and SHA-256
+ * @details Safe to run on an AP: it only reads memory and logs nothing.
+ * @param Entry - Region entry
+ * @param Payload - Stored payload
+ * @param Checksum - Pointer to receive the computed CRC32C
+ * @return EFI_STATUS - EFI_CRC_ERROR on a CRC32C mismatch,
+ *                      EFI_SECURITY_VIOLATION on a SHA-256 mismatch
+ */
+STATIC
+EFI_STATUS
+ValidateRegionPayload(
+    IN CONST FIRMWARE_REGION_ENTRY *Entry,
+    IN CONST VOID *Payload,
+    OUT UINT32 *Checksum
+)
+{
+    UINT8 Digest[SHA256_DIGEST_SIZE];
+    
+    *Checksum = integrity_crc32c(0, Payload, Entry->Size);
+    if (*Checksum != Entry->Crc32c) {
+        return EFI_CRC_ERROR;
+    }
+    
+    if (FIRMWARE_VALIDATE_SHA256) {
+        integrity_sha256(Payload, Entry->Size, Digest);
+        if (CompareMem(Digest, Entry->Sha256, SHA256_DIGEST_SIZE) != 0) {
+            return EFI_SECURITY_VIOLATION;
+        }
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Validate the stored payload of one region
+ * @param View - Package view
+ * @param Index - Region index
+ * @return EFI_STATUS - EFI_CRC_ERROR on a CRC32C mismatch,
+ *                      EFI_SECURITY_VIOLATION on a SHA-256 mismatch
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_validate_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINTN Index
+)
+{
+    EFI_STATUS Status;
+    CONST FIRMWARE_REGION_ENTRY *Entry;
+    CONST VOID *Payload;
+    UINT32 Checksum;
+    
+    DBG_ENTER();
+    
+    Status = firmware_package_get_region(View, Index, &Entry, &Payload);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    Status = ValidateRegionPayload(Entry, Payload, &Checksum);
+    if (Status == EFI_CRC_ERROR) {
+        LOG_ERROR("Package region %ld checksum mismatch: 0x%08X != 0x%08X\n",
+                  Index, Checksum, Entry->Crc32c);
+    } else if (Status == EFI_SECURITY_VIOLATION) {
+        LOG_ERROR("Package region %ld SHA-256 mismatch\n", Index);
+    }
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+//
+// Decompressed flash write state
+//
+typedef struct {
+    UINT32 FlashAddress;
+    UINT64 ImageSize;
+    UINT32 SectorSize;
+    UINT8 ErasedByte;
+    BOOLEAN Program;            // FALSE for a decode-only dry run
+    UINTN LastSector;           // Last sector index programmed, plus one
+    UINT64 BytesProgrammed;
+    UINT64 BytesSkipped;
+    UINTN SectorsProgrammed;
+} FIRMWARE_DECOMPRESS_FLASH;
+
+/**
+ * Program one span of decoded data
+ * @param Flash - FIRMWARE_DECOMPRESS_FLASH
+ * @param Offset - Image offset of the span
+ * @param Data - Span data
+ * @param Length - Span length
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+DecompressProgramSpan(
+    IN OUT FIRMWARE_DECOMPRESS_FLASH *Flash,
+    IN UINT64 Offset,
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+)
+{
+    EFI_STATUS Status;
+    UINTN FirstSector;
+    UINTN EndSector;
+    
+    Status = flash_write(Flash->FlashAddress + (UINT32)Offset, Data, Length);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    FirstSector = (UINTN)(Offset / Flash->SectorSize);
+    EndSector = (UINTN)((Offset + Length + Flash->SectorSize - 1) / Flash->SectorSize);
+    Flash->SectorsProgrammed += EndSector - MAX(FirstSector, Flash->LastSector);
+    Flash->LastSector = EndSector;
+    Flash->BytesProgrammed += Length;
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Program a decoded chunk, leaving runs of erased bytes untouched
+ * @param Context - FIRMWARE_DECOMPRESS_FLASH
+ * @param Offset - Image offset of the chunk
+ * @param Data - Decoded data
+ * @param Length - Chunk length
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+DecompressFlashChunk(
+    IN VOID *Context,
+    IN UINT64 Offset,
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_DECOMPRESS_FLASH *Flash;
+    UINTN WriteStart;
+    UINTN RunStart;
+    UINTN Pos;
+    
+    Flash = (FIRMWARE_DECOMPRESS_FLASH *)Context;
+    
+    if (Offset + Length > Flash->ImageSize) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    if (!Flash->Program) {
+        return EFI_SUCCESS;
+    }
+    
+    // The range was erased up front, so erased runs need no programming
+    WriteStart = 0;
+    Pos = 0;
+    while (Pos < Length) {
+        if (Data[Pos] != Flash->ErasedByte) {
+            Pos++;
+            continue;
+        }
+        
+        RunStart = Pos;
+        while (Pos < Length && Data[Pos] == Flash->ErasedByte) {
+            Pos++;
+        }
+        
+        if (Pos - RunStart >= FIRMWARE_ERASED_SKIP_SIZE) {
+            if (RunStart > WriteStart) {
+                Status = DecompressProgramSpan(Flash, Offset + WriteStart,
+                                               Data + WriteStart, RunStart - WriteStart);
+                if (EFI_ERROR(Status)) {
+                    return Status;
+                }
+            }
+            Flash->BytesSkipped += Pos - RunStart;
+            WriteStart = Pos;
+        }
+    }
+    
+    if (Length > WriteStart) {
+        return DecompressProgramSpan(Flash, Offset + WriteStart,
+                                     Data + WriteStart, Length - WriteStart);
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Decode an LZ4 frame into flash, or dry-run the decode
+ * @param Frame - LZ4 frame
+ * @param FrameSize - Frame size
+ * @param FlashAddress - Sector-aligned destination
+ * @param ImageSize - Exact decoded size expected (a multiple of the sector size)
+ * @param Window - Decoder window of FIRMWARE_DECOMPRESS_WINDOW bytes
+ * @param Program - FALSE to only check that the frame decodes to ImageSize
+ * @param Stats - Optional pointer to receive sector statistics
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+DecompressToFlash(
+    IN CONST VOID *Frame,
+    IN UINTN FrameSize,
+    IN UINT32 FlashAddress,
+    IN UINTN ImageSize,
+    IN UINT8 *Window,
+    IN BOOLEAN Program,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    FLASH_DEVICE_INFO FlashInfo;
+    FIRMWARE_DECOMPRESS_FLASH Flash;
+    UINT64 DecodedSize;
+    
+    Status = flash_get_device_info(&FlashInfo);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    if (ImageSize == 0 || (FlashAddress % FlashInfo.SectorSize) != 0 ||
+        (ImageSize % FlashInfo.SectorSize) != 0) {
+        LOG_ERROR("Compressed image must cover whole sectors: 0x%08X, %ld bytes\n",
+                  FlashAddress, ImageSize);
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    ZeroMemory(&Flash, sizeof(Flash));
+    Flash.FlashAddress = FlashAddress;
+    Flash.ImageSize = ImageSize;
+    Flash.SectorSize = FlashInfo.SectorSize;
+    Flash.ErasedByte = FlashInfo.ErasedByte;
+    Flash.Program = Program;
+    
+    if (Program) {
+        Status = flash_erase_range(FlashAddress, ImageSize);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    Status = lz4_decode_frame(
+        Frame,
+        FrameSize,
+        Window,
+        FIRMWARE_DECOMPRESS_WINDOW,
+        DecompressFlashChunk,
+        &Flash,
+        &DecodedSize
+    );
+    if (!EFI_ERROR(Status) && DecodedSize != ImageSize) {
+        Status = EFI_VOLUME_CORRUPTED;
+    }
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("LZ4 decode for 0x%08X failed: %r\n", FlashAddress, Status);
+        return Status;
+    }
+    
+    if (Program) {
+        LOG_INFO("Decompressed %ld bytes to 0x%08X: %ld programmed, %ld erased bytes skipped\n",
+                 ImageSize, FlashAddress, Flash.BytesProgrammed, Flash.BytesSkipped);
+    }
+    
+    if (Stats != NULL) {
+        Stats->SectorsErased = Program ? ImageSize / FlashInfo.SectorSize : 0;
+        Stats->SectorsProgrammed = Flash.SectorsProgrammed;
+        Stats->SectorsSkipped = 0;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Decompress an LZ4 frame straight into flash
+ * @param Frame - LZ4 frame
+ * @param FrameSize - Frame size
+ * @param FlashAddress - Sector-aligned destination
+ * @param ImageSize - Decoded size; a multiple of the sector size
+ * @param Stats - Optional pointer to receive sector statistics
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_flash_compressed(
+    IN CONST VOID *Frame,
+    IN UINTN FrameSize,
+    IN UINT32 FlashAddress,
+    IN UINTN ImageSize,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    MEMORY_ARENA_MARK Mark;
+    UINT8 *Window;
+    
+    DBG_ENTER();
+    
+    if (Frame == NULL || FrameSize == 0) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    memory_arena_get_mark(&mLoaderArena, &Mark);
+    Window = memory_arena_alloc(&mLoaderArena, FIRMWARE_DECOMPRESS_WINDOW, sizeof(UINT64));
+    if (Window == NULL) {
+        DBG_EXIT_STATUS(EFI_OUT_OF_RESOURCES);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    // Decode once without writing so a bad frame never leaves a blank range
+    Status = DecompressToFlash(Frame, FrameSize, FlashAddress, ImageSize, Window, FALSE, NULL);
+    if (!EFI_ERROR(Status)) {
+        Status = DecompressToFlash(Frame, FrameSize, FlashAddress, ImageSize, Window, TRUE, Stats);
+    }
+    
+    memory_arena_rewind(&mLoaderArena, &Mark);
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+//
+// Region check run on a worker processor
+//
+typedef struct {
+    CONST FIRMWARE_PACKAGE_VIEW *View;
+    UINTN Index;
+} FIRMWARE_REGION_CHECK;
+
+/**
+ * Worker job: hash a region payload and test decode it if compressed
+ * @param Job - Job whose context is a FIRMWARE_REGION_CHECK
+ * @param Scratch - WORKER_POOL_SCRATCH_SIZE bytes, used as the LZ4 window
+ * @return EFI_STATUS - Validation or decode error
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+RegionCheckJob(
+    IN OUT WORKER_JOB *Job,
+    IN VOID *Scratch
+)
+{
+    EFI_STATUS Status;
+    FIRMWARE_REGION_CHECK *Check;
+    CONST FIRMWARE_REGION_ENTRY *Entry;
+    FIRMWARE_DECOMPRESS_FLASH Flash;
+    UINT64 DecodedSize;
+    UINT32 Checksum;
+    
+    Check = (FIRMWARE_REGION_CHECK *)Job->Context;
+    Entry = &Check->View->Regions[Check->Index];
+    
+    Status = ValidateRegionPayload(Entry, Check->View->Base + Entry->Offset, &Checksum);
+    if (EFI_ERROR(Status) || (Entry->Flags & FIRMWARE_REGION_FLAG_LZ4) == 0) {
+        return Status;
+    }
+    
+    // Dry run: DecompressFlashChunk only bounds-checks when not programming
+    ZeroMemory(&Flash, sizeof(Flash));
+    Flash.ImageSize = Entry->UncompressedSize;
+    Flash.Program = FALSE;
+    
+    Status = lz4_decode_frame(
+        Check->View->Base + Entry->Offset,
+        Entry->Size,
+        (UINT8 *)Scratch,
+        WORKER_POOL_SCRATCH_SIZE,
+        DecompressFlashChunk,
+        &Flash,
+        &DecodedSize
+    );
+    if (!EFI_ERROR(Status) && DecodedSize != Entry->UncompressedSize) {
+        Status = EFI_VOLUME_CORRUPTED;
+    }
+    
+    return Status;
+}
+
+/**
+ * Validate and program the selected regions of a package
+ * @param View - Package view
+ * @param RegionMask - FIRMWARE_REGION_MASK bits of the region types to apply
+ * @param Stats - Optional pointer to receive accumulated delta statistics
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_apply(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINT32 RegionMask,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    CONST FIRMWARE_REGION_ENTRY *Entry;
+    CONST VOID *Payload;
+    FLASH_REGION Region;
+    FLASH_DELTA_STATS RegionStats;
+    FLASH_DELTA_STATS Totals;
+    FLASH_DEVICE_INFO FlashInfo;
+    FIRMWARE_REGION_CHECK Checks[FIRMWARE_PACKAGE_MAX_REGIONS];
+    WORKER_JOB Jobs[FIRMWARE_PACKAGE_MAX_REGIONS];
+    UINTN CheckCount;
+    MEMORY_ARENA_MARK Mark;
+    UINT8 *Window;
+    UINTN Applied;
+    UINTN i;
+    
+    DBG_ENTER();
+    
+    if (View == NULL || View->Regions == NULL || View->RegionCount > FIRMWARE_PACKAGE_MAX_REGIONS) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Window = NULL;
+    memory_arena_get_mark(&mLoaderArena, &Mark);
+    for (i = 0; i < View->RegionCount; i++) {
+        if ((View->Regions[i].Flags & FIRMWARE_REGION_FLAG_LZ4) != 0) {
+            Window = memory_arena_alloc(&mLoaderArena, FIRMWARE_DECOMPRESS_WINDOW, sizeof(UINT64));
+            if (Window == NULL) {
+                DBG_EXIT_STATUS(EFI_OUT_OF_RESOURCES);
+                return EFI_OUT_OF_RESOURCES;
+            }
+            break;
+        }
+    }
+    
+    // Validate everything selected first so a bad package never half-flashes.
+    // Placement is checked here; hashes and test decodes run on the worker pool.
+    Status = EFI_SUCCESS;
+    CheckCount = 0;
+    for (i = 0; i < View->RegionCount && !EFI_ERROR(Status); i++) {
+        Entry = &View->Regions[i];
+        if (Entry->RegionType >= 32 ||
+            (RegionMask & FIRMWARE_REGION_MASK(Entry->RegionType)) == 0) {
+            continue;
+        }
+        
+        Status = flash_get_region((FLASH_REGION_TYPE)Entry->RegionType, &Region);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Package region %ld targets unknown flash region %d\n",
+                      i, Entry->RegionType);
+            break;
+        }
+        
+        if ((UINT64)Entry->FlashOffset + Entry->UncompressedSize > Region.Size) {
+            LOG_ERROR("Package region %ld overruns %s: 0x%08X + %d > %d\n",
+                      i, Region.Name, Entry->FlashOffset, Entry->UncompressedSize, Region.Size);
+            Status = EFI_BAD_BUFFER_SIZE;
+            break;
+        }
+        
+        if ((Entry->Flags & FIRMWARE_REGION_FLAG_LZ4) != 0) {
+            Status = flash_get_device_info(&FlashInfo);
+            if (EFI_ERROR(Status)) {
+                break;
+            }
+            if (Entry->UncompressedSize == 0 ||
+                ((Region.StartAddress + Entry->FlashOffset) % FlashInfo.SectorSize) != 0 ||
+                (Entry->UncompressedSize % FlashInfo.SectorSize) != 0) {
+                LOG_ERROR("Compressed package region %ld must cover whole sectors\n", i);
+                Status = EFI_BAD_BUFFER_SIZE;
+                break;
+            }
+        }
+        
+        Checks[CheckCount].View = View;
+        Checks[CheckCount].Index = i;
+        Jobs[CheckCount].Function = RegionCheckJob;
+        Jobs[CheckCount].Context = &Checks[CheckCount];
+        Jobs[CheckCount].Status = EFI_NOT_STARTED;
+        CheckCount++;
+    }
+    
+    if (!EFI_ERROR(Status) && CheckCount > 0) {
+        Status = worker_pool_run(Jobs, CheckCount);
+        for (i = 0; i < CheckCount && EFI_ERROR(Status); i++) {
+            if (EFI_ERROR(Jobs[i].Status)) {
+                LOG_ERROR("Package region %ld failed validation: %r\n",
+                          Checks[i].Index, Jobs[i].Status);
+            }
+        }
+    }
+    
+    if (EFI_ERROR(Status)) {
+        mFirmwareInfo.Status = FIRMWARE_STATUS_CORRUPTED;
+    }
+    
+    ZeroMemory(&Totals, sizeof(Totals));
+    Applied = 0;
+    
+    for (i = 0; i < View->RegionCount && !EFI_ERROR(Status); i++) {
+        Entry = &View->Regions[i];
+        if (Entry->RegionType >= 32 ||
+            (RegionMask & FIRMWARE_REGION_MASK(Entry->RegionType)) == 0 ||
+            Entry->Size == 0) {
+            continue;
+        }
+        
+        flash_get_region((FLASH_REGION_TYPE)Entry->RegionType, &Region);
+        firmware_package_get_region(View, i, NULL, &Payload);
+        
+        if ((Entry->Flags & FIRMWARE_REGION_FLAG_LZ4) != 0) {
+            Status = DecompressToFlash(Payload, Entry->Size, Region.StartAddress + Entry->FlashOffset,
+                                       Entry->UncompressedSize, Window, TRUE, &RegionStats);
+        } else {
+            Status = flash_write_delta(
+                Region.StartAddress + Entry->FlashOffset,
+                Payload,
+                Entry->Size,
+                &RegionStats
+            );
+        }
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Programming %s from package region %ld failed: %r\n",
+                      Region.Name, i, Status);
+            break;
+        }
+        
+        LOG_INFO("Applied %s: %d bytes (%ld skipped, %ld erased, %ld programmed)\n",
+                 Region.Name, Entry->UncompressedSize, RegionStats.SectorsSkipped,
+                 RegionStats.SectorsErased, RegionStats.SectorsProgrammed);
+        
+        Totals.SectorsSkipped += RegionStats.SectorsSkipped;
+        Totals.SectorsErased += RegionStats.SectorsErased;
+        Totals.SectorsProgrammed += RegionStats.SectorsProgrammed;
+        Applied++;
+    }
+    
+    memory_arena_rewind(&mLoaderArena, &Mark);
+    
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    if (Stats != NULL) {
+        CopyMemory(Stats, &Totals, sizeof(Totals));
+    }
+    
+    LOG_INFO("Package applied: %ld of %ld regions\n", Applied, View->RegionCount);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get firmware information
+ * @param Info - Pointer to receive firmware info
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_get_info(
+    OUT FIRMWARE_INFO *Info
+)
+{
+    if (Info == NULL || !mFirmwareLoaderInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    CopyMemory(Info, &mFirmwareInfo, sizeof(FIRMWARE_INFO));
+    return EFI_SUCCESS;
+}
+
+/**
+ * Display firmware loader status
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_loader_status(VOID)
+{
+    if (!mFirmwareLoaderInitialized) {
+        Print(L"Firmware Loader: Not initialized\n");
+        return EFI_NOT_READY;
+    }
+    
+    Print(L"Firmware Loader Status:\n");
+    Print(L"  Name: %s\n", mFirmwareInfo.Name);
+    Print(L"  Vendor: %s\n", mFirmwareInfo.Vendor);
+    Print(L"  Version: %d.%d.%d.%d\n", 
+          mFirmwareInfo.MajorVersion, mFirmwareInfo.MinorVersion,
+          mFirmwareInfo.PatchVersion, mFirmwareInfo.BuildNumber);
+    Print(L"  Status: %s\n", 
+          mFirmwareInfo.Status == FIRMWARE_STATUS_LOADED ? L"Loaded" :
+          mFirmwareInfo.Status == FIRMWARE_STATUS_VALIDATED ? L"Validated" : L"Unknown");
+    Print(L"  Capabilities: 0x%08X\n", mFirmwareInfo.Capabilities);
+    Print(L"  Integrity: CRC32C %s, SHA-256 %s\n",
+          (integrity_get_features() & INTEGRITY_CPU_SSE42) ? L"SSE4.2" : L"slicing-by-8",
+          (integrity_get_features() & INTEGRITY_CPU_SHA) ? L"SHA-NI" : L"portable");
+    Print(L"  File System: %s\n", mFileSystem != NULL ? L"Available" : L"Not Available");
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Cleanup firmware loader resources
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_loader_cleanup(VOID)
+{
+    DBG_ENTER();
+    
+    if (!mFirmwareLoaderInitialized) {
+        DBG_EXIT_STATUS(EFI_NOT_READY);
+        return EFI_NOT_READY;
+    }
+    
+    // Close file system protocol
+    if (mFileSystem != NULL && mFileSystemHandle != NULL) {
+        gBS->CloseProtocol(
+            mFileSystemHandle,
+            &gEfiSimpleFileSystemProtocolGuid,
+            gImageHandle,
+            NULL
+        );
+        mFileSystem = NULL;
+        mFileSystemHandle = NULL;
+    }
+    
+    // Clear firmware info
+    ZeroMemory(&mFirmwareInfo, sizeof(FIRMWARE_INFO));
+    
+    memory_arena_release(&mLoaderArena);
     
     mFirmwareLoaderInitialized = FALSE;
     
@@ -3,6 +3,10 @@
 #define _FIRMWARE_LOADER_H_
 
 #include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+#include "../../include/config.h"
+#include "integrity.h"
+#include "flash_manager.h"
 
 //
 // Firmware Status Definitions
@@ -41,7 +45,8 @@ typedef struct {
     
     UINT32 Status;
     UINT32 Capabilities;
-    UINT32 Checksum;
+    UINT32 Checksum;                    // CRC32C of the image
+    UINT8 Digest[SHA256_DIGEST_SIZE];   // SHA-256 of the image
     UINTN Size;
     
     EFI_TIME BuildDate;
@@ -50,7 +55,10 @@ typedef struct {
 
 //
 // Firmware Update Package Header
+// Checksum is the CRC32C of the payload bytes [HeaderSize, PackageSize)
 //
+#define FIRMWARE_PACKAGE_SIGNATURE      SIGNATURE_32('F', 'W', 'P', 'K')
+
 #pragma pack(1)
 typedef struct {
     UINT32 Signature;          // 'FWPK'
@@ -63,6 +71,104 @@ typedef struct {
 } FIRMWARE_PACKAGE_HEADER;
 #pragma pack()
 
+//
+// Multi-Region Package (format 2)
+// Starts with the same header, signed 'FWP2'. A manifest and RegionCount
+// region entries follow it inside HeaderSize, and Checksum is the CRC32C of
+// those manifest bytes [sizeof(FIRMWARE_PACKAGE_HEADER), HeaderSize). Every
+// region payload carries its own CRC32C and SHA-256, so each one can be
+// located, validated and flashed without touching the others.
+//
+#define FIRMWARE_PACKAGE_V2_SIGNATURE   SIGNATURE_32('F', 'W', 'P', '2')
+#define FIRMWARE_PACKAGE_FORMAT_V2      2
+
+#define FIRMWARE_REGION_FLAG_LZ4        0x00000001  // Payload is an LZ4 frame
+#define FIRMWARE_REGION_FLAGS_KNOWN     (FIRMWARE_REGION_FLAG_LZ4)
+
+#define FIRMWARE_REGION_MASK(Type)      (1U << (Type))
+#define FIRMWARE_REGION_MASK_ALL        0xFFFFFFFF
+
+#pragma pack(1)
+typedef struct {
+    UINT16 FormatVersion;      // FIRMWARE_PACKAGE_FORMAT_V2
+    UINT16 RegionCount;
+    UINT32 Reserved;
+} FIRMWARE_PACKAGE_MANIFEST;
+
+typedef struct {
+    UINT32 RegionType;          // FLASH_REGION_TYPE
+    UINT32 Flags;               // FIRMWARE_REGION_FLAG_*
+    UINT32 Offset;              // Payload offset from the package start
+    UINT32 Size;                // Stored payload size
+    UINT32 UncompressedSize;    // Bytes programmed into the region
+    UINT32 FlashOffset;         // Destination offset inside the region
+    UINT32 Crc32c;              // CRC32C of the stored payload
+    UINT8 Sha256[SHA256_DIGEST_SIZE];
+} FIRMWARE_REGION_ENTRY;
+#pragma pack()
+
+/**
+ * Parsed view of a multi-region package
+ * @details All pointers alias the caller's package buffer.
+ */
+typedef struct {
+    CONST UINT8 *Base;
+    UINTN Size;
+    CONST FIRMWARE_PACKAGE_HEADER *Header;
+    CONST FIRMWARE_REGION_ENTRY *Regions;
+    UINTN RegionCount;
+} FIRMWARE_PACKAGE_VIEW;
+
+//
+// Incremental Validation Context
+// Fed chunk by chunk; a package header in the first bytes is captured on the
+// fly so its payload checksum can be checked at final without a second pass.
+//
+typedef struct {
+    UINT64 Offset;                      // Bytes seen so far
+    UINT32 Crc;                         // CRC32C of everything seen
+    INTEGRITY_SHA256_CONTEXT Sha256;    // SHA-256 of everything seen
+    FIRMWARE_PACKAGE_HEADER Header;     // Leading bytes, if a package
+    UINTN HeaderUsed;
+    BOOLEAN IsPackage;
+    BOOLEAN HeaderCorrupted;            // 'FWPK' with inconsistent sizes
+    UINT32 PayloadCrc;                  // CRC32C of the package payload
+} FIRMWARE_VALIDATE_CONTEXT;
+
+//
+// Streaming Loader Definitions
+//
+
+/**
+ * Ring of page-aligned chunk buffers used by the streaming loader
+ * @details Each File->Read lands in the next buffer of the ring, so a chunk
+ *          passed to the handler stays valid until Count more chunks have
+ *          been read.
+ */
+typedef struct {
+    UINTN ChunkSize;
+    UINTN Count;
+    UINTN Next;
+    VOID *Buffers[FIRMWARE_STREAM_MAX_BUFFERS];
+} FIRMWARE_STREAM_RING;
+
+/**
+ * Per-chunk callback for firmware_stream_from_file
+ * @param Context - Caller context
+ * @param Offset - File offset of the chunk
+ * @param Chunk - Chunk data
+ * @param Length - Chunk length in bytes
+ * @return EFI_STATUS - Any error stops the stream and is returned to the caller
+ */
+typedef
+EFI_STATUS
+(EFIAPI *FIRMWARE_STREAM_HANDLER)(
+    IN VOID *Context,
+    IN UINT64 Offset,
+    IN CONST VOID *Chunk,
+    IN UINTN Length
+    );
+
 //
 // Function Prototypes
 //
@@ -92,6 +198,132 @@ firmware_load_from_file(
     OUT UINTN *Size
     );
 
+/**
+ * Allocate a ring of page-aligned streaming buffers
+ * @param ChunkSize - Bytes per buffer (rounded up to a page)
+ * @param Count - Number of buffers (1..FIRMWARE_STREAM_MAX_BUFFERS)
+ * @param Ring - Ring to initialize
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_ring_create(
+    IN UINTN ChunkSize,
+    IN UINTN Count,
+    OUT FIRMWARE_STREAM_RING *Ring
+    );
+
+/**
+ * Allocate a streaming ring for reads from one USB device
+ * @details Buffers are pre-mapped slices of the device's host controller
+ *          common buffer where one is available, page-aligned memory otherwise.
+ * @param DeviceId - USB device the ring is read from
+ * @param ChunkSize - Bytes per buffer (rounded up to a page)
+ * @param Count - Number of buffers (1..FIRMWARE_STREAM_MAX_BUFFERS)
+ * @param Ring - Ring to initialize
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_ring_create_usb(
+    IN UINTN DeviceId,
+    IN UINTN ChunkSize,
+    IN UINTN Count,
+    OUT FIRMWARE_STREAM_RING *Ring
+    );
+
+/**
+ * Free the buffers of a streaming ring
+ * @param Ring - Ring created by firmware_stream_ring_create
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_ring_destroy(
+    IN OUT FIRMWARE_STREAM_RING *Ring
+    );
+
+/**
+ * Stream a firmware file through a handler one chunk at a time
+ * @param FileName - Firmware file name
+ * @param Ring - Buffer ring to read into
+ * @param Handler - Called for every chunk in file order
+ * @param Context - Passed to Handler
+ * @param FileSize - Optional pointer to receive the file size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_from_file(
+    IN CHAR16 *FileName,
+    IN FIRMWARE_STREAM_RING *Ring,
+    IN FIRMWARE_STREAM_HANDLER Handler,
+    IN VOID *Context,
+    OUT UINT64 *FileSize OPTIONAL
+    );
+
+/**
+ * Stream a raw image from a USB mass storage device one chunk at a time
+ * @details Each chunk is read by a single large SCSI READ straight into the
+ *          next ring buffer, so no data is copied between the device and
+ *          Handler.
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param Ring - Buffer ring; ChunkSize must be a multiple of the block size
+ * @param Handler - Called for every chunk in image order
+ * @param Context - Passed to Handler
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_stream_from_usb(
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN FIRMWARE_STREAM_RING *Ring,
+    IN FIRMWARE_STREAM_HANDLER Handler,
+    IN VOID *Context
+    );
+
+/**
+ * Validate and program a raw image read from a USB mass storage device
+ * @details The image is read twice: once to check the package, then again
+ *          to program chunks that still match what was checked.
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Optional buffer ring; a FIRMWARE_USB_STREAM_CHUNK_SIZE ring is used when NULL
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_flash_from_usb(
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring OPTIONAL
+    );
+
+/**
+ * Validate and program a firmware file without loading it whole
+ * @details The file is read twice: once to check the package, then again
+ *          to program chunks that still match what was checked.
+ * @param FileName - Firmware file name
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Optional buffer ring; a default ring is used when NULL
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_flash_from_file(
+    IN CHAR16 *FileName,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring OPTIONAL
+    );
+
 /**
  * Load firmware from memory
  * @param Address - Physical address of firmware
@@ -120,6 +352,48 @@ firmware_validate(
     IN UINTN Size
     );
 
+/**
+ * Start an incremental firmware validation
+ * @param Context - Validation context to initialize
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_begin(
+    OUT FIRMWARE_VALIDATE_CONTEXT *Context
+    );
+
+/**
+ * Feed the next chunk of a firmware image into a validation
+ * @param Context - Validation context
+ * @param Buffer - Chunk data, in image order
+ * @param Size - Chunk size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_update(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+    );
+
+/**
+ * Finish an incremental firmware validation
+ * @details Records the CRC32C/SHA-256 in the firmware info. When the image
+ *          starts with a package header its payload checksum is checked too.
+ * @param Context - Validation context
+ * @param Checksum - Optional pointer to receive the image CRC32C
+ * @return EFI_STATUS - EFI_CRC_ERROR on a payload checksum mismatch,
+ *                      EFI_VOLUME_CORRUPTED on a malformed or short package
+ */
+EFI_STATUS
+EFIAPI
+firmware_validate_final(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    OUT UINT32 *Checksum OPTIONAL
+    );
+
 /**
  * Validate firmware package
  * @param Package - Firmware package data
@@ -137,6 +411,8 @@ firmware_validate_package(
 
 /**
  * Extract firmware from package
+ * @details Returns a view into Package; the payload is not copied and must
+ *          not be freed separately.
  * @param Package - Firmware package data
  * @param PackageSize - Package size
  * @param FirmwareBuffer - Pointer to receive firmware
@@ -152,6 +428,111 @@ firmware_extract_from_package(
     OUT UINTN *FirmwareSize
     );
 
+/**
+ * Parse the manifest of a multi-region package
+ * @details Checks the header, the manifest checksum and that every region
+ *          payload lies inside the package. Payloads are not hashed here.
+ * @param Package - Package data
+ * @param PackageSize - Package buffer size
+ * @param View - View to initialize; aliases Package
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_open(
+    IN CONST VOID *Package,
+    IN UINTN PackageSize,
+    OUT FIRMWARE_PACKAGE_VIEW *View
+    );
+
+/**
+ * Find the first package region targeting a flash region type
+ * @param View - Package view
+ * @param Type - Flash region type
+ * @param Index - Pointer to receive the region index
+ * @return EFI_STATUS - EFI_NOT_FOUND if the package has no such region
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_find_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN FLASH_REGION_TYPE Type,
+    OUT UINTN *Index
+    );
+
+/**
+ * Get a region entry and a view of its stored payload
+ * @param View - Package view
+ * @param Index - Region index
+ * @param Entry - Optional pointer to receive the region entry
+ * @param Payload - Pointer to receive the payload (aliases the package)
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_get_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINTN Index,
+    OUT CONST FIRMWARE_REGION_ENTRY **Entry OPTIONAL,
+    OUT CONST VOID **Payload
+    );
+
+/**
+ * Validate the stored payload of one region
+ * @param View - Package view
+ * @param Index - Region index
+ * @return EFI_STATUS - EFI_CRC_ERROR on a CRC32C mismatch,
+ *                      EFI_SECURITY_VIOLATION on a SHA-256 mismatch
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_validate_region(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINTN Index
+    );
+
+/**
+ * Decompress an LZ4 frame straight into flash
+ * @details The frame is decoded once as a dry run, then the destination is
+ *          erased and decoded output is programmed chunk by chunk; runs of
+ *          erased-value bytes are skipped since the erase already left them.
+ * @param Frame - LZ4 frame
+ * @param FrameSize - Frame size
+ * @param FlashAddress - Sector-aligned destination
+ * @param ImageSize - Decoded size; a multiple of the sector size
+ * @param Stats - Optional pointer to receive sector statistics
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_flash_compressed(
+    IN CONST VOID *Frame,
+    IN UINTN FrameSize,
+    IN UINT32 FlashAddress,
+    IN UINTN ImageSize,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+    );
+
+/**
+ * Validate and program the selected regions of a package
+ * @details Every selected region is validated (and LZ4 regions test
+ *          decoded) before any of them is programmed. Raw regions are written
+ *          with flash_write_delta so unchanged sectors are skipped; LZ4
+ *          regions go through firmware_flash_compressed's erase-and-program
+ *          path and must cover whole sectors.
+ * @param View - Package view
+ * @param RegionMask - FIRMWARE_REGION_MASK bits of the region types to apply
+ * @param Stats - Optional pointer to receive accumulated delta statistics
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_package_apply(
+    IN CONST FIRMWARE_PACKAGE_VIEW *View,
+    IN UINT32 RegionMask,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+    );
+
 /**
  * Get firmware information
  * @param Info - Pointer to receive firmware info
@@ -219,12 +600,56 @@ PopulateFirmwareInfo(
     );
 
 STATIC
-UINT32
-CalculateChecksum(
-    IN VOID *Buffer,
+BOOLEAN
+IsPackageHeaderConsistent(
+    IN CONST FIRMWARE_PACKAGE_HEADER *Header
+    );
+
+STATIC
+VOID
+ValidateCaptureHeader(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST UINT8 *Data,
     IN UINTN Size
     );
 
+STATIC
+EFI_STATUS
+ValidateParallel(
+    IN OUT FIRMWARE_VALIDATE_CONTEXT *Context,
+    IN CONST UINT8 *Data,
+    IN UINTN Size
+    );
+
+STATIC
+EFI_STATUS
+ValidateRegionPayload(
+    IN CONST FIRMWARE_REGION_ENTRY *Entry,
+    IN CONST VOID *Payload,
+    OUT UINT32 *Checksum
+    );
+
+STATIC
+EFI_STATUS
+OpenFirmwareFile(
+    IN CHAR16 *FileName,
+    OUT EFI_FILE_PROTOCOL **Root,
+    OUT EFI_FILE_PROTOCOL **File,
+    OUT UINT64 *FileSize
+    );
+
+STATIC
+EFI_STATUS
+DecompressToFlash(
+    IN CONST VOID *Frame,
+    IN UINTN FrameSize,
+    IN UINT32 FlashAddress,
+    IN UINTN ImageSize,
+    IN UINT8 *Window,
+    IN BOOLEAN Program,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+    );
+
 STATIC
 EFI_STATUS
 VerifySignature(
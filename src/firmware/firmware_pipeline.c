@@ -0,0 +1,752 @@
+/**
+ * @file firmware_pipeline.c
+ * @brief Three-stage read, validate and program pipeline for firmware updates
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "firmware_pipeline.h"
+#include "../usb/usb_mass_storage.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+#include "../../include/metrics.h"
+
+//
+// Static variables
+//
+STATIC UINTN mStageMetrics[FirmwarePipelineStageCount] = {
+    METRICS_INVALID_ID,
+    METRICS_INVALID_ID,
+    METRICS_INVALID_ID
+};
+STATIC FIRMWARE_PIPELINE_STATS mLastStats;
+STATIC BOOLEAN mLastStatsValid = FALSE;
+
+STATIC CONST CHAR16 *mStageNames[FirmwarePipelineStageCount] = {
+    L"Read",
+    L"Validate",
+    L"Program"
+};
+
+STATIC CONST CHAR16 *mStageMetricNames[FirmwarePipelineStageCount] = {
+    L"loader.read",
+    L"loader.validate",
+    L"loader.program"
+};
+
+/**
+ * Reset a pipeline, allocate its per-chunk CRCs and register the per-stage metrics on first use
+ * @param Pipeline - Pipeline state to initialize
+ * @param Size - Bytes to stream
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Buffer ring
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineBegin(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+)
+{
+    UINTN Index;
+
+    if (Pipeline == NULL || Ring == NULL || Ring->Count == 0 || Size == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (Index = 0; Index < FirmwarePipelineStageCount; Index++) {
+        if (mStageMetrics[Index] == METRICS_INVALID_ID) {
+            metrics_register(mStageMetricNames[Index], &mStageMetrics[Index]);
+        }
+    }
+
+    ZeroMemory(Pipeline, sizeof(FIRMWARE_PIPELINE));
+    Pipeline->Size = Size;
+    Pipeline->FlashAddress = FlashAddress;
+    Pipeline->Ring = Ring;
+    Pipeline->Status = EFI_SUCCESS;
+    Pipeline->Stats.Depth = Ring->Count;
+    Pipeline->Stats.TicksPerMs = metrics_get_ticks_per_ms();
+
+    Pipeline->ChunkCount = (UINTN)DivU64x64Remainder(Size + Ring->ChunkSize - 1, Ring->ChunkSize, NULL);
+    Pipeline->ChunkCrc = AllocatePool(Pipeline->ChunkCount * sizeof(UINT32));
+    if (Pipeline->ChunkCrc == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    firmware_validate_begin(&Pipeline->Validate);
+    Pipeline->StartTick = AsmReadTsc();
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Start a pipeline reading an open firmware file from its current position
+ * @param Pipeline - Pipeline state to initialize
+ * @param File - Open file; must stay open until firmware_pipeline_end
+ * @param Size - Bytes to stream
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Buffer ring; every slot is used
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_begin_file(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_FILE_PROTOCOL *File,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+)
+{
+    EFI_STATUS Status;
+    UINT64 Position;
+
+    if (File == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = File->GetPosition(File, &Position);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Status = PipelineBegin(Pipeline, Size, FlashAddress, Ring);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Pipeline->File = File;
+    Pipeline->FilePosition = Position;
+
+    // A read can only overlap programming if there is another slot to program
+    if (File->Revision >= EFI_FILE_PROTOCOL_REVISION2 && Ring->Count > 1) {
+        Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Pipeline->ReadToken.Event);
+        Pipeline->Stats.AsyncRead = !EFI_ERROR(Status);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Start a pipeline reading a raw image from a USB mass storage device
+ * @param Pipeline - Pipeline state to initialize
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Buffer ring; ChunkSize must be a multiple of the block size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_begin_usb(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+)
+{
+    EFI_STATUS Status;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+
+    if (Pipeline == NULL || Ring == NULL || Ring->Count == 0 || Size == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = usb_msc_get_capacity(DeviceId, &BlockSize, &BlockCount);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    if (Ring->ChunkSize % BlockSize != 0 ||
+        StartLba >= BlockCount || DivU64x32(Size + BlockSize - 1, BlockSize) > BlockCount - StartLba) {
+        LOG_ERROR("USB image of %ld bytes at LBA 0x%lx does not fit the device or ring\n", Size, StartLba);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = PipelineBegin(Pipeline, Size, FlashAddress, Ring);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Pipeline->DeviceId = DeviceId;
+    Pipeline->StartLba = StartLba;
+    Pipeline->BlockSize = BlockSize;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Record that a stage started or stopped waiting on a neighbouring stage
+ * @param Stage - Stage counters
+ * @param Stalled - TRUE if the stage cannot make progress this step
+ */
+STATIC
+VOID
+PipelineStall(
+    IN OUT FIRMWARE_PIPELINE_STAGE_STATS *Stage,
+    IN BOOLEAN Stalled
+)
+{
+    if (Stalled && !Stage->Stalled) {
+        Stage->Stalls++;
+        Stage->StallStart = AsmReadTsc();
+    } else if (!Stalled && Stage->Stalled) {
+        Stage->StallTicks += AsmReadTsc() - Stage->StallStart;
+    }
+
+    Stage->Stalled = Stalled;
+}
+
+/**
+ * Hand a finished read to the validate stage
+ * @param Pipeline - Pipeline state
+ * @param ReadStatus - Status of the read
+ * @param Length - Bytes read into the read slot
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineReadComplete(
+    IN OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_STATUS ReadStatus,
+    IN UINTN Length
+)
+{
+    FIRMWARE_PIPELINE_STAGE_STATS *Stage;
+    UINT64 Ticks;
+
+    if (EFI_ERROR(ReadStatus)) {
+        LOG_ERROR("Pipeline read failed at 0x%lx: %r\n", Pipeline->NextRead, ReadStatus);
+        return ReadStatus;
+    }
+
+    if (Length == 0) {
+        LOG_ERROR("Firmware image truncated at 0x%lx of 0x%lx\n", Pipeline->NextRead, Pipeline->Size);
+        return EFI_END_OF_FILE;
+    }
+
+    Stage = &Pipeline->Stats.Stages[FirmwarePipelineRead];
+    Ticks = AsmReadTsc() - Pipeline->ReadStart;
+    Stage->BusyTicks += Ticks;
+    Stage->Chunks++;
+    Stage->Bytes += Length;
+    metrics_record_ticks(mStageMetrics[FirmwarePipelineRead], Ticks, Length);
+
+    Pipeline->SlotLength[Pipeline->ReadSlot] = Length;
+    Pipeline->SlotState[Pipeline->ReadSlot] = FirmwarePipelineSlotFilled;
+    Pipeline->NextRead += Length;
+    Pipeline->ReadSlot = (Pipeline->ReadSlot + 1) % Pipeline->Ring->Count;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Read stage: fill the next free slot from the file or USB device
+ * @details BOT and File->Read complete before returning; ReadEx leaves the
+ *          read in flight and it is reaped on a later step.
+ * @param Pipeline - Pipeline state
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineReadStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    EFI_STATUS Status;
+    UINTN Slot;
+    UINTN Length;
+    VOID *Buffer;
+
+    if (!Pipeline->ReadPending && Pipeline->NextRead < Pipeline->Size) {
+        Slot = Pipeline->ReadSlot;
+
+        // Back-pressure: the slot is still waiting to be validated or programmed
+        PipelineStall(
+            &Pipeline->Stats.Stages[FirmwarePipelineRead],
+            Pipeline->SlotState[Slot] != FirmwarePipelineSlotFree
+        );
+        if (Pipeline->SlotState[Slot] != FirmwarePipelineSlotFree) {
+            return EFI_SUCCESS;
+        }
+
+        Length = Pipeline->Ring->ChunkSize;
+        if (Length > Pipeline->Size - Pipeline->NextRead) {
+            Length = (UINTN)(Pipeline->Size - Pipeline->NextRead);
+        }
+
+        Buffer = Pipeline->Ring->Buffers[Slot];
+        Pipeline->SlotState[Slot] = FirmwarePipelineSlotReading;
+        Pipeline->ReadStart = AsmReadTsc();
+
+        if (Pipeline->File == NULL) {
+            // The tail is read as whole blocks; only Length bytes are handed on
+            Status = usb_msc_read(
+                Pipeline->DeviceId,
+                Pipeline->StartLba + DivU64x32(Pipeline->NextRead, Pipeline->BlockSize),
+                (Length + Pipeline->BlockSize - 1) / Pipeline->BlockSize,
+                Buffer
+            );
+            return PipelineReadComplete(Pipeline, Status, Length);
+        }
+
+        if (!Pipeline->Stats.AsyncRead) {
+            Status = Pipeline->File->Read(Pipeline->File, &Length, Buffer);
+            return PipelineReadComplete(Pipeline, Status, Length);
+        }
+
+        Pipeline->ReadToken.Status = EFI_SUCCESS;
+        Pipeline->ReadToken.BufferSize = Length;
+        Pipeline->ReadToken.Buffer = Buffer;
+        Status = Pipeline->File->ReadEx(Pipeline->File, &Pipeline->ReadToken);
+        if (EFI_ERROR(Status)) {
+            return PipelineReadComplete(Pipeline, Status, 0);
+        }
+        Pipeline->ReadPending = TRUE;
+    }
+
+    if (Pipeline->ReadPending && gBS->CheckEvent(Pipeline->ReadToken.Event) == EFI_SUCCESS) {
+        Pipeline->ReadPending = FALSE;
+        return PipelineReadComplete(Pipeline, Pipeline->ReadToken.Status, Pipeline->ReadToken.BufferSize);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Worker job: hash the slot being validated
+ * @details The verify pass feeds the validation context and records the
+ *          chunk CRC32C; the program pass checks the chunk against it.
+ * @param Job - Job whose context is the FIRMWARE_PIPELINE
+ * @param Scratch - Unused
+ * @return EFI_STATUS - EFI_CRC_ERROR if the chunk changed since the verify pass
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+PipelineValidateJob(
+    IN OUT WORKER_JOB *Job,
+    IN VOID *Scratch
+)
+{
+    FIRMWARE_PIPELINE *Pipeline;
+    EFI_STATUS Status;
+    CONST VOID *Data;
+    UINTN Length;
+    UINT32 Crc;
+    UINT64 Start;
+
+    Pipeline = (FIRMWARE_PIPELINE *)Job->Context;
+    Data = Pipeline->Ring->Buffers[Pipeline->ValidateSlot];
+    Length = Pipeline->SlotLength[Pipeline->ValidateSlot];
+
+    // Only a short read can produce more chunks than the ring size implies
+    if (Pipeline->ValidateChunk >= Pipeline->ChunkCount) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    Start = AsmReadTsc();
+    Crc = integrity_crc32c(0, Data, Length);
+    Status = EFI_SUCCESS;
+    if (!Pipeline->Verified) {
+        Pipeline->ChunkCrc[Pipeline->ValidateChunk] = Crc;
+        Status = firmware_validate_update(&Pipeline->Validate, Data, Length);
+    } else if (Crc != Pipeline->ChunkCrc[Pipeline->ValidateChunk]) {
+        Status = EFI_CRC_ERROR;
+    }
+    Pipeline->ValidateTicks = AsmReadTsc() - Start;
+
+    return Status;
+}
+
+/**
+ * Hand a validated chunk to the program stage
+ * @param Pipeline - Pipeline state
+ * @param JobStatus - Status of the validation job
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineValidateComplete(
+    IN OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_STATUS JobStatus
+)
+{
+    FIRMWARE_PIPELINE_STAGE_STATS *Stage;
+    UINTN Slot;
+
+    if (EFI_ERROR(JobStatus)) {
+        if (Pipeline->Verified && JobStatus == EFI_CRC_ERROR) {
+            LOG_ERROR("Firmware source changed at 0x%lx since it was verified, nothing programmed past it\n",
+                      Pipeline->NextValidate);
+        } else {
+            LOG_ERROR("Pipeline validation failed at 0x%lx: %r\n", Pipeline->NextValidate, JobStatus);
+        }
+        return JobStatus;
+    }
+
+    Stage = &Pipeline->Stats.Stages[FirmwarePipelineValidate];
+    Slot = Pipeline->ValidateSlot;
+    Stage->BusyTicks += Pipeline->ValidateTicks;
+    Stage->Chunks++;
+    Stage->Bytes += Pipeline->SlotLength[Slot];
+    metrics_record_ticks(
+        mStageMetrics[FirmwarePipelineValidate],
+        Pipeline->ValidateTicks,
+        Pipeline->SlotLength[Slot]
+    );
+
+    Pipeline->SlotState[Slot] = FirmwarePipelineSlotValidated;
+    Pipeline->NextValidate += Pipeline->SlotLength[Slot];
+    Pipeline->ValidateChunk++;
+    Pipeline->ValidateSlot = (Slot + 1) % Pipeline->Ring->Count;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Validate stage: hash the next filled slot on a worker
+ * @details The validation context takes chunks strictly in order, so one
+ *          chunk is hashed at a time while the BSP reads and programs.
+ * @param Pipeline - Pipeline state
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineValidateStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    EFI_STATUS Status;
+    UINTN Slot;
+
+    if (!Pipeline->ValidatePending && Pipeline->NextValidate < Pipeline->Size) {
+        Slot = Pipeline->ValidateSlot;
+
+        PipelineStall(
+            &Pipeline->Stats.Stages[FirmwarePipelineValidate],
+            Pipeline->SlotState[Slot] != FirmwarePipelineSlotFilled
+        );
+        if (Pipeline->SlotState[Slot] != FirmwarePipelineSlotFilled) {
+            return EFI_SUCCESS;
+        }
+
+        Pipeline->SlotState[Slot] = FirmwarePipelineSlotValidating;
+        Pipeline->ValidateJob.Function = PipelineValidateJob;
+        Pipeline->ValidateJob.Context = Pipeline;
+
+        // Without APs the pool runs the job before returning
+        Status = worker_pool_submit(&Pipeline->ValidateJob, 1, &Pipeline->ValidateBatch);
+        if (EFI_ERROR(Status)) {
+            // No pool, or another batch owns the workers: hash here rather than wait
+            return PipelineValidateComplete(Pipeline, PipelineValidateJob(&Pipeline->ValidateJob, NULL));
+        }
+        Pipeline->ValidatePending = TRUE;
+    }
+
+    if (Pipeline->ValidatePending && worker_pool_poll(&Pipeline->ValidateBatch) != EFI_NOT_READY) {
+        Pipeline->ValidatePending = FALSE;
+        return PipelineValidateComplete(Pipeline, worker_pool_wait(&Pipeline->ValidateBatch));
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Program stage: delta erase/program the next validated slot
+ * @details In the verify pass the slot is only released.
+ * @param Pipeline - Pipeline state
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PipelineProgramStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    FIRMWARE_PIPELINE_STAGE_STATS *Stage;
+    FLASH_DELTA_STATS Delta;
+    EFI_STATUS Status;
+    UINTN Slot;
+    UINT64 Start;
+    UINT64 Ticks;
+
+    if (Pipeline->NextProgram >= Pipeline->Size) {
+        return EFI_SUCCESS;
+    }
+
+    Stage = &Pipeline->Stats.Stages[FirmwarePipelineProgram];
+    Slot = Pipeline->ProgramSlot;
+
+    PipelineStall(Stage, Pipeline->SlotState[Slot] != FirmwarePipelineSlotValidated);
+    if (Pipeline->SlotState[Slot] != FirmwarePipelineSlotValidated) {
+        return EFI_SUCCESS;
+    }
+
+    if (!Pipeline->Verified) {
+        Pipeline->SlotState[Slot] = FirmwarePipelineSlotFree;
+        Pipeline->NextProgram += Pipeline->SlotLength[Slot];
+        Pipeline->ProgramSlot = (Slot + 1) % Pipeline->Ring->Count;
+        return EFI_SUCCESS;
+    }
+
+    Start = AsmReadTsc();
+    Status = flash_write_delta(
+        Pipeline->FlashAddress + (UINT32)Pipeline->NextProgram,
+        Pipeline->Ring->Buffers[Slot],
+        Pipeline->SlotLength[Slot],
+        &Delta
+    );
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Pipeline program failed at 0x%lx: %r\n", Pipeline->NextProgram, Status);
+        return Status;
+    }
+
+    Ticks = AsmReadTsc() - Start;
+    Stage->BusyTicks += Ticks;
+    Stage->Chunks++;
+    Stage->Bytes += Pipeline->SlotLength[Slot];
+    metrics_record_ticks(mStageMetrics[FirmwarePipelineProgram], Ticks, Pipeline->SlotLength[Slot]);
+    Pipeline->Stats.Delta.SectorsSkipped += Delta.SectorsSkipped;
+    Pipeline->Stats.Delta.SectorsErased += Delta.SectorsErased;
+    Pipeline->Stats.Delta.SectorsProgrammed += Delta.SectorsProgrammed;
+
+    Pipeline->SlotState[Slot] = FirmwarePipelineSlotFree;
+    Pipeline->NextProgram += Pipeline->SlotLength[Slot];
+    Pipeline->ProgramSlot = (Slot + 1) % Pipeline->Ring->Count;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Finish the verify pass and rewind the source for the program pass
+ * @details Every slot is free again once the last chunk left the program stage.
+ * @param Pipeline - Pipeline state
+ * @return EFI_STATUS - Validation error of the package, or a seek error
+ */
+STATIC
+EFI_STATUS
+PipelineStartProgramPass(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    EFI_STATUS Status;
+
+    Status = firmware_validate_final(&Pipeline->Validate, &Pipeline->Checksum);
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Firmware image failed validation, flash left untouched: %r\n", Status);
+        return Status;
+    }
+
+    if (Pipeline->File != NULL) {
+        Status = Pipeline->File->SetPosition(Pipeline->File, Pipeline->FilePosition);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Cannot rewind firmware file for programming: %r\n", Status);
+            return Status;
+        }
+    }
+
+    Pipeline->NextRead = 0;
+    Pipeline->ReadSlot = 0;
+    Pipeline->NextValidate = 0;
+    Pipeline->ValidateSlot = 0;
+    Pipeline->ValidateChunk = 0;
+    Pipeline->NextProgram = 0;
+    Pipeline->ProgramSlot = 0;
+    Pipeline->Verified = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Advance every stage by at most one chunk
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - EFI_NOT_READY while chunks remain, EFI_SUCCESS once
+ *                      the whole image is programmed, or the first error
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_step(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    EFI_STATUS Status;
+
+    if (Pipeline == NULL || Pipeline->Ring == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (EFI_ERROR(Pipeline->Status)) {
+        return Pipeline->Status;
+    }
+
+    // Start the hash first so the worker runs while this processor does I/O
+    Status = PipelineValidateStage(Pipeline);
+    if (!EFI_ERROR(Status)) {
+        Status = PipelineReadStage(Pipeline);
+    }
+    if (!EFI_ERROR(Status)) {
+        Status = PipelineProgramStage(Pipeline);
+    }
+    if (!EFI_ERROR(Status) && !Pipeline->Verified && Pipeline->NextProgram >= Pipeline->Size) {
+        Status = PipelineStartProgramPass(Pipeline);
+    }
+
+    if (EFI_ERROR(Status)) {
+        Pipeline->Status = Status;
+        return Status;
+    }
+
+    return (Pipeline->Verified && Pipeline->NextProgram >= Pipeline->Size) ? EFI_SUCCESS : EFI_NOT_READY;
+}
+
+/**
+ * Wait for any read or validation still in flight and record the statistics
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - First error seen by any stage, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_end(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    UINTN Index;
+
+    if (Pipeline == NULL || Pipeline->Ring == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // The ring must not be released under a read or a worker still using it
+    if (Pipeline->ReadPending) {
+        gBS->WaitForEvent(1, &Pipeline->ReadToken.Event, &Index);
+        Pipeline->ReadPending = FALSE;
+    }
+
+    if (Pipeline->ValidatePending) {
+        worker_pool_wait(&Pipeline->ValidateBatch);
+        Pipeline->ValidatePending = FALSE;
+    }
+
+    if (Pipeline->ReadToken.Event != NULL) {
+        gBS->CloseEvent(Pipeline->ReadToken.Event);
+        Pipeline->ReadToken.Event = NULL;
+    }
+
+    if (Pipeline->ChunkCrc != NULL) {
+        FreePool(Pipeline->ChunkCrc);
+        Pipeline->ChunkCrc = NULL;
+    }
+
+    for (Index = 0; Index < FirmwarePipelineStageCount; Index++) {
+        PipelineStall(&Pipeline->Stats.Stages[Index], FALSE);
+    }
+    Pipeline->Stats.TotalTicks = AsmReadTsc() - Pipeline->StartTick;
+
+    CopyMemory(&mLastStats, &Pipeline->Stats, sizeof(FIRMWARE_PIPELINE_STATS));
+    mLastStatsValid = TRUE;
+
+    if (!EFI_ERROR(Pipeline->Status) && (!Pipeline->Verified || Pipeline->NextProgram < Pipeline->Size)) {
+        Pipeline->Status = EFI_ABORTED;
+    }
+
+    return Pipeline->Status;
+}
+
+/**
+ * Step a started pipeline to completion and end it
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_run(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+)
+{
+    EFI_STATUS Status;
+
+    DBG_ENTER();
+
+    do {
+        Status = firmware_pipeline_step(Pipeline);
+    } while (Status == EFI_NOT_READY);
+
+    if (Status != EFI_INVALID_PARAMETER) {
+        Status = firmware_pipeline_end(Pipeline);
+    }
+
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Print per-stage counters
+ * @details Stage rates are over the stage's busy time; the total rate is
+ *          over wall time, which approaches the slowest stage when the
+ *          stages overlap. Read and Validate count both passes.
+ * @param Stats - Pipeline statistics
+ */
+STATIC
+VOID
+PipelinePrintStats(
+    IN CONST FIRMWARE_PIPELINE_STATS *Stats
+)
+{
+    CONST FIRMWARE_PIPELINE_STAGE_STATS *Stage;
+    UINTN Index;
+    UINT64 Rate;
+    UINT64 Bytes;
+
+    Print(L"  Depth: %d slots, %s reads\n", Stats->Depth, Stats->AsyncRead ? L"async" : L"blocking");
+
+    for (Index = 0; Index < FirmwarePipelineStageCount; Index++) {
+        Stage = &Stats->Stages[Index];
+        // Bytes per millisecond is kB/s
+        Rate = (Stage->BusyTicks != 0) ?
+               DivU64x64Remainder(MultU64x64(Stage->Bytes, Stats->TicksPerMs), Stage->BusyTicks, NULL) : 0;
+        Print(L"  %-8s %ld chunks, %ld KB, %ld kB/s busy, %d stalls for %ld ms\n",
+              mStageNames[Index], Stage->Chunks, DivU64x32(Stage->Bytes, 1024), Rate, Stage->Stalls,
+              (Stats->TicksPerMs != 0) ? DivU64x64Remainder(Stage->StallTicks, Stats->TicksPerMs, NULL) : 0);
+    }
+
+    Bytes = Stats->Stages[FirmwarePipelineProgram].Bytes;
+    Rate = (Stats->TotalTicks != 0) ?
+           DivU64x64Remainder(MultU64x64(Bytes, Stats->TicksPerMs), Stats->TotalTicks, NULL) : 0;
+    Print(L"  Total: %ld ms, %ld kB/s (%ld skipped, %ld erased, %ld programmed)\n",
+          (Stats->TicksPerMs != 0) ? DivU64x64Remainder(Stats->TotalTicks, Stats->TicksPerMs, NULL) : 0,
+          Rate, Stats->Delta.SectorsSkipped, Stats->Delta.SectorsErased, Stats->Delta.SectorsProgrammed);
+}
+
+/**
+ * Print per-stage throughput and stalls of the last finished pipeline
+ * @return EFI_STATUS - EFI_NOT_FOUND if no pipeline has run yet
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_status(VOID)
+{
+    if (!mLastStatsValid) {
+        Print(L"Firmware Pipeline: No update has run\n");
+        return EFI_NOT_FOUND;
+    }
+
+    Print(L"Firmware Pipeline (last update):\n");
+    PipelinePrintStats(&mLastStats);
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file firmware_pipeline.h
+ * @brief Three-stage read, validate and program pipeline for firmware updates
+ */
+
+#ifndef _FIRMWARE_PIPELINE_H_
+#define _FIRMWARE_PIPELINE_H_
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include "firmware_loader.h"
+#include "flash_manager.h"
+#include "../uefi/worker_pool.h"
+
+//
+// Pipeline Stages
+// Every ring slot moves FREE -> FILLED -> VALIDATED -> FREE, one stage per
+// transition, and each stage takes its slots strictly in image order.
+// The image is streamed twice. The verify pass hashes every chunk and
+// checks the package before anything is written; the program pass reads
+// the image again and only programs chunks whose CRC32C matches the one
+// the verify pass recorded.
+//
+typedef enum {
+    FirmwarePipelineRead,               // File or USB mass storage into a free slot
+    FirmwarePipelineValidate,           // CRC32C/SHA-256 of a filled slot on a worker
+    FirmwarePipelineProgram,            // Delta erase/program of a validated slot; program pass only
+    FirmwarePipelineStageCount
+} FIRMWARE_PIPELINE_STAGE;
+
+typedef enum {
+    FirmwarePipelineSlotFree,
+    FirmwarePipelineSlotReading,
+    FirmwarePipelineSlotFilled,
+    FirmwarePipelineSlotValidating,
+    FirmwarePipelineSlotValidated
+} FIRMWARE_PIPELINE_SLOT_STATE;
+
+//
+// Per-stage counters
+// A stall is counted once each time a stage has to wait on its neighbour:
+// the read stage on a full ring (back-pressure from validate/program), the
+// later stages on an empty one. Ticks are TSC ticks.
+//
+typedef struct {
+    UINT64 Chunks;
+    UINT64 Bytes;
+    UINT64 BusyTicks;                   // Time spent doing the stage's own work
+    UINT64 StallTicks;                  // Time spent waiting on a neighbouring stage
+    UINT32 Stalls;
+    BOOLEAN Stalled;
+    UINT64 StallStart;
+} FIRMWARE_PIPELINE_STAGE_STATS;
+
+typedef struct {
+    FIRMWARE_PIPELINE_STAGE_STATS Stages[FirmwarePipelineStageCount];
+    UINT64 TotalTicks;
+    UINT64 TicksPerMs;                  // Measured TSC rate, 0 if unknown
+    UINTN Depth;                        // Ring slots in use
+    BOOLEAN AsyncRead;                  // File reads issued through ReadEx
+    FLASH_DELTA_STATS Delta;
+} FIRMWARE_PIPELINE_STATS;
+
+//
+// Pipeline State
+// The ring and the source (an open file or a USB mass storage device) are
+// owned by the caller; the pipeline only borrows them between begin and end.
+//
+typedef struct {
+    // Source
+    EFI_FILE_PROTOCOL *File;            // NULL for a USB source
+    UINT64 FilePosition;                // Where the image starts in File
+    UINTN DeviceId;
+    UINT64 StartLba;
+    UINT32 BlockSize;
+    UINT64 Size;
+
+    // Sink
+    UINT32 FlashAddress;
+
+    FIRMWARE_STREAM_RING *Ring;
+    UINT8 SlotState[FIRMWARE_STREAM_MAX_BUFFERS];     // FIRMWARE_PIPELINE_SLOT_STATE
+    UINTN SlotLength[FIRMWARE_STREAM_MAX_BUFFERS];
+
+    // Read stage
+    UINT64 NextRead;                    // Image offset of the next chunk to read
+    UINTN ReadSlot;
+    BOOLEAN ReadPending;
+    EFI_FILE_IO_TOKEN ReadToken;
+    UINT64 ReadStart;
+
+    // Verify pass
+    BOOLEAN Verified;                   // Package checked; chunks are now programmed
+    UINT32 *ChunkCrc;                   // CRC32C of every chunk the verify pass read
+    UINTN ChunkCount;
+    UINT32 Checksum;                    // Image CRC32C, valid once Verified
+
+    // Validate stage
+    FIRMWARE_VALIDATE_CONTEXT Validate;
+    UINT64 NextValidate;
+    UINTN ValidateChunk;                // Chunk index of ValidateSlot in this pass
+    UINTN ValidateSlot;
+    BOOLEAN ValidatePending;
+    UINT64 ValidateTicks;               // Written by the worker that ran the job
+    WORKER_JOB ValidateJob;
+    WORKER_BATCH ValidateBatch;
+
+    // Program stage
+    UINT64 NextProgram;
+    UINTN ProgramSlot;
+
+    UINT64 StartTick;
+    EFI_STATUS Status;                  // First error, sticky
+    FIRMWARE_PIPELINE_STATS Stats;
+} FIRMWARE_PIPELINE;
+
+//
+// Function Prototypes
+//
+
+/**
+ * Start a pipeline reading an open firmware file from its current position
+ * @details Uses EFI_FILE_PROTOCOL.ReadEx when the file supports revision 2,
+ *          so the next chunk is read while the current one is programmed.
+ *          The program pass seeks back to the starting position.
+ * @param Pipeline - Pipeline state to initialize
+ * @param File - Open file; must stay open until firmware_pipeline_end
+ * @param Size - Bytes to stream
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Buffer ring; every slot is used
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_begin_file(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_FILE_PROTOCOL *File,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+    );
+
+/**
+ * Start a pipeline reading a raw image from a USB mass storage device
+ * @param Pipeline - Pipeline state to initialize
+ * @param DeviceId - USB device identifier of an attached mass storage device
+ * @param StartLba - First logical block of the image
+ * @param Size - Image size in bytes
+ * @param FlashAddress - Flash address the image is written to
+ * @param Ring - Buffer ring; ChunkSize must be a multiple of the block size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_begin_usb(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN UINTN DeviceId,
+    IN UINT64 StartLba,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+    );
+
+/**
+ * Advance every stage by at most one chunk
+ * @details Bounded, so the pipeline can also run as a scheduler background task.
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - EFI_NOT_READY while chunks remain, EFI_SUCCESS once
+ *                      the whole image is programmed, or the first error.
+ *                      A package that fails validation is reported before
+ *                      the program pass starts, with the flash untouched.
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_step(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+/**
+ * Wait for any read or validation still in flight and record the statistics
+ * @details Must be called after the last step, including after an error;
+ *          it also frees the per-chunk CRCs.
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - First error seen by any stage, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_end(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+/**
+ * Step a started pipeline to completion and end it
+ * @param Pipeline - Started pipeline
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_run(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+/**
+ * Print per-stage throughput and stalls of the last finished pipeline
+ * @return EFI_STATUS - EFI_NOT_FOUND if no pipeline has run yet
+ */
+EFI_STATUS
+EFIAPI
+firmware_pipeline_status(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+EFI_STATUS
+PipelineBegin(
+    OUT FIRMWARE_PIPELINE *Pipeline,
+    IN UINT64 Size,
+    IN UINT32 FlashAddress,
+    IN FIRMWARE_STREAM_RING *Ring
+    );
+
+STATIC
+VOID
+PipelineStall(
+    IN OUT FIRMWARE_PIPELINE_STAGE_STATS *Stage,
+    IN BOOLEAN Stalled
+    );
+
+STATIC
+EFI_STATUS
+PipelineReadStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+STATIC
+EFI_STATUS
+PipelineReadComplete(
+    IN OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_STATUS ReadStatus,
+    IN UINTN Length
+    );
+
+STATIC
+EFI_STATUS
+PipelineValidateStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+STATIC
+EFI_STATUS
+PipelineValidateComplete(
+    IN OUT FIRMWARE_PIPELINE *Pipeline,
+    IN EFI_STATUS JobStatus
+    );
+
+STATIC
+EFI_STATUS
+PipelineProgramStage(
+    IN OUT FIRMWARE_PIPELINE *Pipeline
+    );
+
+STATIC
+VOID
+PipelinePrintStats(
+    IN CONST FIRMWARE_PIPELINE_STATS *Stats
+    );
+
+#endif // _FIRMWARE_PIPELINE_H_
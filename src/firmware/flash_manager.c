@@ -10,6 +10,7 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/IoLib.h>
+#include <Library/PrintLib.h>
 #include <Protocol/FirmwareVolumeBlock.h>
 
 #include "flash_manager.h"
@@ -17,6 +18,49 @@
 #include "../../include/common.h"
 #include "../../include/config.h"
 #include "../../include/debug_utils.h"
+#include "../../include/metrics.h"
+#include "../uefi/memory_pool.h"
+
+//
+// State of one flash_write_delta call
+//
+typedef struct {
+    UINT32 Address;             // First byte of the new image
+    CONST UINT8 *Buffer;        // New image
+    UINTN Size;                 // Image length
+    UINTN SectorSize;
+    UINT32 HeadBase;            // First sector touched
+    UINT32 TailBase;            // Last sector touched
+    UINT8 *HeadImage;           // Merged first sector when partially covered
+    UINT8 *TailImage;           // Merged last sector when partially covered
+} FLASH_DELTA_JOB;
+
+//
+// Sector read cache entry
+// Every entry is always on the LRU list; invalid entries are kept at its
+// tail so the tail is always the next one to fill.
+//
+typedef struct {
+    EFI_LBA Lba;
+    UINT8 *Data;                // One sector
+    UINTN HashNext;             // Next entry in the same bucket
+    UINTN LruPrev;              // Towards the most recently used entry
+    UINTN LruNext;
+    BOOLEAN Valid;
+    BOOLEAN Prefetched;         // Loaded by read-ahead and not read since
+} FLASH_CACHE_ENTRY;
+
+#define FLASH_CACHE_NONE        ((UINTN)-1)
+
+//
+// Operations with a latency histogram per region
+//
+typedef enum {
+    FlashMetricRead,
+    FlashMetricWrite,
+    FlashMetricErase,
+    FlashMetricOpCount
+} FLASH_METRIC_OP;
 
 //
 // Forward declarations for internal functions
@@ -25,6 +69,29 @@ STATIC EFI_STATUS DetectFlashDevice(VOID);
 STATIC EFI_STATUS InitializeFlashRegions(VOID);
 STATIC EFI_STATUS CheckRegionWriteProtection(IN UINT32 Address, IN UINTN Size);
 STATIC EFI_STATUS CheckRegionEraseSupport(IN UINT32 Address);
+STATIC EFI_STATUS CheckRegionEraseRange(IN UINT32 Address, IN UINTN Size);
+STATIC BOOLEAN FlashFindRegion(IN UINT64 Address, OUT UINTN *Index);
+STATIC EFI_STATUS FlashInsertRegion(IN CONST FLASH_REGION *Region);
+STATIC EFI_STATUS FlashDefineRegion(IN FLASH_REGION_TYPE Type, IN CONST CHAR16 *Name, IN UINT64 StartAddress, IN UINT64 Size, IN BOOLEAN WriteProtected, IN BOOLEAN EraseRequired);
+STATIC EFI_STATUS FlashProgram(IN UINT32 Address, IN CONST UINT8 *Buffer, IN UINTN Size);
+STATIC EFI_STATUS FlashEraseRun(IN UINT32 Address, IN UINTN Size);
+STATIC EFI_STATUS FlashEraseBlocks(IN EFI_LBA Lba, IN UINTN Count);
+STATIC EFI_STATUS FlashTransferBlocks(IN BOOLEAN IsWrite, IN UINT32 Address, IN OUT UINT8 *Buffer, IN UINTN Size);
+STATIC BOOLEAN FlashCompareSector(IN CONST UINT8 *Current, IN CONST UINT8 *Image, IN UINTN Size, OUT BOOLEAN *NeedsErase);
+STATIC BOOLEAN FlashDeltaPartial(IN CONST FLASH_DELTA_JOB *Job, IN UINT32 SectorBase);
+STATIC VOID FlashDeltaMergeEdge(IN OUT FLASH_DELTA_JOB *Job, IN UINT32 SectorBase, IN CONST UINT8 *Current);
+STATIC CONST UINT8 *FlashDeltaSectorImage(IN CONST FLASH_DELTA_JOB *Job, IN UINT32 SectorBase);
+STATIC VOID FlashRegisterMetrics(VOID);
+STATIC VOID FlashRegisterRegionMetrics(IN UINTN Index);
+STATIC UINTN FlashMetricId(IN FLASH_METRIC_OP Op, IN UINT32 Address);
+STATIC VOID FlashCacheInit(VOID);
+STATIC UINTN FlashCacheLookup(IN EFI_LBA Lba);
+STATIC VOID FlashCacheTouch(IN UINTN Index);
+STATIC VOID FlashCacheDrop(IN UINTN Index);
+STATIC VOID FlashCacheInsert(IN EFI_LBA Lba, IN CONST UINT8 *Data, IN BOOLEAN Prefetched);
+STATIC VOID FlashCacheInvalidate(IN EFI_LBA Lba, IN UINTN Count);
+STATIC EFI_STATUS FlashCacheRead(IN UINT32 Address, OUT UINT8 *Buffer, IN UINTN Size);
+STATIC EFI_STATUS FlashDeltaFlushRun(IN CONST FLASH_DELTA_JOB *Job, IN UINT32 RunBase, IN UINTN RunCount, IN BOOLEAN Erase, IN OUT FLASH_DELTA_STATS *Counts);
 
 //
 // Static variables
@@ -33,8 +100,30 @@ STATIC BOOLEAN mFlashManagerInitialized = FALSE;
 STATIC EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *mFvbProtocol = NULL;
 STATIC EFI_HANDLE mFvbHandle = NULL;
 STATIC FLASH_DEVICE_INFO mFlashInfo;
-STATIC FLASH_REGION mFlashRegions[MAX_FLASH_REGIONS];
+STATIC FLASH_REGION mFlashRegions[MAX_FLASH_REGIONS];   // Sorted by StartAddress, never overlapping
 STATIC UINTN mRegionCount = 0;
+STATIC BOOLEAN mFvbMultiBlockTransfers = TRUE;
+STATIC BOOLEAN mFvbMultiBlockErase = TRUE;
+STATIC BOOLEAN mFlashErasePolarity = TRUE;      // Erased bits read as 1
+STATIC MEMORY_ARENA mFlashArena;                // Read cache, then delta update scratch rewound per call
+
+// Sector read cache, write-through invalidated by FlashTransferBlocks and FlashEraseBlocks
+STATIC FLASH_CACHE_ENTRY mFlashCache[FLASH_CACHE_MAX_ENTRIES];
+STATIC UINTN mFlashCacheBuckets[FLASH_CACHE_BUCKETS];
+STATIC UINTN mFlashCacheMru = FLASH_CACHE_NONE;
+STATIC UINTN mFlashCacheLru = FLASH_CACHE_NONE;
+STATIC UINT8 *mFlashCacheStaging = NULL;        // One FVB read of a missed span plus read-ahead
+STATIC UINTN mFlashCacheStagingSectors = 0;
+STATIC EFI_LBA mFlashCacheNextLba = 0;          // Sector after the last cached read
+STATIC FLASH_CACHE_STATS mFlashCacheStats;
+
+// Metric ids per operation and region; the last column is flash outside every region
+STATIC UINTN mFlashMetrics[FlashMetricOpCount][MAX_FLASH_REGIONS + 1];
+STATIC CONST CHAR16 *mFlashMetricOps[FlashMetricOpCount] = {
+    L"read",
+    L"write",
+    L"erase"
+};
 
 /**
  * Initialize flash manager
@@ -59,6 +148,9 @@ flash_manager_init(VOID)
     ZeroMemory(&mFlashInfo, sizeof(FLASH_DEVICE_INFO));
     ZeroMemory(mFlashRegions, sizeof(mFlashRegions));
     mRegionCount = 0;
+    mFvbMultiBlockTransfers = TRUE;
+    mFvbMultiBlockErase = TRUE;
+    mFlashErasePolarity = TRUE;
     
     // Locate firmware volume block protocol
     Status = gBS->LocateHandleBuffer(
@@ -108,6 +200,13 @@ flash_manager_init(VOID)
     Status = InitializeFlashRegions();
     CHECK_STATUS(Status, "Failed to initialize flash regions");
     
+    FlashRegisterMetrics();
+    
+    Status = memory_arena_init(&mFlashArena, L"flash", FLASH_DELTA_READ_SIZE + 2 * mFlashInfo.SectorSize);
+    CHECK_STATUS(Status, "Failed to initialize flash arena");
+    
+    FlashCacheInit();
+    
     mFlashManagerInitialized = TRUE;
     
     LOG_INFO("Flash manager initialized successfully\n");
@@ -144,12 +243,15 @@ DetectFlashDevice(VOID)
     mFlashInfo.SectorSize = 4096;     // 4KB sectors
     mFlashInfo.WriteProtected = FALSE;
     mFlashInfo.BlockCount = mFlashInfo.TotalSize / mFlashInfo.SectorSize;
+    mFlashInfo.ErasedByte = 0xFF;
     
     if (mFvbProtocol != NULL) {
         // Get flash attributes from FVB protocol
         Status = mFvbProtocol->GetAttributes(mFvbProtocol, &Attributes);
         if (!EFI_ERROR(Status)) {
             mFlashInfo.WriteProtected = (Attributes & EFI_FVB2_READ_STATUS) ? TRUE : FALSE;
+            mFlashErasePolarity = (Attributes & EFI_FVB2_ERASE_POLARITY) ? TRUE : FALSE;
+            mFlashInfo.ErasedByte = mFlashErasePolarity ? 0xFF : 0x00;
         }
         
         // Get block information
@@ -176,64 +278,608 @@ DetectFlashDevice(VOID)
 
 /**
  * Initialize flash regions
+ * @details Builds the default layout. Custom layouts replace or add to it
+ *          through flash_remove_region and flash_add_region.
  * @return EFI_STATUS - Success or error code
  */
 STATIC
 EFI_STATUS
 InitializeFlashRegions(VOID)
 {
+    UINT64 TotalSize;
+    
     DBG_ENTER();
     
     // Define standard flash regions for UEFI firmware
     mRegionCount = 0;
+    TotalSize = mFlashInfo.TotalSize;
     
-    // Boot Block region
-    mFlashRegions[mRegionCount].Type = FLASH_REGION_BOOT_BLOCK;
-    mFlashRegions[mRegionCount].StartAddress = 0x00000000;
-    mFlashRegions[mRegionCount].Size = 64 * 1024; // 64KB
-    mFlashRegions[mRegionCount].WriteProtected = TRUE;
-    mFlashRegions[mRegionCount].EraseRequired = TRUE;
-    StrCpyS(mFlashRegions[mRegionCount].Name, 
-           sizeof(mFlashRegions[mRegionCount].Name) / sizeof(CHAR16),
-           L"Boot Block");
-    mRegionCount++;
+    FlashDefineRegion(FLASH_REGION_BOOT_BLOCK, L"Boot Block",
+                      0, 64 * 1024, TRUE, TRUE);
+    FlashDefineRegion(FLASH_REGION_MAIN_FIRMWARE, L"Main Firmware",
+                      64 * 1024, TotalSize - (256 * 1024), FALSE, TRUE);
+    FlashDefineRegion(FLASH_REGION_NVRAM, L"NVRAM",
+                      TotalSize - (192 * 1024), 128 * 1024, FALSE, TRUE);
+    // Intel-specific
+    FlashDefineRegion(FLASH_REGION_DESCRIPTOR, L"Flash Descriptor",
+                      TotalSize - (64 * 1024), 64 * 1024, TRUE, FALSE);
     
-    // Main Firmware region
-    mFlashRegions[mRegionCount].Type = FLASH_REGION_MAIN_FIRMWARE;
-    mFlashRegions[mRegionCount].StartAddress = 64 * 1024;
-    mFlashRegions[mRegionCount].Size = mFlashInfo.TotalSize - (256 * 1024); // Total - 256KB
-    mFlashRegions[mRegionCount].WriteProtected = FALSE;
-    mFlashRegions[mRegionCount].EraseRequired = TRUE;
-    StrCpyS(mFlashRegions[mRegionCount].Name, 
-           sizeof(mFlashRegions[mRegionCount].Name) / sizeof(CHAR16),
-           L"Main Firmware");
-    mRegionCount++;
+    LOG_INFO("Initialized %d flash regions\n", mRegionCount);
     
-    // NVRAM region
-    mFlashRegions[mRegionCount].Type = FLASH_REGION_NVRAM;
-    mFlashRegions[mRegionCount].StartAddress = mFlashInfo.TotalSize - (192 * 1024);
-    mFlashRegions[mRegionCount].Size = 128 * 1024; // 128KB
-    mFlashRegions[mRegionCount].WriteProtected = FALSE;
-    mFlashRegions[mRegionCount].EraseRequired = TRUE;
-    StrCpyS(mFlashRegions[mRegionCount].Name, 
-           sizeof(mFlashRegions[mRegionCount].Name) / sizeof(CHAR16),
-           L"NVRAM");
-    mRegionCount++;
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Add one region of the default layout
+ * @details A region the device is too small for is left out with a warning
+ *          instead of failing initialization.
+ * @param Type - Region type
+ * @param Name - Display name
+ * @param StartAddress - First byte of the region
+ * @param Size - Region length in bytes
+ * @param WriteProtected - TRUE if writes are refused
+ * @param EraseRequired - TRUE if the region can be erased
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashDefineRegion(
+    IN FLASH_REGION_TYPE Type,
+    IN CONST CHAR16 *Name,
+    IN UINT64 StartAddress,
+    IN UINT64 Size,
+    IN BOOLEAN WriteProtected,
+    IN BOOLEAN EraseRequired
+)
+{
+    EFI_STATUS Status;
+    FLASH_REGION Region;
+    
+    if (StartAddress >= mFlashInfo.TotalSize || Size == 0 || Size > mFlashInfo.TotalSize - StartAddress) {
+        LOG_WARN("Flash region %s does not fit a %ld KB device\n", Name, mFlashInfo.TotalSize / 1024);
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    
+    ZeroMemory(&Region, sizeof(Region));
+    Region.Type = Type;
+    Region.StartAddress = (UINT32)StartAddress;
+    Region.Size = (UINT32)Size;
+    Region.WriteProtected = WriteProtected;
+    Region.EraseRequired = EraseRequired;
+    StrCpyS(Region.Name, sizeof(Region.Name) / sizeof(CHAR16), Name);
+    
+    Status = FlashInsertRegion(&Region);
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("Flash region %s not added: %r\n", Name, Status);
+    }
+    
+    return Status;
+}
+
+/**
+ * Locate a flash address in the sorted region table
+ * @details Binary search for the last region starting at or below Address.
+ * @param Address - Flash address
+ * @param Index - Receives the region containing Address when found, else the
+ *                first region starting above it (mRegionCount if none)
+ * @return BOOLEAN - TRUE if a region contains Address
+ */
+STATIC
+BOOLEAN
+FlashFindRegion(
+    IN UINT64 Address,
+    OUT UINTN *Index
+)
+{
+    UINTN Low;
+    UINTN High;
+    UINTN Mid;
+    
+    // Low ends as the number of regions starting at or below Address
+    Low = 0;
+    High = mRegionCount;
+    while (Low < High) {
+        Mid = Low + (High - Low) / 2;
+        if (mFlashRegions[Mid].StartAddress <= Address) {
+            Low = Mid + 1;
+        } else {
+            High = Mid;
+        }
+    }
+    
+    if (Low > 0 && Address - mFlashRegions[Low - 1].StartAddress < mFlashRegions[Low - 1].Size) {
+        *Index = Low - 1;
+        return TRUE;
+    }
+    
+    *Index = Low;
+    return FALSE;
+}
+
+/**
+ * Insert a region into the sorted table
+ * @param Region - Region descriptor, already known to lie inside the device
+ * @return EFI_STATUS - EFI_ACCESS_DENIED if it overlaps an existing region
+ */
+STATIC
+EFI_STATUS
+FlashInsertRegion(
+    IN CONST FLASH_REGION *Region
+)
+{
+    UINTN Index;
+    UINTN Op;
+    
+    if (mRegionCount >= MAX_FLASH_REGIONS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    // Neither may the start fall inside a region nor the next region begin before the end
+    if (FlashFindRegion(Region->StartAddress, &Index) ||
+        (Index < mRegionCount &&
+         mFlashRegions[Index].StartAddress < (UINT64)Region->StartAddress + Region->Size)) {
+        return EFI_ACCESS_DENIED;
+    }
+    
+    // CopyMem handles the overlapping shift
+    CopyMemory(&mFlashRegions[Index + 1], &mFlashRegions[Index],
+            (mRegionCount - Index) * sizeof(FLASH_REGION));
+    CopyMemory(&mFlashRegions[Index], Region, sizeof(FLASH_REGION));
+    mFlashRegions[Index].Name[MAX_FLASH_NAME_LEN - 1] = L'\0';
+    
+    // Metric columns follow their regions
+    for (Op = 0; Op < FlashMetricOpCount; Op++) {
+        CopyMemory(&mFlashMetrics[Op][Index + 1], &mFlashMetrics[Op][Index],
+                (mRegionCount - Index) * sizeof(UINTN));
+        mFlashMetrics[Op][Index] = METRICS_INVALID_ID;
+    }
     
-    // Descriptor region (Intel-specific)
-    mFlashRegions[mRegionCount].Type = FLASH_REGION_DESCRIPTOR;
-    mFlashRegions[mRegionCount].StartAddress = mFlashInfo.TotalSize - (64 * 1024);
-    mFlashRegions[mRegionCount].Size = 64 * 1024; // 64KB
-    mFlashRegions[mRegionCount].WriteProtected = TRUE;
-    mFlashRegions[mRegionCount].EraseRequired = FALSE;
-    StrCpyS(mFlashRegions[mRegionCount].Name, 
-           sizeof(mFlashRegions[mRegionCount].Name) / sizeof(CHAR16),
-           L"Flash Descriptor");
     mRegionCount++;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Register a read, write and erase metric for every flash region
+ * @details Names are "flash.<op>.<region>" with spaces in the region name
+ *          replaced by underscores, so the CSV dump stays easy to parse.
+ */
+STATIC
+VOID
+FlashRegisterMetrics(VOID)
+{
+    CHAR16 Name[METRICS_NAME_LENGTH];
+    EFI_STATUS Status;
+    UINTN Op;
+    UINTN Region;
     
-    LOG_INFO("Initialized %d flash regions\n", mRegionCount);
+    for (Op = 0; Op < FlashMetricOpCount; Op++) {
+        for (Region = 0; Region <= MAX_FLASH_REGIONS; Region++) {
+            mFlashMetrics[Op][Region] = METRICS_INVALID_ID;
+        }
+        
+        UnicodeSPrint(Name, sizeof(Name), L"flash.%s.other", mFlashMetricOps[Op]);
+        Status = metrics_register(Name, &mFlashMetrics[Op][MAX_FLASH_REGIONS]);
+        if (EFI_ERROR(Status)) {
+            LOG_WARN("Flash %s outside any region is not timed: %r\n", mFlashMetricOps[Op], Status);
+        }
+    }
     
-    DBG_EXIT_STATUS(EFI_SUCCESS);
+    for (Region = 0; Region < mRegionCount; Region++) {
+        FlashRegisterRegionMetrics(Region);
+    }
+}
+
+/**
+ * Register the read, write and erase metrics of one region
+ * @details Re-registering a name returns the existing metric, so a region
+ *          removed and added again keeps its history.
+ * @param Index - Region index in the table
+ */
+STATIC
+VOID
+FlashRegisterRegionMetrics(
+    IN UINTN Index
+)
+{
+    CHAR16 Name[METRICS_NAME_LENGTH];
+    EFI_STATUS Status;
+    UINTN Op;
+    UINTN i;
+    
+    for (Op = 0; Op < FlashMetricOpCount; Op++) {
+        UnicodeSPrint(Name, sizeof(Name), L"flash.%s.%s",
+                      mFlashMetricOps[Op], mFlashRegions[Index].Name);
+        for (i = 0; Name[i] != L'\0'; i++) {
+            if (Name[i] == L' ') {
+                Name[i] = L'_';
+            }
+        }
+        Status = metrics_register(Name, &mFlashMetrics[Op][Index]);
+        if (EFI_ERROR(Status)) {
+            LOG_WARN("Flash %s in region %s is not timed: %r\n",
+                     mFlashMetricOps[Op], mFlashRegions[Index].Name, Status);
+        }
+    }
+}
+
+/**
+ * Get the metric of an operation starting at a flash address
+ * @details An operation spanning regions is charged to the region it starts in.
+ * @param Op - Flash operation
+ * @param Address - First byte of the operation
+ * @return UINTN - Metric id, METRICS_INVALID_ID if metrics are unavailable
+ */
+STATIC
+UINTN
+FlashMetricId(
+    IN FLASH_METRIC_OP Op,
+    IN UINT32 Address
+)
+{
+    UINTN i;
+    
+    if (FlashFindRegion(Address, &i)) {
+        return mFlashMetrics[Op][i];
+    }
+    
+    return mFlashMetrics[Op][MAX_FLASH_REGIONS];
+}
+
+/**
+ * Set up the sector read cache
+ * @details Entries and the staging buffer come from the flash arena. The
+ *          cache stays disabled if FLASH_READ_CACHE is FALSE, there is no
+ *          FVB protocol or the storage cannot be allocated.
+ */
+STATIC
+VOID
+FlashCacheInit(VOID)
+{
+    UINTN SectorSize;
+    UINTN Entries;
+    UINTN Index;
+    UINT8 *Storage;
+    
+    ZeroMemory(mFlashCache, sizeof(mFlashCache));
+    SetMem(mFlashCacheBuckets, sizeof(mFlashCacheBuckets), 0xFF);
+    ZeroMemory(&mFlashCacheStats, sizeof(mFlashCacheStats));
+    mFlashCacheMru = FLASH_CACHE_NONE;
+    mFlashCacheLru = FLASH_CACHE_NONE;
+    mFlashCacheStaging = NULL;
+    mFlashCacheStagingSectors = 0;
+    mFlashCacheNextLba = (EFI_LBA)-1;
+    
+    // Memory-mapped flash without FVB is read directly and gains nothing
+    SectorSize = mFlashInfo.SectorSize;
+    if (!FLASH_READ_CACHE || SectorSize == 0 || mFvbProtocol == NULL) {
+        return;
+    }
+    
+    Entries = MIN(FLASH_CACHE_MAX_ENTRIES, FLASH_CACHE_SIZE / SectorSize);
+    if (Entries == 0) {
+        return;
+    }
+    
+    // Staging holds the largest cached read, one partial sector and the read-ahead
+    mFlashCacheStagingSectors = FLASH_CACHE_MAX_READ / SectorSize + 1 + FLASH_CACHE_READ_AHEAD;
+    Storage = memory_arena_alloc(&mFlashArena, Entries * SectorSize, 0);
+    mFlashCacheStaging = memory_arena_alloc(&mFlashArena, mFlashCacheStagingSectors * SectorSize, 0);
+    if (Storage == NULL || mFlashCacheStaging == NULL) {
+        LOG_WARN("Flash read cache disabled: no memory for %d sectors\n", Entries);
+        mFlashCacheStaging = NULL;
+        mFlashCacheStagingSectors = 0;
+        return;
+    }
+    
+    for (Index = 0; Index < Entries; Index++) {
+        mFlashCache[Index].Data = Storage + Index * SectorSize;
+        mFlashCache[Index].HashNext = FLASH_CACHE_NONE;
+        mFlashCache[Index].LruPrev = (Index == 0) ? FLASH_CACHE_NONE : Index - 1;
+        mFlashCache[Index].LruNext = (Index + 1 == Entries) ? FLASH_CACHE_NONE : Index + 1;
+    }
+    mFlashCacheMru = 0;
+    mFlashCacheLru = Entries - 1;
+    
+    mFlashCacheStats.Entries = Entries;
+    mFlashCacheStats.Enabled = TRUE;
+    
+    LOG_INFO("Flash read cache: %d sectors (%d KB)\n", Entries, (Entries * SectorSize) / 1024);
+}
+
+/**
+ * Find the cache entry holding a sector
+ * @param Lba - Sector to look up
+ * @return UINTN - Entry index, FLASH_CACHE_NONE if the sector is not cached
+ */
+STATIC
+UINTN
+FlashCacheLookup(
+    IN EFI_LBA Lba
+)
+{
+    UINTN Index;
+    
+    Index = mFlashCacheBuckets[(UINTN)Lba & (FLASH_CACHE_BUCKETS - 1)];
+    while (Index != FLASH_CACHE_NONE) {
+        if (mFlashCache[Index].Lba == Lba) {
+            return Index;
+        }
+        Index = mFlashCache[Index].HashNext;
+    }
+    
+    return FLASH_CACHE_NONE;
+}
+
+/**
+ * Move an entry to the most recently used end of the LRU list
+ * @param Index - Entry to move
+ */
+STATIC
+VOID
+FlashCacheTouch(
+    IN UINTN Index
+)
+{
+    FLASH_CACHE_ENTRY *Entry;
+    
+    if (Index == mFlashCacheMru) {
+        return;
+    }
+    
+    Entry = &mFlashCache[Index];
+    
+    // Unlink; Index is not the MRU entry, so it has a predecessor
+    mFlashCache[Entry->LruPrev].LruNext = Entry->LruNext;
+    if (Entry->LruNext != FLASH_CACHE_NONE) {
+        mFlashCache[Entry->LruNext].LruPrev = Entry->LruPrev;
+    } else {
+        mFlashCacheLru = Entry->LruPrev;
+    }
+    
+    Entry->LruPrev = FLASH_CACHE_NONE;
+    Entry->LruNext = mFlashCacheMru;
+    mFlashCache[mFlashCacheMru].LruPrev = Index;
+    mFlashCacheMru = Index;
+}
+
+/**
+ * Invalidate an entry and move it to the least recently used end of the LRU list
+ * @param Index - Entry to drop
+ */
+STATIC
+VOID
+FlashCacheDrop(
+    IN UINTN Index
+)
+{
+    FLASH_CACHE_ENTRY *Entry;
+    UINTN *Link;
+    
+    Entry = &mFlashCache[Index];
+    if (!Entry->Valid) {
+        return;
+    }
+    
+    // Remove from the hash chain
+    Link = &mFlashCacheBuckets[(UINTN)Entry->Lba & (FLASH_CACHE_BUCKETS - 1)];
+    while (*Link != Index) {
+        Link = &mFlashCache[*Link].HashNext;
+    }
+    *Link = Entry->HashNext;
+    
+    Entry->HashNext = FLASH_CACHE_NONE;
+    Entry->Valid = FALSE;
+    Entry->Prefetched = FALSE;
+    
+    if (Index == mFlashCacheLru) {
+        return;
+    }
+    
+    // Unlink; Index is not the LRU entry, so it has a successor
+    mFlashCache[Entry->LruNext].LruPrev = Entry->LruPrev;
+    if (Entry->LruPrev != FLASH_CACHE_NONE) {
+        mFlashCache[Entry->LruPrev].LruNext = Entry->LruNext;
+    } else {
+        mFlashCacheMru = Entry->LruNext;
+    }
+    
+    Entry->LruNext = FLASH_CACHE_NONE;
+    Entry->LruPrev = mFlashCacheLru;
+    mFlashCache[mFlashCacheLru].LruNext = Index;
+    mFlashCacheLru = Index;
+}
+
+/**
+ * Cache a sector, evicting the least recently used entry
+ * @param Lba - Sector number
+ * @param Data - Sector contents
+ * @param Prefetched - TRUE if the sector was only read ahead
+ */
+STATIC
+VOID
+FlashCacheInsert(
+    IN EFI_LBA Lba,
+    IN CONST UINT8 *Data,
+    IN BOOLEAN Prefetched
+)
+{
+    FLASH_CACHE_ENTRY *Entry;
+    UINTN Index;
+    UINTN Bucket;
+    
+    Index = FlashCacheLookup(Lba);
+    if (Index == FLASH_CACHE_NONE) {
+        Index = mFlashCacheLru;
+        if (mFlashCache[Index].Valid) {
+            mFlashCacheStats.Evictions++;
+            FlashCacheDrop(Index);
+        }
+        
+        Entry = &mFlashCache[Index];
+        Bucket = (UINTN)Lba & (FLASH_CACHE_BUCKETS - 1);
+        Entry->Lba = Lba;
+        Entry->HashNext = mFlashCacheBuckets[Bucket];
+        mFlashCacheBuckets[Bucket] = Index;
+        Entry->Valid = TRUE;
+    } else {
+        Entry = &mFlashCache[Index];
+    }
+    
+    CopyMemory(Entry->Data, Data, mFlashInfo.SectorSize);
+    Entry->Prefetched = Prefetched;
+    FlashCacheTouch(Index);
+}
+
+/**
+ * Drop cached copies of sectors about to change
+ * @param Lba - First sector
+ * @param Count - Number of sectors
+ */
+STATIC
+VOID
+FlashCacheInvalidate(
+    IN EFI_LBA Lba,
+    IN UINTN Count
+)
+{
+    UINTN Index;
+    UINTN i;
+    
+    if (mFlashCacheStats.Entries == 0) {
+        return;
+    }
+    
+    // Reads following a write are not the sequential stream read-ahead expects
+    mFlashCacheNextLba = (EFI_LBA)-1;
+    
+    if (Count > mFlashCacheStats.Entries) {
+        // Large erase or write: cheaper to check every entry than every sector
+        for (Index = 0; Index < mFlashCacheStats.Entries; Index++) {
+            if (mFlashCache[Index].Valid &&
+                mFlashCache[Index].Lba >= Lba && mFlashCache[Index].Lba - Lba < Count) {
+                FlashCacheDrop(Index);
+                mFlashCacheStats.Invalidations++;
+            }
+        }
+        return;
+    }
+    
+    for (i = 0; i < Count; i++) {
+        Index = FlashCacheLookup(Lba + i);
+        if (Index != FLASH_CACHE_NONE) {
+            FlashCacheDrop(Index);
+            mFlashCacheStats.Invalidations++;
+        }
+    }
+}
+
+/**
+ * Serve a read from the sector cache, filling it from FVB on a miss
+ * @details A miss reads the whole sector span with one FVB transfer. When
+ *          the read starts at or right before the sector after the previous
+ *          one, up to FLASH_CACHE_READ_AHEAD following sectors are fetched
+ *          in the same transfer.
+ * @param Address - Flash address to read from
+ * @param Buffer - Buffer to store read data
+ * @param Size - Number of bytes to read
+ * @return EFI_STATUS - EFI_UNSUPPORTED if the read must go straight to FVB
+ */
+STATIC
+EFI_STATUS
+FlashCacheRead(
+    IN UINT32 Address,
+    OUT UINT8 *Buffer,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    FLASH_CACHE_ENTRY *Entry;
+    UINTN SectorSize;
+    EFI_LBA FirstLba;
+    EFI_LBA LastLba;
+    EFI_LBA Lba;
+    UINTN Span;
+    UINTN Fetch;
+    UINTN Present;
+    UINTN Offset;
+    UINTN Chunk;
+    UINTN Index;
+    
+    if (!mFlashCacheStats.Enabled) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    SectorSize = mFlashInfo.SectorSize;
+    FirstLba = Address / SectorSize;
+    LastLba = (Address + Size - 1) / SectorSize;
+    Span = (UINTN)(LastLba - FirstLba) + 1;
+    
+    if (Size > FLASH_CACHE_MAX_READ || Span > mFlashCacheStats.Entries) {
+        mFlashCacheStats.Bypassed++;
+        return EFI_UNSUPPORTED;
+    }
+    
+    Present = 0;
+    for (Lba = FirstLba; Lba <= LastLba; Lba++) {
+        if (FlashCacheLookup(Lba) != FLASH_CACHE_NONE) {
+            Present++;
+        }
+    }
+    
+    if (Present < Span) {
+        // Some sectors are missing: refill the whole span with one FVB read
+        Fetch = Span;
+        if (FirstLba == mFlashCacheNextLba || FirstLba + 1 == mFlashCacheNextLba) {
+            Fetch = MIN(Span + FLASH_CACHE_READ_AHEAD, mFlashCacheStagingSectors);
+            Fetch = MIN(Fetch, mFlashCacheStats.Entries);
+            Fetch = MIN(Fetch, (UINTN)(mFlashInfo.TotalSize / SectorSize - FirstLba));
+            Fetch = MAX(Fetch, Span);
+        }
+        
+        Status = FlashTransferBlocks(FALSE, (UINT32)(FirstLba * SectorSize), mFlashCacheStaging, Fetch * SectorSize);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        // Insert backwards so the requested sectors end up most recently used
+        for (Index = Fetch; Index > 0; Index--) {
+            Lba = FirstLba + Index - 1;
+            if (Index > Span && FlashCacheLookup(Lba) != FLASH_CACHE_NONE) {
+                // Never let read-ahead overwrite a sector already cached
+                continue;
+            }
+            FlashCacheInsert(Lba, mFlashCacheStaging + (Index - 1) * SectorSize, Index > Span);
+        }
+        
+        mFlashCacheStats.Misses += Span - Present;
+        mFlashCacheStats.Hits += Present;
+        mFlashCacheStats.ReadAhead += Fetch - Span;
+        
+        CopyMemory(Buffer, mFlashCacheStaging + Address % SectorSize, Size);
+    } else {
+        Offset = Address % SectorSize;
+        for (Lba = FirstLba; Lba <= LastLba; Lba++) {
+            Index = FlashCacheLookup(Lba);
+            Entry = &mFlashCache[Index];
+            if (Entry->Prefetched) {
+                mFlashCacheStats.ReadAheadHits++;
+                Entry->Prefetched = FALSE;
+            }
+            
+            Chunk = MIN(Size, SectorSize - Offset);
+            CopyMemory(Buffer, Entry->Data + Offset, Chunk);
+            Buffer += Chunk;
+            Size -= Chunk;
+            Offset = 0;
+            
+            FlashCacheTouch(Index);
+        }
+        
+        mFlashCacheStats.Hits += Span;
+    }
+    
+    mFlashCacheNextLba = LastLba + 1;
     return EFI_SUCCESS;
 }
 
@@ -253,10 +899,8 @@ flash_read(
 )
 {
     EFI_STATUS Status;
-    EFI_LBA Lba;
-    UINTN Offset;
-    UINTN BytesToRead;
     UINT8 *ReadBuffer;
+    DEBUG_TIMER Timer;
     
     DBG_ENTER();
     
@@ -272,19 +916,14 @@ flash_read(
         return EFI_INVALID_PARAMETER;
     }
     
+    DebugTimerStart(&Timer, "flash_read");
+    
     if (mFvbProtocol != NULL) {
-        // Use FVB protocol for reading
-        Lba = Address / mFlashInfo.SectorSize;
-        Offset = Address % mFlashInfo.SectorSize;
-        BytesToRead = Size;
-        
-        Status = mFvbProtocol->Read(
-            mFvbProtocol,
-            Lba,
-            Offset,
-            &BytesToRead,
-            Buffer
-        );
+        // Small reads go through the sector cache, the rest straight to FVB
+        Status = FlashCacheRead(Address, (UINT8 *)Buffer, Size);
+        if (Status == EFI_UNSUPPORTED) {
+            Status = FlashTransferBlocks(FALSE, Address, (UINT8 *)Buffer, Size);
+        }
         
         if (EFI_ERROR(Status)) {
             LOG_ERROR("FVB read failed: %r\n", Status);
@@ -298,7 +937,8 @@ flash_read(
         Status = EFI_SUCCESS;
     }
     
-    LOG_INFO("Flash read: 0x%08X, %ld bytes\n", Address, Size);
+    metrics_record(FlashMetricId(FlashMetricRead, Address), &Timer, Size);
+    TRACE_EVENT(DEBUG_CAT_FIRMWARE, TraceEventFlashRead, Address, Size, Status);
     
     DBG_EXIT_STATUS(Status);
     return Status;
@@ -320,9 +960,6 @@ flash_write(
 )
 {
     EFI_STATUS Status;
-    EFI_LBA Lba;
-    UINTN Offset;
-    UINTN BytesToWrite;
     
     DBG_ENTER();
     
@@ -352,23 +989,38 @@ flash_write(
         return Status;
     }
     
-    if (mFvbProtocol != NULL) {
-        // Use FVB protocol for writing
-        Lba = Address / mFlashInfo.SectorSize;
-        Offset = Address % mFlashInfo.SectorSize;
-        BytesToWrite = Size;
-        
-        Status = mFvbProtocol->Write(
-            mFvbProtocol,
-            Lba,
-            Offset,
-            &BytesToWrite,
-            (UINT8 *)Buffer
-        );
+    Status = FlashProgram(Address, (CONST UINT8 *)Buffer, Size);
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Program a range already validated against the device and region table
+ * @param Address - Flash address to write to
+ * @param Buffer - Buffer containing data to write
+ * @param Size - Number of bytes to write
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashProgram(
+    IN UINT32 Address,
+    IN CONST UINT8 *Buffer,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    DEBUG_TIMER Timer;
+    
+    DebugTimerStart(&Timer, "flash_write");
+    
+    if (mFvbProtocol != NULL) {
+        // Use FVB protocol for writing, split on block boundaries
+        Status = FlashTransferBlocks(TRUE, Address, (UINT8 *)Buffer, Size);
         
         if (EFI_ERROR(Status)) {
             LOG_ERROR("FVB write failed: %r\n", Status);
-            DBG_EXIT_STATUS(Status);
             return Status;
         }
     } else {
@@ -377,12 +1029,93 @@ flash_write(
         Status = EFI_SUCCESS;
     }
     
-    LOG_INFO("Flash write: 0x%08X, %ld bytes\n", Address, Size);
+    metrics_record(FlashMetricId(FlashMetricWrite, Address), &Timer, Size);
+    TRACE_EVENT(DEBUG_CAT_FIRMWARE, TraceEventFlashWrite, Address, Size, Status);
     
-    DBG_EXIT_STATUS(Status);
     return Status;
 }
 
+/**
+ * Move data between a buffer and flash through the FVB protocol
+ * @details The request is split into per-LBA segments. A leading or trailing
+ *          partial block is always issued as its own call confined to that
+ *          block; runs of whole blocks go out as one contiguous transfer of up
+ *          to FLASH_MAX_TRANSFER_SIZE. FVB drivers are allowed to stop at a
+ *          block boundary and return EFI_BAD_BUFFER_SIZE, in which case the
+ *          partial progress is kept and later runs are issued per block.
+ * @param IsWrite - TRUE to program flash, FALSE to read it
+ * @param Address - Flash address of the first byte
+ * @param Buffer - Source (write) or destination (read) buffer
+ * @param Size - Number of bytes to transfer
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashTransferBlocks(
+    IN BOOLEAN IsWrite,
+    IN UINT32 Address,
+    IN OUT UINT8 *Buffer,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    EFI_LBA Lba;
+    UINTN Offset;
+    UINTN Requested;
+    UINTN NumBytes;
+    UINTN SectorSize;
+    
+    SectorSize = mFlashInfo.SectorSize;
+    
+    if (IsWrite) {
+        // Before programming, so a failed write cannot leave stale sectors cached
+        FlashCacheInvalidate(Address / SectorSize, (Address % SectorSize + Size + SectorSize - 1) / SectorSize);
+    }
+    
+    while (Size > 0) {
+        Lba = Address / SectorSize;
+        Offset = Address % SectorSize;
+        
+        if (Offset != 0 || Size < SectorSize || !mFvbMultiBlockTransfers) {
+            // Partial block (or driver limited to one block per call)
+            Requested = MIN(Size, SectorSize - Offset);
+        } else {
+            // Run of whole blocks
+            Requested = MIN(Size, FLASH_MAX_TRANSFER_SIZE);
+            Requested = MAX((Requested / SectorSize) * SectorSize, SectorSize);
+        }
+        
+        NumBytes = Requested;
+        if (IsWrite) {
+            Status = mFvbProtocol->Write(mFvbProtocol, Lba, Offset, &NumBytes, Buffer);
+        } else {
+            Status = mFvbProtocol->Read(mFvbProtocol, Lba, Offset, &NumBytes, Buffer);
+        }
+        
+        if (Status == EFI_BAD_BUFFER_SIZE && Requested > SectorSize - Offset) {
+            // Driver stopped at the block boundary; keep what it transferred
+            mFvbMultiBlockTransfers = FALSE;
+            Status = EFI_SUCCESS;
+        }
+        
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        if (NumBytes == 0 || NumBytes > Requested) {
+            LOG_ERROR("FVB %a returned %ld bytes for LBA 0x%lX (requested %ld)\n",
+                      IsWrite ? "write" : "read", NumBytes, Lba, Requested);
+            return EFI_DEVICE_ERROR;
+        }
+        
+        Address += (UINT32)NumBytes;
+        Buffer += NumBytes;
+        Size -= NumBytes;
+    }
+    
+    return EFI_SUCCESS;
+}
+
 /**
  * Erase flash sector
  * @param Address - Address within sector to erase
@@ -396,6 +1129,7 @@ flash_erase_sector(
 {
     EFI_STATUS Status;
     EFI_LBA Lba;
+    DEBUG_TIMER Timer;
     
     DBG_ENTER();
     
@@ -425,16 +1159,13 @@ flash_erase_sector(
         return Status;
     }
     
+    DebugTimerStart(&Timer, "flash_erase_sector");
+    
     if (mFvbProtocol != NULL) {
         // Use FVB protocol for erasing
         Lba = Address / mFlashInfo.SectorSize;
         
-        Status = mFvbProtocol->EraseBlocks(
-            mFvbProtocol,
-            Lba,
-            1,  // Erase 1 block
-            EFI_LBA_LIST_TERMINATOR
-        );
+        Status = FlashEraseBlocks(Lba, 1);
         
         if (EFI_ERROR(Status)) {
             LOG_ERROR("FVB erase failed: %r\n", Status);
@@ -447,14 +1178,554 @@ flash_erase_sector(
         Status = EFI_SUCCESS;
     }
     
-    LOG_INFO("Flash sector erased: 0x%08X\n", Address);
+    metrics_record(FlashMetricId(FlashMetricErase, Address), &Timer, mFlashInfo.SectorSize);
+    TRACE_EVENT(DEBUG_CAT_FIRMWARE, TraceEventFlashErase, Address, mFlashInfo.SectorSize, Status);
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Erase a sector-aligned flash range
+ * @details The whole range is validated once against the region table and
+ *          erased with a single EraseBlocks(Lba, Count) call, letting the FVB
+ *          driver use its largest erase opcodes on aligned runs.
+ * @param Address - Start address, aligned to the sector size
+ * @param Size - Number of bytes to erase, a multiple of the sector size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+flash_erase_range(
+    IN UINT32 Address,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    
+    DBG_ENTER();
+    
+    if (!mFlashManagerInitialized) {
+        DBG_EXIT_STATUS(EFI_NOT_READY);
+        return EFI_NOT_READY;
+    }
+    
+    if (Size == 0 || (Address % mFlashInfo.SectorSize) != 0 ||
+        (Size % mFlashInfo.SectorSize) != 0) {
+        LOG_ERROR("Erase range not sector aligned: 0x%08X, %ld bytes\n", Address, Size);
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Address + Size > mFlashInfo.TotalSize) {
+        LOG_ERROR("Erase beyond flash boundary: 0x%08X + %ld > 0x%08X\n", 
+                  Address, Size, mFlashInfo.TotalSize);
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (mFlashInfo.WriteProtected) {
+        LOG_ERROR("Flash is write protected\n");
+        DBG_EXIT_STATUS(EFI_WRITE_PROTECTED);
+        return EFI_WRITE_PROTECTED;
+    }
+    
+    // Check every region touched by the range once
+    Status = CheckRegionEraseRange(Address, Size);
+    if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    Status = FlashEraseRun(Address, Size);
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Erase a sector-aligned range already validated against the region table
+ * @param Address - Start address, aligned to the sector size
+ * @param Size - Number of bytes to erase, a multiple of the sector size
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashEraseRun(
+    IN UINT32 Address,
+    IN UINTN Size
+)
+{
+    EFI_STATUS Status;
+    DEBUG_TIMER Timer;
+    
+    DebugTimerStart(&Timer, "flash_erase_range");
+    
+    if (mFvbProtocol != NULL) {
+        Status = FlashEraseBlocks(
+            Address / mFlashInfo.SectorSize,
+            Size / mFlashInfo.SectorSize
+        );
+        
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("FVB range erase failed: %r\n", Status);
+            return Status;
+        }
+    } else {
+        // Simulate erase operation
+        LOG_WARN("Simulated flash erase (no FVB protocol)\n");
+        Status = EFI_SUCCESS;
+    }
+    
+    metrics_record(FlashMetricId(FlashMetricErase, Address), &Timer, Size);
+    TRACE_EVENT(DEBUG_CAT_FIRMWARE, TraceEventFlashErase, Address, Size, Status);
+    
+    return Status;
+}
+
+/**
+ * Write data to flash, touching only the sectors that differ
+ * @details Each sector under the range is read back and compared with the new
+ *          image a word at a time. Matching sectors are skipped. A sector whose
+ *          new contents only move bits toward the programmed state (1->0 on
+ *          parts that erase to 0xFF) is programmed in place; anything else is
+ *          erased first. Neighbouring sectors that need the same treatment are
+ *          erased and programmed as one run, and bytes of a partially covered
+ *          first or last sector are preserved.
+ * @param Address - Flash address to write to
+ * @param Buffer - Buffer containing the new image
+ * @param Size - Number of bytes to write
+ * @param Stats - Optional sector counts for the update
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+flash_write_delta(
+    IN UINT32 Address,
+    IN CONST VOID *Buffer,
+    IN UINTN Size,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    FLASH_DELTA_JOB Job;
+    FLASH_DELTA_STATS Counts;
+    UINT8 *ReadBuffer;
+    MEMORY_ARENA_MARK Mark;
+    UINTN SectorSize;
+    UINTN BatchSize;
+    UINT32 RangeStart;
+    UINT32 RangeEnd;
+    UINT32 BatchBase;
+    UINT32 SectorBase;
+    UINT32 RunBase;
+    UINTN RunCount;
+    BOOLEAN RunErase;
+    BOOLEAN NeedsErase;
+    BOOLEAN Same;
+    CONST UINT8 *Current;
+    CONST UINT8 *Image;
+    
+    DBG_ENTER();
+    
+    if (Buffer == NULL || Size == 0 || !mFlashManagerInitialized) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Address + Size > mFlashInfo.TotalSize) {
+        LOG_ERROR("Delta write beyond flash boundary: 0x%08X + %ld > 0x%08X\n", 
+                  Address, Size, mFlashInfo.TotalSize);
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (mFlashInfo.WriteProtected) {
+        LOG_ERROR("Flash is write protected\n");
+        DBG_EXIT_STATUS(EFI_WRITE_PROTECTED);
+        return EFI_WRITE_PROTECTED;
+    }
+    
+    // Fail before touching flash if any part of the range is locked
+    Status = CheckRegionWriteProtection(Address, Size);
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Region is write protected\n");
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    SectorSize = mFlashInfo.SectorSize;
+    RangeStart = Address - (Address % SectorSize);
+    RangeEnd = (UINT32)(Address + Size);
+    if ((RangeEnd % SectorSize) != 0) {
+        RangeEnd += (UINT32)(SectorSize - (RangeEnd % SectorSize));
+    }
+    
+    BatchSize = FLASH_DELTA_READ_SIZE - (FLASH_DELTA_READ_SIZE % SectorSize);
+    if (BatchSize == 0) {
+        BatchSize = SectorSize;
+    }
+    
+    ZeroMemory(&Job, sizeof(Job));
+    Job.Address = Address;
+    Job.Buffer = (CONST UINT8 *)Buffer;
+    Job.Size = Size;
+    Job.SectorSize = SectorSize;
+    Job.HeadBase = RangeStart;
+    Job.TailBase = RangeEnd - (UINT32)SectorSize;
+    
+    // Scratch comes from the arena; the spare chunk kept by the rewind below
+    // makes every call after the first allocation free
+    memory_arena_get_mark(&mFlashArena, &Mark);
+    ReadBuffer = memory_arena_alloc(&mFlashArena, BatchSize, sizeof(UINT64));
+    Job.HeadImage = memory_arena_alloc(&mFlashArena, SectorSize, sizeof(UINT64));
+    Job.TailImage = memory_arena_alloc(&mFlashArena, SectorSize, sizeof(UINT64));
+    if (ReadBuffer == NULL || Job.HeadImage == NULL || Job.TailImage == NULL) {
+        Status = EFI_OUT_OF_RESOURCES;
+        goto Done;
+    }
+    
+    ZeroMemory(&Counts, sizeof(Counts));
+    RunBase = RangeStart;
+    RunCount = 0;
+    RunErase = FALSE;
+    Status = EFI_SUCCESS;
+    
+    for (BatchBase = RangeStart; BatchBase < RangeEnd; BatchBase += (UINT32)BatchSize) {
+        if (BatchSize > RangeEnd - BatchBase) {
+            BatchSize = RangeEnd - BatchBase;
+        }
+        
+        Status = flash_read(BatchBase, ReadBuffer, BatchSize);
+        if (EFI_ERROR(Status)) {
+            goto Done;
+        }
+        
+        for (SectorBase = BatchBase; SectorBase < BatchBase + BatchSize;
+             SectorBase += (UINT32)SectorSize) {
+            Current = ReadBuffer + (SectorBase - BatchBase);
+            
+            // Partially covered sectors keep the bytes outside the range
+            FlashDeltaMergeEdge(&Job, SectorBase, Current);
+            Image = FlashDeltaSectorImage(&Job, SectorBase);
+            Same = FlashCompareSector(Current, Image, SectorSize, &NeedsErase);
+            
+            if (!Same && RunCount != 0 && NeedsErase == RunErase) {
+                RunCount++;
+                continue;
+            }
+            
+            if (RunCount != 0) {
+                Status = FlashDeltaFlushRun(&Job, RunBase, RunCount, RunErase, &Counts);
+                if (EFI_ERROR(Status)) {
+                    goto Done;
+                }
+                RunCount = 0;
+            }
+            
+            if (Same) {
+                Counts.SectorsSkipped++;
+            } else {
+                RunBase = SectorBase;
+                RunErase = NeedsErase;
+                RunCount = 1;
+            }
+        }
+    }
+    
+    if (RunCount != 0) {
+        Status = FlashDeltaFlushRun(&Job, RunBase, RunCount, RunErase, &Counts);
+    }
+    
+Done:
+    memory_arena_rewind(&mFlashArena, &Mark);
+    
+    TRACE_EVENT(DEBUG_CAT_FIRMWARE, TraceEventFlashDelta, Address, Size, Status);
+    
+    if (!EFI_ERROR(Status)) {
+        if (Stats != NULL) {
+            CopyMemory(Stats, &Counts, sizeof(Counts));
+        }
+    } else {
+        LOG_ERROR("Flash delta write failed: %r\n", Status);
+    }
     
     DBG_EXIT_STATUS(Status);
     return Status;
 }
 
+/**
+ * Compare a flash sector with its new image
+ * @details Works a UINT64 at a time when both buffers allow it. Alongside the
+ *          equality test it accumulates the bits that programming alone cannot
+ *          produce (0->1 on parts that erase to 0xFF, 1->0 otherwise).
+ * @param Current - Sector as read back from flash
+ * @param Image - New sector contents
+ * @param Size - Sector size in bytes
+ * @param NeedsErase - Set when the image cannot be reached without an erase
+ * @return BOOLEAN - TRUE if the sector already matches the image
+ */
+STATIC
+BOOLEAN
+FlashCompareSector(
+    IN CONST UINT8 *Current,
+    IN CONST UINT8 *Image,
+    IN UINTN Size,
+    OUT BOOLEAN *NeedsErase
+)
+{
+    CONST UINT64 *Old64;
+    CONST UINT64 *New64;
+    UINT64 Diff;
+    UINT64 Erase;
+    UINTN Index;
+    
+    Diff = 0;
+    Erase = 0;
+    
+    if ((((UINTN)Current | (UINTN)Image | Size) & (sizeof(UINT64) - 1)) == 0) {
+        Old64 = (CONST UINT64 *)Current;
+        New64 = (CONST UINT64 *)Image;
+        for (Index = 0; Index < Size / sizeof(UINT64); Index++) {
+            Diff |= Old64[Index] ^ New64[Index];
+            Erase |= mFlashErasePolarity ? (~Old64[Index] & New64[Index]) :
+                                           (Old64[Index] & ~New64[Index]);
+        }
+    } else {
+        for (Index = 0; Index < Size; Index++) {
+            Diff |= (UINT8)(Current[Index] ^ Image[Index]);
+            Erase |= mFlashErasePolarity ? (UINT8)(~Current[Index] & Image[Index]) :
+                                           (UINT8)(Current[Index] & ~Image[Index]);
+        }
+    }
+    
+    *NeedsErase = (Erase != 0) ? TRUE : FALSE;
+    return (Diff == 0) ? TRUE : FALSE;
+}
+
+/**
+ * Check whether a sector is only partly covered by a delta write
+ * @param Job - Delta write in progress
+ * @param SectorBase - Flash address of the sector
+ * @return BOOLEAN - TRUE if some bytes of the sector lie outside the range
+ */
+STATIC
+BOOLEAN
+FlashDeltaPartial(
+    IN CONST FLASH_DELTA_JOB *Job,
+    IN UINT32 SectorBase
+)
+{
+    return (SectorBase < Job->Address ||
+            SectorBase + Job->SectorSize > Job->Address + Job->Size) ? TRUE : FALSE;
+}
+
+/**
+ * Build the new image of a partially covered first or last sector
+ * @param Job - Delta write in progress
+ * @param SectorBase - Flash address of the sector
+ * @param Current - Sector as read back from flash
+ */
+STATIC
+VOID
+FlashDeltaMergeEdge(
+    IN OUT FLASH_DELTA_JOB *Job,
+    IN UINT32 SectorBase,
+    IN CONST UINT8 *Current
+)
+{
+    UINT8 *Image;
+    UINTN Start;
+    UINTN End;
+    
+    if (!FlashDeltaPartial(Job, SectorBase)) {
+        return;
+    }
+    
+    Image = (SectorBase == Job->HeadBase) ? Job->HeadImage : Job->TailImage;
+    Start = MAX((UINTN)Job->Address, (UINTN)SectorBase);
+    End = MIN((UINTN)Job->Address + Job->Size, (UINTN)SectorBase + Job->SectorSize);
+    
+    CopyMemory(Image, Current, Job->SectorSize);
+    CopyMemory(Image + (Start - SectorBase), Job->Buffer + (Start - Job->Address), End - Start);
+}
+
+/**
+ * Get the new contents of one sector
+ * @param Job - Delta write in progress
+ * @param SectorBase - Flash address of the sector
+ * @return CONST UINT8* - Merged edge image or a slice of the caller's buffer
+ */
+STATIC
+CONST UINT8 *
+FlashDeltaSectorImage(
+    IN CONST FLASH_DELTA_JOB *Job,
+    IN UINT32 SectorBase
+)
+{
+    if (FlashDeltaPartial(Job, SectorBase)) {
+        return (SectorBase == Job->HeadBase) ? Job->HeadImage : Job->TailImage;
+    }
+    
+    return Job->Buffer + (SectorBase - Job->Address);
+}
+
+/**
+ * Update a run of neighbouring sectors that all differ from the image
+ * @details Program-only runs write just the requested bytes. Erase runs are
+ *          erased with one EraseBlocks call and rewritten as the merged edge
+ *          sectors plus one contiguous write from the caller's buffer. Write
+ *          protection was checked for the whole update by the caller, so only
+ *          erase support is resolved here, once per run.
+ * @param Job - Delta write in progress
+ * @param RunBase - Flash address of the first sector in the run
+ * @param RunCount - Number of sectors in the run
+ * @param Erase - TRUE if the run must be erased before programming
+ * @param Counts - Sector counters to update
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashDeltaFlushRun(
+    IN CONST FLASH_DELTA_JOB *Job,
+    IN UINT32 RunBase,
+    IN UINTN RunCount,
+    IN BOOLEAN Erase,
+    IN OUT FLASH_DELTA_STATS *Counts
+)
+{
+    EFI_STATUS Status;
+    UINT32 Start;
+    UINT32 End;
+    UINT32 MidEnd;
+    
+    End = RunBase + (UINT32)(RunCount * Job->SectorSize);
+    
+    if (!Erase) {
+        // Bytes outside the range already hold their final value
+        Start = MAX(Job->Address, RunBase);
+        MidEnd = (UINT32)MIN((UINTN)Job->Address + Job->Size, (UINTN)End);
+        Status = FlashProgram(Start, Job->Buffer + (Start - Job->Address), MidEnd - Start);
+        if (!EFI_ERROR(Status)) {
+            Counts->SectorsProgrammed += RunCount;
+        }
+        return Status;
+    }
+    
+    // Programming was cleared for the whole range up front; erase is resolved once per run
+    Status = CheckRegionEraseRange(RunBase, RunCount * Job->SectorSize);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    
+    Status = FlashEraseRun(RunBase, RunCount * Job->SectorSize);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    Counts->SectorsErased += RunCount;
+    
+    Start = RunBase;
+    if (FlashDeltaPartial(Job, Start)) {
+        Status = FlashProgram(Start, FlashDeltaSectorImage(Job, Start), Job->SectorSize);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        Start += (UINT32)Job->SectorSize;
+    }
+    
+    MidEnd = End;
+    if (MidEnd > Start && FlashDeltaPartial(Job, End - (UINT32)Job->SectorSize)) {
+        MidEnd -= (UINT32)Job->SectorSize;
+    }
+    
+    if (MidEnd > Start) {
+        Status = FlashProgram(Start, Job->Buffer + (Start - Job->Address), MidEnd - Start);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    if (MidEnd < End) {
+        Status = FlashProgram(MidEnd, FlashDeltaSectorImage(Job, MidEnd), Job->SectorSize);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+    }
+    
+    Counts->SectorsProgrammed += RunCount;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Erase a run of blocks through the FVB protocol
+ * @details Tries one EraseBlocks call for the whole run. Drivers that cap the
+ *          count reject it with EFI_INVALID_PARAMETER or EFI_UNSUPPORTED; the
+ *          run is then split into 64KB, 32KB and single-block pieces aligned
+ *          to their own size, matching the SPI part's erase opcodes.
+ * @param Lba - First block to erase
+ * @param Count - Number of blocks to erase
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+FlashEraseBlocks(
+    IN EFI_LBA Lba,
+    IN UINTN Count
+)
+{
+    EFI_STATUS Status;
+    UINTN SectorSize;
+    UINTN LargeBlocks;
+    UINTN MediumBlocks;
+    UINTN Blocks;
+    
+    FlashCacheInvalidate(Lba, Count);
+    
+    if (mFvbMultiBlockErase || Count == 1) {
+        Status = mFvbProtocol->EraseBlocks(mFvbProtocol, Lba, (UINTN)Count, EFI_LBA_LIST_TERMINATOR);
+        if (Count == 1 || (Status != EFI_INVALID_PARAMETER && Status != EFI_UNSUPPORTED)) {
+            return Status;
+        }
+        
+        LOG_WARN("FVB rejected %ld-block erase (%r), splitting\n", Count, Status);
+        mFvbMultiBlockErase = FALSE;
+    }
+    
+    SectorSize = mFlashInfo.SectorSize;
+    LargeBlocks = MAX(FLASH_LARGE_ERASE_SIZE / SectorSize, 1);
+    MediumBlocks = MAX(FLASH_MEDIUM_ERASE_SIZE / SectorSize, 1);
+    
+    while (Count > 0) {
+        if ((Lba % LargeBlocks) == 0 && Count >= LargeBlocks) {
+            Blocks = LargeBlocks;
+        } else if ((Lba % MediumBlocks) == 0 && Count >= MediumBlocks) {
+            Blocks = MediumBlocks;
+        } else {
+            Blocks = 1;
+        }
+        
+        Status = mFvbProtocol->EraseBlocks(mFvbProtocol, Lba, (UINTN)Blocks, EFI_LBA_LIST_TERMINATOR);
+        if (EFI_ERROR(Status) && Blocks > 1) {
+            // Piece still too large for this driver; fall back to one block
+            Blocks = 1;
+            Status = mFvbProtocol->EraseBlocks(mFvbProtocol, Lba, (UINTN)1, EFI_LBA_LIST_TERMINATOR);
+        }
+        
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        
+        Lba += Blocks;
+        Count -= Blocks;
+    }
+    
+    return EFI_SUCCESS;
+}
+
 /**
  * Check region write protection
+ * @details One lookup for the first region touched, then a walk over the
+ *          regions the range covers.
  * @param Address - Start address
  * @param Size - Size of operation
  * @return EFI_STATUS - Success or error code
@@ -467,17 +1738,14 @@ CheckRegionWriteProtection(
 )
 {
     UINTN i;
-    UINT32 EndAddress = Address + Size - 1;
+    UINT64 EndAddress = (UINT64)Address + Size;
     
-    for (i = 0; i < mRegionCount; i++) {
-        UINT32 RegionEnd = mFlashRegions[i].StartAddress + mFlashRegions[i].Size - 1;
-        
-        // Check if operation overlaps with this region
-        if (Address <= RegionEnd && EndAddress >= mFlashRegions[i].StartAddress) {
-            if (mFlashRegions[i].WriteProtected) {
-                LOG_ERROR("Write to protected region: %s\n", mFlashRegions[i].Name);
-                return EFI_WRITE_PROTECTED;
-            }
+    FlashFindRegion(Address, &i);
+    
+    for (; i < mRegionCount && mFlashRegions[i].StartAddress < EndAddress; i++) {
+        if (mFlashRegions[i].WriteProtected) {
+            LOG_ERROR("Write to protected region: %s\n", mFlashRegions[i].Name);
+            return EFI_WRITE_PROTECTED;
         }
     }
     
@@ -497,21 +1765,62 @@ CheckRegionEraseSupport(
 {
     UINTN i;
     
-    for (i = 0; i < mRegionCount; i++) {
-        UINT32 RegionEnd = mFlashRegions[i].StartAddress + mFlashRegions[i].Size - 1;
+    if (!FlashFindRegion(Address, &i)) {
+        LOG_ERROR("Address not found in any region: 0x%08X\n", Address);
+        return EFI_NOT_FOUND;
+    }
+    
+    if (!mFlashRegions[i].EraseRequired) {
+        LOG_ERROR("Erase not supported in region: %s\n", mFlashRegions[i].Name);
+        return EFI_UNSUPPORTED;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Check erase support for every region covered by a range
+ * @details The range is resolved with one lookup; because the table is sorted
+ *          and non-overlapping, the rest of the range must be covered by the
+ *          regions immediately following, with no gap between them.
+ * @param Address - Start address
+ * @param Size - Size of the range
+ * @return EFI_STATUS - EFI_NOT_FOUND if part of the range lies outside every
+ *                      region, EFI_UNSUPPORTED if a region cannot be erased
+ */
+STATIC
+EFI_STATUS
+CheckRegionEraseRange(
+    IN UINT32 Address,
+    IN UINTN Size
+)
+{
+    UINTN i;
+    UINT64 Cursor = Address;
+    UINT64 EndAddress = (UINT64)Address + Size;
+    
+    if (!FlashFindRegion(Address, &i)) {
+        LOG_ERROR("Address not found in any region: 0x%08lX\n", Cursor);
+        return EFI_NOT_FOUND;
+    }
+    
+    while (Cursor < EndAddress) {
+        if (i == mRegionCount || mFlashRegions[i].StartAddress > Cursor) {
+            LOG_ERROR("Address not found in any region: 0x%08lX\n", Cursor);
+            return EFI_NOT_FOUND;
+        }
         
-        // Check if address is within this region
-        if (Address >= mFlashRegions[i].StartAddress && Address <= RegionEnd) {
-            if (!mFlashRegions[i].EraseRequired) {
-                LOG_ERROR("Erase not supported in region: %s\n", mFlashRegions[i].Name);
-                return EFI_UNSUPPORTED;
-            }
-            return EFI_SUCCESS;
+        if (!mFlashRegions[i].EraseRequired) {
+            LOG_ERROR("Erase not supported in region: %s\n", mFlashRegions[i].Name);
+            return EFI_UNSUPPORTED;
         }
+        
+        // Skip to the end of this region
+        Cursor = (UINT64)mFlashRegions[i].StartAddress + mFlashRegions[i].Size;
+        i++;
     }
     
-    LOG_ERROR("Address not found in any region: 0x%08X\n", Address);
-    return EFI_NOT_FOUND;
+    return EFI_SUCCESS;
 }
 
 /**
@@ -533,6 +1842,200 @@ flash_get_device_info(
     return EFI_SUCCESS;
 }
 
+/**
+ * Get the layout of a flash region by type
+ * @param Type - Region type to look up
+ * @param Region - Pointer to receive a copy of the region descriptor
+ * @return EFI_STATUS - EFI_NOT_FOUND if no region has that type
+ */
+EFI_STATUS
+EFIAPI
+flash_get_region(
+    IN FLASH_REGION_TYPE Type,
+    OUT FLASH_REGION *Region
+)
+{
+    UINTN i;
+    
+    if (Region == NULL || !mFlashManagerInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    for (i = 0; i < mRegionCount; i++) {
+        if (mFlashRegions[i].Type == Type) {
+            CopyMemory(Region, &mFlashRegions[i], sizeof(FLASH_REGION));
+            return EFI_SUCCESS;
+        }
+    }
+    
+    return EFI_NOT_FOUND;
+}
+
+/**
+ * Get the region containing a flash address
+ * @param Address - Flash address
+ * @param Region - Pointer to receive a copy of the region descriptor
+ * @return EFI_STATUS - EFI_NOT_FOUND if no region contains Address
+ */
+EFI_STATUS
+EFIAPI
+flash_find_region(
+    IN UINT32 Address,
+    OUT FLASH_REGION *Region
+)
+{
+    UINTN i;
+    
+    if (Region == NULL || !mFlashManagerInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!FlashFindRegion(Address, &i)) {
+        return EFI_NOT_FOUND;
+    }
+    
+    CopyMemory(Region, &mFlashRegions[i], sizeof(FLASH_REGION));
+    return EFI_SUCCESS;
+}
+
+/**
+ * Add a region to the flash layout
+ * @details Regions must be sector aligned so an erase or a merged sector
+ *          rewrite never reaches into a neighbour with a different policy.
+ * @param Region - Region descriptor to copy into the table
+ * @return EFI_STATUS - EFI_ACCESS_DENIED if it overlaps an existing region,
+ *                      EFI_OUT_OF_RESOURCES if the table is full
+ */
+EFI_STATUS
+EFIAPI
+flash_add_region(
+    IN CONST FLASH_REGION *Region
+)
+{
+    EFI_STATUS Status;
+    UINTN i;
+    
+    DBG_ENTER();
+    
+    if (Region == NULL || !mFlashManagerInitialized) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (Region->Size == 0 ||
+        (UINT64)Region->StartAddress + Region->Size > mFlashInfo.TotalSize ||
+        (Region->StartAddress % mFlashInfo.SectorSize) != 0 ||
+        (Region->Size % mFlashInfo.SectorSize) != 0) {
+        LOG_ERROR("Invalid flash region: 0x%08X, %d bytes\n", Region->StartAddress, Region->Size);
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Status = FlashInsertRegion(Region);
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Flash region 0x%08X, %d bytes not added: %r\n",
+                  Region->StartAddress, Region->Size, Status);
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+    
+    FlashFindRegion(Region->StartAddress, &i);
+    FlashRegisterRegionMetrics(i);
+    
+    LOG_INFO("Added flash region %s at 0x%08X (%d KB)\n",
+             mFlashRegions[i].Name, Region->StartAddress, Region->Size / 1024);
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Remove a region from the flash layout
+ * @details Flash left outside every region can still be written but not erased.
+ * @param StartAddress - First byte of the region to remove
+ * @return EFI_STATUS - EFI_NOT_FOUND if no region starts at StartAddress
+ */
+EFI_STATUS
+EFIAPI
+flash_remove_region(
+    IN UINT32 StartAddress
+)
+{
+    UINTN i;
+    UINTN Op;
+    
+    if (!mFlashManagerInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (!FlashFindRegion(StartAddress, &i) || mFlashRegions[i].StartAddress != StartAddress) {
+        return EFI_NOT_FOUND;
+    }
+    
+    LOG_INFO("Removed flash region %s\n", mFlashRegions[i].Name);
+    
+    mRegionCount--;
+    CopyMemory(&mFlashRegions[i], &mFlashRegions[i + 1], (mRegionCount - i) * sizeof(FLASH_REGION));
+    ZeroMemory(&mFlashRegions[mRegionCount], sizeof(FLASH_REGION));
+    
+    for (Op = 0; Op < FlashMetricOpCount; Op++) {
+        CopyMemory(&mFlashMetrics[Op][i], &mFlashMetrics[Op][i + 1], (mRegionCount - i) * sizeof(UINTN));
+        mFlashMetrics[Op][mRegionCount] = METRICS_INVALID_ID;
+    }
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Turn the sector read cache on or off
+ * @details Cached sectors are dropped either way, so re-enabling starts cold.
+ * @param Enable - TRUE to serve small reads from the cache
+ * @return EFI_STATUS - EFI_UNSUPPORTED if the cache has no storage
+ */
+EFI_STATUS
+EFIAPI
+flash_read_cache_enable(
+    IN BOOLEAN Enable
+)
+{
+    UINTN Index;
+    
+    if (!mFlashManagerInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (mFlashCacheStats.Entries == 0) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    for (Index = 0; Index < mFlashCacheStats.Entries; Index++) {
+        FlashCacheDrop(Index);
+    }
+    mFlashCacheNextLba = (EFI_LBA)-1;
+    mFlashCacheStats.Enabled = Enable;
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get sector read cache counters
+ * @param Stats - Pointer to receive the counters
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+flash_get_cache_stats(
+    OUT FLASH_CACHE_STATS *Stats
+)
+{
+    if (Stats == NULL || !mFlashManagerInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    CopyMemory(Stats, &mFlashCacheStats, sizeof(FLASH_CACHE_STATS));
+    return EFI_SUCCESS;
+}
+
 /**
  * Display flash manager status
  * @return EFI_STATUS - Success or error code
@@ -555,6 +2058,25 @@ flash_manager_status(VOID)
     Print(L"  Block Count: %d\n", mFlashInfo.BlockCount);
     Print(L"  Write Protected: %s\n", mFlashInfo.WriteProtected ? L"YES" : L"NO");
     Print(L"  FVB Protocol: %s\n", mFvbProtocol != NULL ? L"Available" : L"Not Available");
+    Print(L"  Block Transfers: %s\n", mFvbMultiBlockTransfers ? L"Multi-block" : L"Per-block");
+    if (mFlashCacheStats.Entries == 0) {
+        Print(L"  Read Cache: Not Available\n");
+    } else {
+        Print(L"  Read Cache: %s, %d sectors, %ld hits, %ld misses (%ld%% hit rate)\n",
+              mFlashCacheStats.Enabled ? L"On" : L"Off",
+              mFlashCacheStats.Entries,
+              mFlashCacheStats.Hits,
+              mFlashCacheStats.Misses,
+              (mFlashCacheStats.Hits + mFlashCacheStats.Misses != 0) ?
+                  DivU64x64Remainder(MultU64x32(mFlashCacheStats.Hits, 100),
+                                     mFlashCacheStats.Hits + mFlashCacheStats.Misses, NULL) : 0);
+        Print(L"              %ld read ahead (%ld used), %ld evicted, %ld invalidated, %ld bypassed\n",
+              mFlashCacheStats.ReadAhead,
+              mFlashCacheStats.ReadAheadHits,
+              mFlashCacheStats.Evictions,
+              mFlashCacheStats.Invalidations,
+              mFlashCacheStats.Bypassed);
+    }
     
     Print(L"\nFlash Regions (%d):\n", mRegionCount);
     for (i = 0; i < mRegionCount; i++) {
@@ -603,6 +2125,11 @@ flash_manager_cleanup(VOID)
     ZeroMemory(mFlashRegions, sizeof(mFlashRegions));
     mRegionCount = 0;
     
+    // The cache storage lives in the arena
+    ZeroMemory(&mFlashCacheStats, sizeof(mFlashCacheStats));
+    mFlashCacheStaging = NULL;
+    memory_arena_release(&mFlashArena);
+    
     mFlashManagerInitialized = FALSE;
     
     LOG_INFO("Flash manager cleanup complete\n");
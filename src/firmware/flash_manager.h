@@ -8,8 +8,8 @@
 
 #include <Uefi.h>
 #include <Library/UefiLib.h>
+#include "../../include/config.h"
 
-#define MAX_FLASH_REGIONS 16
 #define MAX_FLASH_NAME_LEN 64
 
 typedef enum {
@@ -37,8 +37,33 @@ typedef struct {
     UINT32 SectorSize;
     BOOLEAN WriteProtected;
     UINT32 BlockCount;
+    UINT8 ErasedByte;           // Value of an erased byte (from the erase polarity)
 } FLASH_DEVICE_INFO;
 
+//
+// Delta update statistics (counted in sectors)
+//
+typedef struct {
+    UINTN SectorsSkipped;       // Already matched the image
+    UINTN SectorsErased;        // Needed an erase before programming
+    UINTN SectorsProgrammed;    // Programmed (with or without erase)
+} FLASH_DELTA_STATS;
+
+//
+// Read cache statistics (counted in sectors)
+//
+typedef struct {
+    UINTN Entries;              // Sectors the cache can hold; 0 when unavailable
+    BOOLEAN Enabled;
+    UINT64 Hits;
+    UINT64 Misses;
+    UINT64 ReadAhead;           // Sectors prefetched
+    UINT64 ReadAheadHits;       // Prefetched sectors later read
+    UINT64 Evictions;
+    UINT64 Invalidations;       // Cached sectors dropped by writes and erases
+    UINT64 Bypassed;            // Reads too large to cache
+} FLASH_CACHE_STATS;
+
 // Public API
 EFI_STATUS
 EFIAPI
@@ -60,18 +85,72 @@ flash_write(
     IN UINTN Size
     );
 
+EFI_STATUS
+EFIAPI
+flash_write_delta(
+    IN UINT32 Address,
+    IN CONST VOID *Buffer,
+    IN UINTN Size,
+    OUT FLASH_DELTA_STATS *Stats OPTIONAL
+    );
+
 EFI_STATUS
 EFIAPI
 flash_erase_sector(
     IN UINT32 Address
     );
 
+EFI_STATUS
+EFIAPI
+flash_erase_range(
+    IN UINT32 Address,
+    IN UINTN Size
+    );
+
 EFI_STATUS
 EFIAPI
 flash_get_device_info(
     OUT FLASH_DEVICE_INFO *FlashInfo
     );
 
+EFI_STATUS
+EFIAPI
+flash_get_region(
+    IN FLASH_REGION_TYPE Type,
+    OUT FLASH_REGION *Region
+    );
+
+EFI_STATUS
+EFIAPI
+flash_find_region(
+    IN UINT32 Address,
+    OUT FLASH_REGION *Region
+    );
+
+EFI_STATUS
+EFIAPI
+flash_add_region(
+    IN CONST FLASH_REGION *Region
+    );
+
+EFI_STATUS
+EFIAPI
+flash_remove_region(
+    IN UINT32 StartAddress
+    );
+
+EFI_STATUS
+EFIAPI
+flash_read_cache_enable(
+    IN BOOLEAN Enable
+    );
+
+EFI_STATUS
+EFIAPI
+flash_get_cache_stats(
+    OUT FLASH_CACHE_STATS *Stats
+    );
+
 EFI_STATUS
 EFIAPI
 flash_manager_status(VOID);
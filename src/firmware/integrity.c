@@ -0,0 +1,644 @@
+/**
+ * @file integrity.c
+ * @brief CRC32C and SHA-256 integrity engine
+ *
+ * Portable paths are slicing-by-8 CRC32C and a straight FIPS 180-4 SHA-256.
+ * On X64 the SSE4.2 CRC32 instruction and the SHA extensions are used when
+ * integrity_init is told the CPU has them; both only touch XMM state, which
+ * is always enabled for X64 UEFI images.
+ */
+
+#ifdef INTEGRITY_HOST_BUILD
+#include <string.h>
+#define CopyMem(Dest, Src, Size)    memcpy(Dest, Src, Size)
+#define ZeroMem(Dest, Size)         memset(Dest, 0, Size)
+#else
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#endif
+
+#include "integrity.h"
+
+#if defined(MDE_CPU_X64) || (defined(INTEGRITY_HOST_BUILD) && (defined(__x86_64__) || defined(_M_X64)))
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define INTEGRITY_TARGET(Isa)
+#define INTEGRITY_X64_ACCEL         1
+#elif defined(__GNUC__)
+#include <immintrin.h>
+#define INTEGRITY_TARGET(Isa)       __attribute__((target(Isa)))
+#define INTEGRITY_X64_ACCEL         1
+#endif
+#endif
+
+#ifdef INTEGRITY_HOST_BUILD
+#if defined(INTEGRITY_X64_ACCEL) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+#endif
+
+//
+// CRC32C (Castagnoli) reflected polynomial
+//
+#define CRC32C_POLYNOMIAL           0x82F63B78
+
+//
+// Static variables
+//
+STATIC UINT32 mCrc32cTable[8][256];
+STATIC BOOLEAN mCrc32cTableReady = FALSE;
+STATIC UINT32 mIntegrityFeatures = 0;
+
+STATIC CONST UINT32 mSha256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+STATIC CONST UINT32 mSha256Init[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/**
+ * Build the slicing-by-8 tables
+ * @details Table[0] is the classic byte-wise table; Table[k][i] is the CRC of
+ *          byte i followed by k zero bytes, so eight lookups retire a word.
+ */
+STATIC
+VOID
+BuildCrc32cTables(VOID)
+{
+    UINT32 Index;
+    UINT32 Bit;
+    UINT32 Slice;
+    UINT32 Crc;
+
+    for (Index = 0; Index < 256; Index++) {
+        Crc = Index;
+        for (Bit = 0; Bit < 8; Bit++) {
+            Crc = (Crc >> 1) ^ ((Crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        mCrc32cTable[0][Index] = Crc;
+    }
+
+    for (Index = 0; Index < 256; Index++) {
+        Crc = mCrc32cTable[0][Index];
+        for (Slice = 1; Slice < 8; Slice++) {
+            Crc = (Crc >> 8) ^ mCrc32cTable[0][Crc & 0xFF];
+            mCrc32cTable[Slice][Index] = Crc;
+        }
+    }
+
+    mCrc32cTableReady = TRUE;
+}
+
+/**
+ * Portable CRC32C, eight bytes per step
+ * @param Crc - Inverted running CRC
+ * @param Data - Data buffer
+ * @param Size - Data size
+ * @return UINT32 - Inverted running CRC
+ */
+STATIC
+UINT32
+Crc32cSlicing8(
+    IN UINT32 Crc,
+    IN CONST UINT8 *Data,
+    IN UINTN Size
+)
+{
+    UINT64 Word;
+
+    while (Size > 0 && ((UINTN)Data & 7) != 0) {
+        Crc = mCrc32cTable[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+        Size--;
+    }
+
+    while (Size >= 8) {
+        Word = *(CONST UINT64 *)Data ^ Crc;
+        Crc = mCrc32cTable[7][Word & 0xFF] ^
+              mCrc32cTable[6][(Word >> 8) & 0xFF] ^
+              mCrc32cTable[5][(Word >> 16) & 0xFF] ^
+              mCrc32cTable[4][(Word >> 24) & 0xFF] ^
+              mCrc32cTable[3][(Word >> 32) & 0xFF] ^
+              mCrc32cTable[2][(Word >> 40) & 0xFF] ^
+              mCrc32cTable[1][(Word >> 48) & 0xFF] ^
+              mCrc32cTable[0][Word >> 56];
+        Data += 8;
+        Size -= 8;
+    }
+
+    while (Size > 0) {
+        Crc = mCrc32cTable[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+        Size--;
+    }
+
+    return Crc;
+}
+
+#ifdef INTEGRITY_X64_ACCEL
+/**
+ * CRC32C with the SSE4.2 CRC32 instruction
+ * @param Crc - Inverted running CRC
+ * @param Data - Data buffer
+ * @param Size - Data size
+ * @return UINT32 - Inverted running CRC
+ */
+INTEGRITY_TARGET("sse4.2")
+STATIC
+UINT32
+Crc32cSse42(
+    IN UINT32 Crc,
+    IN CONST UINT8 *Data,
+    IN UINTN Size
+)
+{
+    UINT64 Crc64;
+
+    while (Size > 0 && ((UINTN)Data & 7) != 0) {
+        Crc = _mm_crc32_u8(Crc, *Data++);
+        Size--;
+    }
+
+    Crc64 = Crc;
+    while (Size >= 32) {
+        Crc64 = _mm_crc32_u64(Crc64, ((CONST UINT64 *)Data)[0]);
+        Crc64 = _mm_crc32_u64(Crc64, ((CONST UINT64 *)Data)[1]);
+        Crc64 = _mm_crc32_u64(Crc64, ((CONST UINT64 *)Data)[2]);
+        Crc64 = _mm_crc32_u64(Crc64, ((CONST UINT64 *)Data)[3]);
+        Data += 32;
+        Size -= 32;
+    }
+
+    while (Size >= 8) {
+        Crc64 = _mm_crc32_u64(Crc64, *(CONST UINT64 *)Data);
+        Data += 8;
+        Size -= 8;
+    }
+    Crc = (UINT32)Crc64;
+
+    while (Size > 0) {
+        Crc = _mm_crc32_u8(Crc, *Data++);
+        Size--;
+    }
+
+    return Crc;
+}
+#endif
+
+/**
+ * Initialize the integrity engine
+ * @param CpuFeatures - INTEGRITY_CPU_* flags reported by CPUID
+ */
+VOID
+EFIAPI
+integrity_init(
+    IN UINT32 CpuFeatures
+)
+{
+    if (!mCrc32cTableReady) {
+        BuildCrc32cTables();
+    }
+
+#ifdef INTEGRITY_X64_ACCEL
+    mIntegrityFeatures = CpuFeatures & (INTEGRITY_CPU_SSE42 | INTEGRITY_CPU_SHA);
+#else
+    mIntegrityFeatures = 0;
+#endif
+}
+
+/**
+ * Get the accelerated paths currently in use
+ * @return UINT32 - INTEGRITY_CPU_* flags
+ */
+UINT32
+EFIAPI
+integrity_get_features(VOID)
+{
+    return mIntegrityFeatures;
+}
+
+/**
+ * Update a CRC32C (Castagnoli) over a buffer
+ * @param Crc - CRC of the preceding data (0 to start)
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ * @return UINT32 - CRC32C of all data so far
+ */
+UINT32
+EFIAPI
+integrity_crc32c(
+    IN UINT32 Crc,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+)
+{
+    if (Buffer == NULL || Size == 0) {
+        return Crc;
+    }
+
+#ifdef INTEGRITY_X64_ACCEL
+    if ((mIntegrityFeatures & INTEGRITY_CPU_SSE42) != 0) {
+        return ~Crc32cSse42(~Crc, (CONST UINT8 *)Buffer, Size);
+    }
+#endif
+
+    if (!mCrc32cTableReady) {
+        BuildCrc32cTables();
+    }
+
+    return ~Crc32cSlicing8(~Crc, (CONST UINT8 *)Buffer, Size);
+}
+
+/**
+ * Multiply two polynomials modulo the CRC32C polynomial
+ * @details Both operands are in reflected form, so x^0 is bit 31.
+ * @param A - First factor
+ * @param B - Second factor
+ * @return UINT32 - A * B mod P
+ */
+STATIC
+UINT32
+Crc32cMultiplyModP(
+    IN UINT32 A,
+    IN UINT32 B
+)
+{
+    UINT32 Mask;
+    UINT32 Product;
+
+    Product = 0;
+    for (Mask = 0x80000000; Mask != 0 && A != 0; Mask >>= 1) {
+        if ((A & Mask) != 0) {
+            Product ^= B;
+            A ^= Mask;
+        }
+        B = (B & 1) ? (B >> 1) ^ CRC32C_POLYNOMIAL : B >> 1;
+    }
+
+    return Product;
+}
+
+/**
+ * Combine the CRC32C of two adjacent blocks
+ * @param Crc1 - CRC32C of the first block
+ * @param Crc2 - CRC32C of the second block
+ * @param Length2 - Length of the second block in bytes
+ * @return UINT32 - CRC32C of both blocks back to back
+ */
+UINT32
+EFIAPI
+integrity_crc32c_combine(
+    IN UINT32 Crc1,
+    IN UINT32 Crc2,
+    IN UINT64 Length2
+)
+{
+    UINT32 Shift;
+    UINT32 Power;
+
+    // Shift Crc1 past Length2 zero bytes: multiply by x^(8 * Length2)
+    Shift = 0x80000000;
+    Power = 0x00800000;
+    while (Length2 != 0) {
+        if ((Length2 & 1) != 0) {
+            Shift = Crc32cMultiplyModP(Power, Shift);
+        }
+        Power = Crc32cMultiplyModP(Power, Power);
+        Length2 >>= 1;
+    }
+
+    return Crc32cMultiplyModP(Shift, Crc1) ^ Crc2;
+}
+
+//
+// SHA-256 round helpers
+//
+#define SHA256_ROTR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA256_S0(x)        (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_S1(x)        (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_G0(x)        (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_G1(x)        (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+/**
+ * Portable SHA-256 compression over whole blocks
+ * @param State - Hash state
+ * @param Data - Input blocks
+ * @param Blocks - Number of 64-byte blocks
+ */
+STATIC
+VOID
+Sha256BlocksPortable(
+    IN OUT UINT32 *State,
+    IN CONST UINT8 *Data,
+    IN UINTN Blocks
+)
+{
+    UINT32 W[64];
+    UINT32 A, B, C, D, E, F, G, H;
+    UINT32 T1, T2;
+    UINTN Index;
+
+    while (Blocks-- > 0) {
+        for (Index = 0; Index < 16; Index++) {
+            W[Index] = ((UINT32)Data[Index * 4] << 24) |
+                       ((UINT32)Data[Index * 4 + 1] << 16) |
+                       ((UINT32)Data[Index * 4 + 2] << 8) |
+                       (UINT32)Data[Index * 4 + 3];
+        }
+        for (Index = 16; Index < 64; Index++) {
+            W[Index] = SHA256_G1(W[Index - 2]) + W[Index - 7] +
+                       SHA256_G0(W[Index - 15]) + W[Index - 16];
+        }
+
+        A = State[0]; B = State[1]; C = State[2]; D = State[3];
+        E = State[4]; F = State[5]; G = State[6]; H = State[7];
+
+        for (Index = 0; Index < 64; Index++) {
+            T1 = H + SHA256_S1(E) + SHA256_CH(E, F, G) + mSha256K[Index] + W[Index];
+            T2 = SHA256_S0(A) + SHA256_MAJ(A, B, C);
+            H = G; G = F; F = E; E = D + T1;
+            D = C; C = B; B = A; A = T1 + T2;
+        }
+
+        State[0] += A; State[1] += B; State[2] += C; State[3] += D;
+        State[4] += E; State[5] += F; State[6] += G; State[7] += H;
+
+        Data += SHA256_BLOCK_SIZE;
+    }
+}
+
+#ifdef INTEGRITY_X64_ACCEL
+/**
+ * SHA-256 compression with the SHA extensions
+ * @details Four rounds per group; the message schedule for group g+4 is
+ *          produced with SHA256MSG1/MSG2 while group g runs.
+ * @param State - Hash state
+ * @param Data - Input blocks
+ * @param Blocks - Number of 64-byte blocks
+ */
+INTEGRITY_TARGET("sha,ssse3,sse4.1")
+STATIC
+VOID
+Sha256BlocksShaNi(
+    IN OUT UINT32 *State,
+    IN CONST UINT8 *Data,
+    IN UINTN Blocks
+)
+{
+    __m128i State0;
+    __m128i State1;
+    __m128i SaveAbef;
+    __m128i SaveCdgh;
+    __m128i Msg[4];
+    __m128i Round;
+    __m128i Next;
+    __m128i Tmp;
+    __m128i Mask;
+    UINTN Group;
+
+    Mask = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+    // Repack A..H into the ABEF/CDGH lane order SHA256RNDS2 expects
+    Tmp = _mm_loadu_si128((CONST __m128i *)&State[0]);
+    State1 = _mm_loadu_si128((CONST __m128i *)&State[4]);
+    Tmp = _mm_shuffle_epi32(Tmp, 0xB1);
+    State1 = _mm_shuffle_epi32(State1, 0x1B);
+    State0 = _mm_alignr_epi8(Tmp, State1, 8);
+    State1 = _mm_blend_epi16(State1, Tmp, 0xF0);
+
+    while (Blocks-- > 0) {
+        SaveAbef = State0;
+        SaveCdgh = State1;
+
+        for (Group = 0; Group < 4; Group++) {
+            Msg[Group] = _mm_shuffle_epi8(
+                _mm_loadu_si128((CONST __m128i *)(Data + Group * 16)), Mask);
+        }
+
+        for (Group = 0; Group < 16; Group++) {
+            Round = _mm_add_epi32(Msg[Group & 3],
+                                  _mm_loadu_si128((CONST __m128i *)&mSha256K[Group * 4]));
+            State1 = _mm_sha256rnds2_epu32(State1, State0, Round);
+            Round = _mm_shuffle_epi32(Round, 0x0E);
+            State0 = _mm_sha256rnds2_epu32(State0, State1, Round);
+
+            if (Group < 12) {
+                Next = _mm_sha256msg1_epu32(Msg[Group & 3], Msg[(Group + 1) & 3]);
+                Next = _mm_add_epi32(Next, _mm_alignr_epi8(Msg[(Group + 3) & 3],
+                                                           Msg[(Group + 2) & 3], 4));
+                Msg[Group & 3] = _mm_sha256msg2_epu32(Next, Msg[(Group + 3) & 3]);
+            }
+        }
+
+        State0 = _mm_add_epi32(State0, SaveAbef);
+        State1 = _mm_add_epi32(State1, SaveCdgh);
+
+        Data += SHA256_BLOCK_SIZE;
+    }
+
+    // Back to A..H order
+    Tmp = _mm_shuffle_epi32(State0, 0x1B);
+    State1 = _mm_shuffle_epi32(State1, 0xB1);
+    State0 = _mm_blend_epi16(Tmp, State1, 0xF0);
+    State1 = _mm_alignr_epi8(State1, Tmp, 8);
+
+    _mm_storeu_si128((__m128i *)&State[0], State0);
+    _mm_storeu_si128((__m128i *)&State[4], State1);
+}
+#endif
+
+/**
+ * Run the SHA-256 compression function over whole blocks
+ * @param State - Hash state
+ * @param Data - Input blocks
+ * @param Blocks - Number of 64-byte blocks
+ */
+STATIC
+VOID
+Sha256Blocks(
+    IN OUT UINT32 *State,
+    IN CONST UINT8 *Data,
+    IN UINTN Blocks
+)
+{
+#ifdef INTEGRITY_X64_ACCEL
+    if ((mIntegrityFeatures & INTEGRITY_CPU_SHA) != 0) {
+        Sha256BlocksShaNi(State, Data, Blocks);
+        return;
+    }
+#endif
+
+    Sha256BlocksPortable(State, Data, Blocks);
+}
+
+/**
+ * Start a SHA-256 computation
+ * @param Context - Hash context to initialize
+ */
+VOID
+EFIAPI
+integrity_sha256_init(
+    OUT INTEGRITY_SHA256_CONTEXT *Context
+)
+{
+    CopyMem(Context->State, mSha256Init, sizeof(mSha256Init));
+    Context->Length = 0;
+    Context->BlockUsed = 0;
+}
+
+/**
+ * Add data to a SHA-256 computation
+ * @param Context - Hash context
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ */
+VOID
+EFIAPI
+integrity_sha256_update(
+    IN OUT INTEGRITY_SHA256_CONTEXT *Context,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+)
+{
+    CONST UINT8 *Data;
+    UINTN Take;
+
+    Data = (CONST UINT8 *)Buffer;
+    Context->Length += Size;
+
+    // Top up a pending partial block first
+    if (Context->BlockUsed > 0) {
+        Take = SHA256_BLOCK_SIZE - Context->BlockUsed;
+        if (Take > Size) {
+            Take = Size;
+        }
+        CopyMem(Context->Block + Context->BlockUsed, Data, Take);
+        Context->BlockUsed += Take;
+        Data += Take;
+        Size -= Take;
+
+        if (Context->BlockUsed < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        Sha256Blocks(Context->State, Context->Block, 1);
+        Context->BlockUsed = 0;
+    }
+
+    // Whole blocks straight from the caller's buffer
+    if (Size >= SHA256_BLOCK_SIZE) {
+        Sha256Blocks(Context->State, Data, Size / SHA256_BLOCK_SIZE);
+        Data += Size - (Size % SHA256_BLOCK_SIZE);
+        Size %= SHA256_BLOCK_SIZE;
+    }
+
+    if (Size > 0) {
+        CopyMem(Context->Block, Data, Size);
+        Context->BlockUsed = Size;
+    }
+}
+
+/**
+ * Finish a SHA-256 computation
+ * @param Context - Hash context
+ * @param Digest - Buffer to receive the 32-byte digest
+ */
+VOID
+EFIAPI
+integrity_sha256_final(
+    IN OUT INTEGRITY_SHA256_CONTEXT *Context,
+    OUT UINT8 *Digest
+)
+{
+    UINT64 BitLength;
+    UINTN Index;
+
+    BitLength = Context->Length * 8;
+
+    Context->Block[Context->BlockUsed++] = 0x80;
+    if (Context->BlockUsed > SHA256_BLOCK_SIZE - 8) {
+        ZeroMem(Context->Block + Context->BlockUsed, SHA256_BLOCK_SIZE - Context->BlockUsed);
+        Sha256Blocks(Context->State, Context->Block, 1);
+        Context->BlockUsed = 0;
+    }
+    ZeroMem(Context->Block + Context->BlockUsed, SHA256_BLOCK_SIZE - 8 - Context->BlockUsed);
+
+    for (Index = 0; Index < 8; Index++) {
+        Context->Block[SHA256_BLOCK_SIZE - 1 - Index] = (UINT8)(BitLength >> (Index * 8));
+    }
+    Sha256Blocks(Context->State, Context->Block, 1);
+
+    for (Index = 0; Index < 8; Index++) {
+        Digest[Index * 4] = (UINT8)(Context->State[Index] >> 24);
+        Digest[Index * 4 + 1] = (UINT8)(Context->State[Index] >> 16);
+        Digest[Index * 4 + 2] = (UINT8)(Context->State[Index] >> 8);
+        Digest[Index * 4 + 3] = (UINT8)Context->State[Index];
+    }
+
+    ZeroMem(Context, sizeof(INTEGRITY_SHA256_CONTEXT));
+}
+
+/**
+ * Hash a buffer with SHA-256 in one call
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ * @param Digest - Buffer to receive the 32-byte digest
+ */
+VOID
+EFIAPI
+integrity_sha256(
+    IN CONST VOID *Buffer,
+    IN UINTN Size,
+    OUT UINT8 *Digest
+)
+{
+    INTEGRITY_SHA256_CONTEXT Context;
+
+    integrity_sha256_init(&Context);
+    integrity_sha256_update(&Context, Buffer, Size);
+    integrity_sha256_final(&Context, Digest);
+}
+
+#ifdef INTEGRITY_HOST_BUILD
+/**
+ * Query the host CPU for INTEGRITY_CPU_* flags
+ * @return UINT32 - Flags suitable for integrity_init
+ */
+UINT32
+integrity_host_cpu_features(VOID)
+{
+    UINT32 Features = 0;
+
+#if defined(INTEGRITY_X64_ACCEL) && defined(_MSC_VER)
+    int Regs[4];
+
+    __cpuid(Regs, 1);
+    if (Regs[2] & (1 << 20)) {
+        Features |= INTEGRITY_CPU_SSE42;
+    }
+    __cpuidex(Regs, 7, 0);
+    if (Regs[1] & (1 << 29)) {
+        Features |= INTEGRITY_CPU_SHA;
+    }
+#elif defined(INTEGRITY_X64_ACCEL)
+    unsigned int Eax, Ebx, Ecx, Edx;
+
+    if (__get_cpuid(1, &Eax, &Ebx, &Ecx, &Edx) && (Ecx & (1u << 20))) {
+        Features |= INTEGRITY_CPU_SSE42;
+    }
+    if (__get_cpuid_count(7, 0, &Eax, &Ebx, &Ecx, &Edx) && (Ebx & (1u << 29))) {
+        Features |= INTEGRITY_CPU_SHA;
+    }
+#endif
+
+    return Features;
+}
+#endif
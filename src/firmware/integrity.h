@@ -0,0 +1,188 @@
+// integrity.h
+#ifndef _INTEGRITY_H_
+#define _INTEGRITY_H_
+
+//
+// The integrity engine is shared with the host flash utility. Host builds
+// define INTEGRITY_HOST_BUILD and get the handful of EDK2 types it needs
+// from the C library instead of Uefi.h.
+//
+#ifdef INTEGRITY_HOST_BUILD
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t     UINT8;
+typedef uint32_t    UINT32;
+typedef uint64_t    UINT64;
+typedef size_t      UINTN;
+typedef uint8_t     BOOLEAN;
+
+#ifndef VOID
+#define VOID        void
+#endif
+#ifndef CONST
+#define CONST       const
+#endif
+#ifndef STATIC
+#define STATIC      static
+#endif
+#ifndef IN
+#define IN
+#define OUT
+#endif
+#ifndef OPTIONAL
+#define OPTIONAL
+#endif
+#ifndef EFIAPI
+#define EFIAPI
+#endif
+#ifndef TRUE
+#define TRUE        1
+#define FALSE       0
+#endif
+#else
+#include <Uefi.h>
+#endif
+
+//
+// CPU acceleration flags passed to integrity_init
+//
+#define INTEGRITY_CPU_SSE42         0x00000001  // CRC32 instruction
+#define INTEGRITY_CPU_SHA           0x00000002  // SHA-NI (SHA256RNDS2/MSG1/MSG2)
+
+//
+// SHA-256 Definitions
+//
+#define SHA256_DIGEST_SIZE          32
+#define SHA256_BLOCK_SIZE           64
+
+typedef struct {
+    UINT32 State[8];
+    UINT64 Length;                      // Bytes hashed so far
+    UINT8 Block[SHA256_BLOCK_SIZE];     // Pending partial block
+    UINTN BlockUsed;
+} INTEGRITY_SHA256_CONTEXT;
+
+//
+// Function Prototypes
+//
+
+/**
+ * Initialize the integrity engine
+ * @details Builds the CRC32C slicing tables and selects the accelerated
+ *          paths allowed by CpuFeatures. Safe to call more than once.
+ * @param CpuFeatures - INTEGRITY_CPU_* flags reported by CPUID
+ */
+VOID
+EFIAPI
+integrity_init(
+    IN UINT32 CpuFeatures
+    );
+
+/**
+ * Get the accelerated paths currently in use
+ * @return UINT32 - INTEGRITY_CPU_* flags
+ */
+UINT32
+EFIAPI
+integrity_get_features(
+    VOID
+    );
+
+/**
+ * Update a CRC32C (Castagnoli) over a buffer
+ * @details Chains like zlib's crc32: start with 0 and pass each result back
+ *          in, so crc(crc(0, A), B) == crc(0, A || B).
+ * @param Crc - CRC of the preceding data (0 to start)
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ * @return UINT32 - CRC32C of all data so far
+ */
+UINT32
+EFIAPI
+integrity_crc32c(
+    IN UINT32 Crc,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+    );
+
+/**
+ * Combine the CRC32C of two adjacent blocks
+ * @details Lets blocks be checksummed independently, e.g. on separate
+ *          processors: combine(crc(0, A), crc(0, B), |B|) == crc(0, A || B).
+ *          Costs O(log Length2) and does not touch the data.
+ * @param Crc1 - CRC32C of the first block
+ * @param Crc2 - CRC32C of the second block
+ * @param Length2 - Length of the second block in bytes
+ * @return UINT32 - CRC32C of both blocks back to back
+ */
+UINT32
+EFIAPI
+integrity_crc32c_combine(
+    IN UINT32 Crc1,
+    IN UINT32 Crc2,
+    IN UINT64 Length2
+    );
+
+/**
+ * Start a SHA-256 computation
+ * @param Context - Hash context to initialize
+ */
+VOID
+EFIAPI
+integrity_sha256_init(
+    OUT INTEGRITY_SHA256_CONTEXT *Context
+    );
+
+/**
+ * Add data to a SHA-256 computation
+ * @param Context - Hash context
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ */
+VOID
+EFIAPI
+integrity_sha256_update(
+    IN OUT INTEGRITY_SHA256_CONTEXT *Context,
+    IN CONST VOID *Buffer,
+    IN UINTN Size
+    );
+
+/**
+ * Finish a SHA-256 computation
+ * @param Context - Hash context
+ * @param Digest - Buffer to receive the 32-byte digest
+ */
+VOID
+EFIAPI
+integrity_sha256_final(
+    IN OUT INTEGRITY_SHA256_CONTEXT *Context,
+    OUT UINT8 *Digest
+    );
+
+/**
+ * Hash a buffer with SHA-256 in one call
+ * @param Buffer - Data buffer
+ * @param Size - Data size
+ * @param Digest - Buffer to receive the 32-byte digest
+ */
+VOID
+EFIAPI
+integrity_sha256(
+    IN CONST VOID *Buffer,
+    IN UINTN Size,
+    OUT UINT8 *Digest
+    );
+
+#ifdef INTEGRITY_HOST_BUILD
+/**
+ * Query the host CPU for INTEGRITY_CPU_* flags
+ * @return UINT32 - Flags suitable for integrity_init
+ */
+UINT32
+integrity_host_cpu_features(
+    VOID
+    );
+#endif
+
+#endif // _INTEGRITY_H_
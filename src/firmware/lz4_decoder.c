@@ -0,0 +1,642 @@
+/**
+ * @file lz4_decoder.c
+ * @brief Streaming LZ4 frame decoder
+ *
+ * Decodes the standard LZ4 frame format (as written by the lz4 tool) into a
+ * fixed window. Dictionaries and concatenated frames are not supported.
+ */
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "lz4_decoder.h"
+#include "../../include/common.h"
+
+//
+// Frame descriptor flags
+//
+#define LZ4_FLG_VERSION_MASK        0xC0
+#define LZ4_FLG_VERSION_01          0x40
+#define LZ4_FLG_BLOCK_CHECKSUM      0x10
+#define LZ4_FLG_CONTENT_SIZE        0x08
+#define LZ4_FLG_CONTENT_CHECKSUM    0x04
+#define LZ4_FLG_RESERVED            0x02
+#define LZ4_FLG_DICT_ID             0x01
+#define LZ4_BD_RESERVED             0x8F
+#define LZ4_BLOCK_UNCOMPRESSED      0x80000000
+
+#define LZ4_MIN_MATCH               4
+
+//
+// xxHash32, used by every checksum in the frame format
+//
+#define XXH_PRIME32_1               0x9E3779B1U
+#define XXH_PRIME32_2               0x85EBCA77U
+#define XXH_PRIME32_3               0xC2B2AE3DU
+#define XXH_PRIME32_4               0x27D4EB2FU
+#define XXH_PRIME32_5               0x165667B1U
+
+typedef struct {
+    UINT32 V[4];
+    UINT64 Length;
+    UINT8 Pending[16];
+    UINTN PendingUsed;
+} LZ4_XXH32_STATE;
+
+//
+// Decoder state
+//
+typedef struct {
+    UINT8 *Window;
+    UINTN WindowSize;
+    UINTN Pos;                  // Decoded bytes currently in the window
+    UINTN Pending;              // Start of bytes not yet handed out
+    UINT64 Flushed;             // Bytes handed to the handler
+    LZ4_OUTPUT_HANDLER Handler;
+    VOID *Context;
+    BOOLEAN ContentChecksum;
+    LZ4_XXH32_STATE Xxh;
+} LZ4_STREAM;
+
+STATIC
+UINT32
+Lz4Read32(
+    IN CONST UINT8 *Buffer
+)
+{
+    return (UINT32)Buffer[0] | ((UINT32)Buffer[1] << 8) |
+           ((UINT32)Buffer[2] << 16) | ((UINT32)Buffer[3] << 24);
+}
+
+STATIC
+UINT32
+XxhRotl(
+    IN UINT32 Value,
+    IN UINTN Count
+)
+{
+    return (Value << Count) | (Value >> (32 - Count));
+}
+
+STATIC
+UINT32
+XxhRound(
+    IN UINT32 Acc,
+    IN UINT32 Input
+)
+{
+    Acc += Input * XXH_PRIME32_2;
+    Acc = XxhRotl(Acc, 13);
+    return Acc * XXH_PRIME32_1;
+}
+
+STATIC
+VOID
+XxhInit(
+    OUT LZ4_XXH32_STATE *State
+)
+{
+    ZeroMemory(State, sizeof(LZ4_XXH32_STATE));
+    State->V[0] = XXH_PRIME32_1 + XXH_PRIME32_2;
+    State->V[1] = XXH_PRIME32_2;
+    State->V[2] = 0;
+    State->V[3] = 0 - XXH_PRIME32_1;
+}
+
+STATIC
+VOID
+XxhUpdate(
+    IN OUT LZ4_XXH32_STATE *State,
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+)
+{
+    UINTN Take;
+    UINTN i;
+
+    State->Length += Length;
+
+    if (State->PendingUsed > 0) {
+        Take = MIN(Length, sizeof(State->Pending) - State->PendingUsed);
+        CopyMemory(State->Pending + State->PendingUsed, Data, Take);
+        State->PendingUsed += Take;
+        Data += Take;
+        Length -= Take;
+        if (State->PendingUsed < sizeof(State->Pending)) {
+            return;
+        }
+        for (i = 0; i < 4; i++) {
+            State->V[i] = XxhRound(State->V[i], Lz4Read32(State->Pending + i * 4));
+        }
+        State->PendingUsed = 0;
+    }
+
+    while (Length >= 16) {
+        State->V[0] = XxhRound(State->V[0], Lz4Read32(Data));
+        State->V[1] = XxhRound(State->V[1], Lz4Read32(Data + 4));
+        State->V[2] = XxhRound(State->V[2], Lz4Read32(Data + 8));
+        State->V[3] = XxhRound(State->V[3], Lz4Read32(Data + 12));
+        Data += 16;
+        Length -= 16;
+    }
+
+    if (Length > 0) {
+        CopyMemory(State->Pending, Data, Length);
+        State->PendingUsed = Length;
+    }
+}
+
+STATIC
+UINT32
+XxhDigest(
+    IN CONST LZ4_XXH32_STATE *State
+)
+{
+    UINT32 Hash;
+    UINTN i;
+
+    if (State->Length >= 16) {
+        Hash = XxhRotl(State->V[0], 1) + XxhRotl(State->V[1], 7) +
+               XxhRotl(State->V[2], 12) + XxhRotl(State->V[3], 18);
+    } else {
+        Hash = State->V[2] + XXH_PRIME32_5;
+    }
+
+    Hash += (UINT32)State->Length;
+
+    for (i = 0; i + 4 <= State->PendingUsed; i += 4) {
+        Hash += Lz4Read32(State->Pending + i) * XXH_PRIME32_3;
+        Hash = XxhRotl(Hash, 17) * XXH_PRIME32_4;
+    }
+    for (; i < State->PendingUsed; i++) {
+        Hash += State->Pending[i] * XXH_PRIME32_5;
+        Hash = XxhRotl(Hash, 11) * XXH_PRIME32_1;
+    }
+
+    Hash ^= Hash >> 15;
+    Hash *= XXH_PRIME32_2;
+    Hash ^= Hash >> 13;
+    Hash *= XXH_PRIME32_3;
+    Hash ^= Hash >> 16;
+
+    return Hash;
+}
+
+STATIC
+UINT32
+Xxh32(
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+)
+{
+    LZ4_XXH32_STATE State;
+
+    XxhInit(&State);
+    XxhUpdate(&State, Data, Length);
+    return XxhDigest(&State);
+}
+
+/**
+ * Hand everything decoded since the last flush to the handler
+ * @param Stream - Decoder state
+ * @return EFI_STATUS - Handler status
+ */
+STATIC
+EFI_STATUS
+Lz4Flush(
+    IN OUT LZ4_STREAM *Stream
+)
+{
+    EFI_STATUS Status;
+    UINTN Length;
+
+    Length = Stream->Pos - Stream->Pending;
+    if (Length == 0) {
+        return EFI_SUCCESS;
+    }
+
+    if (Stream->ContentChecksum) {
+        XxhUpdate(&Stream->Xxh, Stream->Window + Stream->Pending, Length);
+    }
+
+    Status = Stream->Handler(Stream->Context, Stream->Flushed,
+                             Stream->Window + Stream->Pending, Length);
+    Stream->Flushed += Length;
+    Stream->Pending = Stream->Pos;
+
+    return Status;
+}
+
+/**
+ * Make room in the window, flushing and sliding it when full
+ * @param Stream - Decoder state
+ * @param Room - Pointer to receive the free bytes after Pos
+ * @return EFI_STATUS - Handler status
+ */
+STATIC
+EFI_STATUS
+Lz4Reserve(
+    IN OUT LZ4_STREAM *Stream,
+    OUT UINTN *Room
+)
+{
+    EFI_STATUS Status;
+
+    if (Stream->Pos == Stream->WindowSize) {
+        Status = Lz4Flush(Stream);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        // Keep one match distance of history at the front
+        CopyMemory(Stream->Window, Stream->Window + Stream->Pos - LZ4_HISTORY_SIZE,
+                   LZ4_HISTORY_SIZE);
+        Stream->Pos = LZ4_HISTORY_SIZE;
+        Stream->Pending = LZ4_HISTORY_SIZE;
+    }
+
+    *Room = Stream->WindowSize - Stream->Pos;
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+Lz4EmitLiterals(
+    IN OUT LZ4_STREAM *Stream,
+    IN CONST UINT8 *Source,
+    IN UINTN Length
+)
+{
+    EFI_STATUS Status;
+    UINTN Room;
+    UINTN Count;
+
+    while (Length > 0) {
+        Status = Lz4Reserve(Stream, &Room);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        Count = MIN(Length, Room);
+        CopyMemory(Stream->Window + Stream->Pos, Source, Count);
+        Stream->Pos += Count;
+        Source += Count;
+        Length -= Count;
+    }
+
+    return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+Lz4EmitMatch(
+    IN OUT LZ4_STREAM *Stream,
+    IN UINTN Offset,
+    IN UINTN Length
+)
+{
+    EFI_STATUS Status;
+    UINT8 *Dest;
+    UINTN Room;
+    UINTN Count;
+    UINTN Done;
+    UINTN Copy;
+
+    while (Length > 0) {
+        Status = Lz4Reserve(Stream, &Room);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        Count = MIN(Length, Room);
+        Dest = Stream->Window + Stream->Pos;
+
+        // An overlapping match repeats with period Offset, so the bytes from
+        // Dest - Offset can be copied in chunks that double each time and
+        // never overlap their own source
+        for (Done = 0; Done < Count; Done += Copy) {
+            Copy = MIN(Done + Offset, Count - Done);
+            CopyMemory(Dest + Done, Dest - Offset, Copy);
+        }
+
+        Stream->Pos += Count;
+        Length -= Count;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Decode one compressed block
+ * @param Stream - Decoder state
+ * @param Block - Block data
+ * @param BlockSize - Block size
+ * @param BlockMax - Largest decoded block the frame allows
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+Lz4DecodeBlock(
+    IN OUT LZ4_STREAM *Stream,
+    IN CONST UINT8 *Block,
+    IN UINTN BlockSize,
+    IN UINTN BlockMax
+)
+{
+    EFI_STATUS Status;
+    CONST UINT8 *End;
+    UINTN Produced;
+    UINTN Literals;
+    UINTN MatchLength;
+    UINTN Offset;
+    UINT8 Token;
+    UINT8 Extra;
+
+    End = Block + BlockSize;
+    Produced = 0;
+
+    for (;;) {
+        if (Block >= End) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Token = *Block++;
+
+        Literals = Token >> 4;
+        if (Literals == 15) {
+            do {
+                if (Block >= End) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                Extra = *Block++;
+                Literals += Extra;
+            } while (Extra == 255);
+        }
+
+        if (Literals > (UINTN)(End - Block) || Literals > BlockMax - Produced) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Status = Lz4EmitLiterals(Stream, Block, Literals);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        Block += Literals;
+        Produced += Literals;
+
+        // The last sequence of a block carries literals only
+        if (Block == End) {
+            return EFI_SUCCESS;
+        }
+
+        if (End - Block < 2) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        Offset = (UINTN)Block[0] | ((UINTN)Block[1] << 8);
+        Block += 2;
+
+        if (Offset == 0 || Offset > Stream->Pos) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        MatchLength = (Token & 0x0F) + LZ4_MIN_MATCH;
+        if ((Token & 0x0F) == 15) {
+            do {
+                if (Block >= End) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                Extra = *Block++;
+                MatchLength += Extra;
+            } while (Extra == 255);
+        }
+
+        if (MatchLength > BlockMax - Produced) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        Status = Lz4EmitMatch(Stream, Offset, MatchLength);
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+        Produced += MatchLength;
+    }
+}
+
+/**
+ * Parse the frame header
+ * @param Source - Frame data
+ * @param SourceSize - Frame size
+ * @param Flags - Pointer to receive the FLG byte
+ * @param BlockMax - Pointer to receive the maximum block size
+ * @param ContentSize - Pointer to receive the content size (0 if absent)
+ * @param HeaderSize - Pointer to receive the header length
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+Lz4ParseHeader(
+    IN CONST UINT8 *Source,
+    IN UINTN SourceSize,
+    OUT UINT8 *Flags,
+    OUT UINTN *BlockMax,
+    OUT UINT64 *ContentSize,
+    OUT UINTN *HeaderSize
+)
+{
+    UINTN DescriptorSize;
+    UINT8 Flg;
+    UINT8 Bd;
+
+    if (SourceSize < 7 || Lz4Read32(Source) != LZ4_FRAME_MAGIC) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    Flg = Source[4];
+    Bd = Source[5];
+
+    if ((Flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION_01 ||
+        (Flg & LZ4_FLG_RESERVED) != 0 || (Bd & LZ4_BD_RESERVED) != 0 ||
+        (Bd >> 4) < 4) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    if ((Flg & LZ4_FLG_DICT_ID) != 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    DescriptorSize = 2 + (((Flg & LZ4_FLG_CONTENT_SIZE) != 0) ? 8 : 0);
+    if (SourceSize < 4 + DescriptorSize + 1) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    if (Source[4 + DescriptorSize] != (UINT8)(Xxh32(Source + 4, DescriptorSize) >> 8)) {
+        return EFI_CRC_ERROR;
+    }
+
+    *ContentSize = 0;
+    if ((Flg & LZ4_FLG_CONTENT_SIZE) != 0) {
+        *ContentSize = (UINT64)Lz4Read32(Source + 6) | ((UINT64)Lz4Read32(Source + 10) << 32);
+    }
+
+    *Flags = Flg;
+    *BlockMax = (UINTN)1 << (8 + 2 * (Bd >> 4));
+    *HeaderSize = 4 + DescriptorSize + 1;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Read the declared content size of an LZ4 frame
+ * @param Source - Frame data
+ * @param SourceSize - Frame size
+ * @param ContentSize - Pointer to receive the content size
+ * @return EFI_STATUS - EFI_NOT_FOUND if the frame does not declare one
+ */
+EFI_STATUS
+EFIAPI
+lz4_get_content_size(
+    IN CONST VOID *Source,
+    IN UINTN SourceSize,
+    OUT UINT64 *ContentSize
+)
+{
+    EFI_STATUS Status;
+    UINT8 Flags;
+    UINTN BlockMax;
+    UINTN HeaderSize;
+
+    if (Source == NULL || ContentSize == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = Lz4ParseHeader(Source, SourceSize, &Flags, &BlockMax, ContentSize, &HeaderSize);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    return ((Flags & LZ4_FLG_CONTENT_SIZE) != 0) ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+/**
+ * Decode an LZ4 frame through a bounded window
+ * @param Source - Frame data
+ * @param SourceSize - Frame size
+ * @param Window - Scratch buffer of at least LZ4_MIN_WINDOW_SIZE bytes
+ * @param WindowSize - Scratch buffer size
+ * @param Handler - Called with each run of decoded bytes
+ * @param Context - Passed to Handler
+ * @param DecodedSize - Optional pointer to receive the decoded size
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+lz4_decode_frame(
+    IN CONST VOID *Source,
+    IN UINTN SourceSize,
+    IN UINT8 *Window,
+    IN UINTN WindowSize,
+    IN LZ4_OUTPUT_HANDLER Handler,
+    IN VOID *Context,
+    OUT UINT64 *DecodedSize OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    LZ4_STREAM Stream;
+    CONST UINT8 *Input;
+    CONST UINT8 *End;
+    UINT64 ContentSize;
+    UINTN HeaderSize;
+    UINTN BlockMax;
+    UINT32 BlockSize;
+    UINT8 Flags;
+
+    if (Source == NULL || Window == NULL || Handler == NULL ||
+        WindowSize < LZ4_MIN_WINDOW_SIZE) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Input = (CONST UINT8 *)Source;
+    End = Input + SourceSize;
+
+    Status = Lz4ParseHeader(Input, SourceSize, &Flags, &BlockMax, &ContentSize, &HeaderSize);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    Input += HeaderSize;
+
+    ZeroMemory(&Stream, sizeof(Stream));
+    Stream.Window = Window;
+    Stream.WindowSize = WindowSize;
+    Stream.Handler = Handler;
+    Stream.Context = Context;
+    Stream.ContentChecksum = ((Flags & LZ4_FLG_CONTENT_CHECKSUM) != 0) ? TRUE : FALSE;
+    XxhInit(&Stream.Xxh);
+
+    for (;;) {
+        if (End - Input < 4) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        BlockSize = Lz4Read32(Input);
+        Input += 4;
+
+        if (BlockSize == 0) {
+            break;
+        }
+
+        if ((BlockSize & ~LZ4_BLOCK_UNCOMPRESSED) > BlockMax ||
+            (BlockSize & ~LZ4_BLOCK_UNCOMPRESSED) > (UINTN)(End - Input)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        if ((Flags & LZ4_FLG_BLOCK_CHECKSUM) != 0) {
+            if ((UINTN)(End - Input) - (BlockSize & ~LZ4_BLOCK_UNCOMPRESSED) < 4) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            if (Xxh32(Input, BlockSize & ~LZ4_BLOCK_UNCOMPRESSED) !=
+                Lz4Read32(Input + (BlockSize & ~LZ4_BLOCK_UNCOMPRESSED))) {
+                return EFI_CRC_ERROR;
+            }
+        }
+
+        if ((BlockSize & LZ4_BLOCK_UNCOMPRESSED) != 0) {
+            BlockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+            Status = Lz4EmitLiterals(&Stream, Input, BlockSize);
+        } else {
+            Status = Lz4DecodeBlock(&Stream, Input, BlockSize, BlockMax);
+        }
+        if (EFI_ERROR(Status)) {
+            return Status;
+        }
+
+        Input += BlockSize;
+        if ((Flags & LZ4_FLG_BLOCK_CHECKSUM) != 0) {
+            Input += 4;
+        }
+    }
+
+    Status = Lz4Flush(&Stream);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    if (Stream.ContentChecksum) {
+        if (End - Input < 4) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (XxhDigest(&Stream.Xxh) != Lz4Read32(Input)) {
+            return EFI_CRC_ERROR;
+        }
+        Input += 4;
+    }
+
+    if (Input != End ||
+        ((Flags & LZ4_FLG_CONTENT_SIZE) != 0 && ContentSize != Stream.Flushed)) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    if (DecodedSize != NULL) {
+        *DecodedSize = Stream.Flushed;
+    }
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file lz4_decoder.h
+ * @brief Streaming LZ4 frame decoder
+ */
+
+#ifndef _LZ4_DECODER_H_
+#define _LZ4_DECODER_H_
+
+#include <Uefi.h>
+
+//
+// LZ4 Frame Definitions
+//
+#define LZ4_FRAME_MAGIC             0x184D2204
+#define LZ4_HISTORY_SIZE            (64 * 1024)     // Largest match distance
+#define LZ4_MIN_WINDOW_SIZE         (2 * LZ4_HISTORY_SIZE)
+
+/**
+ * Receives decoded data in order
+ * @param Context - Caller context
+ * @param Offset - Offset of Data in the decoded stream
+ * @param Data - Decoded bytes; only valid for the duration of the call
+ * @param Length - Number of bytes
+ * @return EFI_STATUS - Any error stops decoding and is returned to the caller
+ */
+typedef
+EFI_STATUS
+(EFIAPI *LZ4_OUTPUT_HANDLER)(
+    IN VOID *Context,
+    IN UINT64 Offset,
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+    );
+
+/**
+ * Read the declared content size of an LZ4 frame
+ * @param Source - Frame data
+ * @param SourceSize - Frame size
+ * @param ContentSize - Pointer to receive the content size
+ * @return EFI_STATUS - EFI_NOT_FOUND if the frame does not declare one
+ */
+EFI_STATUS
+EFIAPI
+lz4_get_content_size(
+    IN CONST VOID *Source,
+    IN UINTN SourceSize,
+    OUT UINT64 *ContentSize
+    );
+
+/**
+ * Decode an LZ4 frame through a bounded window
+ * @details Output is produced into Window and handed to Handler each time the
+ *          window fills, keeping the last LZ4_HISTORY_SIZE bytes for back
+ *          references, so memory use does not depend on the decoded size.
+ *          Header, block and content checksums are verified when present.
+ * @param Source - Frame data
+ * @param SourceSize - Frame size
+ * @param Window - Scratch buffer of at least LZ4_MIN_WINDOW_SIZE bytes
+ * @param WindowSize - Scratch buffer size
+ * @param Handler - Called with each run of decoded bytes
+ * @param Context - Passed to Handler
+ * @param DecodedSize - Optional pointer to receive the decoded size
+ * @return EFI_STATUS - EFI_VOLUME_CORRUPTED on malformed input,
+ *                      EFI_CRC_ERROR on a checksum mismatch
+ */
+EFI_STATUS
+EFIAPI
+lz4_decode_frame(
+    IN CONST VOID *Source,
+    IN UINTN SourceSize,
+    IN UINT8 *Window,
+    IN UINTN WindowSize,
+    IN LZ4_OUTPUT_HANDLER Handler,
+    IN VOID *Context,
+    OUT UINT64 *DecodedSize OPTIONAL
+    );
+
+#endif // _LZ4_DECODER_H_
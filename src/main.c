@@ -15,11 +15,18 @@
 #include "../include/common.h"
 #include "../include/config.h"
 #include "../include/debug_utils.h"
+#include "../include/metrics.h"
 #include "usb/usb_driver.h"
+#include "usb/usb_hid.h"
 #include "uefi/uefi_interface.h"
+#include "uefi/scheduler.h"
+#include "uefi/worker_pool.h"
+#include "uefi/memory_pool.h"
+#include "uefi/boot_cache.h"
 #include "firmware/firmware_loader.h"
+#include "firmware/firmware_pipeline.h"
 
-#ifdef ENABLE_UNIT_TESTS
+#if defined(ENABLE_UNIT_TESTS) || defined(ENABLE_BENCHMARKS)
 #include "../tests/test_runner.h"
 #endif
 
@@ -30,15 +37,47 @@ EFI_HANDLE gImageHandle;
 EFI_SYSTEM_TABLE *gST;
 UINT32 gDebugLevel = DEBUG_LEVEL_ALL;
 UINT32 gDebugCategories = DEBUG_CAT_USB | DEBUG_CAT_FIRMWARE | DEBUG_CAT_UEFI;
+UINT32 gTraceCategories = TRACE_DEFAULT_CATEGORIES;
+
+//
+// Subsystems the fast boot profile initializes on first use
+//
+typedef enum {
+    SubsystemWorkerPool,
+    SubsystemUsb,
+    SubsystemFirmwareLoader,
+    SubsystemCount
+} SUBSYSTEM_ID;
+
+typedef struct {
+    CONST CHAR16 *Name;
+    BOOLEAN Started;
+    EFI_STATUS Status;          // Result of the first initialization attempt
+} SUBSYSTEM_STATE;
+
+STATIC SUBSYSTEM_STATE mSubsystems[SubsystemCount] = {
+    { L"Worker pool", FALSE, EFI_NOT_STARTED },
+    { L"USB", FALSE, EFI_NOT_STARTED },
+    { L"Firmware loader", FALSE, EFI_NOT_STARTED }
+};
+STATIC UINTN mDeferredInitTask = 0;
 
 //
 // Forward declarations
 //
 STATIC EFI_STATUS InitializeSubsystems(VOID);
+STATIC EFI_STATUS RequireSubsystem(IN SUBSYSTEM_ID Id);
+#if defined(ENABLE_UNIT_TESTS) || defined(ENABLE_BENCHMARKS)
+STATIC VOID RequireAllSubsystems(VOID);
+#endif
+STATIC EFI_STATUS EFIAPI DeferredInitTask(IN VOID *Context);
 STATIC EFI_STATUS RunMainLoop(VOID);
 STATIC VOID CleanupAndExit(EFI_STATUS ExitStatus);
 STATIC VOID PrintBanner(VOID);
-STATIC EFI_STATUS ProcessUserCommands(VOID);
+STATIC EFI_STATUS ProcessUserCommands(IN CONST EFI_INPUT_KEY *Key);
+STATIC EFI_STATUS EFIAPI ConsoleKeyTask(IN VOID *Context);
+STATIC EFI_STATUS EFIAPI HidKeyTask(IN VOID *Context);
+STATIC EFI_STATUS EFIAPI UsbCompletionTask(IN VOID *Context);
 
 /**
  * Main entry point for the UEFI application
@@ -88,6 +127,9 @@ UefiMain(
 
 /**
  * Initialize all subsystems in order
+ * @details With FAST_BOOT only what the main loop needs is set up here; the
+ *          worker pool, USB and the firmware loader start on first use or
+ *          from a background task once the loop is idle.
  * @return EFI_STATUS - Success or error code
  */
 STATIC
@@ -101,39 +143,237 @@ InitializeSubsystems(VOID)
     
     DebugTimerStart(&Timer, "Subsystem Initialization");
     
+    // First, so every later subsystem can register its metrics
+    Status = metrics_init();
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("Metrics initialization failed: %r\n", Status);
+    }
+    
+    // Scratch allocators used by every subsystem below
+    Status = memory_pool_init();
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("Memory pool initialization failed: %r\n", Status);
+    }
+    
+    // Before any probe that can be answered from it
+    boot_cache_load();
+    
     // Initialize UEFI interface
     LOG_INFO("Initializing UEFI interface...\n");
     Status = uefi_interface_init();
     CHECK_STATUS(Status, "UEFI interface initialization failed");
     
-    // Initialize USB driver
-    LOG_INFO("Initializing USB driver...\n");
-    Status = usb_driver_init();
-    CHECK_STATUS(Status, "USB driver initialization failed");
+    // Initialize the scheduler before subsystems that register tasks
+    Status = scheduler_init();
+    CHECK_STATUS(Status, "Scheduler initialization failed");
     
-    // Detect USB devices
-    LOG_INFO("Detecting USB devices...\n");
-    Status = usb_device_detect();
-    if (EFI_ERROR(Status)) {
-        LOG_WARN("USB device detection failed: %r\n", Status);
-        // Continue execution even if no devices found
+    if (!FAST_BOOT) {
+        RequireSubsystem(SubsystemWorkerPool);
+        
+        Status = RequireSubsystem(SubsystemUsb);
+        CHECK_STATUS(Status, "USB driver initialization failed");
+        
+        Status = RequireSubsystem(SubsystemFirmwareLoader);
+        CHECK_STATUS(Status, "Firmware loader initialization failed");
     }
     
-    // Initialize firmware loader
-    LOG_INFO("Initializing firmware loader...\n");
-    Status = firmware_loader_init();
-    CHECK_STATUS(Status, "Firmware loader initialization failed");
+    // Probes that missed the cache are saved for the next boot
+    boot_cache_flush();
     
     DebugTimerEnd(&Timer);
     
     LOG_INFO("All subsystems initialized successfully\n");
     
-    DBG_EXIT_STATUS(Status);
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Initialize a subsystem unless that was already attempted
+ * @details Only the first call initializes; later calls return its result,
+ *          so a subsystem that failed is not retried on every command.
+ * @param Id - Subsystem to initialize
+ * @return EFI_STATUS - Result of the initialization
+ */
+STATIC
+EFI_STATUS
+RequireSubsystem(
+    IN SUBSYSTEM_ID Id
+)
+{
+    EFI_STATUS Status;
+    EFI_EVENT Event;
+    
+    if (mSubsystems[Id].Started) {
+        return mSubsystems[Id].Status;
+    }
+    mSubsystems[Id].Started = TRUE;
+    
+    switch (Id) {
+        case SubsystemWorkerPool:
+            // Validation and decompression fall back to the BSP if this fails
+            Status = worker_pool_init();
+            if (EFI_ERROR(Status)) {
+                LOG_WARN("Worker pool initialization failed: %r\n", Status);
+            }
+            break;
+            
+        case SubsystemUsb:
+            LOG_INFO("Initializing USB driver...\n");
+            Status = usb_driver_init();
+            if (EFI_ERROR(Status)) {
+                break;
+            }
+            
+            // Detect USB devices
+            LOG_INFO("Detecting USB devices...\n");
+            if (EFI_ERROR(usb_device_detect())) {
+                LOG_WARN("USB device detection failed\n");
+                // Continue execution even if no devices found
+            }
+            
+            // USB HID keyboards feed the same commands as ConIn
+            Event = usb_hid_get_key_event();
+            if (Event != NULL) {
+                scheduler_add_task(L"HID keys", HidKeyTask, NULL, SCHEDULER_PRIORITY_HIGH, Event, 0, NULL);
+            }
+            
+            Event = usb_get_completion_event();
+            if (Event != NULL) {
+                scheduler_add_task(L"USB done", UsbCompletionTask, NULL, SCHEDULER_PRIORITY_NORMAL, Event, 0, NULL);
+            }
+            break;
+            
+        case SubsystemFirmwareLoader:
+            RequireSubsystem(SubsystemWorkerPool);
+            LOG_INFO("Initializing firmware loader...\n");
+            Status = firmware_loader_init();
+            break;
+            
+        default:
+            Status = EFI_INVALID_PARAMETER;
+            break;
+    }
+    
+    mSubsystems[Id].Status = Status;
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("%s initialization failed: %r\n", mSubsystems[Id].Name, Status);
+    }
+    
+    return Status;
+}
+
+#if defined(ENABLE_UNIT_TESTS) || defined(ENABLE_BENCHMARKS)
+/**
+ * Initialize every deferred subsystem, e.g. before running the test suites
+ */
+STATIC
+VOID
+RequireAllSubsystems(VOID)
+{
+    UINTN Id;
+    
+    for (Id = 0; Id < SubsystemCount; Id++) {
+        RequireSubsystem((SUBSYSTEM_ID)Id);
+    }
+}
+#endif
+
+/**
+ * Scheduler background task: initialize one deferred subsystem per step
+ * @details Runs only while the main loop is idle and removes itself once
+ *          every subsystem has started, so a command or key press is never
+ *          held up by more than one subsystem's initialization.
+ * @param Context - Unused
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+DeferredInitTask(
+    IN VOID *Context
+)
+{
+    UINTN Id;
+    
+    for (Id = 0; Id < SubsystemCount; Id++) {
+        if (!mSubsystems[Id].Started) {
+            RequireSubsystem((SUBSYSTEM_ID)Id);
+            return EFI_SUCCESS;
+        }
+    }
+    
+    LOG_INFO("Deferred initialization complete\n");
+    return scheduler_remove_task(mDeferredInitTask);
+}
+
+/**
+ * Scheduler task: run the command for a ConIn key press
+ * @param Context - Unused
+ * @return EFI_STATUS - Success, error code, or EFI_ABORTED to exit
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+ConsoleKeyTask(
+    IN VOID *Context
+)
+{
+    EFI_STATUS Status;
+    EFI_INPUT_KEY Key;
+    
+    Status = gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);
+    if (EFI_ERROR(Status)) {
+        // The key was consumed elsewhere
+        return EFI_SUCCESS;
+    }
+    
+    return ProcessUserCommands(&Key);
+}
+
+/**
+ * Scheduler task: run the commands for buffered USB HID key presses
+ * @param Context - Unused
+ * @return EFI_STATUS - Success, error code, or EFI_ABORTED to exit
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+HidKeyTask(
+    IN VOID *Context
+)
+{
+    EFI_STATUS Status;
+    EFI_INPUT_KEY Key;
+    
+    Status = EFI_SUCCESS;
+    while (Status != EFI_ABORTED && !EFI_ERROR(usb_hid_read_key(&Key))) {
+        Status = ProcessUserCommands(&Key);
+    }
+    
+    return Status;
+}
+
+/**
+ * Scheduler task: report completed queued USB transfers
+ * @param Context - Unused
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+UsbCompletionTask(
+    IN VOID *Context
+)
+{
+    LOG_INFO("%d queued USB transfers completed\n", usb_transfer_reap());
     return EFI_SUCCESS;
 }
 
 /**
  * Main application loop
+ * @details Input and completion handlers are scheduler tasks; subsystems
+ *          may add their own periodic or background tasks.
  * @return EFI_STATUS - Success or error code
  */
 STATIC
@@ -141,88 +381,47 @@ EFI_STATUS
 RunMainLoop(VOID)
 {
     EFI_STATUS Status;
-    UINTN EventIndex;
-    EFI_EVENT TimerEvent;
-    EFI_EVENT WaitList[2];
     
     DBG_ENTER();
     
-    // Create timer event for periodic tasks
-    Status = gBS->CreateEvent(
-        EVT_TIMER,
-        TPL_CALLBACK,
-        NULL,
-        NULL,
-        &TimerEvent
-    );
-    CHECK_STATUS(Status, "Failed to create timer event");
+    Status = scheduler_add_task(L"Console", ConsoleKeyTask, NULL, SCHEDULER_PRIORITY_HIGH,
+                                gST->ConIn->WaitForKey, 0, NULL);
+    CHECK_STATUS(Status, "Failed to schedule console input");
     
-    // Set timer to fire every second
-    Status = gBS->SetTimer(TimerEvent, TimerPeriodic, 10000000); // 1 second
-    CHECK_STATUS(Status, "Failed to set timer");
-    
-    WaitList[0] = gST->ConIn->WaitForKey;
-    WaitList[1] = TimerEvent;
+    // USB registers its HID and completion tasks when it starts
+    if (FAST_BOOT) {
+        scheduler_add_task(L"Deferred init", DeferredInitTask, NULL, SCHEDULER_PRIORITY_LOW,
+                           NULL, 0, &mDeferredInitTask);
+    }
     
     LOG_INFO("Entering main loop - Press any key for commands\n");
     LOG_INFO("System ready for debugging operations\n");
     
-    // Main event loop
-    while (TRUE) {
-        Status = gBS->WaitForEvent(2, WaitList, &EventIndex);
-        if (EFI_ERROR(Status)) {
-            LOG_ERROR("WaitForEvent failed: %r\n", Status);
-            break;
-        }
-        
-        switch (EventIndex) {
-            case 0: // Keyboard input
-                Status = ProcessUserCommands();
-                if (Status == EFI_ABORTED) {
-                    // User requested exit
-                    LOG_INFO("Exit requested by user\n");
-                    gBS->CloseEvent(TimerEvent);
-                    DBG_EXIT_STATUS(EFI_SUCCESS);
-                    return EFI_SUCCESS;
-                }
-                break;
-                
-            case 1: // Timer event
-                // Perform periodic tasks
-                usb_driver_status();
-                break;
-                
-            default:
-                LOG_WARN("Unexpected event index: %d\n", EventIndex);
-                break;
-        }
+    Status = scheduler_run();
+    if (!EFI_ERROR(Status)) {
+        LOG_INFO("Exit requested by user\n");
     }
     
-    gBS->CloseEvent(TimerEvent);
     DBG_EXIT_STATUS(Status);
     return Status;
 }
 
 /**
- * Process user commands from keyboard input
+ * Process a user command key from ConIn or a USB HID keyboard
+ * @param Key - Key that was pressed
  * @return EFI_STATUS - Success, error code, or EFI_ABORTED to exit
  */
 STATIC
 EFI_STATUS
-ProcessUserCommands(VOID)
+ProcessUserCommands(IN CONST EFI_INPUT_KEY *Key)
 {
-    EFI_INPUT_KEY Key;
+#ifdef ENABLE_UNIT_TESTS
     EFI_STATUS Status;
+#endif
     
-    // Read the key
-    Status = gST->ConIn->ReadKeyStroke(gST->ConIn, &Key);
-    if (EFI_ERROR(Status)) {
-        return Status;
-    }
-    
-    Print(L"\nCommand received: %c\n", Key.UnicodeChar);
+    Print(L"\nCommand received: %c\n", Key->UnicodeChar);
     
-    switch (Key.UnicodeChar) {
+    switch (Key->UnicodeChar) {
         case L'h':
         case L'H':
         case L'?':
@@ -231,8 +430,11 @@ ProcessUserCommands(VOID)
             Print(L"  u/U    - USB device status\n");
             Print(L"  f/F    - Firmware information\n");
             Print(L"  s/S    - System information\n");
-            Print(L"  d/D    - Debug level control\n");
-            Print(L"  r/R    - Reset USB subsystem\n");
+            Print(L"  d/D    - Debug level and trace dump\n");
+            Print(L"  m/M    - Operation latency metrics\n");
+            Print(L"  x/X    - Export metrics as CSV\n");
+            Print(L"  b/B    - Run benchmarks (CSV)\n");
+            Print(L"  r/R    - Rescan USB devices\n");
             Print(L"  q/Q    - Quit application\n");
             Print(L"  test   - Run comprehensive test suite\n");
             Print(L"  test-usb - Run USB-specific tests\n");
@@ -243,34 +445,54 @@ ProcessUserCommands(VOID)
         case L'u':
         case L'U':
             Print(L"\nUSB Device Status:\n");
+            RequireSubsystem(SubsystemUsb);
             usb_driver_status();
             break;
             
         case L'f':
         case L'F':
             Print(L"\nFirmware Information:\n");
+            RequireSubsystem(SubsystemFirmwareLoader);
             firmware_loader_status();
+            firmware_pipeline_status();
             break;
             
         case L's':
         case L'S':
             Print(L"\nSystem Information:\n");
             uefi_interface_status();
+            boot_cache_status();
+            scheduler_status();
+            RequireSubsystem(SubsystemWorkerPool);
+            worker_pool_status();
+            memory_pool_status();
             break;
             
         case L'd':
         case L'D':
             Print(L"\nDebug Level: 0x%08X, Categories: 0x%08X\n", 
                   gDebugLevel, gDebugCategories);
+            DebugTraceDump(TRACE_DUMP_RECORDS);
+            break;
+            
+        case L'm':
+        case L'M':
+            Print(L"\n");
+            metrics_status();
+            break;
+            
+        case L'x':
+        case L'X':
+            Print(L"\n");
+            metrics_dump();
             break;
             
         case L'r':
         case L'R':
-            Print(L"\nResetting USB subsystem...\n");
-            usb_driver_cleanup();
-            usb_driver_init();
-            usb_device_detect();
-            Print(L"USB subsystem reset complete\n");
+            Print(L"\nRescanning USB devices...\n");
+            RequireSubsystem(SubsystemUsb);
+            usb_device_rescan();
+            Print(L"USB rescan complete: %d devices connected\n", usb_get_connected_count());
             break;
             
         case L'q':
@@ -282,6 +504,7 @@ ProcessUserCommands(VOID)
         case L'T':
 #ifdef ENABLE_UNIT_TESTS
             Print(L"\nRunning comprehensive test suite...\n");
+            RequireAllSubsystems();
             Status = RunAllTests();
             if (EFI_ERROR(Status)) {
                 Print(L"Tests failed: %r\n", Status);
@@ -293,6 +516,16 @@ ProcessUserCommands(VOID)
 #endif
             break;
             
+        case L'b':
+        case L'B':
+#ifdef ENABLE_BENCHMARKS
+            RequireAllSubsystems();
+            RunBenchmarks();
+#else
+            Print(L"\nBenchmarks not enabled in this build (make benchmark)\n");
+#endif
+            break;
+            
         default:
             Print(L"\nUnknown command. Press 'h' for help.\n");
             break;
@@ -316,10 +549,17 @@ CleanupAndExit(
     LOG_INFO("Cleaning up resources...\n");
     
     // Cleanup subsystems in reverse order
+    scheduler_cleanup();
     firmware_loader_cleanup();
     usb_driver_cleanup();
+    worker_pool_cleanup();
     uefi_interface_cleanup();
     
+    boot_cache_flush();
+    
+    // Last: returns whatever the subsystems above still hold
+    memory_pool_cleanup();
+    
     if (EFI_ERROR(ExitStatus)) {
         Print(L"\nApplication exiting with error: %r\n", ExitStatus);
     } else {
@@ -0,0 +1,412 @@
+/**
+ * @file metrics.c
+ * @brief Latency histograms and byte counters for flash, USB and loader operations
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "../include/common.h"
+#include "../include/config.h"
+#include "../include/metrics.h"
+
+//
+// Static variables
+//
+STATIC METRICS_ENTRY mMetrics[METRICS_MAX_ENTRIES];
+STATIC UINTN mMetricCount = 0;
+STATIC UINT64 mTicksPerMs = 0;
+
+/**
+ * Get the histogram bucket for a duration
+ * @param Ticks - Duration in TSC ticks
+ * @return UINTN - log2 of the duration in ns, clamped to the last bucket
+ */
+STATIC
+UINTN
+MetricsBucket(
+    IN UINT64 Ticks
+)
+{
+    INTN HighBit;
+
+    HighBit = HighBitSet64(metrics_ticks_to_ns(Ticks));
+    if (HighBit < 0) {
+        return 0;
+    }
+
+    return MIN((UINTN)HighBit, (UINTN)(METRICS_BUCKETS - 1));
+}
+
+/**
+ * Get the throughput of a metric over the time its operations took
+ * @param Entry - Metric
+ * @return UINT64 - Kilobytes (1000 bytes) per second, 0 without timed samples
+ */
+STATIC
+UINT64
+MetricsKilobytesPerSecond(
+    IN CONST METRICS_ENTRY *Entry
+)
+{
+    if (Entry->TotalTicks == 0) {
+        return 0;
+    }
+
+    // Bytes per millisecond is kB/s
+    return DivU64x64Remainder(MultU64x64(Entry->Bytes, mTicksPerMs), Entry->TotalTicks, NULL);
+}
+
+/**
+ * Calibrate the TSC against gBS->Stall and clear every metric
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_init(VOID)
+{
+    DBG_ENTER();
+
+    ZeroMemory(mMetrics, sizeof(mMetrics));
+    mMetricCount = 0;
+    mTicksPerMs = 0;
+
+    LOG_INFO("Metrics: TSC runs at %ld kHz\n", metrics_get_ticks_per_ms());
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Find a metric by name, creating it on first use
+ * @param Name - Metric name
+ * @param MetricId - Receives the metric id
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES when METRICS_MAX_ENTRIES are in use
+ */
+EFI_STATUS
+EFIAPI
+metrics_register(
+    IN CONST CHAR16 *Name,
+    OUT UINTN *MetricId
+)
+{
+    UINTN Index;
+
+    if (Name == NULL || MetricId == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *MetricId = METRICS_INVALID_ID;
+
+    for (Index = 0; Index < mMetricCount; Index++) {
+        if (StrnCmp(mMetrics[Index].Name, Name, METRICS_NAME_LENGTH - 1) == 0) {
+            *MetricId = Index;
+            return EFI_SUCCESS;
+        }
+    }
+
+    if (mMetricCount >= METRICS_MAX_ENTRIES) {
+        LOG_WARN("Metrics table full, %s is not recorded\n", Name);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    ZeroMemory(&mMetrics[mMetricCount], sizeof(METRICS_ENTRY));
+    StrnCpyS(mMetrics[mMetricCount].Name, METRICS_NAME_LENGTH, Name, METRICS_NAME_LENGTH - 1);
+    mMetrics[mMetricCount].MinTicks = MAX_UINT64;
+    *MetricId = mMetricCount++;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Record one operation timed with DebugTimerStart
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Timer - Timer started before the operation; its EndTick is set
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_record(
+    IN UINTN MetricId,
+    IN OUT DEBUG_TIMER *Timer,
+    IN UINT64 Bytes
+)
+{
+    if (Timer == NULL) {
+        return;
+    }
+
+    Timer->EndTick = AsmReadTsc();
+    metrics_record_ticks(MetricId, Timer->EndTick - Timer->StartTick, Bytes);
+}
+
+/**
+ * Record one operation whose duration was measured elsewhere
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Ticks - Duration in TSC ticks
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_record_ticks(
+    IN UINTN MetricId,
+    IN UINT64 Ticks,
+    IN UINT64 Bytes
+)
+{
+    METRICS_ENTRY *Entry;
+
+    if (MetricId >= mMetricCount) {
+        return;
+    }
+
+    Entry = &mMetrics[MetricId];
+    Entry->Count++;
+    Entry->Samples++;
+    Entry->Bytes += Bytes;
+    Entry->TotalTicks += Ticks;
+    Entry->MinTicks = MIN(Entry->MinTicks, Ticks);
+    Entry->MaxTicks = MAX(Entry->MaxTicks, Ticks);
+    Entry->Buckets[MetricsBucket(Ticks)]++;
+}
+
+/**
+ * Count an operation without a latency
+ * @param MetricId - Metric id; METRICS_INVALID_ID is ignored
+ * @param Bytes - Bytes moved by the operation
+ */
+VOID
+EFIAPI
+metrics_count(
+    IN UINTN MetricId,
+    IN UINT64 Bytes
+)
+{
+    if (MetricId >= mMetricCount) {
+        return;
+    }
+
+    mMetrics[MetricId].Count++;
+    mMetrics[MetricId].Bytes += Bytes;
+}
+
+/**
+ * Get the measured TSC rate, calibrating on first use
+ * @return UINT64 - TSC ticks per millisecond
+ */
+UINT64
+EFIAPI
+metrics_get_ticks_per_ms(VOID)
+{
+    UINT64 Start;
+
+    if (mTicksPerMs == 0) {
+        Start = AsmReadTsc();
+        gBS->Stall(METRICS_CALIBRATE_US);
+        mTicksPerMs = DivU64x32(MultU64x32(AsmReadTsc() - Start, 1000), METRICS_CALIBRATE_US);
+        if (mTicksPerMs == 0) {
+            mTicksPerMs = 1;
+        }
+    }
+
+    return mTicksPerMs;
+}
+
+/**
+ * Convert TSC ticks to nanoseconds
+ * @param Ticks - TSC ticks
+ * @return UINT64 - Nanoseconds
+ */
+UINT64
+EFIAPI
+metrics_ticks_to_ns(
+    IN UINT64 Ticks
+)
+{
+    UINT64 TicksPerMs;
+
+    TicksPerMs = metrics_get_ticks_per_ms();
+
+    // Keep full precision unless Ticks * 10^6 would overflow
+    if (Ticks < BIT44) {
+        return DivU64x64Remainder(MultU64x32(Ticks, 1000000), TicksPerMs, NULL);
+    }
+
+    return MultU64x32(DivU64x64Remainder(Ticks, TicksPerMs, NULL), 1000000);
+}
+
+/**
+ * Estimate a latency percentile from the histogram
+ * @param MetricId - Metric id
+ * @param Percent - Percentile, 1..100
+ * @return UINT64 - Upper bound of the bucket holding the percentile in ns, 0 if no samples
+ */
+UINT64
+EFIAPI
+metrics_get_percentile(
+    IN UINTN MetricId,
+    IN UINTN Percent
+)
+{
+    METRICS_ENTRY *Entry;
+    UINT64 Target;
+    UINT64 Seen;
+    UINTN Bucket;
+
+    if (MetricId >= mMetricCount || Percent == 0 || Percent > 100) {
+        return 0;
+    }
+
+    Entry = &mMetrics[MetricId];
+    if (Entry->Samples == 0) {
+        return 0;
+    }
+
+    // Rank of the sample at the percentile, rounded up
+    Target = DivU64x32(MultU64x32(Entry->Samples, (UINT32)Percent) + 99, 100);
+
+    Seen = 0;
+    for (Bucket = 0; Bucket < METRICS_BUCKETS; Bucket++) {
+        Seen += Entry->Buckets[Bucket];
+        if (Seen >= Target) {
+            break;
+        }
+    }
+
+    // The slowest sample is a tighter bound for the top bucket
+    return MIN(LShiftU64(1, Bucket + 1), metrics_ticks_to_ns(Entry->MaxTicks));
+}
+
+/**
+ * Get a copy of a metric
+ * @param MetricId - Metric id
+ * @param Entry - Receives the metric
+ * @return EFI_STATUS - EFI_NOT_FOUND for an unknown id
+ */
+EFI_STATUS
+EFIAPI
+metrics_get_entry(
+    IN UINTN MetricId,
+    OUT METRICS_ENTRY *Entry
+)
+{
+    if (Entry == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (MetricId >= mMetricCount) {
+        return EFI_NOT_FOUND;
+    }
+
+    CopyMemory(Entry, &mMetrics[MetricId], sizeof(METRICS_ENTRY));
+    return EFI_SUCCESS;
+}
+
+/**
+ * Clear the counters and histograms of every metric, keeping the ids
+ */
+VOID
+EFIAPI
+metrics_reset(VOID)
+{
+    UINTN Index;
+
+    for (Index = 0; Index < mMetricCount; Index++) {
+        mMetrics[Index].Count = 0;
+        mMetrics[Index].Bytes = 0;
+        mMetrics[Index].TotalTicks = 0;
+        mMetrics[Index].MinTicks = MAX_UINT64;
+        mMetrics[Index].MaxTicks = 0;
+        mMetrics[Index].Samples = 0;
+        ZeroMemory(mMetrics[Index].Buckets, sizeof(mMetrics[Index].Buckets));
+    }
+}
+
+/**
+ * Print a table of every metric with throughput and latency percentiles
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_status(VOID)
+{
+    METRICS_ENTRY *Entry;
+    UINTN Index;
+    UINT64 Rate;
+
+    Print(L"Metrics (TSC %ld kHz, %d metrics):\n", metrics_get_ticks_per_ms(), mMetricCount);
+    Print(L"  %-32s %8s %10s %9s %9s %9s %9s\n",
+          L"Name", L"Count", L"MB/s", L"avg us", L"p50 us", L"p99 us", L"max us");
+
+    for (Index = 0; Index < mMetricCount; Index++) {
+        Entry = &mMetrics[Index];
+        if (Entry->Count == 0) {
+            continue;
+        }
+
+        if (Entry->Samples == 0) {
+            // Byte counter only
+            Print(L"  %-32s %8ld %10s (%ld bytes)\n", Entry->Name, Entry->Count, L"-", Entry->Bytes);
+            continue;
+        }
+
+        Rate = MetricsKilobytesPerSecond(Entry);
+        Print(L"  %-32s %8ld %6ld.%03ld %9ld %9ld %9ld %9ld\n",
+              Entry->Name,
+              Entry->Count,
+              DivU64x32(Rate, 1000),
+              ModU64x32(Rate, 1000),
+              DivU64x64Remainder(metrics_ticks_to_ns(Entry->TotalTicks), Entry->Samples * 1000, NULL),
+              DivU64x32(metrics_get_percentile(Index, 50), 1000),
+              DivU64x32(metrics_get_percentile(Index, 99), 1000),
+              DivU64x32(metrics_ticks_to_ns(Entry->MaxTicks), 1000));
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Print every metric as CSV, histogram included, for offline comparison
+ * @details The histogram column lists "bucket:count" pairs for non-empty
+ *          buckets; bucket n covers [2^n, 2^(n+1)) ns.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+metrics_dump(VOID)
+{
+    METRICS_ENTRY *Entry;
+    UINTN Index;
+    UINTN Bucket;
+
+    Print(L"# usb-uefi-firmware metrics v1, tsc_khz=%ld\n", metrics_get_ticks_per_ms());
+    Print(L"metric,count,bytes,samples,total_ns,min_ns,max_ns,p50_ns,p99_ns,kb_per_s,histogram\n");
+
+    for (Index = 0; Index < mMetricCount; Index++) {
+        Entry = &mMetrics[Index];
+
+        Print(L"%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,",
+              Entry->Name,
+              Entry->Count,
+              Entry->Bytes,
+              Entry->Samples,
+              metrics_ticks_to_ns(Entry->TotalTicks),
+              (Entry->Samples != 0) ? metrics_ticks_to_ns(Entry->MinTicks) : 0,
+              metrics_ticks_to_ns(Entry->MaxTicks),
+              metrics_get_percentile(Index, 50),
+              metrics_get_percentile(Index, 99),
+              MetricsKilobytesPerSecond(Entry));
+
+        for (Bucket = 0; Bucket < METRICS_BUCKETS; Bucket++) {
+            if (Entry->Buckets[Bucket] != 0) {
+                Print(L"%d:%d ", Bucket, Entry->Buckets[Bucket]);
+            }
+        }
+        Print(L"\n");
+    }
+
+    return EFI_SUCCESS;
+}
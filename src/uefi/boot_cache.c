@@ -0,0 +1,355 @@
+/**
+ * @file boot_cache.c
+ * @brief Probe results kept in NVRAM for the fast boot profile
+ *
+ * CPUID brand detection gives the same answers on every boot of the same
+ * machine. Anything the key below cannot see change, such as the memory
+ * map, the TPM or the FVB layout, is probed again every boot.
+ * In the FAST_BOOT profile the CPU results are kept in one versioned NVRAM
+ * variable. A boot only trusts it after comparing a key built from the
+ * system table and CPUID leaf 1, which is far cheaper than the probes.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "boot_cache.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+#define BOOT_CACHE_SIGNATURE        SIGNATURE_32('F', 'B', 'C', 'A')
+#define BOOT_CACHE_VERSION          2
+
+//
+// NVRAM image. The checksum covers everything after it.
+//
+#pragma pack(1)
+typedef struct {
+    UINT32 Signature;
+    UINT16 Version;
+    UINT16 SlotCount;
+    UINT32 Checksum;
+    BOOT_CACHE_KEY Key;
+    UINT16 SlotSize[BootCacheSlotCount];        // 0 for an empty slot
+    UINT8 Slot[BootCacheSlotCount][BOOT_CACHE_SLOT_SIZE];
+} BOOT_CACHE_IMAGE;
+#pragma pack()
+
+STATIC EFI_GUID mFirmwareVariableGuid = FIRMWARE_VARIABLE_GUID;
+STATIC BOOT_CACHE_IMAGE mImage;
+STATIC BOOLEAN mBootCacheEnabled = FALSE;
+STATIC BOOLEAN mBootCacheDirty = FALSE;
+STATIC EFI_STATUS mLoadStatus = EFI_NOT_STARTED;
+STATIC BOOLEAN mSlotHit[BootCacheSlotCount];    // Served from the variable this boot
+
+STATIC CONST CHAR16 *mSlotNames[BootCacheSlotCount] = {
+    L"CPU info"
+};
+
+/**
+ * Build the key of the running system
+ * @param Key - Key to fill in
+ */
+STATIC
+VOID
+BootCacheBuildKey(
+    OUT BOOT_CACHE_KEY *Key
+)
+{
+    UINT32 Eax;
+
+    ZeroMemory(Key, sizeof(BOOT_CACHE_KEY));
+    Key->UefiRevision = gST->Hdr.Revision;
+    Key->FirmwareRevision = gST->FirmwareRevision;
+    if (gST->FirmwareVendor != NULL) {
+        Key->FirmwareVendorCrc = CalculateCrc32(gST->FirmwareVendor, StrSize(gST->FirmwareVendor));
+    }
+
+    AsmCpuid(1, &Eax, NULL, NULL, NULL);
+    Key->CpuSignature = Eax;
+
+    Key->BuildId = (FIRMWARE_VERSION_MAJOR << 24) | (FIRMWARE_VERSION_MINOR << 16) |
+                   (FIRMWARE_VERSION_PATCH << 8) | FIRMWARE_BUILD_NUMBER;
+}
+
+/**
+ * Checksum the image as it would be written
+ * @return UINT32 - CRC32 of everything after the checksum field
+ */
+STATIC
+UINT32
+BootCacheChecksum(
+    VOID
+)
+{
+    UINTN Offset;
+
+    Offset = OFFSET_OF(BOOT_CACHE_IMAGE, Checksum) + sizeof(mImage.Checksum);
+    return CalculateCrc32((UINT8 *)&mImage + Offset, sizeof(mImage) - Offset);
+}
+
+/**
+ * Empty every slot and key the image to the running system
+ */
+STATIC
+VOID
+BootCacheReset(
+    VOID
+)
+{
+    ZeroMemory(&mImage, sizeof(mImage));
+    mImage.Signature = BOOT_CACHE_SIGNATURE;
+    mImage.Version = BOOT_CACHE_VERSION;
+    mImage.SlotCount = BootCacheSlotCount;
+    BootCacheBuildKey(&mImage.Key);
+}
+
+/**
+ * Load the probe results of an earlier boot
+ * @return EFI_STATUS - EFI_NOT_FOUND if nothing usable was persisted,
+ *                      EFI_UNSUPPORTED if fast boot is disabled
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_load(
+    VOID
+)
+{
+    EFI_STATUS Status;
+    BOOT_CACHE_KEY Key;
+    UINTN DataSize;
+    UINT32 Attributes;
+    UINTN Index;
+
+    mBootCacheEnabled = FAST_BOOT;
+    mBootCacheDirty = FALSE;
+    ZeroMemory(mSlotHit, sizeof(mSlotHit));
+
+    if (!mBootCacheEnabled || gRT == NULL) {
+        mBootCacheEnabled = FALSE;
+        mLoadStatus = EFI_UNSUPPORTED;
+        return mLoadStatus;
+    }
+
+    DataSize = sizeof(mImage);
+    Status = gRT->GetVariable(
+        BOOT_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        &Attributes,
+        &DataSize,
+        &mImage
+    );
+
+    if (EFI_ERROR(Status) ||
+        DataSize != sizeof(mImage) ||
+        mImage.Signature != BOOT_CACHE_SIGNATURE ||
+        mImage.Version != BOOT_CACHE_VERSION ||
+        mImage.SlotCount != BootCacheSlotCount ||
+        mImage.Checksum != BootCacheChecksum()) {
+        if (Status != EFI_NOT_FOUND) {
+            LOG_WARN("Ignoring unusable fast boot cache variable: %r\n", Status);
+            Status = EFI_ERROR(Status) ? Status : EFI_VOLUME_CORRUPTED;
+        }
+        BootCacheReset();
+        mLoadStatus = Status;
+        return Status;
+    }
+
+    BootCacheBuildKey(&Key);
+    if (CompareMem(&mImage.Key, &Key, sizeof(Key)) != 0) {
+        LOG_INFO("Fast boot cache is from other firmware or hardware, probing again\n");
+        BootCacheReset();
+        mLoadStatus = EFI_NOT_FOUND;
+        return mLoadStatus;
+    }
+
+    for (Index = 0; Index < BootCacheSlotCount; Index++) {
+        if (mImage.SlotSize[Index] > BOOT_CACHE_SLOT_SIZE) {
+            mImage.SlotSize[Index] = 0;
+        }
+    }
+
+    LOG_INFO("Loaded fast boot cache\n");
+    mLoadStatus = EFI_SUCCESS;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Copy a cached probe result
+ * @param Slot - Slot to read
+ * @param Data - Buffer to receive the structure
+ * @param Size - Size of the structure
+ * @return EFI_STATUS - EFI_NOT_FOUND if the slot is empty or was stored with another size
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_get(
+    IN BOOT_CACHE_SLOT Slot,
+    OUT VOID *Data,
+    IN UINTN Size
+)
+{
+    if (Slot >= BootCacheSlotCount || Data == NULL || Size == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (!mBootCacheEnabled) {
+        return EFI_UNSUPPORTED;
+    }
+
+    if (mImage.SlotSize[Slot] != Size) {
+        return EFI_NOT_FOUND;
+    }
+
+    CopyMemory(Data, mImage.Slot[Slot], Size);
+    mSlotHit[Slot] = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Store a probe result for later boots
+ * @param Slot - Slot to write
+ * @param Data - Structure to store
+ * @param Size - Size of the structure, at most BOOT_CACHE_SLOT_SIZE
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_set(
+    IN BOOT_CACHE_SLOT Slot,
+    IN CONST VOID *Data,
+    IN UINTN Size
+)
+{
+    if (Slot >= BootCacheSlotCount || Data == NULL || Size == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (Size > BOOT_CACHE_SLOT_SIZE) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    if (!mBootCacheEnabled) {
+        return EFI_UNSUPPORTED;
+    }
+
+    if (mImage.SlotSize[Slot] == Size && CompareMem(mImage.Slot[Slot], Data, Size) == 0) {
+        return EFI_SUCCESS;
+    }
+
+    ZeroMemory(mImage.Slot[Slot], BOOT_CACHE_SLOT_SIZE);
+    CopyMemory(mImage.Slot[Slot], Data, Size);
+    mImage.SlotSize[Slot] = (UINT16)Size;
+    mBootCacheDirty = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Write the cache to NVRAM if a slot changed
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_flush(
+    VOID
+)
+{
+    EFI_STATUS Status;
+
+    if (!mBootCacheEnabled || !mBootCacheDirty) {
+        return EFI_SUCCESS;
+    }
+
+    mImage.Checksum = BootCacheChecksum();
+    Status = gRT->SetVariable(
+        BOOT_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(mImage),
+        &mImage
+    );
+
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("Failed to save fast boot cache: %r\n", Status);
+        return Status;
+    }
+
+    mBootCacheDirty = FALSE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Empty every slot and delete the NVRAM variable
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_invalidate(
+    VOID
+)
+{
+    EFI_STATUS Status;
+
+    if (!mBootCacheEnabled) {
+        return EFI_UNSUPPORTED;
+    }
+
+    BootCacheReset();
+    ZeroMemory(mSlotHit, sizeof(mSlotHit));
+    mBootCacheDirty = FALSE;
+
+    Status = gRT->SetVariable(
+        BOOT_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        0,
+        0,
+        NULL
+    );
+
+    return (Status == EFI_NOT_FOUND) ? EFI_SUCCESS : Status;
+}
+
+/**
+ * Check whether a slot changed since the cache was loaded or flushed
+ * @return BOOLEAN - TRUE if the next boot_cache_flush writes NVRAM
+ */
+BOOLEAN
+EFIAPI
+boot_cache_is_dirty(
+    VOID
+)
+{
+    return mBootCacheDirty;
+}
+
+/**
+ * Print how the cache was loaded and which slots were served from it
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_status(
+    VOID
+)
+{
+    UINTN Index;
+
+    if (!mBootCacheEnabled) {
+        Print(L"Fast Boot: Disabled\n");
+        return EFI_SUCCESS;
+    }
+
+    Print(L"Fast Boot Cache: %r%s\n", mLoadStatus, mBootCacheDirty ? L" (unsaved changes)" : L"");
+    for (Index = 0; Index < BootCacheSlotCount; Index++) {
+        Print(L"  %-16s %s\n", mSlotNames[Index],
+              mSlotHit[Index] ? L"cached" :
+              (mImage.SlotSize[Index] != 0) ? L"probed" : L"empty");
+    }
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file boot_cache.h
+ * @brief Probe results kept in NVRAM for the fast boot profile
+ */
+
+#ifndef _BOOT_CACHE_H_
+#define _BOOT_CACHE_H_
+
+#include <Uefi.h>
+
+//
+// Cached probes. Each slot holds one fixed-size structure owned by the
+// subsystem that produced it; a slot whose size no longer matches its
+// structure reads as empty.
+//
+typedef enum {
+    BootCacheCpuInfo,                   // UEFI_CPU_INFO from uefi_interface
+    BootCacheSlotCount
+} BOOT_CACHE_SLOT;
+
+//
+// What a cached probe depends on. All of it is read without walking any
+// tables (system table header, one CPUID leaf, build constants), so
+// checking it costs next to nothing compared with the probes it replaces.
+//
+#pragma pack(1)
+typedef struct {
+    UINT32 UefiRevision;                // gST->Hdr.Revision
+    UINT32 FirmwareRevision;            // gST->FirmwareRevision
+    UINT32 FirmwareVendorCrc;           // CRC32 of gST->FirmwareVendor
+    UINT32 CpuSignature;                // CPUID leaf 1 EAX: family, model, stepping
+    UINT32 BuildId;                     // FIRMWARE_VERSION_* and FIRMWARE_BUILD_NUMBER
+} BOOT_CACHE_KEY;
+#pragma pack()
+
+//
+// Function Prototypes
+//
+
+/**
+ * Load the probe results of an earlier boot
+ * @details The cache is only used in the FAST_BOOT profile. A variable
+ *          written by different firmware, a different CPU or another build
+ *          of this application is dropped, so every slot reads as empty and
+ *          the next boot_cache_flush replaces it.
+ * @return EFI_STATUS - EFI_NOT_FOUND if nothing usable was persisted,
+ *                      EFI_UNSUPPORTED if fast boot is disabled
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_load(
+    VOID
+    );
+
+/**
+ * Copy a cached probe result
+ * @param Slot - Slot to read
+ * @param Data - Buffer to receive the structure
+ * @param Size - Size of the structure
+ * @return EFI_STATUS - EFI_NOT_FOUND if the slot is empty or was stored with another size
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_get(
+    IN BOOT_CACHE_SLOT Slot,
+    OUT VOID *Data,
+    IN UINTN Size
+    );
+
+/**
+ * Store a probe result for later boots
+ * @details Storing what the slot already holds does not dirty the cache,
+ *          so a boot that found everything cached never writes NVRAM.
+ * @param Slot - Slot to write
+ * @param Data - Structure to store
+ * @param Size - Size of the structure, at most BOOT_CACHE_SLOT_SIZE
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_set(
+    IN BOOT_CACHE_SLOT Slot,
+    IN CONST VOID *Data,
+    IN UINTN Size
+    );
+
+/**
+ * Write the cache to NVRAM if a slot changed
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_flush(
+    VOID
+    );
+
+/**
+ * Empty every slot and delete the NVRAM variable
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_invalidate(
+    VOID
+    );
+
+/**
+ * Check whether a slot changed since the cache was loaded or flushed
+ * @details A stable probe must leave this FALSE, or every boot rewrites
+ *          the NVRAM variable.
+ * @return BOOLEAN - TRUE if the next boot_cache_flush writes NVRAM
+ */
+BOOLEAN
+EFIAPI
+boot_cache_is_dirty(
+    VOID
+    );
+
+/**
+ * Print how the cache was loaded and which slots were served from it
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+boot_cache_status(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+VOID
+BootCacheBuildKey(
+    OUT BOOT_CACHE_KEY *Key
+    );
+
+STATIC
+UINT32
+BootCacheChecksum(
+    VOID
+    );
+
+STATIC
+VOID
+BootCacheReset(
+    VOID
+    );
+
+#endif // _BOOT_CACHE_H_
@@ -52,37 +52,26 @@ AllocateAlignedMemory(
     EFI_STATUS Status;
     VOID *Memory;
     UINTN AlignedSize;
+    UINTN Aligned;
     
-    if (Buffer == NULL || Size == 0) {
+    if (Buffer == NULL || Size == 0 || Alignment == 0 ||
+        (Alignment & (Alignment - 1)) != 0) {
         return EFI_INVALID_PARAMETER;
     }
     
     // Calculate aligned size
     AlignedSize = ALIGN_UP(Size, Alignment);
     
-    // Allocate memory
-    Status = gBS->AllocatePool(MemoryType, AlignedSize, &Memory);
+    // Over-allocate so the block can be aligned with room for a back-pointer
+    Status = gBS->AllocatePool(MemoryType, AlignedSize + Alignment + sizeof(VOID *), &Memory);
     if (EFI_ERROR(Status)) {
         return Status;
     }
     
-    // Check if already aligned
-    if (((UINTN)Memory & (Alignment - 1)) == 0) {
-        *Buffer = Memory;
-        return EFI_SUCCESS;
-    }
-    
-    // Need to reallocate with proper alignment
-    gBS->FreePool(Memory);
-    
-    // Allocate extra space for alignment
-    Status = gBS->AllocatePool(MemoryType, AlignedSize + Alignment, &Memory);
-    if (EFI_ERROR(Status)) {
-        return Status;
-    }
-    
-    // Calculate aligned address
-    *Buffer = (VOID *)ALIGN_UP((UINTN)Memory, Alignment);
+    // Calculate aligned address and remember the pool allocation behind it
+    Aligned = ALIGN_UP((UINTN)Memory + sizeof(VOID *), Alignment);
+    ((VOID **)Aligned)[-1] = Memory;
+    *Buffer = (VOID *)Aligned;
     
     return EFI_SUCCESS;
 }
@@ -101,7 +90,8 @@ FreeAlignedMemory(
         return EFI_INVALID_PARAMETER;
     }
     
-    return gBS->FreePool(Buffer);
+    // Release the original pool allocation recorded by AllocateAlignedMemory
+    return gBS->FreePool(((VOID **)Buffer)[-1]);
 }
 
 /**
@@ -0,0 +1,584 @@
+/**
+ * @file memory_pool.c
+ * @brief Page-backed arenas and a size-class pool for firmware subsystems
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "memory_pool.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+//
+// Static variables
+//
+STATIC MEMORY_ARENA *mArenas[MEMORY_MAX_ARENAS];
+STATIC UINTN mArenaCount = 0;
+
+STATIC BOOLEAN mPoolInitialized = FALSE;
+STATIC VOID *mFreeBlocks[MEMORY_POOL_CLASSES];     // Intrusive free list per class
+STATIC MEMORY_POOL_SLAB *mSlabs = NULL;             // Slabs and page allocations
+STATIC UINTN mClassSlabs[MEMORY_POOL_CLASSES];
+STATIC UINTN mClassInUse[MEMORY_POOL_CLASSES];
+STATIC UINTN mLargeCount = 0;
+STATIC UINTN mLargePages = 0;
+
+/**
+ * Put a chunk at the head of an arena, reusing the spare when it is big enough
+ * @param Arena - Arena
+ * @param MinimumBytes - Bytes the chunk must hold after its header
+ * @return MEMORY_ARENA_CHUNK* - New head chunk, NULL on failure
+ */
+STATIC
+MEMORY_ARENA_CHUNK *
+ArenaNewChunk(
+    IN OUT MEMORY_ARENA *Arena,
+    IN UINTN MinimumBytes
+)
+{
+    MEMORY_ARENA_CHUNK *Chunk;
+    EFI_PHYSICAL_ADDRESS Address;
+    EFI_STATUS Status;
+    UINTN Pages;
+
+    Pages = MAX(Arena->ChunkPages, EFI_SIZE_TO_PAGES(sizeof(MEMORY_ARENA_CHUNK) + MinimumBytes));
+
+    if (Arena->Spare != NULL && Arena->Spare->Pages >= Pages) {
+        Chunk = Arena->Spare;
+        Arena->Spare = NULL;
+    } else {
+        Status = gBS->AllocatePages(AllocateAnyPages, EfiBootServicesData, Pages, &Address);
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Arena %s: %d pages unavailable: %r\n", Arena->Name, Pages, Status);
+            return NULL;
+        }
+        Chunk = (MEMORY_ARENA_CHUNK *)(UINTN)Address;
+        Chunk->Pages = Pages;
+        Arena->PagesReserved += Pages;
+        Arena->ChunkAllocations++;
+    }
+
+    Chunk->Used = sizeof(MEMORY_ARENA_CHUNK);
+    Chunk->Next = Arena->Head;
+    Arena->Head = Chunk;
+
+    return Chunk;
+}
+
+/**
+ * Drop a chunk from an arena, keeping the largest dropped chunk as the spare
+ * @param Arena - Arena
+ * @param Chunk - Chunk no longer linked into the arena
+ */
+STATIC
+VOID
+ArenaFreeChunk(
+    IN OUT MEMORY_ARENA *Arena,
+    IN MEMORY_ARENA_CHUNK *Chunk
+)
+{
+    MEMORY_ARENA_CHUNK *Victim;
+
+    Victim = Chunk;
+    if (Arena->Spare == NULL || Chunk->Pages > Arena->Spare->Pages) {
+        Victim = Arena->Spare;
+        Arena->Spare = Chunk;
+    }
+
+    if (Victim != NULL) {
+        Arena->PagesReserved -= Victim->Pages;
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)Victim, Victim->Pages);
+    }
+}
+
+/**
+ * Prepare an arena; no memory is reserved until the first allocation
+ * @param Arena - Arena to initialize
+ * @param Name - Name shown by memory_pool_status
+ * @param ChunkSize - Bytes per chunk, rounded up to whole pages
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES once MEMORY_MAX_ARENAS are registered
+ */
+EFI_STATUS
+EFIAPI
+memory_arena_init(
+    OUT MEMORY_ARENA *Arena,
+    IN CONST CHAR16 *Name,
+    IN UINTN ChunkSize
+)
+{
+    UINTN Index;
+
+    if (Arena == NULL || Name == NULL || ChunkSize == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // Re-initializing a registered arena (subsystem restarted) reuses its slot
+    for (Index = 0; Index < mArenaCount; Index++) {
+        if (mArenas[Index] == Arena) {
+            memory_arena_release(Arena);
+            break;
+        }
+    }
+
+    if (Index == mArenaCount) {
+        if (mArenaCount >= MEMORY_MAX_ARENAS) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        mArenas[mArenaCount++] = Arena;
+    }
+
+    ZeroMemory(Arena, sizeof(MEMORY_ARENA));
+    Arena->Name = Name;
+    Arena->ChunkPages = EFI_SIZE_TO_PAGES(ChunkSize);
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Allocate from an arena
+ * @param Arena - Initialized arena
+ * @param Size - Bytes to allocate
+ * @param Alignment - Power of two up to EFI_PAGE_SIZE; 0 for 8 bytes
+ * @return VOID* - Allocated memory, NULL on failure
+ */
+VOID *
+EFIAPI
+memory_arena_alloc(
+    IN OUT MEMORY_ARENA *Arena,
+    IN UINTN Size,
+    IN UINTN Alignment
+)
+{
+    MEMORY_ARENA_CHUNK *Chunk;
+    UINTN Offset;
+
+    if (Alignment == 0) {
+        Alignment = sizeof(UINT64);
+    }
+
+    if (Arena == NULL || Arena->ChunkPages == 0 || Size == 0 ||
+        Alignment > EFI_PAGE_SIZE || (Alignment & (Alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    Chunk = Arena->Head;
+    if (Chunk != NULL) {
+        Offset = ALIGN_UP(Chunk->Used, Alignment);
+        if (Offset + Size <= EFI_PAGES_TO_SIZE(Chunk->Pages)) {
+            goto Claim;
+        }
+    }
+
+    // Chunks are page aligned, so Alignment - 1 bytes of padding always suffice
+    Chunk = ArenaNewChunk(Arena, Size + Alignment - 1);
+    if (Chunk == NULL) {
+        return NULL;
+    }
+    Offset = ALIGN_UP(Chunk->Used, Alignment);
+
+Claim:
+    Chunk->Used = Offset + Size;
+    Arena->BytesInUse += Size;
+    Arena->PeakBytes = MAX(Arena->PeakBytes, Arena->BytesInUse);
+
+    return (UINT8 *)Chunk + Offset;
+}
+
+/**
+ * Record the current arena position
+ * @param Arena - Initialized arena
+ * @param Mark - Receives the position
+ */
+VOID
+EFIAPI
+memory_arena_get_mark(
+    IN CONST MEMORY_ARENA *Arena,
+    OUT MEMORY_ARENA_MARK *Mark
+)
+{
+    if (Arena == NULL || Mark == NULL) {
+        return;
+    }
+
+    Mark->Chunk = Arena->Head;
+    Mark->Used = (Arena->Head != NULL) ? Arena->Head->Used : 0;
+    Mark->BytesInUse = Arena->BytesInUse;
+}
+
+/**
+ * Free everything allocated since a mark was taken
+ * @param Arena - Initialized arena
+ * @param Mark - Position from memory_arena_get_mark on the same arena
+ */
+VOID
+EFIAPI
+memory_arena_rewind(
+    IN OUT MEMORY_ARENA *Arena,
+    IN CONST MEMORY_ARENA_MARK *Mark
+)
+{
+    MEMORY_ARENA_CHUNK *Chunk;
+
+    if (Arena == NULL || Mark == NULL) {
+        return;
+    }
+
+    while (Arena->Head != NULL && Arena->Head != Mark->Chunk) {
+        Chunk = Arena->Head;
+        Arena->Head = Chunk->Next;
+        ArenaFreeChunk(Arena, Chunk);
+    }
+
+    if (Arena->Head != NULL) {
+        Arena->Head->Used = Mark->Used;
+    }
+    Arena->BytesInUse = Mark->BytesInUse;
+}
+
+/**
+ * Return every page held by an arena, spare included
+ * @param Arena - Initialized arena
+ */
+VOID
+EFIAPI
+memory_arena_release(
+    IN OUT MEMORY_ARENA *Arena
+)
+{
+    MEMORY_ARENA_CHUNK *Chunk;
+
+    if (Arena == NULL) {
+        return;
+    }
+
+    while (Arena->Head != NULL) {
+        Chunk = Arena->Head;
+        Arena->Head = Chunk->Next;
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)Chunk, Chunk->Pages);
+    }
+
+    if (Arena->Spare != NULL) {
+        gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)Arena->Spare, Arena->Spare->Pages);
+        Arena->Spare = NULL;
+    }
+
+    Arena->BytesInUse = 0;
+    Arena->PagesReserved = 0;
+}
+
+/**
+ * Get the size class of a request
+ * @param Size - Bytes requested, at most MEMORY_POOL_MAX_BLOCK
+ * @return UINTN - Class index; class n holds MEMORY_POOL_MIN_BLOCK << n bytes
+ */
+STATIC
+UINTN
+PoolSizeClass(
+    IN UINTN Size
+)
+{
+    UINTN Class;
+    UINTN Block;
+
+    Class = 0;
+    for (Block = MEMORY_POOL_MIN_BLOCK; Block < Size; Block <<= 1) {
+        Class++;
+    }
+
+    return Class;
+}
+
+/**
+ * Track a slab or page allocation for cleanup
+ * @param Slab - Slab header
+ */
+STATIC
+VOID
+PoolLink(
+    IN OUT MEMORY_POOL_SLAB *Slab
+)
+{
+    Slab->Prev = NULL;
+    Slab->Next = mSlabs;
+    if (mSlabs != NULL) {
+        mSlabs->Prev = Slab;
+    }
+    mSlabs = Slab;
+}
+
+/**
+ * Stop tracking a slab or page allocation
+ * @param Slab - Slab header
+ */
+STATIC
+VOID
+PoolUnlink(
+    IN OUT MEMORY_POOL_SLAB *Slab
+)
+{
+    if (Slab->Prev != NULL) {
+        Slab->Prev->Next = Slab->Next;
+    } else {
+        mSlabs = Slab->Next;
+    }
+    if (Slab->Next != NULL) {
+        Slab->Next->Prev = Slab->Prev;
+    }
+}
+
+/**
+ * Carve a new slab into free blocks of one class
+ * @details The header takes the first block (or blocks) so every block
+ *          stays aligned to the class size.
+ * @param Class - Size class index
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+PoolAddSlab(
+    IN UINTN Class
+)
+{
+    MEMORY_POOL_SLAB *Slab;
+    UINTN BlockSize;
+    UINTN Offset;
+    VOID **Block;
+
+    Slab = AllocateAlignedPages(EFI_SIZE_TO_PAGES(MEMORY_POOL_SLAB_SIZE), MEMORY_POOL_SLAB_SIZE);
+    if (Slab == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Slab->Signature = MEMORY_POOL_SIGNATURE;
+    Slab->Class = (UINT32)Class;
+    Slab->Pages = EFI_SIZE_TO_PAGES(MEMORY_POOL_SLAB_SIZE);
+    Slab->InUse = 0;
+    PoolLink(Slab);
+
+    BlockSize = MEMORY_POOL_MIN_BLOCK << Class;
+    for (Offset = ALIGN_UP(sizeof(MEMORY_POOL_SLAB), BlockSize);
+         Offset + BlockSize <= MEMORY_POOL_SLAB_SIZE;
+         Offset += BlockSize) {
+        Block = (VOID **)((UINT8 *)Slab + Offset);
+        *Block = mFreeBlocks[Class];
+        mFreeBlocks[Class] = Block;
+    }
+
+    mClassSlabs[Class]++;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Initialize the size-class pool
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_init(VOID)
+{
+    if (mPoolInitialized) {
+        return EFI_SUCCESS;
+    }
+
+    ZeroMemory(mFreeBlocks, sizeof(mFreeBlocks));
+    ZeroMemory(mClassSlabs, sizeof(mClassSlabs));
+    ZeroMemory(mClassInUse, sizeof(mClassInUse));
+    mSlabs = NULL;
+    mLargeCount = 0;
+    mLargePages = 0;
+    mPoolInitialized = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Allocate a block from the size-class pool
+ * @param Size - Bytes to allocate
+ * @return VOID* - Block aligned to its class size, page aligned above
+ *                 MEMORY_POOL_MAX_BLOCK, NULL on failure
+ */
+VOID *
+EFIAPI
+memory_pool_alloc(
+    IN UINTN Size
+)
+{
+    MEMORY_POOL_SLAB *Slab;
+    EFI_TPL OldTpl;
+    VOID **Block;
+    UINTN Class;
+    UINTN Pages;
+
+    if (Size == 0) {
+        return NULL;
+    }
+
+    memory_pool_init();
+
+    // Timer callbacks may allocate too
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+
+    if (Size > MEMORY_POOL_MAX_BLOCK) {
+        // One header page in front keeps the slab-mask lookup working
+        Pages = EFI_SIZE_TO_PAGES(Size) + 1;
+        Slab = AllocateAlignedPages(Pages, MEMORY_POOL_SLAB_SIZE);
+        Block = NULL;
+        if (Slab != NULL) {
+            Slab->Signature = MEMORY_POOL_SIGNATURE;
+            Slab->Class = MEMORY_POOL_LARGE;
+            Slab->Pages = Pages;
+            Slab->InUse = 1;
+            PoolLink(Slab);
+            mLargeCount++;
+            mLargePages += Pages;
+            Block = (VOID **)((UINT8 *)Slab + EFI_PAGE_SIZE);
+        }
+        gBS->RestoreTPL(OldTpl);
+        return Block;
+    }
+
+    Class = PoolSizeClass(Size);
+    if (mFreeBlocks[Class] == NULL && EFI_ERROR(PoolAddSlab(Class))) {
+        gBS->RestoreTPL(OldTpl);
+        return NULL;
+    }
+
+    Block = (VOID **)mFreeBlocks[Class];
+    mFreeBlocks[Class] = *Block;
+    Slab = (MEMORY_POOL_SLAB *)((UINTN)Block & ~((UINTN)MEMORY_POOL_SLAB_SIZE - 1));
+    Slab->InUse++;
+    mClassInUse[Class]++;
+
+    gBS->RestoreTPL(OldTpl);
+    return Block;
+}
+
+/**
+ * Return a block to the size-class pool
+ * @param Buffer - Block from memory_pool_alloc
+ * @return EFI_STATUS - EFI_INVALID_PARAMETER if Buffer is not a pool block
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_free(
+    IN VOID *Buffer
+)
+{
+    MEMORY_POOL_SLAB *Slab;
+    EFI_TPL OldTpl;
+    UINTN Offset;
+    UINTN Class;
+
+    if (Buffer == NULL || !mPoolInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Slab = (MEMORY_POOL_SLAB *)((UINTN)Buffer & ~((UINTN)MEMORY_POOL_SLAB_SIZE - 1));
+    Offset = (UINTN)Buffer - (UINTN)Slab;
+    if (Slab->Signature != MEMORY_POOL_SIGNATURE || Offset == 0) {
+        LOG_ERROR("memory_pool_free: %p is not a pool block\n", Buffer);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+
+    if (Slab->Class == MEMORY_POOL_LARGE) {
+        if (Offset != EFI_PAGE_SIZE) {
+            gBS->RestoreTPL(OldTpl);
+            return EFI_INVALID_PARAMETER;
+        }
+        PoolUnlink(Slab);
+        mLargeCount--;
+        mLargePages -= Slab->Pages;
+        Slab->Signature = 0;
+        FreeAlignedPages(Slab, Slab->Pages);
+        gBS->RestoreTPL(OldTpl);
+        return EFI_SUCCESS;
+    }
+
+    Class = Slab->Class;
+    if (Class >= MEMORY_POOL_CLASSES || (Offset % (MEMORY_POOL_MIN_BLOCK << Class)) != 0) {
+        gBS->RestoreTPL(OldTpl);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *(VOID **)Buffer = mFreeBlocks[Class];
+    mFreeBlocks[Class] = Buffer;
+    Slab->InUse--;
+    mClassInUse[Class]--;
+
+    gBS->RestoreTPL(OldTpl);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Print pool usage and every registered arena
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_status(VOID)
+{
+    MEMORY_ARENA *Arena;
+    UINTN Index;
+
+    Print(L"Memory Pool:\n");
+    for (Index = 0; Index < MEMORY_POOL_CLASSES; Index++) {
+        if (mClassSlabs[Index] != 0) {
+            Print(L"  %5d-byte blocks: %d in use, %d slabs\n",
+                  MEMORY_POOL_MIN_BLOCK << Index, mClassInUse[Index], mClassSlabs[Index]);
+        }
+    }
+    Print(L"  Page allocations: %d (%d KB)\n", mLargeCount, EFI_PAGES_TO_SIZE(mLargePages) / 1024);
+
+    Print(L"Arenas:\n");
+    for (Index = 0; Index < mArenaCount; Index++) {
+        Arena = mArenas[Index];
+        Print(L"  %-12s %6d KB held, %6d KB in use, %6d KB peak, %d page allocations\n",
+              Arena->Name,
+              EFI_PAGES_TO_SIZE(Arena->PagesReserved) / 1024,
+              Arena->BytesInUse / 1024,
+              Arena->PeakBytes / 1024,
+              Arena->ChunkAllocations);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Release every slab and page allocation in one shot
+ * @details Arenas still holding pages are released too.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_cleanup(VOID)
+{
+    MEMORY_POOL_SLAB *Slab;
+    UINTN Index;
+
+    DBG_ENTER();
+
+    for (Index = 0; Index < mArenaCount; Index++) {
+        memory_arena_release(mArenas[Index]);
+    }
+    mArenaCount = 0;
+
+    while (mSlabs != NULL) {
+        Slab = mSlabs;
+        mSlabs = Slab->Next;
+        Slab->Signature = 0;
+        FreeAlignedPages(Slab, Slab->Pages);
+    }
+
+    mPoolInitialized = FALSE;
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
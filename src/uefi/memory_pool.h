@@ -0,0 +1,232 @@
+/**
+ * @file memory_pool.h
+ * @brief Page-backed arenas and a size-class pool for firmware subsystems
+ */
+
+#ifndef _MEMORY_POOL_H_
+#define _MEMORY_POOL_H_
+
+#include <Uefi.h>
+
+//
+// Arenas
+// A bump allocator over chunks of whole pages. Allocations are never freed
+// one by one: a caller takes a mark, allocates scratch, and rewinds to the
+// mark, or releases the whole arena at cleanup. Rewinding keeps the largest
+// freed chunk as a spare, so a hot path that rewinds after every call stops
+// reaching boot services after its first use. Arenas are not reentrant; each
+// belongs to one subsystem and is only used on the BSP.
+//
+typedef struct _MEMORY_ARENA_CHUNK MEMORY_ARENA_CHUNK;
+
+struct _MEMORY_ARENA_CHUNK {
+    MEMORY_ARENA_CHUNK *Next;           // Older chunk
+    UINTN Pages;
+    UINTN Used;                         // Bytes from the chunk start, header included
+};
+
+typedef struct {
+    CONST CHAR16 *Name;
+    UINTN ChunkPages;                   // Pages per chunk unless a request needs more
+    MEMORY_ARENA_CHUNK *Head;           // Newest chunk, allocations come from here
+    MEMORY_ARENA_CHUNK *Spare;          // Kept by the last rewind
+    UINTN BytesInUse;
+    UINTN PeakBytes;
+    UINTN PagesReserved;                // Pages held, spare included
+    UINTN ChunkAllocations;             // gBS->AllocatePages calls made
+} MEMORY_ARENA;
+
+typedef struct {
+    MEMORY_ARENA_CHUNK *Chunk;
+    UINTN Used;
+    UINTN BytesInUse;
+} MEMORY_ARENA_MARK;
+
+//
+// Size-class pool
+// Blocks of MEMORY_POOL_MIN_BLOCK..MEMORY_POOL_MAX_BLOCK bytes (powers of
+// two) are carved from MEMORY_POOL_SLAB_SIZE slabs aligned to their own
+// size, so every block is aligned to its class size and its slab header is
+// found by masking the block address. Larger requests get whole pages behind
+// a one-page header and are page aligned.
+//
+typedef struct _MEMORY_POOL_SLAB MEMORY_POOL_SLAB;
+
+struct _MEMORY_POOL_SLAB {
+    UINT32 Signature;                   // MEMORY_POOL_SIGNATURE
+    UINT32 Class;                       // Size class index, MEMORY_POOL_LARGE for page allocations
+    UINTN Pages;                        // Pages behind this header, header included
+    UINTN InUse;                        // Blocks handed out
+    MEMORY_POOL_SLAB *Next;
+    MEMORY_POOL_SLAB *Prev;
+};
+
+#define MEMORY_POOL_SIGNATURE       SIGNATURE_32('M', 'P', 'S', 'L')
+#define MEMORY_POOL_LARGE           0xFFFFFFFF
+
+//
+// Function Prototypes
+//
+
+/**
+ * Prepare an arena; no memory is reserved until the first allocation
+ * @param Arena - Arena to initialize
+ * @param Name - Name shown by memory_pool_status
+ * @param ChunkSize - Bytes per chunk, rounded up to whole pages
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES once MEMORY_MAX_ARENAS are registered
+ */
+EFI_STATUS
+EFIAPI
+memory_arena_init(
+    OUT MEMORY_ARENA *Arena,
+    IN CONST CHAR16 *Name,
+    IN UINTN ChunkSize
+    );
+
+/**
+ * Allocate from an arena
+ * @param Arena - Initialized arena
+ * @param Size - Bytes to allocate
+ * @param Alignment - Power of two up to EFI_PAGE_SIZE, e.g. a DMA alignment
+ * @return VOID* - Allocated memory, NULL on failure
+ */
+VOID *
+EFIAPI
+memory_arena_alloc(
+    IN OUT MEMORY_ARENA *Arena,
+    IN UINTN Size,
+    IN UINTN Alignment
+    );
+
+/**
+ * Record the current arena position
+ * @param Arena - Initialized arena
+ * @param Mark - Receives the position
+ */
+VOID
+EFIAPI
+memory_arena_get_mark(
+    IN CONST MEMORY_ARENA *Arena,
+    OUT MEMORY_ARENA_MARK *Mark
+    );
+
+/**
+ * Free everything allocated since a mark was taken
+ * @param Arena - Initialized arena
+ * @param Mark - Position from memory_arena_get_mark on the same arena
+ */
+VOID
+EFIAPI
+memory_arena_rewind(
+    IN OUT MEMORY_ARENA *Arena,
+    IN CONST MEMORY_ARENA_MARK *Mark
+    );
+
+/**
+ * Return every page held by an arena, spare included
+ * @details The arena stays registered and usable; it simply starts empty.
+ * @param Arena - Initialized arena
+ */
+VOID
+EFIAPI
+memory_arena_release(
+    IN OUT MEMORY_ARENA *Arena
+    );
+
+/**
+ * Initialize the size-class pool
+ * @details Also done on first use; safe to call more than once.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_init(
+    VOID
+    );
+
+/**
+ * Allocate a block from the size-class pool
+ * @param Size - Bytes to allocate
+ * @return VOID* - Block aligned to its class size (page aligned above
+ *                 MEMORY_POOL_MAX_BLOCK), NULL on failure
+ */
+VOID *
+EFIAPI
+memory_pool_alloc(
+    IN UINTN Size
+    );
+
+/**
+ * Return a block to the size-class pool
+ * @param Buffer - Block from memory_pool_alloc
+ * @return EFI_STATUS - EFI_INVALID_PARAMETER if Buffer is not a pool block
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_free(
+    IN VOID *Buffer
+    );
+
+/**
+ * Print pool usage and every registered arena
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_status(
+    VOID
+    );
+
+/**
+ * Release every slab and page allocation in one shot
+ * @details Any block still held by a caller becomes invalid.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+memory_pool_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+MEMORY_ARENA_CHUNK *
+ArenaNewChunk(
+    IN OUT MEMORY_ARENA *Arena,
+    IN UINTN MinimumBytes
+    );
+
+STATIC
+VOID
+ArenaFreeChunk(
+    IN OUT MEMORY_ARENA *Arena,
+    IN MEMORY_ARENA_CHUNK *Chunk
+    );
+
+STATIC
+UINTN
+PoolSizeClass(
+    IN UINTN Size
+    );
+
+STATIC
+EFI_STATUS
+PoolAddSlab(
+    IN UINTN Class
+    );
+
+STATIC
+VOID
+PoolLink(
+    IN OUT MEMORY_POOL_SLAB *Slab
+    );
+
+STATIC
+VOID
+PoolUnlink(
+    IN OUT MEMORY_POOL_SLAB *Slab
+    );
+
+#endif // _MEMORY_POOL_H_
@@ -0,0 +1,412 @@
+/**
+ * @file scheduler.c
+ * @brief Cooperative task scheduler driving the main loop
+ *
+ * Event and periodic tasks share one wait list, rebuilt whenever the task
+ * set changes and ordered by priority, so WaitForEvent reports the highest
+ * priority ready task first. While background tasks are registered the
+ * loop polls the wait list instead of blocking and runs one background
+ * step between polls, which keeps key handling responsive during long jobs.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+#include "scheduler.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+//
+// Registered task
+//
+typedef struct {
+    BOOLEAN InUse;
+    CONST CHAR16 *Name;
+    SCHEDULER_TASK_FUNCTION Function;
+    VOID *Context;
+    UINTN Priority;
+    EFI_EVENT Event;                    // NULL for background tasks
+    BOOLEAN OwnsEvent;                  // Periodic timer created by the scheduler
+    UINT64 Period;
+    UINTN RunCount;
+    EFI_STATUS LastStatus;
+} SCHEDULER_TASK;
+
+STATIC SCHEDULER_TASK mTasks[SCHEDULER_MAX_TASKS];
+STATIC EFI_EVENT mWaitList[SCHEDULER_MAX_TASKS];
+STATIC UINTN mWaitTask[SCHEDULER_MAX_TASKS];
+STATIC UINTN mWaitCount = 0;
+STATIC UINTN mBackgroundCount = 0;
+STATIC UINTN mBackgroundCursor = 0;
+STATIC BOOLEAN mWaitListDirty = TRUE;
+STATIC BOOLEAN mSchedulerInitialized = FALSE;
+
+// Watchdog codes up to 0xFFFF are reserved for the firmware
+#define SCHEDULER_WATCHDOG_CODE     0x10000
+
+/**
+ * Keep the firmware watchdog from resetting the platform during long sessions
+ * @param Context - Unused
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+SchedulerWatchdogTask(
+    IN VOID *Context
+)
+{
+    return gBS->SetWatchdogTimer(SCHEDULER_WATCHDOG_TIMEOUT, SCHEDULER_WATCHDOG_CODE, 0, NULL);
+}
+
+/**
+ * Initialize the scheduler and register the watchdog kick
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_init(
+    VOID
+)
+{
+    EFI_STATUS Status;
+
+    DBG_ENTER();
+
+    if (mSchedulerInitialized) {
+        DBG_EXIT_STATUS(EFI_ALREADY_STARTED);
+        return EFI_ALREADY_STARTED;
+    }
+
+    ZeroMemory(mTasks, sizeof(mTasks));
+    mWaitCount = 0;
+    mBackgroundCount = 0;
+    mBackgroundCursor = 0;
+    mWaitListDirty = TRUE;
+    mSchedulerInitialized = TRUE;
+
+    if (SCHEDULER_WATCHDOG_TIMEOUT != 0) {
+        SchedulerWatchdogTask(NULL);
+        Status = scheduler_add_task(L"Watchdog", SchedulerWatchdogTask, NULL, SCHEDULER_PRIORITY_LOW,
+                                    NULL, SCHEDULER_WATCHDOG_PERIOD, NULL);
+        if (EFI_ERROR(Status)) {
+            LOG_WARN("Watchdog kick not scheduled: %r\n", Status);
+        }
+    }
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Register a task
+ * @param Name - Task name for status output
+ * @param Function - Task callback
+ * @param Context - Passed to Function
+ * @param Priority - SCHEDULER_PRIORITY_*
+ * @param Event - Event that triggers the task, or NULL
+ * @param Period - Timer period in 100ns units, or 0
+ * @param TaskId - Optional pointer to receive the task id
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES if the task table is full
+ */
+EFI_STATUS
+EFIAPI
+scheduler_add_task(
+    IN CONST CHAR16 *Name,
+    IN SCHEDULER_TASK_FUNCTION Function,
+    IN VOID *Context OPTIONAL,
+    IN UINTN Priority,
+    IN EFI_EVENT Event OPTIONAL,
+    IN UINT64 Period,
+    OUT UINTN *TaskId OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    SCHEDULER_TASK *Task;
+    UINTN Index;
+
+    if (!mSchedulerInitialized || Name == NULL || Function == NULL || (Event != NULL && Period != 0)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (Index = 0; Index < SCHEDULER_MAX_TASKS; Index++) {
+        if (!mTasks[Index].InUse) {
+            break;
+        }
+    }
+
+    if (Index == SCHEDULER_MAX_TASKS) {
+        LOG_ERROR("No room to schedule task %s\n", Name);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    Task = &mTasks[Index];
+    ZeroMemory(Task, sizeof(SCHEDULER_TASK));
+    Task->Name = Name;
+    Task->Function = Function;
+    Task->Context = Context;
+    Task->Priority = Priority;
+    Task->Event = Event;
+    Task->Period = Period;
+    Task->LastStatus = EFI_NOT_STARTED;
+
+    if (Period != 0) {
+        // A plain timer event so it can sit in the wait list
+        Status = gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &Task->Event);
+        if (!EFI_ERROR(Status)) {
+            Status = gBS->SetTimer(Task->Event, TimerPeriodic, Period);
+            if (EFI_ERROR(Status)) {
+                gBS->CloseEvent(Task->Event);
+            }
+        }
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Failed to create timer for task %s: %r\n", Name, Status);
+            Task->Event = NULL;
+            return Status;
+        }
+        Task->OwnsEvent = TRUE;
+    }
+
+    Task->InUse = TRUE;
+    mWaitListDirty = TRUE;
+
+    if (TaskId != NULL) {
+        *TaskId = Index;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Unregister a task; a task may remove itself from its own callback
+ * @param TaskId - Task id from scheduler_add_task
+ * @return EFI_STATUS - EFI_NOT_FOUND if the task is not registered
+ */
+EFI_STATUS
+EFIAPI
+scheduler_remove_task(
+    IN UINTN TaskId
+)
+{
+    SCHEDULER_TASK *Task;
+
+    if (TaskId >= SCHEDULER_MAX_TASKS || !mTasks[TaskId].InUse) {
+        return EFI_NOT_FOUND;
+    }
+
+    Task = &mTasks[TaskId];
+    if (Task->OwnsEvent && Task->Event != NULL) {
+        gBS->CloseEvent(Task->Event);
+    }
+
+    ZeroMemory(Task, sizeof(SCHEDULER_TASK));
+    mWaitListDirty = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Rebuild the wait list from the registered tasks, highest priority first
+ */
+STATIC
+VOID
+SchedulerBuildWaitList(
+    VOID
+)
+{
+    UINTN Index;
+    UINTN Slot;
+
+    mWaitCount = 0;
+    mBackgroundCount = 0;
+
+    for (Index = 0; Index < SCHEDULER_MAX_TASKS; Index++) {
+        if (!mTasks[Index].InUse) {
+            continue;
+        }
+
+        if (mTasks[Index].Event == NULL) {
+            mBackgroundCount++;
+            continue;
+        }
+
+        // Insertion sort; equal priorities keep registration order
+        for (Slot = mWaitCount; Slot > 0 && mTasks[mWaitTask[Slot - 1]].Priority < mTasks[Index].Priority; Slot--) {
+            mWaitTask[Slot] = mWaitTask[Slot - 1];
+            mWaitList[Slot] = mWaitList[Slot - 1];
+        }
+        mWaitTask[Slot] = Index;
+        mWaitList[Slot] = mTasks[Index].Event;
+        mWaitCount++;
+    }
+
+    mWaitListDirty = FALSE;
+}
+
+/**
+ * Call a task and record the result
+ * @param TaskId - Task id
+ * @return EFI_STATUS - The task's status
+ */
+STATIC
+EFI_STATUS
+SchedulerRunTask(
+    IN UINTN TaskId
+)
+{
+    EFI_STATUS Status;
+    SCHEDULER_TASK *Task;
+
+    Task = &mTasks[TaskId];
+    Status = Task->Function(Task->Context);
+
+    // The task may have removed itself
+    if (Task->InUse) {
+        Task->RunCount++;
+        if (EFI_ERROR(Status) && Status != EFI_ABORTED && Status != Task->LastStatus) {
+            LOG_WARN("Task %s returned %r\n", Task->Name, Status);
+        }
+        Task->LastStatus = Status;
+    }
+
+    return Status;
+}
+
+/**
+ * Run the next background task in round-robin order
+ * @return EFI_STATUS - The task's status
+ */
+STATIC
+EFI_STATUS
+SchedulerRunBackground(
+    VOID
+)
+{
+    UINTN Step;
+    UINTN Index;
+
+    for (Step = 0; Step < SCHEDULER_MAX_TASKS; Step++) {
+        Index = (mBackgroundCursor + Step) % SCHEDULER_MAX_TASKS;
+        if (mTasks[Index].InUse && mTasks[Index].Event == NULL) {
+            mBackgroundCursor = (Index + 1) % SCHEDULER_MAX_TASKS;
+            return SchedulerRunTask(Index);
+        }
+    }
+
+    return EFI_NOT_FOUND;
+}
+
+/**
+ * Run tasks until one returns EFI_ABORTED
+ * @return EFI_STATUS - EFI_SUCCESS when stopped by a task, or an error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_run(
+    VOID
+)
+{
+    EFI_STATUS Status;
+    UINTN Index;
+
+    DBG_ENTER();
+
+    if (!mSchedulerInitialized) {
+        DBG_EXIT_STATUS(EFI_NOT_READY);
+        return EFI_NOT_READY;
+    }
+
+    while (TRUE) {
+        if (mWaitListDirty) {
+            SchedulerBuildWaitList();
+        }
+
+        if (mBackgroundCount > 0) {
+            // Poll so background work continues while nothing is signaled
+            for (Index = 0; Index < mWaitCount; Index++) {
+                if (gBS->CheckEvent(mWaitList[Index]) == EFI_SUCCESS) {
+                    break;
+                }
+            }
+
+            Status = (Index < mWaitCount) ? SchedulerRunTask(mWaitTask[Index]) : SchedulerRunBackground();
+        } else {
+            if (mWaitCount == 0) {
+                LOG_ERROR("No tasks to wait on\n");
+                DBG_EXIT_STATUS(EFI_NOT_READY);
+                return EFI_NOT_READY;
+            }
+
+            Status = gBS->WaitForEvent(mWaitCount, mWaitList, &Index);
+            if (EFI_ERROR(Status)) {
+                LOG_ERROR("WaitForEvent failed: %r\n", Status);
+                DBG_EXIT_STATUS(Status);
+                return Status;
+            }
+
+            Status = SchedulerRunTask(mWaitTask[Index]);
+        }
+
+        if (Status == EFI_ABORTED) {
+            break;
+        }
+    }
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Print every registered task with its run count and last status
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_status(
+    VOID
+)
+{
+    UINTN Index;
+
+    Print(L"Scheduler tasks:\n");
+    for (Index = 0; Index < SCHEDULER_MAX_TASKS; Index++) {
+        if (!mTasks[Index].InUse) {
+            continue;
+        }
+        Print(L"  %-12s priority %d, %s, %d runs, last %r\n",
+              mTasks[Index].Name, mTasks[Index].Priority,
+              (mTasks[Index].Event == NULL) ? L"background" : (mTasks[Index].OwnsEvent ? L"periodic" : L"event"),
+              mTasks[Index].RunCount, mTasks[Index].LastStatus);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Unregister every task and release the timers the scheduler owns
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_cleanup(
+    VOID
+)
+{
+    UINTN Index;
+
+    if (!mSchedulerInitialized) {
+        return EFI_NOT_READY;
+    }
+
+    for (Index = 0; Index < SCHEDULER_MAX_TASKS; Index++) {
+        scheduler_remove_task(Index);
+    }
+
+    mWaitCount = 0;
+    mBackgroundCount = 0;
+    mSchedulerInitialized = FALSE;
+    return EFI_SUCCESS;
+}
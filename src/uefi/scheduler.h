@@ -0,0 +1,129 @@
+/**
+ * @file scheduler.h
+ * @brief Cooperative task scheduler driving the main loop
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <Uefi.h>
+
+//
+// Task Priorities
+// Signaled tasks run highest priority first; background tasks only run
+// when no event or periodic task is ready.
+//
+#define SCHEDULER_PRIORITY_LOW      1
+#define SCHEDULER_PRIORITY_NORMAL   2
+#define SCHEDULER_PRIORITY_HIGH     3
+
+//
+// Task callback. Returning EFI_ABORTED stops scheduler_run; other errors
+// are recorded and the task stays scheduled.
+//
+typedef
+EFI_STATUS
+(EFIAPI *SCHEDULER_TASK_FUNCTION)(
+    IN VOID *Context
+    );
+
+//
+// Function Prototypes
+//
+
+/**
+ * Initialize the scheduler and register the watchdog kick
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_init(
+    VOID
+    );
+
+/**
+ * Register a task
+ * @details A task with an Event runs each time the event is signaled; the
+ *          event must be waitable (not EVT_NOTIFY_SIGNAL). A task with a
+ *          Period runs on a timer the scheduler owns. A task with neither
+ *          is a background task, called one step at a time whenever nothing
+ *          else is ready, so long jobs must return after each bounded step.
+ * @param Name - Task name for status output
+ * @param Function - Task callback
+ * @param Context - Passed to Function
+ * @param Priority - SCHEDULER_PRIORITY_*
+ * @param Event - Event that triggers the task, or NULL
+ * @param Period - Timer period in 100ns units, or 0
+ * @param TaskId - Optional pointer to receive the task id
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES if the task table is full
+ */
+EFI_STATUS
+EFIAPI
+scheduler_add_task(
+    IN CONST CHAR16 *Name,
+    IN SCHEDULER_TASK_FUNCTION Function,
+    IN VOID *Context OPTIONAL,
+    IN UINTN Priority,
+    IN EFI_EVENT Event OPTIONAL,
+    IN UINT64 Period,
+    OUT UINTN *TaskId OPTIONAL
+    );
+
+/**
+ * Unregister a task; a task may remove itself from its own callback
+ * @param TaskId - Task id from scheduler_add_task
+ * @return EFI_STATUS - EFI_NOT_FOUND if the task is not registered
+ */
+EFI_STATUS
+EFIAPI
+scheduler_remove_task(
+    IN UINTN TaskId
+    );
+
+/**
+ * Run tasks until one returns EFI_ABORTED
+ * @return EFI_STATUS - EFI_SUCCESS when stopped by a task, or an error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_run(
+    VOID
+    );
+
+/**
+ * Print every registered task with its run count and last status
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_status(
+    VOID
+    );
+
+/**
+ * Unregister every task and release the timers the scheduler owns
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+scheduler_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+VOID
+SchedulerBuildWaitList(
+    VOID
+    );
+
+STATIC
+EFI_STATUS
+EFIAPI
+SchedulerWatchdogTask(
+    IN VOID *Context
+    );
+
+#endif // _SCHEDULER_H_
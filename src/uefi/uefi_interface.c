@@ -20,6 +20,7 @@
 
 #include "uefi_interface.h"
 #include "boot_services.h"
+#include "boot_cache.h"
 #include "../../include/common.h"
 #include "../../include/config.h"
 #include "../../include/debug_utils.h"
@@ -28,7 +29,10 @@
 // Forward declarations for internal functions
 //
 STATIC EFI_STATUS GatherSystemInformation(VOID);
+STATIC VOID ProbeMemoryMap(VOID);
+STATIC VOID ProbeSecurityFeatures(VOID);
 STATIC VOID CalculateMemoryStatistics(IN EFI_MEMORY_DESCRIPTOR *MemoryMap, IN UINTN MapSize, IN UINTN DescriptorSize);
+STATIC VOID ProbeCpuInformation(VOID);
 STATIC VOID DetectCpuInformation(VOID);
 
 //
@@ -92,13 +96,6 @@ STATIC
 EFI_STATUS
 GatherSystemInformation(VOID)
 {
-    EFI_STATUS Status;
-    UINTN MapSize;
-    UINTN MapKey;
-    UINTN DescriptorSize;
-    UINT32 DescriptorVersion;
-    EFI_MEMORY_DESCRIPTOR *MemoryMap;
-    
     DBG_ENTER();
     
     // Initialize system info structure
@@ -118,6 +115,64 @@ GatherSystemInformation(VOID)
     mSystemInfo.FirmwareRevision = gST->FirmwareRevision;
     
     // Get memory information
+    ProbeMemoryMap();
+    
+    // Detect CPU information (CPUID-based, reused by fast boot)
+    ProbeCpuInformation();
+
+    // Cache security features (best-effort; do not fail init on errors)
+    ProbeSecurityFeatures();
+    
+    LOG_INFO("System information gathered successfully\n");
+    
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Fill in the CPU information, from the fast boot cache when an earlier boot probed it
+ */
+STATIC
+VOID
+ProbeCpuInformation(VOID)
+{
+    UEFI_CPU_INFO Cpu;
+    
+    if (!EFI_ERROR(boot_cache_get(BootCacheCpuInfo, &Cpu, sizeof(Cpu)))) {
+        CopyMemory(mSystemInfo.CpuVendor, Cpu.CpuVendor, sizeof(Cpu.CpuVendor));
+        CopyMemory(mSystemInfo.CpuFamily, Cpu.CpuFamily, sizeof(Cpu.CpuFamily));
+        mSystemInfo.CpuCores = Cpu.CpuCores;
+        mSystemInfo.CpuThreads = Cpu.CpuThreads;
+        mSystemInfo.CpuFeatures = Cpu.CpuFeatures;
+        LOG_INFO("CPU information loaded from the fast boot cache\n");
+        return;
+    }
+    
+    DetectCpuInformation();
+    
+    // mSystemInfo was zeroed first, so the string tails match from boot to boot
+    CopyMemory(Cpu.CpuVendor, mSystemInfo.CpuVendor, sizeof(Cpu.CpuVendor));
+    CopyMemory(Cpu.CpuFamily, mSystemInfo.CpuFamily, sizeof(Cpu.CpuFamily));
+    Cpu.CpuCores = mSystemInfo.CpuCores;
+    Cpu.CpuThreads = mSystemInfo.CpuThreads;
+    Cpu.CpuFeatures = mSystemInfo.CpuFeatures;
+    boot_cache_set(BootCacheCpuInfo, &Cpu, sizeof(Cpu));
+}
+
+/**
+ * Fill in the memory totals from the current memory map
+ */
+STATIC
+VOID
+ProbeMemoryMap(VOID)
+{
+    EFI_STATUS Status;
+    UINTN MapSize;
+    UINTN MapKey;
+    UINTN DescriptorSize;
+    UINT32 DescriptorVersion;
+    EFI_MEMORY_DESCRIPTOR *MemoryMap;
+    
     MapSize = 0;
     Status = gBS->GetMemoryMap(&MapSize, NULL, &MapKey, &DescriptorSize, &DescriptorVersion);
     if (Status == EFI_BUFFER_TOO_SMALL) {
@@ -130,33 +185,27 @@ GatherSystemInformation(VOID)
             FreePool(MemoryMap);
         }
     }
-    
-    // Detect CPU information (CPUID-based)
-    DetectCpuInformation();
-
-    // Cache security features (best-effort; do not fail init on errors)
-    {
-        EFI_STATUS SbStatus;
-        EFI_STATUS TpmStatus;
-        BOOLEAN SbEnabled = FALSE;
-        BOOLEAN TpmPresent = FALSE;
-        SbStatus = uefi_check_secure_boot(&SbEnabled);
-        if (EFI_ERROR(SbStatus)) {
-            SbEnabled = FALSE;
-        }
-        mSystemInfo.SecureBootEnabled = SbEnabled;
+}
 
-        TpmStatus = uefi_check_tpm(&TpmPresent);
-        if (EFI_ERROR(TpmStatus)) {
-            TpmPresent = FALSE;
-        }
-        mSystemInfo.TpmPresent = TpmPresent;
-    }
+/**
+ * Record the Secure Boot state and TPM presence
+ */
+STATIC
+VOID
+ProbeSecurityFeatures(VOID)
+{
+    BOOLEAN SbEnabled = FALSE;
+    BOOLEAN TpmPresent = FALSE;
     
-    LOG_INFO("System information gathered successfully\n");
+    if (EFI_ERROR(uefi_check_secure_boot(&SbEnabled))) {
+        SbEnabled = FALSE;
+    }
+    mSystemInfo.SecureBootEnabled = SbEnabled;
     
-    DBG_EXIT_STATUS(EFI_SUCCESS);
-    return EFI_SUCCESS;
+    if (EFI_ERROR(uefi_check_tpm(&TpmPresent))) {
+        TpmPresent = FALSE;
+    }
+    mSystemInfo.TpmPresent = TpmPresent;
 }
 
 /**
@@ -277,11 +326,29 @@ DetectCpuInformation(VOID)
     // Threads are unknown without SMT topology; assume at least one per core
     mSystemInfo.CpuThreads = Cores;
 
+    // Instruction set extensions used by the integrity engine
+    mSystemInfo.CpuFeatures = 0;
+    AsmCpuid(1, &Eax, &Ebx, &Ecx, &Edx);
+    if (Ecx & BIT20) {
+        mSystemInfo.CpuFeatures |= UEFI_CPU_FEATURE_SSE42;
+    }
+    if (Ecx & BIT1) {
+        mSystemInfo.CpuFeatures |= UEFI_CPU_FEATURE_PCLMULQDQ;
+    }
+    AsmCpuid(0, &Eax, &Ebx, &Ecx, &Edx);
+    if (Eax >= 7) {
+        AsmCpuidEx(7, 0, &Eax, &Ebx, &Ecx, &Edx);
+        if (Ebx & BIT29) {
+            mSystemInfo.CpuFeatures |= UEFI_CPU_FEATURE_SHA;
+        }
+    }
+
     LOG_INFO("CPU Information:\n");
     LOG_INFO("  Vendor: %s\n", mSystemInfo.CpuVendor);
     LOG_INFO("  Family: %s\n", mSystemInfo.CpuFamily);
     LOG_INFO("  Cores: %d\n", mSystemInfo.CpuCores);
     LOG_INFO("  Threads: %d\n", mSystemInfo.CpuThreads);
+    LOG_INFO("  Features: 0x%08X\n", mSystemInfo.CpuFeatures);
 }
 
 /**
@@ -457,6 +524,10 @@ uefi_interface_status(VOID)
     Print(L"  CPU Vendor: %s\n", mSystemInfo.CpuVendor);
     Print(L"  CPU Family: %s\n", mSystemInfo.CpuFamily);
     Print(L"  CPU Cores: %d\n", mSystemInfo.CpuCores);
+    Print(L"  CPU Features: %s%s%s\n",
+          (mSystemInfo.CpuFeatures & UEFI_CPU_FEATURE_SSE42) ? L"SSE4.2 " : L"",
+          (mSystemInfo.CpuFeatures & UEFI_CPU_FEATURE_PCLMULQDQ) ? L"PCLMULQDQ " : L"",
+          (mSystemInfo.CpuFeatures & UEFI_CPU_FEATURE_SHA) ? L"SHA" : L"");
     Print(L"  Total Memory: %ld MB\n", mSystemInfo.TotalMemory / (1024 * 1024));
     Print(L"  Available Memory: %ld MB\n", mSystemInfo.AvailableMemory / (1024 * 1024));
     
@@ -11,6 +11,61 @@
 #include "boot_services.h"
 #include "../../include/common.h"
 
+// Structure definitions
+
+/**
+ * @brief UEFI interface structure.
+ * 
+ * This structure holds information related to the UEFI interface, including
+ * pointers to the system table and boot services.
+ */
+typedef struct {
+    EFI_SYSTEM_TABLE *SystemTable;    // Pointer to the UEFI system table
+    EFI_BOOT_SERVICES *BootServices;  // Boot services pointer
+} UEFIInterface;
+
+//
+// CPU feature flags (from CPUID leaves 1 and 7)
+//
+#define UEFI_CPU_FEATURE_SSE42      0x00000001
+#define UEFI_CPU_FEATURE_PCLMULQDQ  0x00000002
+#define UEFI_CPU_FEATURE_SHA        0x00000004
+
+//
+// System Information Structure
+//
+typedef struct {
+    UINT16 UefiMajorVersion;
+    UINT16 UefiMinorVersion;
+    CHAR16 FirmwareVendor[64];
+    UINT32 FirmwareRevision;
+    
+    CHAR16 CpuVendor[32];
+    CHAR16 CpuFamily[64];
+    UINT32 CpuCores;
+    UINT32 CpuThreads;
+    UINT32 CpuFeatures;         // UEFI_CPU_FEATURE_* flags
+    
+    UINT64 TotalMemory;
+    UINT64 AvailableMemory;
+    UINT64 ReservedMemory;
+    BOOLEAN SecureBootEnabled;
+    BOOLEAN TpmPresent;
+} UEFI_SYSTEM_INFO;
+
+//
+// CPU part of the system information, kept in the fast boot cache.
+// Nothing else is cached: it would differ from one boot to the next and
+// rewrite the NVRAM variable every time.
+//
+typedef struct {
+    CHAR16 CpuVendor[32];
+    CHAR16 CpuFamily[64];
+    UINT32 CpuCores;
+    UINT32 CpuThreads;
+    UINT32 CpuFeatures;
+} UEFI_CPU_INFO;
+
 // Function declarations
 
 /**
@@ -102,37 +157,5 @@ uefi_interface_cleanup(
     VOID
     );
 
-// Structure definitions
-
-/**
- * @brief UEFI interface structure.
- * 
- * This structure holds information related to the UEFI interface, including
- * pointers to the system table and boot services.
- */
-typedef struct {
-    EFI_SYSTEM_TABLE *SystemTable;    // Pointer to the UEFI system table
-    EFI_BOOT_SERVICES *BootServices;  // Boot services pointer
-} UEFIInterface;
-
-// System Information Structure
-//
-typedef struct {
-    UINT16 UefiMajorVersion;
-    UINT16 UefiMinorVersion;
-    CHAR16 FirmwareVendor[64];
-    UINT32 FirmwareRevision;
-    
-    CHAR16 CpuVendor[32];
-    CHAR16 CpuFamily[64];
-    UINT32 CpuCores;
-    UINT32 CpuThreads;
-    
-    UINT64 TotalMemory;
-    UINT64 AvailableMemory;
-    UINT64 ReservedMemory;
-    BOOLEAN SecureBootEnabled;
-    BOOLEAN TpmPresent;
-} UEFI_SYSTEM_INFO;
 
-#endif // _UEFI_INTERFACE_H_
\ No newline at end of file
+#endif // _UEFI_INTERFACE_H_
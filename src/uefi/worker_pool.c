@@ -0,0 +1,550 @@
+/**
+ * @file worker_pool.c
+ * @brief Compute worker pool on the application processors
+ *
+ * The APs are started once with StartupAllAPs in non-blocking mode and then
+ * spin in WorkerApLoop, so posting a batch costs a generation bump rather
+ * than a trip through the MP services. Every enabled processor owns a work
+ * descriptor holding its scratch buffer, counters and the last batch
+ * generation it finished; jobs are claimed from the batch with an atomic
+ * increment, so neither the descriptors nor the batch need a lock. An AP
+ * that sees no work for WORKER_POOL_IDLE_SPINS pauses returns to the
+ * firmware and is restarted by the next submit.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
+#include <Library/DebugLib.h>
+#include <Protocol/MpService.h>
+
+#include "worker_pool.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+//
+// Per-processor work descriptor, indexed by MP services processor number
+// The BSP sets Running before starting the APs; after that only the owning
+// AP writes Running, Generation and JobsRun.
+//
+typedef struct {
+    BOOLEAN Enabled;
+    VOID *Scratch;                      // WORKER_POOL_SCRATCH_SIZE bytes
+    volatile BOOLEAN Running;           // Inside WorkerApLoop
+    volatile UINT32 Generation;         // Last batch generation finished
+    volatile UINT32 JobsRun;
+} WORKER_DESCRIPTOR;
+
+STATIC EFI_MP_SERVICES_PROTOCOL *mMpServices = NULL;
+STATIC WORKER_DESCRIPTOR mWorkers[WORKER_POOL_MAX_PROCESSORS];
+STATIC UINTN mWorkerSlots = 0;
+STATIC UINTN mProcessorCount = 0;
+STATIC UINTN mBspProcessor = 0;
+STATIC EFI_EVENT mApsDone = NULL;
+STATIC WORKER_BATCH * volatile mPostedBatch = NULL;
+STATIC volatile UINT32 mBatchGeneration = 0;
+STATIC volatile BOOLEAN mStopAps = FALSE;
+STATIC WORKER_BATCH *mActiveBatch = NULL;
+STATIC UINTN mBatchesRun = 0;
+STATIC UINTN mApStarts = 0;
+STATIC BOOLEAN mWorkerPoolInitialized = FALSE;
+
+/**
+ * Run jobs from a batch until none are left unclaimed
+ * @param Batch - Batch in flight
+ * @param Processor - Processor number of the caller
+ */
+STATIC
+VOID
+WorkerDrainBatch(
+    IN OUT WORKER_BATCH *Batch,
+    IN UINTN Processor
+)
+{
+    WORKER_DESCRIPTOR *Worker;
+    WORKER_JOB *Job;
+    UINT32 Index;
+
+    Worker = &mWorkers[Processor];
+
+    for (;;) {
+        Index = InterlockedIncrement(&Batch->NextJob) - 1;
+        if (Index >= Batch->JobCount) {
+            break;
+        }
+
+        Job = &Batch->Jobs[Index];
+        Job->Processor = Processor;
+        Job->Status = Job->Function(Job, Worker->Scratch);
+        Worker->JobsRun++;
+
+        // Publishes Job->Status before the BSP sees the job as complete
+        InterlockedIncrement(&Batch->Completed);
+    }
+}
+
+/**
+ * AP entry point: run posted batches until idle or stopped
+ * @param Buffer - Unused
+ */
+STATIC
+VOID
+EFIAPI
+WorkerApLoop(
+    IN OUT VOID *Buffer
+)
+{
+    WORKER_DESCRIPTOR *Worker;
+    WORKER_BATCH *Batch;
+    UINTN Processor;
+    UINT32 Generation;
+    UINTN Idle;
+
+    if (EFI_ERROR(mMpServices->WhoAmI(mMpServices, &Processor)) ||
+        Processor >= mWorkerSlots || !mWorkers[Processor].Enabled) {
+        return;
+    }
+
+    Worker = &mWorkers[Processor];
+    Idle = 0;
+
+    while (!mStopAps) {
+        Generation = mBatchGeneration;
+        if (Generation != Worker->Generation) {
+            Batch = mPostedBatch;
+            if (Batch != NULL) {
+                WorkerDrainBatch(Batch, Processor);
+            }
+            // The BSP may release the batch once every running AP has acked it
+            MemoryFence();
+            Worker->Generation = Generation;
+            Idle = 0;
+        } else if (++Idle >= WORKER_POOL_IDLE_SPINS) {
+            break;
+        } else {
+            CpuPause();
+        }
+    }
+
+    Worker->Running = FALSE;
+}
+
+/**
+ * Check that no running AP can still touch the posted batch
+ * @return BOOLEAN - TRUE once every running AP finished the current generation
+ */
+STATIC
+BOOLEAN
+WorkerBatchReleased(
+    VOID
+)
+{
+    UINTN Index;
+
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        if (Index != mBspProcessor && mWorkers[Index].Enabled &&
+            mWorkers[Index].Running && mWorkers[Index].Generation != mBatchGeneration) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Start the AP loops unless some are still running
+ * @return EFI_STATUS - EFI_NOT_READY while the previous run is winding down
+ */
+STATIC
+EFI_STATUS
+WorkerStartAps(
+    VOID
+)
+{
+    EFI_STATUS Status;
+    UINTN Index;
+
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        if (Index != mBspProcessor && mWorkers[Index].Running) {
+            return EFI_SUCCESS;
+        }
+    }
+
+    // The MP services only accept new work once they have seen the APs return
+    if (mApsDone != NULL) {
+        if (gBS->CheckEvent(mApsDone) == EFI_NOT_READY) {
+            return EFI_NOT_READY;
+        }
+        gBS->CloseEvent(mApsDone);
+        mApsDone = NULL;
+    }
+
+    Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &mApsDone);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    // Marked running up front so a batch posted before an AP enters its loop waits for it
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        if (Index != mBspProcessor && mWorkers[Index].Enabled) {
+            mWorkers[Index].Generation = mBatchGeneration;
+            mWorkers[Index].Running = TRUE;
+        }
+    }
+    mStopAps = FALSE;
+
+    Status = mMpServices->StartupAllAPs(mMpServices, WorkerApLoop, FALSE, mApsDone, 0, NULL, NULL);
+    if (EFI_ERROR(Status)) {
+        for (Index = 0; Index < mWorkerSlots; Index++) {
+            mWorkers[Index].Running = FALSE;
+        }
+        gBS->CloseEvent(mApsDone);
+        mApsDone = NULL;
+        return Status;
+    }
+
+    mApStarts++;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Locate the MP services and prepare a work descriptor per processor
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_init(
+    VOID
+)
+{
+    EFI_STATUS Status;
+    EFI_PROCESSOR_INFORMATION Info;
+    UINTN Total;
+    UINTN Enabled;
+    UINTN Index;
+
+    DBG_ENTER();
+
+    if (mWorkerPoolInitialized) {
+        DBG_EXIT_STATUS(EFI_ALREADY_STARTED);
+        return EFI_ALREADY_STARTED;
+    }
+
+    ZeroMemory(mWorkers, sizeof(mWorkers));
+    mProcessorCount = 0;
+    mBspProcessor = 0;
+    mApsDone = NULL;
+    mPostedBatch = NULL;
+    mBatchGeneration = 0;
+    mActiveBatch = NULL;
+    mBatchesRun = 0;
+    mApStarts = 0;
+
+    Total = 1;
+    Status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (VOID **)&mMpServices);
+    if (!EFI_ERROR(Status)) {
+        Status = mMpServices->GetNumberOfProcessors(mMpServices, &Total, &Enabled);
+    }
+    if (!EFI_ERROR(Status)) {
+        Status = mMpServices->WhoAmI(mMpServices, &mBspProcessor);
+    }
+    if (!EFI_ERROR(Status) && mBspProcessor >= WORKER_POOL_MAX_PROCESSORS) {
+        Status = EFI_UNSUPPORTED;
+    }
+    if (EFI_ERROR(Status)) {
+        LOG_INFO("MP services not usable (%r), jobs run on the BSP\n", Status);
+        mMpServices = NULL;
+        mBspProcessor = 0;
+        Total = 1;
+    }
+
+    mWorkerSlots = MIN(Total, WORKER_POOL_MAX_PROCESSORS);
+
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        if (Index != mBspProcessor) {
+            Status = mMpServices->GetProcessorInfo(mMpServices, Index, &Info);
+            if (EFI_ERROR(Status) || (Info.StatusFlag & PROCESSOR_ENABLED_BIT) == 0) {
+                continue;
+            }
+        }
+
+        // Scratch is allocated up front since APs cannot allocate memory
+        mWorkers[Index].Scratch = AllocatePages(EFI_SIZE_TO_PAGES(WORKER_POOL_SCRATCH_SIZE));
+        if (mWorkers[Index].Scratch == NULL) {
+            if (Index == mBspProcessor) {
+                worker_pool_cleanup();
+                DBG_EXIT_STATUS(EFI_OUT_OF_RESOURCES);
+                return EFI_OUT_OF_RESOURCES;
+            }
+            LOG_WARN("No scratch for processor %d, leaving it idle\n", Index);
+            continue;
+        }
+
+        mWorkers[Index].Enabled = TRUE;
+        mProcessorCount++;
+    }
+
+    mStopAps = FALSE;
+    mWorkerPoolInitialized = TRUE;
+
+    LOG_INFO("Worker pool: %d of %d processors\n", mProcessorCount, Total);
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the number of processors that run jobs, BSP included
+ * @return UINTN - 1 when only the BSP is available
+ */
+UINTN
+EFIAPI
+worker_pool_get_processor_count(
+    VOID
+)
+{
+    return mWorkerPoolInitialized ? mProcessorCount : 1;
+}
+
+/**
+ * Start a batch of jobs on the APs without waiting for them
+ * @param Jobs - Jobs to run; must stay valid until the batch completes
+ * @param JobCount - Number of jobs
+ * @param Batch - Batch state to initialize; must stay valid until the batch completes
+ * @return EFI_STATUS - EFI_NOT_READY if another batch is still running
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_submit(
+    IN WORKER_JOB *Jobs,
+    IN UINTN JobCount,
+    OUT WORKER_BATCH *Batch
+)
+{
+    EFI_STATUS Status;
+    UINTN Index;
+
+    if (!mWorkerPoolInitialized || Jobs == NULL || JobCount == 0 ||
+        JobCount > MAX_UINT32 || Batch == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (mActiveBatch != NULL) {
+        return EFI_NOT_READY;
+    }
+
+    for (Index = 0; Index < JobCount; Index++) {
+        if (Jobs[Index].Function == NULL) {
+            return EFI_INVALID_PARAMETER;
+        }
+        Jobs[Index].Status = EFI_NOT_STARTED;
+    }
+
+    ZeroMemory(Batch, sizeof(WORKER_BATCH));
+    Batch->Jobs = Jobs;
+    Batch->JobCount = (UINT32)JobCount;
+    mActiveBatch = Batch;
+    mBatchesRun++;
+
+    Status = EFI_NOT_STARTED;
+    if (mMpServices != NULL && mProcessorCount > 1) {
+        Status = WorkerStartAps();
+        if (EFI_ERROR(Status) && Status != EFI_NOT_READY) {
+            LOG_WARN("AP dispatch failed: %r, using the BSP only\n", Status);
+            mProcessorCount = 1;
+        }
+    }
+
+    if (EFI_ERROR(Status)) {
+        // No AP will pick the batch up, so the BSP runs it now
+        WorkerDrainBatch(Batch, mBspProcessor);
+        mActiveBatch = NULL;
+        return EFI_SUCCESS;
+    }
+
+    mPostedBatch = Batch;
+    MemoryFence();
+    mBatchGeneration++;
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Check whether a batch has completed, without blocking
+ * @param Batch - Submitted batch
+ * @return EFI_STATUS - EFI_NOT_READY while jobs are still running
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_poll(
+    IN OUT WORKER_BATCH *Batch
+)
+{
+    UINTN Index;
+
+    if (Batch == NULL || Batch->Jobs == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (Batch != mActiveBatch) {
+        return EFI_SUCCESS;
+    }
+
+    if (Batch->NextJob < Batch->JobCount) {
+        for (Index = 0; Index < mWorkerSlots; Index++) {
+            if (Index != mBspProcessor && mWorkers[Index].Running) {
+                break;
+            }
+        }
+        // Every AP went idle just as the batch was posted; finish it here
+        if (Index == mWorkerSlots) {
+            WorkerDrainBatch(Batch, mBspProcessor);
+        }
+    }
+
+    if (Batch->Completed < Batch->JobCount || !WorkerBatchReleased()) {
+        return EFI_NOT_READY;
+    }
+
+    mActiveBatch = NULL;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Finish a batch, running unclaimed jobs on the BSP, and wait for the APs
+ * @param Batch - Submitted batch
+ * @return EFI_STATUS - Status of the first failed job in job order, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_wait(
+    IN OUT WORKER_BATCH *Batch
+)
+{
+    UINTN Index;
+
+    if (Batch == NULL || Batch->Jobs == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (Batch == mActiveBatch) {
+        WorkerDrainBatch(Batch, mBspProcessor);
+        while (Batch->Completed < Batch->JobCount || !WorkerBatchReleased()) {
+            CpuPause();
+        }
+        mActiveBatch = NULL;
+    }
+
+    for (Index = 0; Index < Batch->JobCount; Index++) {
+        if (EFI_ERROR(Batch->Jobs[Index].Status)) {
+            return Batch->Jobs[Index].Status;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Run a batch of jobs on every processor and wait for it
+ * @param Jobs - Jobs to run
+ * @param JobCount - Number of jobs
+ * @return EFI_STATUS - Status of the first failed job in job order, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_run(
+    IN WORKER_JOB *Jobs,
+    IN UINTN JobCount
+)
+{
+    EFI_STATUS Status;
+    WORKER_BATCH Batch;
+
+    Status = worker_pool_submit(Jobs, JobCount, &Batch);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    return worker_pool_wait(&Batch);
+}
+
+/**
+ * Print the processors in the pool and the jobs each has run
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_status(
+    VOID
+)
+{
+    UINTN Index;
+
+    if (!mWorkerPoolInitialized) {
+        Print(L"Worker Pool: Not initialized\n");
+        return EFI_NOT_READY;
+    }
+
+    Print(L"Worker pool: %d processors, %d batches, %d AP starts\n",
+          mProcessorCount, mBatchesRun, mApStarts);
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        if (!mWorkers[Index].Enabled) {
+            continue;
+        }
+        Print(L"  CPU %-3d %s %d jobs\n", Index,
+              (Index == mBspProcessor) ? L"BSP " : (mWorkers[Index].Running ? L"busy" : L"idle"),
+              mWorkers[Index].JobsRun);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Wait for any batch still in flight and release the per-processor scratch
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_cleanup(
+    VOID
+)
+{
+    UINTN Index;
+
+    if (mActiveBatch != NULL) {
+        worker_pool_wait(mActiveBatch);
+    }
+
+    // Scratch may only be freed once every AP has left its loop
+    mStopAps = TRUE;
+    for (Index = 0; Index < mWorkerSlots; Index++) {
+        while (mWorkers[Index].Running) {
+            CpuPause();
+        }
+    }
+    if (mApsDone != NULL) {
+        gBS->WaitForEvent(1, &mApsDone, &Index);
+        gBS->CloseEvent(mApsDone);
+        mApsDone = NULL;
+    }
+
+    for (Index = 0; Index < WORKER_POOL_MAX_PROCESSORS; Index++) {
+        if (mWorkers[Index].Scratch != NULL) {
+            FreePages(mWorkers[Index].Scratch, EFI_SIZE_TO_PAGES(WORKER_POOL_SCRATCH_SIZE));
+        }
+    }
+    ZeroMemory(mWorkers, sizeof(mWorkers));
+
+    mMpServices = NULL;
+    mPostedBatch = NULL;
+    mProcessorCount = 0;
+    mWorkerSlots = 0;
+    mWorkerPoolInitialized = FALSE;
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file worker_pool.h
+ * @brief Compute worker pool on the application processors
+ */
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <Uefi.h>
+
+//
+// Jobs run on application processors (APs) as well as the BSP. APs may not
+// call boot services, Print or the debug log, so a job function must only
+// compute over memory prepared by the BSP and report through its context.
+// Each processor has its own WORKER_POOL_SCRATCH_SIZE scratch buffer.
+//
+typedef struct _WORKER_JOB WORKER_JOB;
+
+typedef
+EFI_STATUS
+(EFIAPI *WORKER_JOB_FUNCTION)(
+    IN OUT WORKER_JOB *Job,
+    IN VOID *Scratch
+    );
+
+struct _WORKER_JOB {
+    WORKER_JOB_FUNCTION Function;
+    VOID *Context;
+    EFI_STATUS Status;                  // Set by the processor that ran the job
+    UINTN Processor;                    // Processor number that ran the job
+};
+
+//
+// Batch of jobs in flight
+// Processors claim jobs by atomically advancing NextJob, so no job is run
+// twice and no lock is held while jobs execute.
+//
+typedef struct {
+    WORKER_JOB *Jobs;
+    UINT32 JobCount;
+    volatile UINT32 NextJob;
+    volatile UINT32 Completed;
+} WORKER_BATCH;
+
+//
+// Function Prototypes
+//
+
+/**
+ * Locate the MP services and prepare a work descriptor per processor
+ * @details Without EFI_MP_SERVICES_PROTOCOL or enabled APs every batch runs
+ *          on the BSP, so callers never need a separate serial path.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_init(
+    VOID
+    );
+
+/**
+ * Get the number of processors that run jobs, BSP included
+ * @return UINTN - 1 when only the BSP is available
+ */
+UINTN
+EFIAPI
+worker_pool_get_processor_count(
+    VOID
+    );
+
+/**
+ * Start a batch of jobs on the APs without waiting for them
+ * @details Returns as soon as the batch is posted so the BSP can keep doing
+ *          I/O. Only one batch runs at a time. When no AP is available the
+ *          jobs are run on the BSP before returning.
+ * @param Jobs - Jobs to run; must stay valid until the batch completes
+ * @param JobCount - Number of jobs
+ * @param Batch - Batch state to initialize; must stay valid until the batch completes
+ * @return EFI_STATUS - EFI_NOT_READY if another batch is still running
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_submit(
+    IN WORKER_JOB *Jobs,
+    IN UINTN JobCount,
+    OUT WORKER_BATCH *Batch
+    );
+
+/**
+ * Check whether a batch has completed, without blocking
+ * @param Batch - Submitted batch
+ * @return EFI_STATUS - EFI_NOT_READY while jobs or APs are still running
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_poll(
+    IN OUT WORKER_BATCH *Batch
+    );
+
+/**
+ * Finish a batch, running unclaimed jobs on the BSP, and wait for the APs
+ * @param Batch - Submitted batch
+ * @return EFI_STATUS - Status of the first failed job in job order, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_wait(
+    IN OUT WORKER_BATCH *Batch
+    );
+
+/**
+ * Run a batch of jobs on every processor and wait for it
+ * @param Jobs - Jobs to run
+ * @param JobCount - Number of jobs
+ * @return EFI_STATUS - Status of the first failed job in job order, or EFI_SUCCESS
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_run(
+    IN WORKER_JOB *Jobs,
+    IN UINTN JobCount
+    );
+
+/**
+ * Print the processors in the pool and the jobs each has run
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_status(
+    VOID
+    );
+
+/**
+ * Wait for any batch still in flight and release the per-processor scratch
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+worker_pool_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+VOID
+WorkerDrainBatch(
+    IN OUT WORKER_BATCH *Batch,
+    IN UINTN Processor
+    );
+
+STATIC
+BOOLEAN
+WorkerBatchReleased(
+    VOID
+    );
+
+STATIC
+EFI_STATUS
+WorkerStartAps(
+    VOID
+    );
+
+STATIC
+VOID
+EFIAPI
+WorkerApLoop(
+    IN OUT VOID *Buffer
+    );
+
+#endif // _WORKER_POOL_H_
@@ -0,0 +1,325 @@
+/**
+ * @file usb_descriptor_cache.c
+ * @brief Parsed interface/endpoint cache keyed by device identity
+ *
+ * The same hubs and storage sticks show up on every boot, so the result of
+ * parsing an interface is kept by VID/PID/bcdDevice and, when
+ * USB_DESCRIPTOR_CACHE_PERSIST is set, saved in an NVRAM variable. A hit
+ * replaces the per-endpoint descriptor walk with a table copy.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "usb_descriptor_cache.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+#define USB_DESCRIPTOR_CACHE_SIGNATURE  SIGNATURE_32('U', 'D', 'C', 'A')
+#define USB_DESCRIPTOR_CACHE_VERSION    2
+
+#define USB_DESCRIPTOR_CACHE_FLAG_UAS   BIT0
+
+#pragma pack(1)
+typedef struct {
+    USB_DESCRIPTOR_CACHE_KEY Key;
+    UINT8 InterfaceClass;
+    UINT8 InterfaceSubClass;
+    UINT8 InterfaceProtocol;
+    UINT8 BulkInEndpoint;
+    UINT8 BulkOutEndpoint;
+    UINT8 InterruptInEndpoint;
+    UINT8 InterruptInInterval;
+    UINT8 Flags;
+    UINT16 BulkInMaxPacket;
+    UINT16 BulkOutMaxPacket;
+    UINT16 InterruptInMaxPacket;
+    UINT8 BulkInMaxBurst;               // From SuperSpeed companions
+    UINT8 BulkOutMaxBurst;
+} USB_DESCRIPTOR_CACHE_ENTRY;
+
+//
+// NVRAM image: header followed by Count entries
+//
+typedef struct {
+    UINT32 Signature;
+    UINT16 Version;
+    UINT16 Count;
+    USB_DESCRIPTOR_CACHE_ENTRY Entries[USB_DESCRIPTOR_CACHE_ENTRIES];
+} USB_DESCRIPTOR_CACHE_IMAGE;
+#pragma pack()
+
+STATIC EFI_GUID mFirmwareVariableGuid = FIRMWARE_VARIABLE_GUID;
+STATIC USB_DESCRIPTOR_CACHE_IMAGE mCache;
+STATIC UINTN mNextVictim = 0;
+STATIC BOOLEAN mCacheDirty = FALSE;
+STATIC UINTN mCacheHits = 0;
+STATIC UINTN mCacheMisses = 0;
+
+/**
+ * Find the entry for a key
+ * @param Key - Interface identity
+ * @return USB_DESCRIPTOR_CACHE_ENTRY* - Entry, or NULL on a miss
+ */
+STATIC
+USB_DESCRIPTOR_CACHE_ENTRY *
+FindEntry(
+    IN CONST USB_DESCRIPTOR_CACHE_KEY *Key
+)
+{
+    UINTN Index;
+
+    for (Index = 0; Index < mCache.Count; Index++) {
+        if (CompareMem(&mCache.Entries[Index].Key, Key, sizeof(USB_DESCRIPTOR_CACHE_KEY)) == 0) {
+            return &mCache.Entries[Index];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Load the cache persisted by a previous boot
+ * @return EFI_STATUS - EFI_NOT_FOUND if nothing was persisted
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_load(
+    VOID
+)
+{
+    EFI_STATUS Status;
+    UINTN DataSize;
+    UINT32 Attributes;
+
+    ZeroMemory(&mCache, sizeof(mCache));
+    mCache.Signature = USB_DESCRIPTOR_CACHE_SIGNATURE;
+    mCache.Version = USB_DESCRIPTOR_CACHE_VERSION;
+    mNextVictim = 0;
+    mCacheDirty = FALSE;
+    mCacheHits = 0;
+    mCacheMisses = 0;
+
+    if (!USB_DESCRIPTOR_CACHE_PERSIST || gRT == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    DataSize = sizeof(mCache);
+    Status = gRT->GetVariable(
+        USB_DESCRIPTOR_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        &Attributes,
+        &DataSize,
+        &mCache
+    );
+
+    if (EFI_ERROR(Status) ||
+        DataSize < OFFSET_OF(USB_DESCRIPTOR_CACHE_IMAGE, Entries) ||
+        mCache.Signature != USB_DESCRIPTOR_CACHE_SIGNATURE ||
+        mCache.Version != USB_DESCRIPTOR_CACHE_VERSION ||
+        mCache.Count > USB_DESCRIPTOR_CACHE_ENTRIES ||
+        DataSize != OFFSET_OF(USB_DESCRIPTOR_CACHE_IMAGE, Entries) +
+                    mCache.Count * sizeof(USB_DESCRIPTOR_CACHE_ENTRY)) {
+        if (Status != EFI_NOT_FOUND) {
+            LOG_WARN("Ignoring unusable USB descriptor cache variable: %r\n", Status);
+        }
+        ZeroMemory(&mCache, sizeof(mCache));
+        mCache.Signature = USB_DESCRIPTOR_CACHE_SIGNATURE;
+        mCache.Version = USB_DESCRIPTOR_CACHE_VERSION;
+        return EFI_ERROR(Status) ? Status : EFI_VOLUME_CORRUPTED;
+    }
+
+    mNextVictim = mCache.Count % USB_DESCRIPTOR_CACHE_ENTRIES;
+    LOG_INFO("Loaded %d cached USB interface descriptions\n", mCache.Count);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Fill a device's interface and endpoint fields from the cache
+ * @param Key - Interface identity
+ * @param Device - Device information to fill in
+ * @return EFI_STATUS - EFI_NOT_FOUND on a miss
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_lookup(
+    IN CONST USB_DESCRIPTOR_CACHE_KEY *Key,
+    IN OUT USB_DEVICE_INFO *Device
+)
+{
+    USB_DESCRIPTOR_CACHE_ENTRY *Entry;
+
+    if (Key == NULL || Device == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Entry = FindEntry(Key);
+    if (Entry == NULL) {
+        mCacheMisses++;
+        return EFI_NOT_FOUND;
+    }
+
+    Device->InterfaceNumber = Entry->Key.InterfaceNumber;
+    Device->InterfaceClass = Entry->InterfaceClass;
+    Device->InterfaceSubClass = Entry->InterfaceSubClass;
+    Device->InterfaceProtocol = Entry->InterfaceProtocol;
+    Device->BulkInEndpoint = Entry->BulkInEndpoint;
+    Device->BulkOutEndpoint = Entry->BulkOutEndpoint;
+    Device->BulkInMaxPacket = Entry->BulkInMaxPacket;
+    Device->BulkOutMaxPacket = Entry->BulkOutMaxPacket;
+    Device->BulkInMaxBurst = Entry->BulkInMaxBurst;
+    Device->BulkOutMaxBurst = Entry->BulkOutMaxBurst;
+    Device->UasCapable = (Entry->Flags & USB_DESCRIPTOR_CACHE_FLAG_UAS) != 0;
+    Device->InterruptInEndpoint = Entry->InterruptInEndpoint;
+    Device->InterruptInMaxPacket = Entry->InterruptInMaxPacket;
+    Device->InterruptInInterval = Entry->InterruptInInterval;
+
+    mCacheHits++;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Remember a device's parsed interface and endpoint fields
+ * @param Key - Interface identity
+ * @param Device - Parsed device information
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_store(
+    IN CONST USB_DESCRIPTOR_CACHE_KEY *Key,
+    IN CONST USB_DEVICE_INFO *Device
+)
+{
+    USB_DESCRIPTOR_CACHE_ENTRY *Entry;
+    USB_DESCRIPTOR_CACHE_ENTRY Updated;
+
+    if (Key == NULL || Device == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&Updated, sizeof(Updated));
+    CopyMemory(&Updated.Key, Key, sizeof(USB_DESCRIPTOR_CACHE_KEY));
+    Updated.InterfaceClass = Device->InterfaceClass;
+    Updated.InterfaceSubClass = Device->InterfaceSubClass;
+    Updated.InterfaceProtocol = Device->InterfaceProtocol;
+    Updated.BulkInEndpoint = Device->BulkInEndpoint;
+    Updated.BulkOutEndpoint = Device->BulkOutEndpoint;
+    Updated.BulkInMaxPacket = Device->BulkInMaxPacket;
+    Updated.BulkOutMaxPacket = Device->BulkOutMaxPacket;
+    Updated.BulkInMaxBurst = Device->BulkInMaxBurst;
+    Updated.BulkOutMaxBurst = Device->BulkOutMaxBurst;
+    Updated.Flags = Device->UasCapable ? USB_DESCRIPTOR_CACHE_FLAG_UAS : 0;
+    Updated.InterruptInEndpoint = Device->InterruptInEndpoint;
+    Updated.InterruptInMaxPacket = Device->InterruptInMaxPacket;
+    Updated.InterruptInInterval = Device->InterruptInInterval;
+
+    Entry = FindEntry(Key);
+    if (Entry == NULL) {
+        if (mCache.Count < USB_DESCRIPTOR_CACHE_ENTRIES) {
+            Entry = &mCache.Entries[mCache.Count++];
+        } else {
+            // Full: replace entries oldest first
+            Entry = &mCache.Entries[mNextVictim];
+            mNextVictim = (mNextVictim + 1) % USB_DESCRIPTOR_CACHE_ENTRIES;
+        }
+    } else if (CompareMem(Entry, &Updated, sizeof(Updated)) == 0) {
+        return EFI_SUCCESS;
+    }
+
+    CopyMemory(Entry, &Updated, sizeof(Updated));
+    mCacheDirty = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Write the cache to NVRAM if it changed since the last load or flush
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_flush(
+    VOID
+)
+{
+    EFI_STATUS Status;
+
+    if (!mCacheDirty || !USB_DESCRIPTOR_CACHE_PERSIST || gRT == NULL) {
+        return EFI_SUCCESS;
+    }
+
+    Status = gRT->SetVariable(
+        USB_DESCRIPTOR_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        OFFSET_OF(USB_DESCRIPTOR_CACHE_IMAGE, Entries) + mCache.Count * sizeof(USB_DESCRIPTOR_CACHE_ENTRY),
+        &mCache
+    );
+
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("Failed to persist USB descriptor cache: %r\n", Status);
+        return Status;
+    }
+
+    mCacheDirty = FALSE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Drop every entry, including the persisted copy
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_invalidate(
+    VOID
+)
+{
+    EFI_STATUS Status;
+
+    mCache.Count = 0;
+    mNextVictim = 0;
+    mCacheDirty = FALSE;
+
+    if (!USB_DESCRIPTOR_CACHE_PERSIST || gRT == NULL) {
+        return EFI_SUCCESS;
+    }
+
+    // A zero-size write deletes the variable
+    Status = gRT->SetVariable(
+        USB_DESCRIPTOR_CACHE_VARIABLE,
+        &mFirmwareVariableGuid,
+        0,
+        0,
+        NULL
+    );
+
+    return (Status == EFI_NOT_FOUND) ? EFI_SUCCESS : Status;
+}
+
+/**
+ * Get cache hit and miss counts since load
+ * @param Hits - Pointer to receive the hit count
+ * @param Misses - Pointer to receive the miss count
+ * @param Entries - Optional pointer to receive the number of cached entries
+ */
+VOID
+EFIAPI
+usb_descriptor_cache_get_stats(
+    OUT UINTN *Hits,
+    OUT UINTN *Misses,
+    OUT UINTN *Entries OPTIONAL
+)
+{
+    if (Hits != NULL) {
+        *Hits = mCacheHits;
+    }
+    if (Misses != NULL) {
+        *Misses = mCacheMisses;
+    }
+    if (Entries != NULL) {
+        *Entries = mCache.Count;
+    }
+}
@@ -0,0 +1,107 @@
+/**
+ * @file usb_descriptor_cache.h
+ * @brief Parsed interface/endpoint cache keyed by device identity
+ */
+
+#ifndef _USB_DESCRIPTOR_CACHE_H_
+#define _USB_DESCRIPTOR_CACHE_H_
+
+#include <Uefi.h>
+#include "usb_driver.h"
+
+//
+// Identifies one interface of one device model. The configuration length
+// and endpoint count guard against two firmware builds that share a
+// bcdDevice but describe different interfaces; the length also tells a
+// SuperSpeed link (with endpoint companions) from a USB 2.0 one.
+//
+#pragma pack(1)
+typedef struct {
+    UINT16 VendorId;
+    UINT16 ProductId;
+    UINT16 DeviceRevision;              // bcdDevice
+    UINT16 ConfigLength;                // wTotalLength of the active configuration
+    UINT8 InterfaceNumber;
+    UINT8 AlternateSetting;
+    UINT8 NumEndpoints;
+    UINT8 Reserved;
+} USB_DESCRIPTOR_CACHE_KEY;
+#pragma pack()
+
+//
+// Function Prototypes
+//
+
+/**
+ * Load the cache persisted by a previous boot
+ * @details A missing or malformed variable leaves the cache empty.
+ * @return EFI_STATUS - EFI_NOT_FOUND if nothing was persisted
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_load(
+    VOID
+    );
+
+/**
+ * Fill a device's interface and endpoint fields from the cache
+ * @param Key - Interface identity
+ * @param Device - Device information to fill in
+ * @return EFI_STATUS - EFI_NOT_FOUND on a miss
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_lookup(
+    IN CONST USB_DESCRIPTOR_CACHE_KEY *Key,
+    IN OUT USB_DEVICE_INFO *Device
+    );
+
+/**
+ * Remember a device's parsed interface and endpoint fields
+ * @details The oldest entry is replaced once the cache is full.
+ * @param Key - Interface identity
+ * @param Device - Parsed device information
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_store(
+    IN CONST USB_DESCRIPTOR_CACHE_KEY *Key,
+    IN CONST USB_DEVICE_INFO *Device
+    );
+
+/**
+ * Write the cache to NVRAM if it changed since the last load or flush
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_flush(
+    VOID
+    );
+
+/**
+ * Drop every entry, including the persisted copy
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_descriptor_cache_invalidate(
+    VOID
+    );
+
+/**
+ * Get cache hit and miss counts since load
+ * @param Hits - Pointer to receive the hit count
+ * @param Misses - Pointer to receive the miss count
+ * @param Entries - Optional pointer to receive the number of cached entries
+ */
+VOID
+EFIAPI
+usb_descriptor_cache_get_stats(
+    OUT UINTN *Hits,
+    OUT UINTN *Misses,
+    OUT UINTN *Entries OPTIONAL
+    );
+
+#endif // _USB_DESCRIPTOR_CACHE_H_
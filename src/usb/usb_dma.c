@@ -0,0 +1,369 @@
+/**
+ * @file usb_dma.c
+ * @brief Pre-mapped common-buffer slices for USB transfer buffers
+ *
+ * EFI_USB_IO_PROTOCOL takes host addresses, so the host controller driver
+ * still calls PciIo->Map on every transfer. What it maps is what decides the
+ * cost: a buffer the controller cannot reach (above 4 GiB on a 32-bit
+ * controller, or outside what an IOMMU has granted) is bounced through a
+ * copy each time. Slices handed out here come from memory the controller's
+ * own PciIo allocated and mapped as a common buffer, so those per-transfer
+ * maps are identity translations with no bounce, and the mapping itself is
+ * set up once per controller instead of once per transfer.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+
+#include "usb_dma.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+#include "../uefi/boot_services.h"
+
+STATIC USB_DMA_REGION mDmaRegions[MAX_USB_HOST_CONTROLLERS];
+STATIC UINTN mDmaRegionCount = 0;
+STATIC UINTN mDmaUnsupported = 0;      // Requests from devices with no PCI host controller
+STATIC BOOLEAN mDmaEnabled = FALSE;
+
+/**
+ * Allocate and map the common buffer of a host controller
+ * @param Controller - PCI handle of the host controller
+ * @param Region - Region to fill in
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+DmaMapRegion(
+    IN EFI_HANDLE Controller,
+    OUT USB_DMA_REGION *Region
+)
+{
+    EFI_STATUS Status;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+    VOID *HostAddress;
+    EFI_PHYSICAL_ADDRESS DeviceAddress;
+    VOID *Mapping;
+    UINTN Bytes;
+
+    Status = gBS->OpenProtocol(
+        Controller,
+        &gEfiPciIoProtocolGuid,
+        (VOID **)&PciIo,
+        gImageHandle,
+        NULL,
+        EFI_OPEN_PROTOCOL_GET_PROTOCOL
+        );
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Status = PciIo->AllocateBuffer(PciIo, AllocateAnyPages, EfiBootServicesData,
+                                   USB_DMA_REGION_PAGES, &HostAddress, 0);
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("USB DMA: %d KB common buffer unavailable: %r\n", USB_DMA_REGION_SIZE / 1024, Status);
+        return Status;
+    }
+
+    Bytes = USB_DMA_REGION_SIZE;
+    Status = PciIo->Map(PciIo, EfiPciIoOperationBusMasterCommonBuffer, HostAddress,
+                        &Bytes, &DeviceAddress, &Mapping);
+    if (!EFI_ERROR(Status) && Bytes < USB_DMA_REGION_SIZE) {
+        // A partial common-buffer mapping is of no use to the slices
+        PciIo->Unmap(PciIo, Mapping);
+        Status = EFI_OUT_OF_RESOURCES;
+    }
+    if (EFI_ERROR(Status)) {
+        LOG_WARN("USB DMA: common buffer mapping failed: %r\n", Status);
+        PciIo->FreeBuffer(PciIo, USB_DMA_REGION_PAGES, HostAddress);
+        return Status;
+    }
+
+    ZeroMemory(Region, sizeof(USB_DMA_REGION));
+    Region->Controller = Controller;
+    Region->PciIo = PciIo;
+    Region->HostAddress = HostAddress;
+    Region->DeviceAddress = DeviceAddress;
+    Region->Mapping = Mapping;
+
+    LOG_INFO("USB DMA: %d KB mapped at host 0x%lx, device 0x%lx\n",
+             USB_DMA_REGION_SIZE / 1024, (UINT64)(UINTN)HostAddress, DeviceAddress);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the region of the host controller a device sits behind, mapping it on first use
+ * @param DeviceId - Device identifier
+ * @return USB_DMA_REGION* - Region, NULL if the controller has none
+ */
+STATIC
+USB_DMA_REGION *
+DmaFindRegion(
+    IN UINTN DeviceId
+)
+{
+    USB_DEVICE_INFO Info;
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+    EFI_HANDLE Controller;
+    UINTN Index;
+
+    if (EFI_ERROR(usb_get_device_info(DeviceId, &Info)) || Info.Handle == NULL) {
+        return NULL;
+    }
+
+    // Class drivers attach before the device table records the path, so
+    // resolve it from the UsbIo handle; the nearest PciIo is the controller
+    if (EFI_ERROR(GetDevicePathFromHandle(Info.Handle, &DevicePath)) ||
+        EFI_ERROR(gBS->LocateDevicePath(&gEfiPciIoProtocolGuid, &DevicePath, &Controller))) {
+        return NULL;
+    }
+
+    for (Index = 0; Index < mDmaRegionCount; Index++) {
+        if (mDmaRegions[Index].Controller == Controller) {
+            return &mDmaRegions[Index];
+        }
+    }
+
+    if (mDmaRegionCount >= MAX_USB_HOST_CONTROLLERS ||
+        EFI_ERROR(DmaMapRegion(Controller, &mDmaRegions[mDmaRegionCount]))) {
+        return NULL;
+    }
+
+    return &mDmaRegions[mDmaRegionCount++];
+}
+
+/**
+ * Get the region a host address lies in
+ * @param Buffer - Host address
+ * @return USB_DMA_REGION* - Region, NULL if Buffer is in none
+ */
+STATIC
+USB_DMA_REGION *
+DmaRegionOf(
+    IN CONST VOID *Buffer
+)
+{
+    UINTN Index;
+    UINTN Base;
+
+    for (Index = 0; Index < mDmaRegionCount; Index++) {
+        Base = (UINTN)mDmaRegions[Index].HostAddress;
+        if ((UINTN)Buffer >= Base && (UINTN)Buffer - Base < USB_DMA_REGION_SIZE) {
+            return &mDmaRegions[Index];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Initialize the DMA buffer manager
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_init(
+    VOID
+)
+{
+    ZeroMemory(mDmaRegions, sizeof(mDmaRegions));
+    mDmaRegionCount = 0;
+    mDmaUnsupported = 0;
+    mDmaEnabled = ENABLE_DMA_TRANSFERS;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get a pre-mapped slice of the common buffer of a device's host controller
+ * @param DeviceId - Device the buffer is used with
+ * @param Size - Bytes needed, rounded up to whole pages
+ * @param Buffer - Pointer to receive the page-aligned host address
+ * @param DeviceAddress - Optional pointer to receive the bus address
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_alloc(
+    IN UINTN DeviceId,
+    IN UINTN Size,
+    OUT VOID **Buffer,
+    OUT EFI_PHYSICAL_ADDRESS *DeviceAddress OPTIONAL
+)
+{
+    USB_DMA_REGION *Region;
+    EFI_TPL OldTpl;
+    UINTN Pages;
+    UINTN Start;
+    UINTN Run;
+    UINTN Index;
+
+    if (Buffer == NULL || Size == 0 || Size > USB_DMA_REGION_SIZE) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (!mDmaEnabled) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // Mass storage attaches from the hot-plug notification
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+
+    Region = DmaFindRegion(DeviceId);
+    if (Region == NULL) {
+        mDmaUnsupported++;
+        gBS->RestoreTPL(OldTpl);
+        return EFI_UNSUPPORTED;
+    }
+
+    Pages = EFI_SIZE_TO_PAGES(Size);
+    Run = 0;
+    Start = 0;
+    for (Index = 0; Index < USB_DMA_REGION_PAGES && Run < Pages; Index++) {
+        if (Region->PageInUse[Index]) {
+            Run = 0;
+            continue;
+        }
+        if (Run == 0) {
+            Start = Index;
+        }
+        Run++;
+    }
+
+    if (Run < Pages) {
+        Region->Misses++;
+        gBS->RestoreTPL(OldTpl);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    SetMem(&Region->PageInUse[Start], Pages * sizeof(BOOLEAN), TRUE);
+    Region->SlicePages[Start] = (UINT16)Pages;
+    Region->PagesInUse += Pages;
+    Region->PeakPages = MAX(Region->PeakPages, Region->PagesInUse);
+    Region->Slices++;
+
+    *Buffer = (UINT8 *)Region->HostAddress + EFI_PAGES_TO_SIZE(Start);
+    if (DeviceAddress != NULL) {
+        *DeviceAddress = Region->DeviceAddress + EFI_PAGES_TO_SIZE(Start);
+    }
+
+    gBS->RestoreTPL(OldTpl);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Return a slice to its region
+ * @param Buffer - Host address from usb_dma_alloc
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_free(
+    IN VOID *Buffer
+)
+{
+    USB_DMA_REGION *Region;
+    EFI_TPL OldTpl;
+    UINTN Offset;
+    UINTN Start;
+    UINTN Pages;
+
+    if (Buffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+
+    Region = DmaRegionOf(Buffer);
+    if (Region == NULL) {
+        gBS->RestoreTPL(OldTpl);
+        return EFI_NOT_FOUND;
+    }
+
+    Offset = (UINTN)Buffer - (UINTN)Region->HostAddress;
+    Start = Offset >> EFI_PAGE_SHIFT;
+    if ((Offset & EFI_PAGE_MASK) != 0 || Region->SlicePages[Start] == 0) {
+        gBS->RestoreTPL(OldTpl);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Pages = Region->SlicePages[Start];
+    ZeroMemory(&Region->PageInUse[Start], Pages * sizeof(BOOLEAN));
+    Region->SlicePages[Start] = 0;
+    Region->PagesInUse -= Pages;
+
+    gBS->RestoreTPL(OldTpl);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Check whether a buffer lies in a mapped region
+ * @param Buffer - Host address
+ * @return BOOLEAN - TRUE if Buffer is inside a common buffer
+ */
+BOOLEAN
+EFIAPI
+usb_dma_contains(
+    IN CONST VOID *Buffer
+)
+{
+    return DmaRegionOf(Buffer) != NULL;
+}
+
+/**
+ * Print the use of every mapped region
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_status(
+    VOID
+)
+{
+    USB_DMA_REGION *Region;
+    UINTN Index;
+
+    for (Index = 0; Index < mDmaRegionCount; Index++) {
+        Region = &mDmaRegions[Index];
+        DEBUG((EFI_D_INFO, "  DMA region %d: %d of %d KB in use (peak %d KB), %d slices, %d misses, device 0x%lx\n",
+               Index, EFI_PAGES_TO_SIZE(Region->PagesInUse) / 1024, USB_DMA_REGION_SIZE / 1024,
+               EFI_PAGES_TO_SIZE(Region->PeakPages) / 1024, Region->Slices, Region->Misses,
+               Region->DeviceAddress));
+    }
+
+    if (mDmaUnsupported != 0) {
+        DEBUG((EFI_D_INFO, "  DMA requests without a PCI host controller: %d\n", mDmaUnsupported));
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Unmap and free every region
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_cleanup(
+    VOID
+)
+{
+    USB_DMA_REGION *Region;
+    UINTN Index;
+
+    for (Index = 0; Index < mDmaRegionCount; Index++) {
+        Region = &mDmaRegions[Index];
+        if (Region->PagesInUse != 0) {
+            LOG_WARN("USB DMA: region %d released with %d pages in use\n", Index, Region->PagesInUse);
+        }
+        Region->PciIo->Unmap(Region->PciIo, Region->Mapping);
+        Region->PciIo->FreeBuffer(Region->PciIo, USB_DMA_REGION_PAGES, Region->HostAddress);
+    }
+
+    ZeroMemory(mDmaRegions, sizeof(mDmaRegions));
+    mDmaRegionCount = 0;
+    return EFI_SUCCESS;
+}
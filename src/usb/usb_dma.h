@@ -0,0 +1,137 @@
+/**
+ * @file usb_dma.h
+ * @brief Pre-mapped common-buffer slices for USB transfer buffers
+ */
+
+#ifndef _USB_DMA_H_
+#define _USB_DMA_H_
+
+#include <Uefi.h>
+#include <Protocol/PciIo.h>
+#include "usb_driver.h"
+#include "../../include/config.h"
+
+//
+// DMA region of one host controller
+// USB_DMA_REGION_SIZE bytes are allocated through the controller's PciIo
+// and mapped once as a bus master common buffer. Slices are whole pages
+// handed out first-fit and stay mapped until usb_dma_cleanup.
+//
+#define USB_DMA_REGION_PAGES        EFI_SIZE_TO_PAGES(USB_DMA_REGION_SIZE)
+
+typedef struct {
+    EFI_HANDLE Controller;              // PCI handle of the host controller
+    EFI_PCI_IO_PROTOCOL *PciIo;
+    VOID *HostAddress;
+    EFI_PHYSICAL_ADDRESS DeviceAddress;
+    VOID *Mapping;
+    UINTN PagesInUse;
+    UINTN PeakPages;
+    UINTN Slices;                       // Slices handed out since the region was mapped
+    UINTN Misses;                       // Requests that did not fit
+    UINT16 SlicePages[USB_DMA_REGION_PAGES];    // Slice length at its first page, 0 elsewhere
+    BOOLEAN PageInUse[USB_DMA_REGION_PAGES];
+} USB_DMA_REGION;
+
+//
+// Function Prototypes
+//
+
+/**
+ * Initialize the DMA buffer manager
+ * @details Regions are mapped when a device behind a controller first asks
+ *          for a slice, so controllers nobody streams from cost nothing.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_init(
+    VOID
+    );
+
+/**
+ * Get a pre-mapped slice of the common buffer of a device's host controller
+ * @param DeviceId - Device the buffer is used with
+ * @param Size - Bytes needed, rounded up to whole pages
+ * @param Buffer - Pointer to receive the page-aligned host address
+ * @param DeviceAddress - Optional pointer to receive the bus address
+ * @return EFI_STATUS - EFI_UNSUPPORTED when DMA transfers are disabled or the
+ *                      controller is not a PCI device, EFI_OUT_OF_RESOURCES
+ *                      when the region is full
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_alloc(
+    IN UINTN DeviceId,
+    IN UINTN Size,
+    OUT VOID **Buffer,
+    OUT EFI_PHYSICAL_ADDRESS *DeviceAddress OPTIONAL
+    );
+
+/**
+ * Return a slice to its region
+ * @param Buffer - Host address from usb_dma_alloc
+ * @return EFI_STATUS - EFI_NOT_FOUND if Buffer lies outside every region,
+ *                      EFI_INVALID_PARAMETER if it is not the start of a slice
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_free(
+    IN VOID *Buffer
+    );
+
+/**
+ * Check whether a buffer lies in a mapped region
+ * @param Buffer - Host address
+ * @return BOOLEAN - TRUE if Buffer is inside a common buffer
+ */
+BOOLEAN
+EFIAPI
+usb_dma_contains(
+    IN CONST VOID *Buffer
+    );
+
+/**
+ * Print the use of every mapped region
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_status(
+    VOID
+    );
+
+/**
+ * Unmap and free every region
+ * @details Slices still held by a caller become invalid.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_dma_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+EFI_STATUS
+DmaMapRegion(
+    IN EFI_HANDLE Controller,
+    OUT USB_DMA_REGION *Region
+    );
+
+STATIC
+USB_DMA_REGION *
+DmaFindRegion(
+    IN UINTN DeviceId
+    );
+
+STATIC
+USB_DMA_REGION *
+DmaRegionOf(
+    IN CONST VOID *Buffer
+    );
+
+#endif // _USB_DMA_H_
@@ -5,20 +5,81 @@
 #include <Library/UefiLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/DebugLib.h>
+#include <Library/DevicePathLib.h>
 #include <Protocol/UsbIo.h>
 #include <Protocol/Usb2HostController.h>
+#include <Protocol/LoadedImage.h>
 
 #include "usb_driver.h"
 #include "usb_protocol.h"
+#include "usb_descriptor_cache.h"
+#include "usb_mass_storage.h"
+#include "usb_hid.h"
+#include "usb_dma.h"
 #include "../../include/common.h"
 #include "../../include/config.h"
+#include "../../include/debug_utils.h"
+#include "../../include/metrics.h"
+#include "../uefi/boot_services.h"
+#include "../uefi/memory_pool.h"
+
+//
+// Every USB2_HC producer (EHCI and xHCI alike) found at init
+//
+typedef struct {
+    EFI_HANDLE Handle;
+    EFI_USB2_HC_PROTOCOL *Usb2Hc;
+    UINT8 MaxSpeed;
+    UINT8 PortCount;
+    UINTN DeviceCount;
+} USB_HOST_CONTROLLER;
 
 // Static variables for USB driver state
-static EFI_USB2_HC_PROTOCOL *mUsb2HcProtocol = NULL;
-static EFI_HANDLE mUsb2HcHandle = NULL;
+static USB_HOST_CONTROLLER mHostControllers[MAX_USB_HOST_CONTROLLERS];
+static UINTN mHostControllerCount = 0;
 static BOOLEAN mUsbDriverInitialized = FALSE;
 static USB_DEVICE_INFO mUsbDevices[MAX_USB_DEVICES];
-static UINTN mDeviceCount = 0;
+static UINTN mDeviceCount = 0;                  // Slots in use, connected or not
+static EFI_EVENT mUsbIoNotifyEvent = NULL;
+static VOID *mUsbIoRegistration = NULL;
+
+//
+// Queued transfers, one ring of caller-owned tokens per device
+//
+typedef struct {
+    USB_TRANSFER_TOKEN *Tokens[USB_TRANSFER_QUEUE_DEPTH];
+    UINTN Head;
+    UINTN Count;
+    UINT32 Elapsed;                     // Milliseconds the head transfer has waited
+    BOOLEAN InterruptActive;
+} USB_TRANSFER_QUEUE;
+
+static USB_TRANSFER_QUEUE mTransferQueues[MAX_USB_DEVICES];
+static EFI_EVENT mTransferPumpEvent = NULL;
+static EFI_EVENT mTransferDoneEvent = NULL;
+static UINTN mTransferCompleted = 0;
+static UINTN mTransferCursor = 0;
+
+//
+// Latency metrics per transfer type; queued bulk transfers are timed per slice
+//
+typedef enum {
+    UsbMetricControl,
+    UsbMetricBulkIn,
+    UsbMetricBulkOut,
+    UsbMetricQueuedIn,
+    UsbMetricQueuedOut,
+    UsbMetricCount
+} USB_METRIC;
+
+static UINTN mUsbMetrics[UsbMetricCount];
+static CONST CHAR16 *mUsbMetricNames[UsbMetricCount] = {
+    L"usb.control",
+    L"usb.bulk.in",
+    L"usb.bulk.out",
+    L"usb.queued.in",
+    L"usb.queued.out"
+};
 
 /**
  * Initialize the USB driver and locate USB host controllers
@@ -28,6 +89,9 @@ EFI_STATUS usb_driver_init(VOID) {
     EFI_STATUS Status;
     EFI_HANDLE *HandleBuffer;
     UINTN HandleCount;
+    UINTN Index;
+    USB_HOST_CONTROLLER *Controller;
+    UINT8 Is64BitCapable;
     
     if (mUsbDriverInitialized) {
         return EFI_ALREADY_STARTED;
@@ -54,36 +118,287 @@ EFI_STATUS usb_driver_init(VOID) {
         return EFI_NOT_FOUND;
     }
     
-    // Get the first USB2 Host Controller protocol
-    Status = gBS->OpenProtocol(
-        HandleBuffer[0],
-        &gEfiUsb2HcProtocolGuid,
-        (VOID **)&mUsb2HcProtocol,
-        gImageHandle,
-        NULL,
-        EFI_OPEN_PROTOCOL_GET_PROTOCOL
-    );
-
-    if (!EFI_ERROR(Status)) {
-        // Store the handle for later cleanup
-        mUsb2HcHandle = HandleBuffer[0];
+    // Track every controller; devices are attributed to them at detect time
+    mHostControllerCount = 0;
+    for (Index = 0; Index < HandleCount && mHostControllerCount < MAX_USB_HOST_CONTROLLERS; Index++) {
+        Controller = &mHostControllers[mHostControllerCount];
+        ZeroMemory(Controller, sizeof(USB_HOST_CONTROLLER));
+        
+        Status = gBS->OpenProtocol(
+            HandleBuffer[Index],
+            &gEfiUsb2HcProtocolGuid,
+            (VOID **)&Controller->Usb2Hc,
+            gImageHandle,
+            NULL,
+            EFI_OPEN_PROTOCOL_GET_PROTOCOL
+        );
+        
+        if (EFI_ERROR(Status)) {
+            DEBUG((EFI_D_WARN, "Failed to open USB2 Host Controller %d: %r\n", Index, Status));
+            continue;
+        }
+        
+        Controller->Handle = HandleBuffer[Index];
+        if (EFI_ERROR(Controller->Usb2Hc->GetCapability(Controller->Usb2Hc, &Controller->MaxSpeed,
+                                                        &Controller->PortCount, &Is64BitCapable))) {
+            Controller->MaxSpeed = 0;
+            Controller->PortCount = 0;
+        }
+        
+        DEBUG((EFI_D_INFO, "Host controller %d: USB %d.%d, %d ports, max speed %d\n",
+               mHostControllerCount, Controller->Usb2Hc->MajorRevision, Controller->Usb2Hc->MinorRevision,
+               Controller->PortCount, Controller->MaxSpeed));
+        mHostControllerCount++;
+    }
+    
+    if (HandleCount > MAX_USB_HOST_CONTROLLERS) {
+        DEBUG((EFI_D_WARN, "Only the first %d of %d host controllers are tracked\n",
+               MAX_USB_HOST_CONTROLLERS, HandleCount));
     }
 
     FreePool(HandleBuffer);
 
+    if (mHostControllerCount == 0) {
+        DEBUG((EFI_D_ERROR, "Failed to open any USB2 Host Controller protocol: %r\n", Status));
+        return EFI_ERROR(Status) ? Status : EFI_NOT_FOUND;
+    }
+    
+    // Plain event so the main loop can wait on transfer completion
+    Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &mTransferDoneEvent);
     if (EFI_ERROR(Status)) {
-        DEBUG((EFI_D_ERROR, "Failed to open USB2 Host Controller protocol: %r\n", Status));
+        DEBUG((EFI_D_ERROR, "Failed to create transfer completion event: %r\n", Status));
         return Status;
     }
     
+    if (USE_INTERRUPT_DRIVEN_IO) {
+        Status = CreateTimerEvent(UsbTransferPump, NULL, USB_ASYNC_POLL_INTERVAL, &mTransferPumpEvent);
+        if (!EFI_ERROR(Status)) {
+            Status = gBS->SetTimer(mTransferPumpEvent, TimerPeriodic, USB_ASYNC_POLL_INTERVAL);
+        }
+        if (EFI_ERROR(Status)) {
+            // Queued transfers still work, they just complete inline
+            DEBUG((EFI_D_WARN, "Transfer pump unavailable: %r\n", Status));
+            if (mTransferPumpEvent != NULL) {
+                gBS->CloseEvent(mTransferPumpEvent);
+                mTransferPumpEvent = NULL;
+            }
+        }
+    }
+    
+    for (Index = 0; Index < UsbMetricCount; Index++) {
+        metrics_register(mUsbMetricNames[Index], &mUsbMetrics[Index]);
+    }
+    
+    usb_descriptor_cache_load();
+    
+    // Before enumeration: mass storage attach takes its command page here
+    usb_dma_init();
+    
+    Status = usb_hid_init();
+    if (EFI_ERROR(Status)) {
+        // HID devices are still enumerated, just not polled
+        DEBUG((EFI_D_WARN, "HID key event unavailable: %r\n", Status));
+    }
+    
+    ZeroMemory(mTransferQueues, sizeof(mTransferQueues));
+    mTransferCompleted = 0;
+    mTransferCursor = 0;
+    
     mUsbDriverInitialized = TRUE;
     DEBUG((EFI_D_INFO, "USB driver initialized successfully\n"));
     
     return EFI_SUCCESS;
 }
 
+/**
+ * Start tracking a UsbIo handle
+ * @details A device that comes back at the same device path (re-plugged
+ *          into the same port) gets its previous slot, and so its previous
+ *          device id, back.
+ * @param Handle - UsbIo handle
+ * @return EFI_STATUS - EFI_ALREADY_STARTED if the handle is already tracked
+ */
+STATIC EFI_STATUS UsbAddDevice(EFI_HANDLE Handle) {
+    EFI_STATUS Status;
+    EFI_TPL OldTpl;
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+    EFI_DEVICE_PATH_PROTOCOL *SavedPath;
+    USB_DEVICE_INFO *Device;
+    UINTN Slot;
+    UINTN Index;
+    BOOLEAN Fresh;
+    
+    if (EFI_ERROR(GetDevicePathFromHandle(Handle, &DevicePath))) {
+        DevicePath = NULL;
+    }
+    
+    // The UsbIo arrival notify and the transfer pump run at TPL_CALLBACK;
+    // hold both off from the duplicate check until the slot is committed
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    
+    for (Index = 0; Index < mDeviceCount; Index++) {
+        if (mUsbDevices[Index].IsConnected && mUsbDevices[Index].Handle == Handle) {
+            gBS->RestoreTPL(OldTpl);
+            return EFI_ALREADY_STARTED;
+        }
+    }
+    
+    // Prefer the slot this device path had before, then a fresh one,
+    // then any slot whose device has gone away
+    Slot = MAX_USB_DEVICES;
+    for (Index = 0; Index < mDeviceCount && DevicePath != NULL; Index++) {
+        if (!mUsbDevices[Index].IsConnected && mUsbDevices[Index].DevicePath != NULL &&
+            CompareDevicePaths(mUsbDevices[Index].DevicePath, DevicePath)) {
+            Slot = Index;
+            break;
+        }
+    }
+    if (Slot == MAX_USB_DEVICES && mDeviceCount < MAX_USB_DEVICES) {
+        Slot = mDeviceCount;
+    }
+    for (Index = 0; Index < mDeviceCount && Slot == MAX_USB_DEVICES; Index++) {
+        if (!mUsbDevices[Index].IsConnected) {
+            Slot = Index;
+        }
+    }
+    if (Slot == MAX_USB_DEVICES) {
+        gBS->RestoreTPL(OldTpl);
+        LOG_WARN("USB device table full, ignoring new device\n");
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Device = &mUsbDevices[Slot];
+    SavedPath = (Slot < mDeviceCount) ? Device->DevicePath : NULL;
+    
+    // Class drivers look the slot up by id while it is being processed
+    Fresh = (Slot == mDeviceCount);
+    if (Fresh) {
+        mDeviceCount++;
+    }
+    
+    Status = usb_process_device(Handle, Slot);
+    if (EFI_ERROR(Status)) {
+        ZeroMemory(Device, sizeof(USB_DEVICE_INFO));
+        Device->DevicePath = SavedPath;
+        if (Fresh) {
+            mDeviceCount--;
+        }
+    } else {
+        if (SavedPath != NULL && CompareDevicePaths(SavedPath, DevicePath)) {
+            Device->DevicePath = SavedPath;
+        } else {
+            if (SavedPath != NULL) {
+                FreePool(SavedPath);
+            }
+            Device->DevicePath = (DevicePath != NULL) ? DuplicateDevicePath(DevicePath) : NULL;
+        }
+        
+        if (Device->HostController != USB_HOST_CONTROLLER_NONE) {
+            mHostControllers[Device->HostController].DeviceCount++;
+        }
+    }
+    
+    gBS->RestoreTPL(OldTpl);
+    return Status;
+}
+
+/**
+ * Stop tracking a device whose UsbIo handle has been uninstalled
+ * @details The slot keeps its device path so a re-plug can reclaim it.
+ * @param DeviceId - Device identifier
+ */
+STATIC VOID UsbRemoveDevice(UINTN DeviceId) {
+    EFI_TPL OldTpl;
+    USB_DEVICE_INFO *Device;
+    
+    // The interface is already gone, so interrupt polling cannot be stopped
+    mTransferQueues[DeviceId].InterruptActive = FALSE;
+    UsbCancelDeviceTransfers(DeviceId);
+    
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    Device = &mUsbDevices[DeviceId];
+    LOG_INFO("USB device %d removed: VID=0x%04X, PID=0x%04X\n", DeviceId, Device->VendorId, Device->ProductId);
+    
+    if (Device->HostController != USB_HOST_CONTROLLER_NONE &&
+        mHostControllers[Device->HostController].DeviceCount > 0) {
+        mHostControllers[Device->HostController].DeviceCount--;
+    }
+    
+    Device->IsConnected = FALSE;
+    Device->Handle = NULL;
+    Device->UsbIo = NULL;
+    gBS->RestoreTPL(OldTpl);
+}
+
+/**
+ * Add every UsbIo handle installed since the last call
+ * @return UINTN - Number of devices added
+ */
+STATIC UINTN UsbProcessArrivals(VOID) {
+    EFI_HANDLE Handle;
+    UINTN BufferSize;
+    UINTN Added;
+    
+    Added = 0;
+    if (mUsbIoRegistration == NULL) {
+        return 0;
+    }
+    
+    while (TRUE) {
+        BufferSize = sizeof(Handle);
+        if (EFI_ERROR(gBS->LocateHandle(ByRegisterNotify, NULL, mUsbIoRegistration, &BufferSize, &Handle))) {
+            break;
+        }
+        if (!EFI_ERROR(UsbAddDevice(Handle))) {
+            Added++;
+        }
+    }
+    
+    return Added;
+}
+
+/**
+ * Drop devices whose UsbIo interface is no longer installed
+ * @details UEFI has no uninstall notification, so removal is found by
+ *          asking the handle database about each tracked handle; this
+ *          costs no bus transactions.
+ * @return UINTN - Number of devices removed
+ */
+STATIC UINTN UsbPruneRemovedDevices(VOID) {
+    VOID *Interface;
+    UINTN Removed;
+    UINTN Index;
+    
+    Removed = 0;
+    for (Index = 0; Index < mDeviceCount; Index++) {
+        if (!mUsbDevices[Index].IsConnected) {
+            continue;
+        }
+        
+        if (EFI_ERROR(gBS->HandleProtocol(mUsbDevices[Index].Handle, &gEfiUsbIoProtocolGuid, &Interface)) ||
+            Interface != (VOID *)mUsbDevices[Index].UsbIo) {
+            UsbRemoveDevice(Index);
+            Removed++;
+        }
+    }
+    
+    return Removed;
+}
+
+/**
+ * UsbIo installation notification; adds hot-plugged devices as they appear
+ * @param Event - Notification event
+ * @param Context - Unused
+ */
+STATIC VOID EFIAPI UsbIoArrivalNotify(EFI_EVENT Event, VOID *Context) {
+    UsbProcessArrivals();
+}
+
 /**
  * Detect and enumerate USB devices
+ * @details The first call registers for UsbIo installations and adds every
+ *          device already present; later calls only touch handles that
+ *          are not tracked yet. Device ids stay stable across calls.
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS usb_device_detect(VOID) {
@@ -98,8 +413,23 @@ EFI_STATUS usb_device_detect(VOID) {
     
     DEBUG((EFI_D_INFO, "Detecting USB devices...\n"));
     
-    // Reset device count
-    mDeviceCount = 0;
+    if (mUsbIoNotifyEvent == NULL) {
+        Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, UsbIoArrivalNotify, NULL, &mUsbIoNotifyEvent);
+        if (!EFI_ERROR(Status)) {
+            Status = gBS->RegisterProtocolNotify(&gEfiUsbIoProtocolGuid, mUsbIoNotifyEvent, &mUsbIoRegistration);
+        }
+        if (EFI_ERROR(Status)) {
+            // Without the notification 'r' still finds new devices via this scan
+            DEBUG((EFI_D_WARN, "UsbIo hot-plug notification unavailable: %r\n", Status));
+            if (mUsbIoNotifyEvent != NULL) {
+                gBS->CloseEvent(mUsbIoNotifyEvent);
+                mUsbIoNotifyEvent = NULL;
+            }
+            mUsbIoRegistration = NULL;
+        }
+    }
+    
+    UsbPruneRemovedDevices();
     
     // Locate all USB I/O handles
     Status = gBS->LocateHandleBuffer(
@@ -117,20 +447,309 @@ EFI_STATUS usb_device_detect(VOID) {
     
     DEBUG((EFI_D_INFO, "Found %d USB devices\n", HandleCount));
     
-    // Process each USB device
-    for (Index = 0; Index < HandleCount && mDeviceCount < MAX_USB_DEVICES; Index++) {
-        Status = usb_process_device(HandleBuffer[Index], Index);
+    // Tracked handles are skipped without touching the device
+    for (Index = 0; Index < HandleCount; Index++) {
+        UsbAddDevice(HandleBuffer[Index]);
+    }
+    
+    FreePool(HandleBuffer);
+    usb_descriptor_cache_flush();
+    
+    DEBUG((EFI_D_INFO, "Tracking %d USB devices on %d host controllers\n",
+           usb_get_connected_count(), mHostControllerCount));
+    return EFI_SUCCESS;
+}
+
+/**
+ * Bring the device table up to date with hot-plug changes
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS usb_device_rescan(VOID) {
+    UINTN Removed;
+    UINTN Added;
+    
+    if (!mUsbDriverInitialized) {
+        return EFI_NOT_READY;
+    }
+    
+    if (mUsbIoRegistration == NULL) {
+        return usb_device_detect();
+    }
+    
+    Removed = UsbPruneRemovedDevices();
+    Added = UsbProcessArrivals();
+    usb_descriptor_cache_flush();
+    
+    LOG_INFO("USB rescan: %d added, %d removed, %d connected\n", Added, Removed, usb_get_connected_count());
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the number of devices currently connected
+ * @return UINTN - Connected device count
+ */
+UINTN usb_get_connected_count(VOID) {
+    UINTN Count;
+    UINTN Index;
+    
+    Count = 0;
+    for (Index = 0; Index < mDeviceCount; Index++) {
+        if (mUsbDevices[Index].IsConnected) {
+            Count++;
+        }
+    }
+    
+    return Count;
+}
+
+/**
+ * Record one endpoint descriptor in the device information
+ * @param Device - Device information
+ * @param Endpoint - Endpoint descriptor
+ */
+STATIC VOID RecordEndpoint(USB_DEVICE_INFO *Device, CONST EFI_USB_ENDPOINT_DESCRIPTOR *Endpoint) {
+    UINT8 Type;
+    UINT16 MaxPacket;
+    BOOLEAN IsIn;
+    
+    Type = Endpoint->Attributes & USB_ENDPOINT_TYPE_MASK;
+    MaxPacket = Endpoint->MaxPacketSize & USB_ENDPOINT_MAX_PACKET_MASK;
+    IsIn = (Endpoint->EndpointAddress & USB_ENDPOINT_DIR_IN) != 0;
+    
+    // The first endpoint of each kind wins
+    if (Type == USB_ENDPOINT_BULK) {
+        if (IsIn && Device->BulkInEndpoint == 0) {
+            Device->BulkInEndpoint = Endpoint->EndpointAddress;
+            Device->BulkInMaxPacket = MaxPacket;
+            Device->BulkInMaxBurst = 1;
+        } else if (!IsIn && Device->BulkOutEndpoint == 0) {
+            Device->BulkOutEndpoint = Endpoint->EndpointAddress;
+            Device->BulkOutMaxPacket = MaxPacket;
+            Device->BulkOutMaxBurst = 1;
+        }
+    } else if (Type == USB_ENDPOINT_INTERRUPT && IsIn && Device->InterruptInEndpoint == 0) {
+        Device->InterruptInEndpoint = Endpoint->EndpointAddress;
+        Device->InterruptInMaxPacket = MaxPacket;
+        Device->InterruptInInterval = Endpoint->Interval;
+    }
+}
+
+/**
+ * Read SuperSpeed endpoint companions and UAS support from the configuration
+ * @details The UsbIo accessors do not return companion descriptors, so the
+ *          full configuration is read once with GET_DESCRIPTOR. Only called
+ *          for SuperSpeed devices on a descriptor cache miss.
+ * @param UsbIo - USB I/O protocol of the interface
+ * @param ConfigLength - wTotalLength of the active configuration
+ * @param AlternateSetting - Active alternate setting of the interface
+ * @param Device - Device information with endpoints already recorded
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC EFI_STATUS ParseSuperSpeedCompanions(EFI_USB_IO_PROTOCOL *UsbIo, UINT16 ConfigLength, UINT8 AlternateSetting,
+                                            USB_DEVICE_INFO *Device) {
+    EFI_STATUS Status;
+    EFI_USB_DEVICE_REQUEST Request;
+    USB_INTERFACE_DESCRIPTOR *Interface;
+    USB_ENDPOINT_DESCRIPTOR *Endpoint;
+    USB_SS_EP_COMPANION_DESCRIPTOR *Companion;
+    UINT8 *ConfigBuffer;
+    UINT8 LastEndpoint;
+    UINT8 MaxBurst;
+    UINT32 TransferStatus;
+    UINTN Offset;
+    BOOLEAN InInterface;
+    BOOLEAN InActiveSetting;
+    
+    if (ConfigLength < sizeof(USB_CONFIG_DESCRIPTOR)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    // Hotplug notifications parse here too, so take the TPL-safe pool
+    ConfigBuffer = memory_pool_alloc(ConfigLength);
+    CHECK_NULL(ConfigBuffer, EFI_OUT_OF_RESOURCES);
+    
+    Request.RequestType = USB_REQ_TYPE_STANDARD | USB_DIR_IN;
+    Request.Request = USB_REQ_GET_DESCRIPTOR;
+    Request.Value = (UINT16)(USB_DESC_TYPE_CONFIG << 8);
+    Request.Index = 0;
+    Request.Length = ConfigLength;
+    
+    Status = UsbIo->UsbControlTransfer(
+        UsbIo,
+        &Request,
+        EfiUsbDataIn,
+        USB_CONTROL_TIMEOUT,
+        ConfigBuffer,
+        ConfigLength,
+        &TransferStatus
+    );
+    
+    if (EFI_ERROR(Status)) {
+        memory_pool_free(ConfigBuffer);
+        return Status;
+    }
+    
+    if (((USB_CONFIG_DESCRIPTOR *)ConfigBuffer)->ConfigurationValue != Device->ConfigurationValue) {
+        // Configuration index 0 is not the active one; keep USB2-style bursts
+        memory_pool_free(ConfigBuffer);
+        return EFI_NOT_FOUND;
+    }
+    
+    InInterface = FALSE;
+    InActiveSetting = FALSE;
+    LastEndpoint = 0;
+    
+    for (Offset = 0; Offset + 2 <= ConfigLength; Offset += ConfigBuffer[Offset]) {
+        if (ConfigBuffer[Offset] < 2 || Offset + ConfigBuffer[Offset] > ConfigLength) {
+            LOG_WARN("Malformed descriptor at offset %d of configuration\n", Offset);
+            break;
+        }
+        
+        switch (ConfigBuffer[Offset + 1]) {
+            case USB_DESC_TYPE_INTERFACE:
+                LastEndpoint = 0;
+                if (ConfigBuffer[Offset] < sizeof(USB_INTERFACE_DESCRIPTOR)) {
+                    break;
+                }
+                Interface = (USB_INTERFACE_DESCRIPTOR *)(ConfigBuffer + Offset);
+                InInterface = (Interface->InterfaceNumber == Device->InterfaceNumber);
+                InActiveSetting = (InInterface && Interface->AlternateSetting == AlternateSetting);
+                
+                // UAS devices offer BOT in setting 0 and UAS in another
+                if (InInterface && Interface->InterfaceClass == USB_CLASS_MASS_STORAGE &&
+                    Interface->InterfaceProtocol == USB_MSC_PROTOCOL_UAS) {
+                    Device->UasCapable = TRUE;
+                }
+                break;
+                
+            case USB_DESC_TYPE_ENDPOINT:
+                LastEndpoint = 0;
+                if (InActiveSetting && ConfigBuffer[Offset] >= sizeof(USB_ENDPOINT_DESCRIPTOR)) {
+                    Endpoint = (USB_ENDPOINT_DESCRIPTOR *)(ConfigBuffer + Offset);
+                    LastEndpoint = Endpoint->EndpointAddress;
+                }
+                break;
+                
+            case USB_DESC_TYPE_SS_ENDPOINT_COMPANION:
+                if (LastEndpoint == 0 || ConfigBuffer[Offset] < sizeof(USB_SS_EP_COMPANION_DESCRIPTOR)) {
+                    break;
+                }
+                Companion = (USB_SS_EP_COMPANION_DESCRIPTOR *)(ConfigBuffer + Offset);
+                MaxBurst = (UINT8)MIN(Companion->MaxBurst + 1, USB_SS_MAX_BURST);
+                if (LastEndpoint == Device->BulkInEndpoint) {
+                    Device->BulkInMaxBurst = MaxBurst;
+                } else if (LastEndpoint == Device->BulkOutEndpoint) {
+                    Device->BulkOutMaxBurst = MaxBurst;
+                }
+                LastEndpoint = 0;
+                break;
+                
+            default:
+                break;
+        }
+    }
+    
+    memory_pool_free(ConfigBuffer);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Discover the endpoints of the interface bound to a UsbIo handle
+ * @details The USB bus driver keeps the descriptors it read while
+ *          enumerating, and the UsbIo descriptor accessors answer from that
+ *          copy for the active alternate setting, so this costs no bus
+ *          transactions. Interfaces seen before (same VID/PID/bcdDevice)
+ *          are filled from the descriptor cache instead.
+ * @param UsbIo - USB I/O protocol of the interface
+ * @param DeviceDescriptor - Device descriptor of the owning device
+ * @param ConfigLength - wTotalLength of the active configuration
+ * @param Device - Device information to fill in
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC EFI_STATUS ParseInterfaceEndpoints(EFI_USB_IO_PROTOCOL *UsbIo, CONST EFI_USB_DEVICE_DESCRIPTOR *DeviceDescriptor,
+                                          UINT16 ConfigLength, USB_DEVICE_INFO *Device) {
+    EFI_STATUS Status;
+    EFI_USB_INTERFACE_DESCRIPTOR InterfaceDescriptor;
+    EFI_USB_ENDPOINT_DESCRIPTOR EndpointDescriptor;
+    USB_DESCRIPTOR_CACHE_KEY Key;
+    UINT8 Index;
+    
+    Status = UsbIo->UsbGetInterfaceDescriptor(UsbIo, &InterfaceDescriptor);
+    CHECK_STATUS(Status, "Failed to get interface descriptor");
+    
+    ZeroMemory(&Key, sizeof(Key));
+    Key.VendorId = DeviceDescriptor->IdVendor;
+    Key.ProductId = DeviceDescriptor->IdProduct;
+    Key.DeviceRevision = DeviceDescriptor->BcdDevice;
+    Key.ConfigLength = ConfigLength;
+    Key.InterfaceNumber = InterfaceDescriptor.InterfaceNumber;
+    Key.AlternateSetting = InterfaceDescriptor.AlternateSetting;
+    Key.NumEndpoints = InterfaceDescriptor.NumEndpoints;
+    
+    if (!EFI_ERROR(usb_descriptor_cache_lookup(&Key, Device))) {
+        return EFI_SUCCESS;
+    }
+    
+    Device->InterfaceNumber = InterfaceDescriptor.InterfaceNumber;
+    Device->InterfaceClass = InterfaceDescriptor.InterfaceClass;
+    Device->InterfaceSubClass = InterfaceDescriptor.InterfaceSubClass;
+    Device->InterfaceProtocol = InterfaceDescriptor.InterfaceProtocol;
+    
+    for (Index = 0; Index < InterfaceDescriptor.NumEndpoints; Index++) {
+        Status = UsbIo->UsbGetEndpointDescriptor(UsbIo, Index, &EndpointDescriptor);
         if (!EFI_ERROR(Status)) {
-            mDeviceCount++;
+            RecordEndpoint(Device, &EndpointDescriptor);
         }
     }
     
-    FreePool(HandleBuffer);
+    if (ENABLE_USB3_SUPERSPEED && Device->SuperSpeed) {
+        Status = ParseSuperSpeedCompanions(UsbIo, ConfigLength, InterfaceDescriptor.AlternateSetting, Device);
+        if (EFI_ERROR(Status)) {
+            LOG_WARN("No SuperSpeed companions for interface %d (%r); bursts disabled\n",
+                     Device->InterfaceNumber, Status);
+        }
+    }
     
-    DEBUG((EFI_D_INFO, "Successfully processed %d USB devices\n", mDeviceCount));
+    LOG_INFO("Interface %d: bulk IN 0x%02X/%dx%d, bulk OUT 0x%02X/%dx%d, interrupt IN 0x%02X/%d\n",
+             Device->InterfaceNumber, Device->BulkInEndpoint, Device->BulkInMaxPacket, Device->BulkInMaxBurst,
+             Device->BulkOutEndpoint, Device->BulkOutMaxPacket, Device->BulkOutMaxBurst,
+             Device->InterruptInEndpoint, Device->InterruptInMaxPacket);
+    
+    usb_descriptor_cache_store(&Key, Device);
     return EFI_SUCCESS;
 }
 
+/**
+ * Find the host controller a UsbIo handle is attached to
+ * @param Handle - UsbIo handle
+ * @return UINTN - Index into the controller table, or USB_HOST_CONTROLLER_NONE
+ */
+STATIC UINTN FindHostController(EFI_HANDLE Handle) {
+    EFI_STATUS Status;
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;
+    EFI_HANDLE HcHandle;
+    UINTN Index;
+    
+    Status = GetDevicePathFromHandle(Handle, &DevicePath);
+    if (EFI_ERROR(Status)) {
+        return USB_HOST_CONTROLLER_NONE;
+    }
+    
+    // The nearest ancestor on the path producing USB2_HC is the controller
+    Status = gBS->LocateDevicePath(&gEfiUsb2HcProtocolGuid, &DevicePath, &HcHandle);
+    if (EFI_ERROR(Status)) {
+        return USB_HOST_CONTROLLER_NONE;
+    }
+    
+    for (Index = 0; Index < mHostControllerCount; Index++) {
+        if (mHostControllers[Index].Handle == HcHandle) {
+            return Index;
+        }
+    }
+    
+    return USB_HOST_CONTROLLER_NONE;
+}
+
 /**
  * Process individual USB device - COMPLETE IMPLEMENTATION
  */
@@ -139,9 +758,8 @@ STATIC EFI_STATUS usb_process_device(EFI_HANDLE Handle, UINTN DeviceIndex) {
     EFI_USB_IO_PROTOCOL *UsbIo;
     EFI_USB_DEVICE_DESCRIPTOR DeviceDescriptor;
     EFI_USB_CONFIG_DESCRIPTOR ConfigDescriptor;
-    EFI_USB_INTERFACE_DESCRIPTOR *InterfaceDescriptor;
-    VOID *ConfigBuffer = NULL;
-    UINTN ConfigSize;
+    USB_DEVICE_INFO *Device;
+    UINT8 DeviceClass;
     
     DBG_ENTER();
     
@@ -164,35 +782,42 @@ STATIC EFI_STATUS usb_process_device(EFI_HANDLE Handle, UINTN DeviceIndex) {
     Status = UsbIo->UsbGetConfigDescriptor(UsbIo, &ConfigDescriptor);
     CHECK_STATUS(Status, "Failed to get config descriptor");
     
-    // Get full configuration buffer
-    ConfigSize = ConfigDescriptor.TotalLength;
-    ConfigBuffer = AllocatePool(ConfigSize);
-    CHECK_NULL(ConfigBuffer, EFI_OUT_OF_RESOURCES);
+    // Store device information
+    Device = &mUsbDevices[DeviceIndex];
+    ZeroMemory(Device, sizeof(USB_DEVICE_INFO));
+    Device->Handle = Handle;
+    Device->UsbIo = UsbIo;
+    Device->VendorId = DeviceDescriptor.IdVendor;
+    Device->ProductId = DeviceDescriptor.IdProduct;
+    Device->DeviceClass = DeviceDescriptor.DeviceClass;
+    Device->InterfaceCount = ConfigDescriptor.NumInterfaces;
+    Device->ConfigurationValue = ConfigDescriptor.ConfigurationValue;
+    Device->IsConnected = TRUE;
     
-    Status = UsbIo->UsbGetConfigDescriptor(UsbIo, (EFI_USB_CONFIG_DESCRIPTOR *)ConfigBuffer);
-    if (EFI_ERROR(Status)) {
-        FreePool(ConfigBuffer);
-        CHECK_STATUS(Status, "Failed to get full config descriptor");
+    Device->HostController = FindHostController(Handle);
+    
+    // A USB3 device reports bcdUSB 3.x only while linked at SuperSpeed
+    Device->UsbRevision = DeviceDescriptor.BcdUSB;
+    Device->SuperSpeed = (DeviceDescriptor.BcdUSB >= 0x0300);
+    if (Device->HostController != USB_HOST_CONTROLLER_NONE &&
+        mHostControllers[Device->HostController].MaxSpeed < EFI_USB_SPEED_SUPER) {
+        Device->SuperSpeed = FALSE;
     }
     
-    // Parse interface descriptors
-    InterfaceDescriptor = (EFI_USB_INTERFACE_DESCRIPTOR *)((UINT8 *)ConfigBuffer + sizeof(EFI_USB_CONFIG_DESCRIPTOR));
+    // Parse the interface's endpoint descriptors
+    Status = ParseInterfaceEndpoints(UsbIo, &DeviceDescriptor, ConfigDescriptor.TotalLength, Device);
+    CHECK_STATUS(Status, "Failed to parse endpoints");
     
-    // Store device information
-    mUsbDevices[DeviceIndex].Handle = Handle;
-    mUsbDevices[DeviceIndex].UsbIo = UsbIo;
-    mUsbDevices[DeviceIndex].VendorId = DeviceDescriptor.IdVendor;
-    mUsbDevices[DeviceIndex].ProductId = DeviceDescriptor.IdProduct;
-    mUsbDevices[DeviceIndex].DeviceClass = DeviceDescriptor.DeviceClass;
-    mUsbDevices[DeviceIndex].IsConnected = TRUE;
+    // Class 0 means each interface declares its own class
+    DeviceClass = (DeviceDescriptor.DeviceClass != 0) ? DeviceDescriptor.DeviceClass : Device->InterfaceClass;
     
     // Enhanced device classification and handling
-    if (DeviceDescriptor.DeviceClass == USB_CLASS_MASS_STORAGE) {
+    if (DeviceClass == USB_CLASS_MASS_STORAGE) {
         LOG_INFO("Mass Storage Device detected: VID=0x%04X, PID=0x%04X\n",
                  DeviceDescriptor.IdVendor, DeviceDescriptor.IdProduct);
         // Initialize mass storage specific handling
         Status = InitializeMassStorageDevice(UsbIo, DeviceIndex);
-    } else if (DeviceDescriptor.DeviceClass == USB_CLASS_HID) {
+    } else if (DeviceClass == USB_CLASS_HID) {
         LOG_INFO("HID Device detected: VID=0x%04X, PID=0x%04X\n",
                  DeviceDescriptor.IdVendor, DeviceDescriptor.IdProduct);
         // Initialize HID specific handling
@@ -200,11 +825,9 @@ STATIC EFI_STATUS usb_process_device(EFI_HANDLE Handle, UINTN DeviceIndex) {
     } else {
         LOG_INFO("Generic USB Device: VID=0x%04X, PID=0x%04X, Class=0x%02X\n",
                  DeviceDescriptor.IdVendor, DeviceDescriptor.IdProduct, 
-                 DeviceDescriptor.DeviceClass);
+                 DeviceClass);
     }
     
-    FreePool(ConfigBuffer);
-    
     LOG_INFO("Device %d processed successfully\n", DeviceIndex);
     DBG_EXIT_STATUS(EFI_SUCCESS);
     return EFI_SUCCESS;
@@ -212,6 +835,8 @@ STATIC EFI_STATUS usb_process_device(EFI_HANDLE Handle, UINTN DeviceIndex) {
 
 /**
  * Communicate with a specific USB device
+ * @details Reads from the bulk IN endpoint when the interface has one;
+ *          otherwise falls back to a 2-byte GET_STATUS control read.
  * @param DeviceId - Device identifier
  * @param Data - Data buffer
  * @param Length - Data length
@@ -221,10 +846,12 @@ EFI_STATUS usb_device_communicate(UINTN DeviceId, VOID *Data, UINTN Length) {
     EFI_STATUS Status;
     EFI_USB_DEVICE_REQUEST DeviceRequest;
     UINT32 TransferStatus;
+    UINTN Transferred;
+    DEBUG_TIMER Timer;
     
     DBG_ENTER();
     
-    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized) {
+    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized || Data == NULL || Length == 0) {
         DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
         return EFI_INVALID_PARAMETER;
     }
@@ -234,15 +861,23 @@ EFI_STATUS usb_device_communicate(UINTN DeviceId, VOID *Data, UINTN Length) {
         return EFI_NOT_READY;
     }
     
-    LOG_INFO("Communicating with USB device %d, length=%d\n", DeviceId, Length);
+    TRACE_EVENT(DEBUG_CAT_USB, TraceEventUsbTransfer, DeviceId, Length, 0);
+    
+    if (mUsbDevices[DeviceId].BulkInEndpoint != 0) {
+        Transferred = Length;
+        Status = usb_bulk_transfer(DeviceId, EfiUsbDataIn, Data, &Transferred);
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
     
-    // Example: Send a standard GET_STATUS request
+    // No data endpoint: send a standard GET_STATUS request
     DeviceRequest.RequestType = USB_REQ_TYPE_STANDARD | USB_DIR_IN;
     DeviceRequest.Request = USB_REQ_GET_STATUS;
     DeviceRequest.Value = 0;
     DeviceRequest.Index = 0;
     DeviceRequest.Length = 2;
     
+    DebugTimerStart(&Timer, "usb_control_transfer");
     Status = mUsbDevices[DeviceId].UsbIo->UsbControlTransfer(
         mUsbDevices[DeviceId].UsbIo,
         &DeviceRequest,
@@ -260,18 +895,573 @@ EFI_STATUS usb_device_communicate(UINTN DeviceId, VOID *Data, UINTN Length) {
         return Status;
     }
     
+    metrics_record(mUsbMetrics[UsbMetricControl], &Timer, MIN(Length, 2));
     LOG_INFO("USB communication successful\n");
     DBG_EXIT_STATUS(EFI_SUCCESS);
     return EFI_SUCCESS;
 }
 
+/**
+ * Clear a halted endpoint after a STALL
+ * @param UsbIo - USB I/O protocol
+ * @param Endpoint - Endpoint address
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC EFI_STATUS ClearEndpointHalt(EFI_USB_IO_PROTOCOL *UsbIo, UINT8 Endpoint) {
+    EFI_USB_DEVICE_REQUEST Request;
+    UINT32 TransferStatus;
+    
+    Request.RequestType = USB_REQ_TYPE_STANDARD | USB_DIR_OUT | USB_RECIPIENT_ENDPOINT;
+    Request.Request = USB_REQ_CLEAR_FEATURE;
+    Request.Value = USB_FEATURE_ENDPOINT_HALT;
+    Request.Index = Endpoint;
+    Request.Length = 0;
+    
+    return UsbIo->UsbControlTransfer(
+        UsbIo,
+        &Request,
+        EfiUsbNoData,
+        USB_CONTROL_TIMEOUT,
+        NULL,
+        0,
+        &TransferStatus
+    );
+}
+
+/**
+ * Get the largest single bulk transfer for an endpoint
+ * @details Kept a whole number of bursts, so on SuperSpeed every transfer but
+ *          the last fills complete bursts of MaxPacket * MaxBurst bytes.
+ * @param Device - Device information
+ * @param MaxPacket - Endpoint max packet size
+ * @param MaxBurst - Packets per burst
+ * @return UINTN - Transfer size limit in bytes
+ */
+STATIC UINTN BulkTransferLimit(CONST USB_DEVICE_INFO *Device, UINTN MaxPacket, UINTN MaxBurst) {
+    UINTN Unit;
+    UINTN Limit;
+    
+    Unit = MaxPacket * MAX(MaxBurst, 1);
+    Limit = Device->SuperSpeed ? USB_SS_BULK_MAX_TRANSFER_SIZE : USB_BULK_MAX_TRANSFER_SIZE;
+    
+    return MAX((Limit / Unit) * Unit, Unit);
+}
+
+/**
+ * Move a payload over the device's bulk endpoint
+ * @param DeviceId - Device identifier
+ * @param Direction - EfiUsbDataIn or EfiUsbDataOut
+ * @param Buffer - Data buffer
+ * @param Length - In: bytes to move; out: bytes actually moved
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS usb_bulk_transfer(UINTN DeviceId, EFI_USB_DATA_DIRECTION Direction, VOID *Buffer, UINTN *Length) {
+    EFI_STATUS Status;
+    USB_DEVICE_INFO *Device;
+    UINT8 Endpoint;
+    UINTN MaxPacket;
+    UINTN MaxBurst;
+    UINTN ChunkLimit;
+    UINTN Requested;
+    UINTN DataLength;
+    UINTN Done;
+    UINT32 TransferStatus;
+    DEBUG_TIMER Timer;
+    
+    DBG_ENTER();
+    
+    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized || Buffer == NULL ||
+        Length == NULL || *Length == 0 ||
+        (Direction != EfiUsbDataIn && Direction != EfiUsbDataOut)) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Device = &mUsbDevices[DeviceId];
+    if (!Device->IsConnected || Device->UsbIo == NULL) {
+        DBG_EXIT_STATUS(EFI_NOT_READY);
+        return EFI_NOT_READY;
+    }
+    
+    if (Direction == EfiUsbDataIn) {
+        Endpoint = Device->BulkInEndpoint;
+        MaxPacket = Device->BulkInMaxPacket;
+        MaxBurst = Device->BulkInMaxBurst;
+    } else {
+        Endpoint = Device->BulkOutEndpoint;
+        MaxPacket = Device->BulkOutMaxPacket;
+        MaxBurst = Device->BulkOutMaxBurst;
+    }
+    
+    if (Endpoint == 0 || MaxPacket == 0) {
+        DBG_EXIT_STATUS(EFI_UNSUPPORTED);
+        return EFI_UNSUPPORTED;
+    }
+    
+    // Every transfer but the last stays a whole number of packets
+    ChunkLimit = BulkTransferLimit(Device, MaxPacket, MaxBurst);
+    
+    Done = 0;
+    Status = EFI_SUCCESS;
+    DebugTimerStart(&Timer, "usb_bulk_transfer");
+    
+    while (Done < *Length) {
+        Requested = MIN(*Length - Done, ChunkLimit);
+        DataLength = Requested;
+        
+        Status = Device->UsbIo->UsbBulkTransfer(
+            Device->UsbIo,
+            Endpoint,
+            (UINT8 *)Buffer + Done,
+            &DataLength,
+            USB_BULK_TIMEOUT,
+            &TransferStatus
+        );
+        
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Bulk transfer on 0x%02X failed after %d bytes: %r, TransferStatus=0x%08X\n",
+                      Endpoint, Done, Status, TransferStatus);
+            if ((TransferStatus & EFI_USB_ERR_STALL) != 0) {
+                ClearEndpointHalt(Device->UsbIo, Endpoint);
+            }
+            break;
+        }
+        
+        Done += DataLength;
+        
+        // A short packet ends an IN transfer
+        if (DataLength < Requested) {
+            break;
+        }
+    }
+    
+    *Length = Done;
+    
+    if (!EFI_ERROR(Status)) {
+        metrics_record(mUsbMetrics[(Direction == EfiUsbDataIn) ? UsbMetricBulkIn : UsbMetricBulkOut], &Timer, Done);
+    }
+    
+    DBG_EXIT_STATUS(Status);
+    return Status;
+}
+
+/**
+ * Get a copy of the information recorded for a device
+ * @param DeviceId - Device identifier
+ * @param Info - Pointer to receive the device information
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS usb_get_device_info(UINTN DeviceId, USB_DEVICE_INFO *Info) {
+    if (DeviceId >= mDeviceCount || Info == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    CopyMemory(Info, &mUsbDevices[DeviceId], sizeof(USB_DEVICE_INFO));
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the number of host controllers the driver is tracking
+ * @return UINTN - Host controller count
+ */
+UINTN usb_get_host_controller_count(VOID) {
+    return mHostControllerCount;
+}
+
+/**
+ * Finish a queued transfer and signal its completion
+ * @param Token - Transfer token
+ * @param Status - Final transfer status
+ */
+STATIC VOID CompleteTransfer(USB_TRANSFER_TOKEN *Token, EFI_STATUS Status) {
+    Token->TransactionStatus = Status;
+    mTransferCompleted++;
+    
+    if (Token->Event != NULL) {
+        gBS->SignalEvent(Token->Event);
+    }
+    if (mTransferDoneEvent != NULL) {
+        gBS->SignalEvent(mTransferDoneEvent);
+    }
+}
+
+/**
+ * Move one bounded slice of the transfer at the head of a device queue
+ * @details The slice timeout is short so a device that is not ready gives
+ *          the pump back quickly; bytes moved before a timeout are kept and
+ *          the transfer only fails once its own timeout has elapsed.
+ * @param DeviceId - Device identifier
+ */
+STATIC VOID ServiceTransferQueue(UINTN DeviceId) {
+    EFI_STATUS Status;
+    USB_TRANSFER_QUEUE *Queue;
+    USB_TRANSFER_TOKEN *Token;
+    USB_DEVICE_INFO *Device;
+    UINT8 Endpoint;
+    UINTN MaxPacket;
+    UINTN MaxBurst;
+    UINTN Requested;
+    UINTN DataLength;
+    UINT32 TransferStatus;
+    UINT32 Timeout;
+    BOOLEAN Finished;
+    DEBUG_TIMER Timer;
+    
+    Queue = &mTransferQueues[DeviceId];
+    if (Queue->Count == 0) {
+        return;
+    }
+    
+    Token = Queue->Tokens[Queue->Head];
+    Device = &mUsbDevices[DeviceId];
+    
+    if (Token->Direction == EfiUsbDataIn) {
+        Endpoint = Device->BulkInEndpoint;
+        MaxPacket = Device->BulkInMaxPacket;
+        MaxBurst = Device->BulkInMaxBurst;
+    } else {
+        Endpoint = Device->BulkOutEndpoint;
+        MaxPacket = Device->BulkOutMaxPacket;
+        MaxBurst = Device->BulkOutMaxBurst;
+    }
+    
+    Finished = FALSE;
+    
+    if (!Device->IsConnected || Device->UsbIo == NULL) {
+        Status = EFI_NOT_READY;
+        Finished = TRUE;
+    } else {
+        Requested = MIN(Token->Length - Token->Transferred, BulkTransferLimit(Device, MaxPacket, MaxBurst));
+        DataLength = Requested;
+        TransferStatus = 0;
+        
+        DebugTimerStart(&Timer, "usb_queued_slice");
+        Status = Device->UsbIo->UsbBulkTransfer(
+            Device->UsbIo,
+            Endpoint,
+            (UINT8 *)Token->Buffer + Token->Transferred,
+            &DataLength,
+            USB_ASYNC_SLICE_TIMEOUT,
+            &TransferStatus
+        );
+        metrics_record(
+            mUsbMetrics[(Token->Direction == EfiUsbDataIn) ? UsbMetricQueuedIn : UsbMetricQueuedOut],
+            &Timer,
+            EFI_ERROR(Status) ? 0 : DataLength
+        );
+        
+        if (Status == EFI_TIMEOUT) {
+            // Keep partial progress and retry next tick
+            Token->Transferred += MIN(DataLength, Requested);
+            Timeout = (Token->Timeout != 0) ? Token->Timeout : USB_BULK_TIMEOUT;
+            Queue->Elapsed += MAX(USB_ASYNC_POLL_INTERVAL / 10000, USB_ASYNC_SLICE_TIMEOUT);
+            if (Queue->Elapsed >= Timeout) {
+                Finished = TRUE;
+            }
+        } else if (EFI_ERROR(Status)) {
+            LOG_ERROR("Queued bulk transfer on 0x%02X failed after %d bytes: %r, TransferStatus=0x%08X\n",
+                      Endpoint, Token->Transferred, Status, TransferStatus);
+            if ((TransferStatus & EFI_USB_ERR_STALL) != 0) {
+                ClearEndpointHalt(Device->UsbIo, Endpoint);
+            }
+            Finished = TRUE;
+        } else {
+            Token->Transferred += DataLength;
+            Queue->Elapsed = 0;
+            // A short packet ends an IN transfer
+            Finished = (Token->Transferred >= Token->Length || DataLength < Requested);
+        }
+    }
+    
+    if (Finished) {
+        Queue->Tokens[Queue->Head] = NULL;
+        Queue->Head = (Queue->Head + 1) % USB_TRANSFER_QUEUE_DEPTH;
+        Queue->Count--;
+        Queue->Elapsed = 0;
+        CompleteTransfer(Token, Status);
+    }
+}
+
+/**
+ * Timer notification that advances every device queue by one slice
+ * @param Event - Pump timer event
+ * @param Context - Unused
+ */
+STATIC VOID EFIAPI UsbTransferPump(EFI_EVENT Event, VOID *Context) {
+    UINTN Index;
+    
+    if (!mUsbDriverInitialized || mDeviceCount == 0) {
+        return;
+    }
+    
+    // Rotate the starting device so no device always goes first
+    for (Index = 0; Index < mDeviceCount; Index++) {
+        ServiceTransferQueue((mTransferCursor + Index) % mDeviceCount);
+    }
+    mTransferCursor = (mTransferCursor + 1) % mDeviceCount;
+}
+
+/**
+ * Abort every transfer queued on one device
+ * @param DeviceId - Device identifier
+ */
+STATIC VOID UsbCancelDeviceTransfers(UINTN DeviceId) {
+    EFI_TPL OldTpl;
+    USB_TRANSFER_QUEUE *Queue;
+    USB_TRANSFER_TOKEN *Token;
+    
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    Queue = &mTransferQueues[DeviceId];
+    while (Queue->Count > 0) {
+        Token = Queue->Tokens[Queue->Head];
+        Queue->Tokens[Queue->Head] = NULL;
+        Queue->Head = (Queue->Head + 1) % USB_TRANSFER_QUEUE_DEPTH;
+        Queue->Count--;
+        CompleteTransfer(Token, EFI_ABORTED);
+    }
+    Queue->Head = 0;
+    Queue->Elapsed = 0;
+    gBS->RestoreTPL(OldTpl);
+}
+
+/**
+ * Abort every queued transfer and stop interrupt polling
+ */
+STATIC VOID UsbCancelAllTransfers(VOID) {
+    UINTN Index;
+    
+    for (Index = 0; Index < mDeviceCount; Index++) {
+        if (mTransferQueues[Index].InterruptActive) {
+            usb_interrupt_stop(Index);
+        }
+        UsbCancelDeviceTransfers(Index);
+    }
+}
+
+/**
+ * Queue a bulk transfer without waiting for it
+ * @param DeviceId - Device identifier
+ * @param Token - Transfer token; Direction, Buffer and Length must be set
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES if the device queue is full
+ */
+EFI_STATUS usb_transfer_submit(UINTN DeviceId, USB_TRANSFER_TOKEN *Token) {
+    EFI_STATUS Status;
+    EFI_TPL OldTpl;
+    USB_TRANSFER_QUEUE *Queue;
+    USB_DEVICE_INFO *Device;
+    UINTN Length;
+    
+    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized || Token == NULL ||
+        Token->Buffer == NULL || Token->Length == 0 ||
+        (Token->Direction != EfiUsbDataIn && Token->Direction != EfiUsbDataOut)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Device = &mUsbDevices[DeviceId];
+    if (!Device->IsConnected || Device->UsbIo == NULL) {
+        return EFI_NOT_READY;
+    }
+    
+    if ((Token->Direction == EfiUsbDataIn && (Device->BulkInEndpoint == 0 || Device->BulkInMaxPacket == 0)) ||
+        (Token->Direction == EfiUsbDataOut && (Device->BulkOutEndpoint == 0 || Device->BulkOutMaxPacket == 0))) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    Token->Transferred = 0;
+    
+    if (mTransferPumpEvent == NULL) {
+        // No pump: complete the transfer before returning
+        Length = Token->Length;
+        Status = usb_bulk_transfer(DeviceId, Token->Direction, Token->Buffer, &Length);
+        Token->Transferred = Length;
+        CompleteTransfer(Token, Status);
+        return EFI_SUCCESS;
+    }
+    
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    Queue = &mTransferQueues[DeviceId];
+    if (Queue->Count >= USB_TRANSFER_QUEUE_DEPTH) {
+        gBS->RestoreTPL(OldTpl);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    Token->TransactionStatus = EFI_NOT_READY;
+    Queue->Tokens[(Queue->Head + Queue->Count) % USB_TRANSFER_QUEUE_DEPTH] = Token;
+    Queue->Count++;
+    gBS->RestoreTPL(OldTpl);
+    
+    return EFI_SUCCESS;
+}
+
+/**
+ * Remove a queued transfer; it completes with EFI_ABORTED
+ * @param Token - Token passed to usb_transfer_submit
+ * @return EFI_STATUS - EFI_NOT_FOUND if the token is not queued
+ */
+EFI_STATUS usb_transfer_cancel(USB_TRANSFER_TOKEN *Token) {
+    EFI_TPL OldTpl;
+    USB_TRANSFER_QUEUE *Queue;
+    UINTN DeviceId;
+    UINTN Index;
+    UINTN Slot;
+    UINTN Next;
+    BOOLEAN WasHead;
+    
+    if (Token == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    
+    for (DeviceId = 0; DeviceId < mDeviceCount; DeviceId++) {
+        Queue = &mTransferQueues[DeviceId];
+        for (Index = 0; Index < Queue->Count; Index++) {
+            Slot = (Queue->Head + Index) % USB_TRANSFER_QUEUE_DEPTH;
+            if (Queue->Tokens[Slot] != Token) {
+                continue;
+            }
+            
+            WasHead = (Index == 0);
+            
+            // Close the gap, keeping the remaining transfers in order
+            for (; Index + 1 < Queue->Count; Index++) {
+                Next = (Slot + 1) % USB_TRANSFER_QUEUE_DEPTH;
+                Queue->Tokens[Slot] = Queue->Tokens[Next];
+                Slot = Next;
+            }
+            Queue->Tokens[Slot] = NULL;
+            Queue->Count--;
+            if (WasHead) {
+                Queue->Elapsed = 0;
+            }
+            
+            CompleteTransfer(Token, EFI_ABORTED);
+            gBS->RestoreTPL(OldTpl);
+            return EFI_SUCCESS;
+        }
+    }
+    
+    gBS->RestoreTPL(OldTpl);
+    return EFI_NOT_FOUND;
+}
+
+/**
+ * Get the event signaled whenever any queued transfer completes
+ * @return EFI_EVENT - Waitable event, or NULL if the driver is not initialized
+ */
+EFI_EVENT usb_get_completion_event(VOID) {
+    return mTransferDoneEvent;
+}
+
+/**
+ * Get the number of queued transfers completed since the last call
+ * @return UINTN - Completed transfer count
+ */
+UINTN usb_transfer_reap(VOID) {
+    EFI_TPL OldTpl;
+    UINTN Completed;
+    
+    OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+    Completed = mTransferCompleted;
+    mTransferCompleted = 0;
+    gBS->RestoreTPL(OldTpl);
+    
+    return Completed;
+}
+
+/**
+ * Start asynchronous polling of the device's interrupt IN endpoint
+ * @param DeviceId - Device identifier
+ * @param Callback - Called by the host controller driver with each report
+ * @param Context - Passed to Callback
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS usb_interrupt_start(UINTN DeviceId, EFI_ASYNC_USB_TRANSFER_CALLBACK Callback, VOID *Context) {
+    EFI_STATUS Status;
+    USB_DEVICE_INFO *Device;
+    
+    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized || Callback == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Device = &mUsbDevices[DeviceId];
+    if (!Device->IsConnected || Device->UsbIo == NULL) {
+        return EFI_NOT_READY;
+    }
+    
+    if (Device->InterruptInEndpoint == 0 || Device->InterruptInMaxPacket == 0) {
+        return EFI_UNSUPPORTED;
+    }
+    
+    if (mTransferQueues[DeviceId].InterruptActive) {
+        return EFI_ALREADY_STARTED;
+    }
+    
+    Status = Device->UsbIo->UsbAsyncInterruptTransfer(
+        Device->UsbIo,
+        Device->InterruptInEndpoint,
+        TRUE,
+        MAX(Device->InterruptInInterval, 1),
+        Device->InterruptInMaxPacket,
+        Callback,
+        Context
+    );
+    
+    if (EFI_ERROR(Status)) {
+        LOG_ERROR("Interrupt polling on 0x%02X failed to start: %r\n", Device->InterruptInEndpoint, Status);
+        return Status;
+    }
+    
+    mTransferQueues[DeviceId].InterruptActive = TRUE;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Stop asynchronous polling of the device's interrupt IN endpoint
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS usb_interrupt_stop(UINTN DeviceId) {
+    EFI_STATUS Status;
+    USB_DEVICE_INFO *Device;
+    
+    if (DeviceId >= mDeviceCount || !mUsbDriverInitialized) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    if (!mTransferQueues[DeviceId].InterruptActive) {
+        return EFI_NOT_STARTED;
+    }
+    
+    Device = &mUsbDevices[DeviceId];
+    Status = Device->UsbIo->UsbAsyncInterruptTransfer(
+        Device->UsbIo,
+        Device->InterruptInEndpoint,
+        FALSE,
+        0,
+        0,
+        NULL,
+        NULL
+    );
+    
+    mTransferQueues[DeviceId].InterruptActive = FALSE;
+    return Status;
+}
+
 /**
  * Initialize Mass Storage Device
  */
 STATIC EFI_STATUS InitializeMassStorageDevice(EFI_USB_IO_PROTOCOL *UsbIo, UINTN DeviceIndex) {
-    // Mass storage specific initialization
-    // This could include SCSI command setup, etc.
-    LOG_INFO("Mass storage device %d initialized\n", DeviceIndex);
+    EFI_STATUS Status;
+    
+    // Commands are deferred to first use so enumeration stays bus-free
+    Status = usb_msc_attach(DeviceIndex);
+    if (EFI_ERROR(Status)) {
+        LOG_INFO("Mass storage device %d does not use SCSI over BOT, not attached\n", DeviceIndex);
+        return EFI_SUCCESS;
+    }
+    
+    LOG_INFO("Mass storage device %d attached\n", DeviceIndex);
     return EFI_SUCCESS;
 }
 
@@ -279,8 +1469,15 @@ STATIC EFI_STATUS InitializeMassStorageDevice(EFI_USB_IO_PROTOCOL *UsbIo, UINTN
  * Initialize HID Device  
  */
 STATIC EFI_STATUS InitializeHidDevice(EFI_USB_IO_PROTOCOL *UsbIo, UINTN DeviceIndex) {
-    // HID specific initialization
-    // This could include report descriptor parsing, etc.
+    EFI_STATUS Status;
+    
+    // Compiles the report layout once and starts interrupt IN polling
+    Status = usb_hid_attach(DeviceIndex);
+    if (EFI_ERROR(Status)) {
+        LOG_INFO("HID device %d not polled: %r\n", DeviceIndex, Status);
+        return EFI_SUCCESS;
+    }
+    
     LOG_INFO("HID device %d initialized\n", DeviceIndex);
     return EFI_SUCCESS;
 }
@@ -290,15 +1487,37 @@ STATIC EFI_STATUS InitializeHidDevice(EFI_USB_IO_PROTOCOL *UsbIo, UINTN DeviceIn
  * @return EFI_STATUS - Success or error code
  */
 EFI_STATUS usb_driver_status(VOID) {
+    UINTN CacheHits;
+    UINTN CacheMisses;
+    UINTN CacheEntries;
+    
     DEBUG((EFI_D_INFO, "USB Driver Status:\n"));
     DEBUG((EFI_D_INFO, "  Initialized: %s\n", mUsbDriverInitialized ? L"YES" : L"NO"));
-    DEBUG((EFI_D_INFO, "  Devices found: %d\n", mDeviceCount));
+    DEBUG((EFI_D_INFO, "  Devices found: %d\n", usb_get_connected_count()));
+    
+    usb_descriptor_cache_get_stats(&CacheHits, &CacheMisses, &CacheEntries);
+    DEBUG((EFI_D_INFO, "  Descriptor cache: %d entries, %d hits, %d misses\n",
+           CacheEntries, CacheHits, CacheMisses));
+    
+    for (UINTN i = 0; i < mHostControllerCount; i++) {
+        DEBUG((EFI_D_INFO, "  Host controller %d: %d ports, %d devices%s\n",
+               i, mHostControllers[i].PortCount, mHostControllers[i].DeviceCount,
+               (mHostControllers[i].MaxSpeed >= EFI_USB_SPEED_SUPER) ? L", SuperSpeed" : L""));
+    }
     
     for (UINTN i = 0; i < mDeviceCount; i++) {
-        DEBUG((EFI_D_INFO, "  Device %d: VID=0x%04X, PID=0x%04X\n",
-               i, mUsbDevices[i].VendorId, mUsbDevices[i].ProductId));
+        if (!mUsbDevices[i].IsConnected) {
+            continue;
+        }
+        DEBUG((EFI_D_INFO, "  Device %d: VID=0x%04X, PID=0x%04X, USB %x.%x, bulk IN 0x%02X, bulk OUT 0x%02X\n",
+               i, mUsbDevices[i].VendorId, mUsbDevices[i].ProductId,
+               mUsbDevices[i].UsbRevision >> 8, (mUsbDevices[i].UsbRevision >> 4) & 0x0F,
+               mUsbDevices[i].BulkInEndpoint, mUsbDevices[i].BulkOutEndpoint));
     }
     
+    usb_hid_status();
+    usb_dma_status();
+    
     return EFI_SUCCESS;
 }
 
@@ -313,6 +1532,29 @@ EFI_STATUS usb_driver_cleanup(VOID) {
     
     DEBUG((EFI_D_INFO, "Cleaning up USB driver...\n"));
     
+    // Closing the event also ends the protocol notify registration
+    if (mUsbIoNotifyEvent != NULL) {
+        gBS->CloseEvent(mUsbIoNotifyEvent);
+        mUsbIoNotifyEvent = NULL;
+        mUsbIoRegistration = NULL;
+    }
+    
+    if (mTransferPumpEvent != NULL) {
+        gBS->CloseEvent(mTransferPumpEvent);
+        mTransferPumpEvent = NULL;
+    }
+    
+    UsbCancelAllTransfers();
+    usb_hid_cleanup();
+    usb_msc_cleanup();
+    usb_dma_cleanup();
+    usb_descriptor_cache_flush();
+    
+    if (mTransferDoneEvent != NULL) {
+        gBS->CloseEvent(mTransferDoneEvent);
+        mTransferDoneEvent = NULL;
+    }
+    
     // Close all opened protocols
     for (UINTN i = 0; i < mDeviceCount; i++) {
         if (mUsbDevices[i].UsbIo != NULL) {
@@ -323,21 +1565,24 @@ EFI_STATUS usb_driver_cleanup(VOID) {
                 NULL
             );
         }
+        if (mUsbDevices[i].DevicePath != NULL) {
+            FreePool(mUsbDevices[i].DevicePath);
+        }
+        ZeroMemory(&mUsbDevices[i], sizeof(USB_DEVICE_INFO));
     }
     
-    if (mUsb2HcProtocol != NULL && mUsb2HcHandle != NULL) {
+    for (UINTN i = 0; i < mHostControllerCount; i++) {
         gBS->CloseProtocol(
-            mUsb2HcHandle,
+            mHostControllers[i].Handle,
             &gEfiUsb2HcProtocolGuid,
             gImageHandle,
             NULL
         );
-        mUsb2HcHandle = NULL;
     }
     
     mUsbDriverInitialized = FALSE;
     mDeviceCount = 0;
-    mUsb2HcProtocol = NULL;
+    mHostControllerCount = 0;
     
     DEBUG((EFI_D_INFO, "USB driver cleanup complete\n"));
     return EFI_SUCCESS;
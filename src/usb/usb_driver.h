@@ -26,8 +26,47 @@ typedef struct {
     CHAR16 DeviceName[64];
     UINT8 InterfaceCount;
     UINT8 ConfigurationValue;
+    UINTN HostController;               // USB_HOST_CONTROLLER_NONE if unknown
+    UINT16 UsbRevision;                 // bcdUSB
+    BOOLEAN SuperSpeed;                 // Enumerated at 5 Gbps or faster
+    EFI_DEVICE_PATH_PROTOCOL *DevicePath;   // Private copy, kept after removal
+    
+    // Interface bound to this UsbIo handle
+    UINT8 InterfaceNumber;
+    UINT8 InterfaceClass;
+    UINT8 InterfaceSubClass;
+    UINT8 InterfaceProtocol;
+    
+    // Endpoints of that interface (address 0 when absent)
+    UINT8 BulkInEndpoint;
+    UINT8 BulkOutEndpoint;
+    UINT16 BulkInMaxPacket;
+    UINT16 BulkOutMaxPacket;
+    UINT8 BulkInMaxBurst;               // Packets per burst; 1 below SuperSpeed
+    UINT8 BulkOutMaxBurst;
+    BOOLEAN UasCapable;                 // Interface has a UAS alternate setting
+    UINT8 InterruptInEndpoint;
+    UINT16 InterruptInMaxPacket;
+    UINT8 InterruptInInterval;
 } USB_DEVICE_INFO;
 
+#define USB_HOST_CONTROLLER_NONE    ((UINTN)-1)
+
+//
+// Queued Transfer Token
+// Modeled on the UEFI I/O token pattern: the caller owns the token, which
+// must stay valid until TransactionStatus leaves EFI_NOT_READY.
+//
+typedef struct {
+    EFI_EVENT Event;                    // Optional; signaled on completion
+    EFI_STATUS TransactionStatus;       // EFI_NOT_READY while queued
+    EFI_USB_DATA_DIRECTION Direction;
+    VOID *Buffer;
+    UINTN Length;                       // Bytes requested
+    UINTN Transferred;                  // Bytes moved so far
+    UINT32 Timeout;                     // Milliseconds; 0 for USB_BULK_TIMEOUT
+} USB_TRANSFER_TOKEN;
+
 //
 // USB Class Definitions
 //
@@ -57,6 +96,17 @@ typedef struct {
 #define USB_REQ_GET_CONFIGURATION   0x08
 #define USB_REQ_SET_CONFIGURATION   0x09
 
+#define USB_FEATURE_ENDPOINT_HALT   0x00
+#define USB_RECIPIENT_INTERFACE     0x01
+#define USB_RECIPIENT_ENDPOINT      0x02
+
+//
+// Endpoint descriptor fields
+//
+#define USB_ENDPOINT_DIR_IN         0x80
+#define USB_ENDPOINT_TYPE_MASK      0x03
+#define USB_ENDPOINT_MAX_PACKET_MASK 0x07FF
+
 //
 // Function Prototypes
 //
@@ -72,6 +122,28 @@ usb_device_detect(
     VOID
     );
 
+/**
+ * Bring the device table up to date with hot-plug changes
+ * @details Only devices that arrived or went away since the last scan are
+ *          touched; device ids of the others do not change.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_device_rescan(
+    VOID
+    );
+
+/**
+ * Get the number of devices currently connected
+ * @return UINTN - Connected device count
+ */
+UINTN
+EFIAPI
+usb_get_connected_count(
+    VOID
+    );
+
 EFI_STATUS
 EFIAPI
 usb_device_communicate(
@@ -80,6 +152,123 @@ usb_device_communicate(
     IN UINTN Length
     );
 
+/**
+ * Move a payload over the device's bulk endpoint
+ * @details The payload is split into transfers of up to
+ *          USB_BULK_MAX_TRANSFER_SIZE, each a whole number of max packets
+ *          except the last. An IN transfer ends early on a short packet.
+ * @param DeviceId - Device identifier
+ * @param Direction - EfiUsbDataIn or EfiUsbDataOut
+ * @param Buffer - Data buffer
+ * @param Length - In: bytes to move; out: bytes actually moved
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_bulk_transfer(
+    IN UINTN DeviceId,
+    IN EFI_USB_DATA_DIRECTION Direction,
+    IN OUT VOID *Buffer,
+    IN OUT UINTN *Length
+    );
+
+/**
+ * Get the number of host controllers the driver is tracking
+ * @return UINTN - Host controller count
+ */
+UINTN
+EFIAPI
+usb_get_host_controller_count(
+    VOID
+    );
+
+/**
+ * Queue a bulk transfer without waiting for it
+ * @details Queued transfers are moved in bounded slices by a TPL_CALLBACK
+ *          timer, one slice per device per tick, so several devices make
+ *          progress together and a stalled device only delays its own queue.
+ *          With USE_INTERRUPT_DRIVEN_IO off the transfer completes inline.
+ * @param DeviceId - Device identifier
+ * @param Token - Transfer token; Direction, Buffer and Length must be set
+ * @return EFI_STATUS - EFI_OUT_OF_RESOURCES if the device queue is full
+ */
+EFI_STATUS
+EFIAPI
+usb_transfer_submit(
+    IN UINTN DeviceId,
+    IN OUT USB_TRANSFER_TOKEN *Token
+    );
+
+/**
+ * Remove a queued transfer; it completes with EFI_ABORTED
+ * @param Token - Token passed to usb_transfer_submit
+ * @return EFI_STATUS - EFI_NOT_FOUND if the token is not queued
+ */
+EFI_STATUS
+EFIAPI
+usb_transfer_cancel(
+    IN OUT USB_TRANSFER_TOKEN *Token
+    );
+
+/**
+ * Get the event signaled whenever any queued transfer completes
+ * @return EFI_EVENT - Waitable event, or NULL if the driver is not initialized
+ */
+EFI_EVENT
+EFIAPI
+usb_get_completion_event(
+    VOID
+    );
+
+/**
+ * Get the number of queued transfers completed since the last call
+ * @return UINTN - Completed transfer count
+ */
+UINTN
+EFIAPI
+usb_transfer_reap(
+    VOID
+    );
+
+/**
+ * Start asynchronous polling of the device's interrupt IN endpoint
+ * @param DeviceId - Device identifier
+ * @param Callback - Called by the host controller driver with each report
+ * @param Context - Passed to Callback
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_interrupt_start(
+    IN UINTN DeviceId,
+    IN EFI_ASYNC_USB_TRANSFER_CALLBACK Callback,
+    IN VOID *Context OPTIONAL
+    );
+
+/**
+ * Stop asynchronous polling of the device's interrupt IN endpoint
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_interrupt_stop(
+    IN UINTN DeviceId
+    );
+
+/**
+ * Get a copy of the information recorded for a device
+ * @param DeviceId - Device identifier
+ * @param Info - Pointer to receive the device information
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_get_device_info(
+    IN UINTN DeviceId,
+    OUT USB_DEVICE_INFO *Info
+    );
+
 EFI_STATUS
 EFIAPI
 usb_driver_status(
@@ -102,6 +291,90 @@ usb_process_device(
     IN UINTN DeviceIndex
     );
 
+STATIC
+EFI_STATUS
+ParseInterfaceEndpoints(
+    IN EFI_USB_IO_PROTOCOL *UsbIo,
+    IN CONST EFI_USB_DEVICE_DESCRIPTOR *DeviceDescriptor,
+    IN UINT16 ConfigLength,
+    IN OUT USB_DEVICE_INFO *Device
+    );
+
+STATIC
+EFI_STATUS
+ParseSuperSpeedCompanions(
+    IN EFI_USB_IO_PROTOCOL *UsbIo,
+    IN UINT16 ConfigLength,
+    IN UINT8 AlternateSetting,
+    IN OUT USB_DEVICE_INFO *Device
+    );
+
+STATIC
+UINTN
+BulkTransferLimit(
+    IN CONST USB_DEVICE_INFO *Device,
+    IN UINTN MaxPacket,
+    IN UINTN MaxBurst
+    );
+
+STATIC
+UINTN
+FindHostController(
+    IN EFI_HANDLE Handle
+    );
+
+STATIC
+EFI_STATUS
+UsbAddDevice(
+    IN EFI_HANDLE Handle
+    );
+
+STATIC
+VOID
+UsbRemoveDevice(
+    IN UINTN DeviceId
+    );
+
+STATIC
+UINTN
+UsbProcessArrivals(
+    VOID
+    );
+
+STATIC
+UINTN
+UsbPruneRemovedDevices(
+    VOID
+    );
+
+STATIC
+VOID
+EFIAPI
+UsbIoArrivalNotify(
+    IN EFI_EVENT Event,
+    IN VOID *Context
+    );
+
+STATIC
+VOID
+EFIAPI
+UsbTransferPump(
+    IN EFI_EVENT Event,
+    IN VOID *Context
+    );
+
+STATIC
+VOID
+UsbCancelDeviceTransfers(
+    IN UINTN DeviceId
+    );
+
+STATIC
+VOID
+UsbCancelAllTransfers(
+    VOID
+    );
+
 STATIC
 EFI_STATUS
 InitializeMassStorageDevice(
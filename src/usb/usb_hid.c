@@ -0,0 +1,1114 @@
+/**
+ * @file usb_hid.c
+ * @brief USB HID report descriptor compiler and interrupt-driven input
+ *
+ * Each HID interface's report descriptor is walked once, when the device is
+ * attached, and compiled into a short table of (report id, bit offset, bit
+ * size, usage) entries. Reports then arrive through asynchronous interrupt
+ * polling at the endpoint's own interval, and decoding one is a table scan
+ * of shifts and masks. Keyboards additionally get their modifier and key
+ * array entries located up front, so key presses are queued straight from
+ * the host controller callback and the main loop wakes on the key event.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/DebugLib.h>
+
+#include "usb_hid.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+#include "../../include/metrics.h"
+#include "../uefi/memory_pool.h"
+
+//
+// Report descriptor item encoding
+//
+#define HID_ITEM_SIZE_MASK          0x03
+#define HID_ITEM_TYPE_MAIN          0x00
+#define HID_ITEM_TYPE_GLOBAL        0x01
+#define HID_ITEM_TYPE_LOCAL         0x02
+#define HID_ITEM_LONG               0xFE
+
+#define HID_MAIN_INPUT              0x08
+#define HID_MAIN_OUTPUT             0x09
+#define HID_MAIN_COLLECTION         0x0A
+#define HID_MAIN_FEATURE            0x0B
+#define HID_MAIN_END_COLLECTION     0x0C
+
+#define HID_GLOBAL_USAGE_PAGE       0x00
+#define HID_GLOBAL_LOGICAL_MIN      0x01
+#define HID_GLOBAL_LOGICAL_MAX      0x02
+#define HID_GLOBAL_REPORT_SIZE      0x07
+#define HID_GLOBAL_REPORT_ID        0x08
+#define HID_GLOBAL_REPORT_COUNT     0x09
+#define HID_GLOBAL_PUSH             0x0A
+#define HID_GLOBAL_POP              0x0B
+
+#define HID_LOCAL_USAGE             0x00
+#define HID_LOCAL_USAGE_MIN         0x01
+#define HID_LOCAL_USAGE_MAX         0x02
+
+#define HID_INPUT_CONSTANT          BIT0
+#define HID_INPUT_VARIABLE          BIT1
+
+#define HID_MAX_USAGES              16
+#define HID_MAX_GLOBAL_STACK        4
+#define HID_MAX_KEYS                16
+#define HID_NO_FIELD                0xFF
+
+#define HID_KEY_ERROR_ROLLOVER      0x01
+
+//
+// Parser state that persists across main items
+//
+typedef struct {
+    UINT16 UsagePage;
+    INT32 LogicalMinimum;
+    INT32 LogicalMaximum;
+    UINT32 ReportSize;
+    UINT32 ReportCount;
+    UINT8 ReportId;
+} HID_GLOBAL_STATE;
+
+//
+// Per-device HID state, indexed by USB device id
+//
+typedef struct {
+    EFI_HANDLE Handle;                  // UsbIo handle the state belongs to
+    UINTN DeviceId;
+    BOOLEAN Active;
+    BOOLEAN UsesReportIds;
+    BOOLEAN NeedsRestart;
+    UINT8 ModifierField;                // Keyboard fast path, HID_NO_FIELD if absent
+    UINT8 KeyArrayField;
+    UINTN FieldCount;
+    USB_HID_FIELD Fields[USB_HID_MAX_FIELDS];
+    UINT8 PressedKeys[HID_MAX_KEYS];
+    UINT8 LastReport[USB_HID_MAX_REPORT_SIZE];
+    UINTN LastReportLength;
+    UINTN Reports;
+    UINTN Errors;
+} USB_HID_DEVICE;
+
+//
+// Report layouts of the boot protocol (HID 1.11 appendix B), compiled like
+// any other descriptor when a boot-class device is left in boot protocol
+//
+STATIC CONST UINT8 mBootKeyboardDescriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
+    0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+
+STATIC CONST UINT8 mBootMouseDescriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+    0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+    0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+    0xC0, 0xC0
+};
+
+//
+// Keyboard usages 0x04-0x38 (US layout); usage 0x29 (Escape) is a scan code
+//
+#define HID_KEY_MAP_FIRST           0x04
+#define HID_KEY_ESCAPE              0x29
+
+STATIC CONST CHAR16 mHidKeyMap[] =
+    L"abcdefghijklmnopqrstuvwxyz1234567890\r\x1b\b\t -=[]\\#;'`,./";
+STATIC CONST CHAR16 mHidShiftedKeyMap[] =
+    L"ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()\r\x1b\b\t _+{}|~:\"~<>?";
+
+STATIC USB_HID_DEVICE mHidDevices[MAX_USB_DEVICES];
+STATIC EFI_INPUT_KEY mKeyBuffer[USB_HID_KEY_BUFFER_SIZE];
+STATIC UINTN mKeyHead = 0;
+STATIC UINTN mKeyCount = 0;
+STATIC UINTN mKeysDropped = 0;
+STATIC EFI_EVENT mKeyEvent = NULL;
+STATIC UINTN mInterruptMetric = METRICS_INVALID_ID;     // Reports are counted, not timed
+
+/**
+ * Create the key event; called once by usb_driver_init
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_init(
+    VOID
+)
+{
+    ZeroMemory(mHidDevices, sizeof(mHidDevices));
+    mKeyHead = 0;
+    mKeyCount = 0;
+    mKeysDropped = 0;
+
+    metrics_register(L"usb.interrupt", &mInterruptMetric);
+
+    if (mKeyEvent != NULL) {
+        return EFI_SUCCESS;
+    }
+
+    // Plain event so the main loop can wait on key presses
+    return gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &mKeyEvent);
+}
+
+/**
+ * Read an item's data as an unsigned or sign-extended value
+ * @param Data - Item data bytes
+ * @param Size - Data size (0, 1, 2 or 4)
+ * @param Signed - TRUE to sign-extend
+ * @return UINT32 - Item value
+ */
+STATIC
+UINT32
+HidItemValue(
+    IN CONST UINT8 *Data,
+    IN UINTN Size,
+    IN BOOLEAN Signed
+)
+{
+    switch (Size) {
+        case 1:
+            return Signed ? (UINT32)(INT32)(INT8)Data[0] : Data[0];
+        case 2:
+            return Signed ? (UINT32)(INT32)(INT16)ReadUnaligned16((CONST UINT16 *)Data) :
+                            ReadUnaligned16((CONST UINT16 *)Data);
+        case 4:
+            return ReadUnaligned32((CONST UINT32 *)Data);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Append a field to the table, merging it into the previous entry when it
+ * continues a run of equal-sized variable fields with consecutive usages
+ * @param Fields - Field table
+ * @param MaxFields - Table capacity
+ * @param FieldCount - In/out: entries used
+ * @param Field - Field to add
+ * @return BOOLEAN - FALSE if the table is full
+ */
+STATIC
+BOOLEAN
+HidEmitField(
+    IN OUT USB_HID_FIELD *Fields,
+    IN UINTN MaxFields,
+    IN OUT UINTN *FieldCount,
+    IN CONST USB_HID_FIELD *Field
+)
+{
+    USB_HID_FIELD *Last;
+
+    if (*FieldCount > 0 && (Field->Flags & USB_HID_FIELD_ARRAY) == 0) {
+        Last = &Fields[*FieldCount - 1];
+        if ((Last->Flags & USB_HID_FIELD_ARRAY) == 0 &&
+            Last->Flags == Field->Flags &&
+            Last->ReportId == Field->ReportId &&
+            Last->UsagePage == Field->UsagePage &&
+            Last->BitSize == Field->BitSize &&
+            Last->LogicalMinimum == Field->LogicalMinimum &&
+            Last->Count < MAX_UINT8 &&
+            Last->BitOffset + Last->Count * Last->BitSize == Field->BitOffset &&
+            Last->Usage + Last->Count == Field->Usage) {
+            Last->Count++;
+            return TRUE;
+        }
+    }
+
+    if (*FieldCount >= MaxFields) {
+        return FALSE;
+    }
+
+    CopyMemory(&Fields[*FieldCount], Field, sizeof(USB_HID_FIELD));
+    (*FieldCount)++;
+    return TRUE;
+}
+
+/**
+ * Compile a report descriptor into a field table
+ * @details Only input reports are compiled; output and feature items just
+ *          consume their locals. Constant (padding) fields advance the bit
+ *          offset without producing an entry.
+ * @param Descriptor - Report descriptor
+ * @param Length - Descriptor length in bytes
+ * @param Fields - Table to fill
+ * @param MaxFields - Table capacity
+ * @param FieldCount - Pointer to receive the number of entries used
+ * @return EFI_STATUS - EFI_BUFFER_TOO_SMALL if the table overflowed
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_compile_report_descriptor(
+    IN CONST UINT8 *Descriptor,
+    IN UINTN Length,
+    OUT USB_HID_FIELD *Fields,
+    IN UINTN MaxFields,
+    OUT UINTN *FieldCount
+)
+{
+    HID_GLOBAL_STATE Global;
+    HID_GLOBAL_STATE GlobalStack[HID_MAX_GLOBAL_STACK];
+    UINTN StackDepth;
+    UINT32 Usages[HID_MAX_USAGES];
+    UINTN UsageCount;
+    UINT32 UsageMinimum;
+    UINT32 UsageMaximum;
+    BOOLEAN HasRange;
+    UINT16 InputBits[256];
+    USB_HID_FIELD Field;
+    UINT32 Usage;
+    UINT32 Value;
+    UINTN Offset;
+    UINTN Size;
+    UINTN Index;
+    UINT8 Prefix;
+    UINT8 Type;
+    UINT8 Tag;
+    BOOLEAN Overflow;
+
+    if (Descriptor == NULL || Fields == NULL || FieldCount == NULL || MaxFields == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    ZeroMemory(&Global, sizeof(Global));
+    ZeroMemory(InputBits, sizeof(InputBits));
+    StackDepth = 0;
+    UsageCount = 0;
+    UsageMinimum = 0;
+    UsageMaximum = 0;
+    HasRange = FALSE;
+    Overflow = FALSE;
+    *FieldCount = 0;
+
+    for (Offset = 0; Offset < Length; Offset += 1 + Size) {
+        Prefix = Descriptor[Offset];
+
+        if (Prefix == HID_ITEM_LONG) {
+            // Long items carry vendor data only; skip them
+            if (Offset + 1 >= Length) {
+                break;
+            }
+            Size = 2 + Descriptor[Offset + 1];
+            continue;
+        }
+
+        Size = Prefix & HID_ITEM_SIZE_MASK;
+        if (Size == 3) {
+            Size = 4;
+        }
+        if (Offset + 1 + Size > Length) {
+            LOG_WARN("HID report descriptor truncated at offset %d\n", Offset);
+            break;
+        }
+
+        Type = (Prefix >> 2) & 0x03;
+        Tag = Prefix >> 4;
+        Value = HidItemValue(&Descriptor[Offset + 1], Size, FALSE);
+
+        if (Type == HID_ITEM_TYPE_GLOBAL) {
+            switch (Tag) {
+                case HID_GLOBAL_USAGE_PAGE:
+                    Global.UsagePage = (UINT16)Value;
+                    break;
+                case HID_GLOBAL_LOGICAL_MIN:
+                    Global.LogicalMinimum = (INT32)HidItemValue(&Descriptor[Offset + 1], Size, TRUE);
+                    break;
+                case HID_GLOBAL_LOGICAL_MAX:
+                    Global.LogicalMaximum = (INT32)HidItemValue(&Descriptor[Offset + 1], Size, TRUE);
+                    break;
+                case HID_GLOBAL_REPORT_SIZE:
+                    Global.ReportSize = Value;
+                    break;
+                case HID_GLOBAL_REPORT_ID:
+                    Global.ReportId = (UINT8)Value;
+                    break;
+                case HID_GLOBAL_REPORT_COUNT:
+                    Global.ReportCount = Value;
+                    break;
+                case HID_GLOBAL_PUSH:
+                    if (StackDepth < HID_MAX_GLOBAL_STACK) {
+                        CopyMemory(&GlobalStack[StackDepth++], &Global, sizeof(Global));
+                    }
+                    break;
+                case HID_GLOBAL_POP:
+                    if (StackDepth > 0) {
+                        CopyMemory(&Global, &GlobalStack[--StackDepth], sizeof(Global));
+                    }
+                    break;
+                default:
+                    break;
+            }
+            continue;
+        }
+
+        if (Type == HID_ITEM_TYPE_LOCAL) {
+            // A 4-byte usage carries its own page in the upper half
+            if (Size < 4 && Tag <= HID_LOCAL_USAGE_MAX) {
+                Value |= (UINT32)Global.UsagePage << 16;
+            }
+            switch (Tag) {
+                case HID_LOCAL_USAGE:
+                    if (UsageCount < HID_MAX_USAGES) {
+                        Usages[UsageCount++] = Value;
+                    }
+                    break;
+                case HID_LOCAL_USAGE_MIN:
+                    UsageMinimum = Value;
+                    HasRange = TRUE;
+                    break;
+                case HID_LOCAL_USAGE_MAX:
+                    UsageMaximum = Value;
+                    HasRange = TRUE;
+                    break;
+                default:
+                    break;
+            }
+            continue;
+        }
+
+        if (Type != HID_ITEM_TYPE_MAIN) {
+            continue;
+        }
+
+        if (Tag == HID_MAIN_INPUT && Global.ReportSize != 0 && Global.ReportCount != 0) {
+            if ((Value & HID_INPUT_CONSTANT) != 0 || Global.ReportSize > 32) {
+                // Padding, or a field too wide to decode
+            } else if ((Value & HID_INPUT_VARIABLE) == 0) {
+                ZeroMemory(&Field, sizeof(Field));
+                Usage = HasRange ? UsageMinimum : ((UsageCount > 0) ? Usages[0] : 0);
+                Field.BitOffset = InputBits[Global.ReportId];
+                Field.BitSize = (UINT8)Global.ReportSize;
+                Field.Count = (UINT8)MIN(Global.ReportCount, MAX_UINT8);
+                Field.UsagePage = (UINT16)(Usage >> 16);
+                Field.Usage = (UINT16)Usage;
+                Field.LogicalMinimum = Global.LogicalMinimum;
+                Field.ReportId = Global.ReportId;
+                Field.Flags = USB_HID_FIELD_ARRAY;
+                Overflow |= !HidEmitField(Fields, MaxFields, FieldCount, &Field);
+            } else {
+                for (Index = 0; Index < Global.ReportCount; Index++) {
+                    if (HasRange) {
+                        Usage = MIN(UsageMinimum + (UINT32)Index, UsageMaximum);
+                    } else if (UsageCount > 0) {
+                        Usage = Usages[MIN(Index, UsageCount - 1)];
+                    } else {
+                        Usage = 0;
+                    }
+                    ZeroMemory(&Field, sizeof(Field));
+                    Field.BitOffset = (UINT16)(InputBits[Global.ReportId] + Index * Global.ReportSize);
+                    Field.BitSize = (UINT8)Global.ReportSize;
+                    Field.Count = 1;
+                    Field.UsagePage = (UINT16)(Usage >> 16);
+                    Field.Usage = (UINT16)Usage;
+                    Field.LogicalMinimum = Global.LogicalMinimum;
+                    Field.ReportId = Global.ReportId;
+                    Field.Flags = (Global.LogicalMinimum < 0) ? USB_HID_FIELD_SIGNED : 0;
+                    Overflow |= !HidEmitField(Fields, MaxFields, FieldCount, &Field);
+                }
+            }
+            InputBits[Global.ReportId] = (UINT16)(InputBits[Global.ReportId] +
+                                                  Global.ReportSize * Global.ReportCount);
+        }
+
+        // Every main item consumes the local items before it
+        UsageCount = 0;
+        UsageMinimum = 0;
+        UsageMaximum = 0;
+        HasRange = FALSE;
+    }
+
+    return Overflow ? EFI_BUFFER_TOO_SMALL : EFI_SUCCESS;
+}
+
+/**
+ * Extract a little-endian bit field from a report
+ * @param Report - Report payload (after the report id)
+ * @param Length - Payload length in bytes
+ * @param BitOffset - First bit of the field
+ * @param BitSize - Field width, 1-32
+ * @return UINT32 - Field value, or 0 if the field lies past the payload
+ */
+STATIC
+UINT32
+HidExtractBits(
+    IN CONST UINT8 *Report,
+    IN UINTN Length,
+    IN UINTN BitOffset,
+    IN UINTN BitSize
+)
+{
+    UINTN First;
+    UINTN Bytes;
+    UINTN Index;
+    UINT64 Raw;
+
+    First = BitOffset >> 3;
+    Bytes = ((BitOffset & 7) + BitSize + 7) >> 3;
+    if (First + Bytes > Length) {
+        return 0;
+    }
+
+    // Byte-aligned bytes are by far the most common field
+    if ((BitOffset & 7) == 0 && BitSize == 8) {
+        return Report[First];
+    }
+
+    Raw = 0;
+    for (Index = 0; Index < Bytes; Index++) {
+        Raw |= LShiftU64(Report[First + Index], Index * 8);
+    }
+
+    return (UINT32)(RShiftU64(Raw, BitOffset & 7) & (LShiftU64(1, BitSize) - 1));
+}
+
+/**
+ * Queue a key press and wake the main loop
+ * @param Key - Key to queue
+ */
+STATIC
+VOID
+HidQueueKey(
+    IN CONST EFI_INPUT_KEY *Key
+)
+{
+    if (mKeyCount >= USB_HID_KEY_BUFFER_SIZE) {
+        mKeysDropped++;
+        return;
+    }
+
+    CopyMemory(&mKeyBuffer[(mKeyHead + mKeyCount) % USB_HID_KEY_BUFFER_SIZE], Key, sizeof(EFI_INPUT_KEY));
+    mKeyCount++;
+
+    if (mKeyEvent != NULL) {
+        gBS->SignalEvent(mKeyEvent);
+    }
+}
+
+/**
+ * Translate a keyboard usage to a UEFI key
+ * @param Usage - Keyboard page usage
+ * @param Shift - TRUE when either shift key is held
+ * @param Key - Pointer to receive the key
+ * @return BOOLEAN - FALSE for usages with no console meaning
+ */
+STATIC
+BOOLEAN
+HidTranslateKey(
+    IN UINT8 Usage,
+    IN BOOLEAN Shift,
+    OUT EFI_INPUT_KEY *Key
+)
+{
+    Key->ScanCode = SCAN_NULL;
+    Key->UnicodeChar = CHAR_NULL;
+
+    if (Usage == HID_KEY_ESCAPE) {
+        Key->ScanCode = SCAN_ESC;
+    } else if (Usage >= HID_KEY_MAP_FIRST && Usage < HID_KEY_MAP_FIRST + ARRAY_SIZE(mHidKeyMap) - 1) {
+        Key->UnicodeChar = Shift ? mHidShiftedKeyMap[Usage - HID_KEY_MAP_FIRST] :
+                                   mHidKeyMap[Usage - HID_KEY_MAP_FIRST];
+    } else if (Usage >= 0x3A && Usage <= 0x45) {
+        Key->ScanCode = (UINT16)(SCAN_F1 + (Usage - 0x3A));
+    } else {
+        switch (Usage) {
+            case 0x49: Key->ScanCode = SCAN_INSERT; break;
+            case 0x4A: Key->ScanCode = SCAN_HOME; break;
+            case 0x4B: Key->ScanCode = SCAN_PAGE_UP; break;
+            case 0x4C: Key->ScanCode = SCAN_DELETE; break;
+            case 0x4D: Key->ScanCode = SCAN_END; break;
+            case 0x4E: Key->ScanCode = SCAN_PAGE_DOWN; break;
+            case 0x4F: Key->ScanCode = SCAN_RIGHT; break;
+            case 0x50: Key->ScanCode = SCAN_LEFT; break;
+            case 0x51: Key->ScanCode = SCAN_DOWN; break;
+            case 0x52: Key->ScanCode = SCAN_UP; break;
+            default: return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Queue the keys that went down since the previous keyboard report
+ * @param Hid - HID device state
+ * @param ReportId - Report id of the payload
+ * @param Report - Report payload
+ * @param Length - Payload length in bytes
+ */
+STATIC
+VOID
+HidDecodeKeyboard(
+    IN OUT USB_HID_DEVICE *Hid,
+    IN UINT8 ReportId,
+    IN CONST UINT8 *Report,
+    IN UINTN Length
+)
+{
+    CONST USB_HID_FIELD *Keys;
+    CONST USB_HID_FIELD *Modifiers;
+    UINT8 Pressed[HID_MAX_KEYS];
+    UINT8 ModifierBits;
+    UINTN SlotCount;
+    UINTN Slot;
+    UINTN Previous;
+    EFI_INPUT_KEY Key;
+    BOOLEAN WasDown;
+
+    Keys = &Hid->Fields[Hid->KeyArrayField];
+    if (Keys->ReportId != ReportId) {
+        return;
+    }
+
+    ModifierBits = 0;
+    if (Hid->ModifierField != HID_NO_FIELD) {
+        Modifiers = &Hid->Fields[Hid->ModifierField];
+        ModifierBits = (UINT8)HidExtractBits(Report, Length, Modifiers->BitOffset, Modifiers->Count);
+    }
+
+    SlotCount = MIN(Keys->Count, HID_MAX_KEYS);
+    ZeroMemory(Pressed, sizeof(Pressed));
+    for (Slot = 0; Slot < SlotCount; Slot++) {
+        Pressed[Slot] = (UINT8)(Keys->Usage + (INT32)HidExtractBits(Report, Length,
+                                   Keys->BitOffset + Slot * Keys->BitSize, Keys->BitSize) - Keys->LogicalMinimum);
+        if (Pressed[Slot] == HID_KEY_ERROR_ROLLOVER) {
+            // Too many keys down; the report says nothing about which
+            return;
+        }
+    }
+
+    for (Slot = 0; Slot < SlotCount; Slot++) {
+        if (Pressed[Slot] == 0) {
+            continue;
+        }
+
+        WasDown = FALSE;
+        for (Previous = 0; Previous < SlotCount; Previous++) {
+            if (Hid->PressedKeys[Previous] == Pressed[Slot]) {
+                WasDown = TRUE;
+                break;
+            }
+        }
+
+        // Modifier bits follow usage order from Left Control (bit 0)
+        if (!WasDown && HidTranslateKey(Pressed[Slot],
+                                        (ModifierBits & (BIT1 | BIT5)) != 0, &Key)) {
+            HidQueueKey(&Key);
+        }
+    }
+
+    CopyMemory(Hid->PressedKeys, Pressed, sizeof(Pressed));
+}
+
+/**
+ * Host controller callback for each interrupt IN report
+ * @param Data - Report data
+ * @param DataLength - Report length in bytes
+ * @param Context - HID device state
+ * @param Result - EFI_USB_NOERROR or transfer error bits
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+HidReportCallback(
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN VOID *Context,
+    IN UINT32 Result
+)
+{
+    USB_HID_DEVICE *Hid;
+    CONST UINT8 *Report;
+    UINTN Length;
+    UINT8 ReportId;
+
+    Hid = (USB_HID_DEVICE *)Context;
+    if (Hid == NULL || !Hid->Active) {
+        return EFI_SUCCESS;
+    }
+
+    if (Result != EFI_USB_NOERROR) {
+        // Polling is restarted from usb_hid_read_key, outside this callback
+        Hid->Errors++;
+        Hid->NeedsRestart = TRUE;
+        if (mKeyEvent != NULL) {
+            gBS->SignalEvent(mKeyEvent);
+        }
+        return EFI_DEVICE_ERROR;
+    }
+
+    if (Data == NULL || DataLength == 0) {
+        return EFI_SUCCESS;
+    }
+
+    Report = (CONST UINT8 *)Data;
+    Length = MIN(DataLength, USB_HID_MAX_REPORT_SIZE);
+    ReportId = 0;
+    if (Hid->UsesReportIds) {
+        ReportId = Report[0];
+        Report++;
+        Length--;
+    }
+
+    Hid->Reports++;
+    metrics_count(mInterruptMetric, DataLength);
+    CopyMemory(Hid->LastReport, Data, MIN(DataLength, USB_HID_MAX_REPORT_SIZE));
+    Hid->LastReportLength = MIN(DataLength, USB_HID_MAX_REPORT_SIZE);
+
+    if (Hid->KeyArrayField != HID_NO_FIELD) {
+        HidDecodeKeyboard(Hid, ReportId, Report, Length);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Issue a HID class or standard request on the interface
+ * @param UsbIo - USB I/O protocol
+ * @param RequestType - bmRequestType
+ * @param Request - bRequest
+ * @param Value - wValue
+ * @param Index - wIndex
+ * @param Direction - Data stage direction
+ * @param Data - Data buffer, or NULL
+ * @param Length - Data length
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+HidControl(
+    IN EFI_USB_IO_PROTOCOL *UsbIo,
+    IN UINT8 RequestType,
+    IN UINT8 Request,
+    IN UINT16 Value,
+    IN UINT16 Index,
+    IN EFI_USB_DATA_DIRECTION Direction,
+    IN OUT VOID *Data OPTIONAL,
+    IN UINT16 Length
+)
+{
+    EFI_USB_DEVICE_REQUEST DeviceRequest;
+    UINT32 TransferStatus;
+
+    DeviceRequest.RequestType = RequestType;
+    DeviceRequest.Request = Request;
+    DeviceRequest.Value = Value;
+    DeviceRequest.Index = Index;
+    DeviceRequest.Length = Length;
+
+    return UsbIo->UsbControlTransfer(
+        UsbIo,
+        &DeviceRequest,
+        Direction,
+        USB_CONTROL_TIMEOUT,
+        Data,
+        Length,
+        &TransferStatus
+    );
+}
+
+/**
+ * Read and compile the report layout of a HID interface
+ * @param Info - Device information
+ * @param Hid - HID device state to fill
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+HidLoadReportLayout(
+    IN CONST USB_DEVICE_INFO *Info,
+    IN OUT USB_HID_DEVICE *Hid
+)
+{
+    EFI_STATUS Status;
+    UINT8 HidDescriptor[9];
+    UINT8 Protocol;
+    UINT8 *Descriptor;
+    UINT16 DescriptorLength;
+    UINTN Index;
+
+    // Boot devices may have been left in boot protocol by the BIOS
+    if (Info->InterfaceSubClass == USB_HID_SUBCLASS_BOOT) {
+        Status = HidControl(Info->UsbIo, USB_REQ_TYPE_CLASS | USB_DIR_IN | USB_RECIPIENT_INTERFACE,
+                            USB_HID_REQ_GET_PROTOCOL, 0, Info->InterfaceNumber, EfiUsbDataIn, &Protocol, 1);
+        if (!EFI_ERROR(Status) && Protocol == USB_HID_BOOT_PROTOCOL) {
+            if (Info->InterfaceProtocol == USB_HID_PROTOCOL_KEYBOARD) {
+                return usb_hid_compile_report_descriptor(mBootKeyboardDescriptor, sizeof(mBootKeyboardDescriptor),
+                                                         Hid->Fields, USB_HID_MAX_FIELDS, &Hid->FieldCount);
+            }
+            if (Info->InterfaceProtocol == USB_HID_PROTOCOL_MOUSE) {
+                return usb_hid_compile_report_descriptor(mBootMouseDescriptor, sizeof(mBootMouseDescriptor),
+                                                         Hid->Fields, USB_HID_MAX_FIELDS, &Hid->FieldCount);
+            }
+        }
+    }
+
+    Status = HidControl(Info->UsbIo, USB_REQ_TYPE_STANDARD | USB_DIR_IN | USB_RECIPIENT_INTERFACE,
+                        USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_HID << 8, Info->InterfaceNumber,
+                        EfiUsbDataIn, HidDescriptor, sizeof(HidDescriptor));
+    CHECK_STATUS(Status, "Failed to read HID descriptor");
+
+    // bNumDescriptors entries of (bDescriptorType, wDescriptorLength) from offset 6
+    DescriptorLength = 0;
+    for (Index = 6; Index + 3 <= MIN(HidDescriptor[0], sizeof(HidDescriptor)); Index += 3) {
+        if (HidDescriptor[Index] == USB_DESC_TYPE_HID_REPORT) {
+            DescriptorLength = ReadUnaligned16((UINT16 *)&HidDescriptor[Index + 1]);
+            break;
+        }
+    }
+
+    if (DescriptorLength == 0 || DescriptorLength > USB_HID_MAX_REPORT_DESCRIPTOR) {
+        LOG_WARN("HID report descriptor length %d not supported\n", DescriptorLength);
+        return EFI_UNSUPPORTED;
+    }
+
+    Descriptor = memory_pool_alloc(DescriptorLength);
+    CHECK_NULL(Descriptor, EFI_OUT_OF_RESOURCES);
+
+    Status = HidControl(Info->UsbIo, USB_REQ_TYPE_STANDARD | USB_DIR_IN | USB_RECIPIENT_INTERFACE,
+                        USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_HID_REPORT << 8, Info->InterfaceNumber,
+                        EfiUsbDataIn, Descriptor, DescriptorLength);
+    if (!EFI_ERROR(Status)) {
+        Status = usb_hid_compile_report_descriptor(Descriptor, DescriptorLength,
+                                                   Hid->Fields, USB_HID_MAX_FIELDS, &Hid->FieldCount);
+    }
+
+    memory_pool_free(Descriptor);
+    return Status;
+}
+
+/**
+ * Compile a HID interface's report layout and start polling it
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - EFI_UNSUPPORTED for HID interfaces without an interrupt IN endpoint
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_attach(
+    IN UINTN DeviceId
+)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    USB_HID_DEVICE *Hid;
+    UINTN Index;
+
+    DBG_ENTER();
+
+    if (DeviceId >= MAX_USB_DEVICES || EFI_ERROR(usb_get_device_info(DeviceId, &Info))) {
+        DBG_EXIT_STATUS(EFI_INVALID_PARAMETER);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Hid = &mHidDevices[DeviceId];
+    ZeroMemory(Hid, sizeof(USB_HID_DEVICE));
+    Hid->DeviceId = DeviceId;
+    Hid->ModifierField = HID_NO_FIELD;
+    Hid->KeyArrayField = HID_NO_FIELD;
+
+    if (Info.InterfaceClass != USB_CLASS_HID || Info.InterruptInEndpoint == 0 || Info.UsbIo == NULL) {
+        DBG_EXIT_STATUS(EFI_UNSUPPORTED);
+        return EFI_UNSUPPORTED;
+    }
+
+    Status = HidLoadReportLayout(&Info, Hid);
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+        LOG_WARN("HID device %d has more than %d input fields; extra fields ignored\n",
+                 DeviceId, USB_HID_MAX_FIELDS);
+    } else if (EFI_ERROR(Status)) {
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+
+    for (Index = 0; Index < Hid->FieldCount; Index++) {
+        if (Hid->Fields[Index].ReportId != 0) {
+            Hid->UsesReportIds = TRUE;
+        }
+        if (Hid->Fields[Index].UsagePage != USB_HID_PAGE_KEYBOARD) {
+            continue;
+        }
+        if ((Hid->Fields[Index].Flags & USB_HID_FIELD_ARRAY) != 0) {
+            if (Hid->KeyArrayField == HID_NO_FIELD && Hid->Fields[Index].BitSize <= 8) {
+                Hid->KeyArrayField = (UINT8)Index;
+            }
+        } else if (Hid->Fields[Index].Usage == USB_HID_KEY_LEFT_CTRL && Hid->Fields[Index].BitSize == 1 &&
+                   Hid->Fields[Index].Count == 8 && Hid->ModifierField == HID_NO_FIELD) {
+            Hid->ModifierField = (UINT8)Index;
+        }
+    }
+
+    // Only report changes; devices that do not support SET_IDLE stall it
+    HidControl(Info.UsbIo, USB_REQ_TYPE_CLASS | USB_DIR_OUT | USB_RECIPIENT_INTERFACE,
+               USB_HID_REQ_SET_IDLE, 0, Info.InterfaceNumber, EfiUsbNoData, NULL, 0);
+
+    Hid->Handle = Info.Handle;
+    Hid->Active = TRUE;
+
+    Status = usb_interrupt_start(DeviceId, HidReportCallback, Hid);
+    if (EFI_ERROR(Status)) {
+        // Typically the firmware's own HID driver already polls the endpoint
+        Hid->Active = FALSE;
+        DBG_EXIT_STATUS(Status);
+        return Status;
+    }
+
+    LOG_INFO("HID device %d: %d compiled fields%s, polled every %d ms\n", DeviceId, Hid->FieldCount,
+             (Hid->KeyArrayField != HID_NO_FIELD) ? L" (keyboard)" : L"", MAX(Info.InterruptInInterval, 1));
+
+    DBG_EXIT_STATUS(EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the event signaled when HID keyboards have keys buffered
+ * @return EFI_EVENT - Waitable event, or NULL before usb_hid_init
+ */
+EFI_EVENT
+EFIAPI
+usb_hid_get_key_event(
+    VOID
+)
+{
+    return mKeyEvent;
+}
+
+/**
+ * Restart polling on devices whose interrupt endpoint reported an error
+ */
+STATIC
+VOID
+HidRecoverDevices(
+    VOID
+)
+{
+    USB_DEVICE_INFO Info;
+    UINTN DeviceId;
+    USB_HID_DEVICE *Hid;
+
+    for (DeviceId = 0; DeviceId < MAX_USB_DEVICES; DeviceId++) {
+        Hid = &mHidDevices[DeviceId];
+        if (!Hid->NeedsRestart) {
+            continue;
+        }
+        Hid->NeedsRestart = FALSE;
+
+        if (EFI_ERROR(usb_get_device_info(DeviceId, &Info)) || !Info.IsConnected || Info.Handle != Hid->Handle) {
+            Hid->Active = FALSE;
+            continue;
+        }
+
+        usb_interrupt_stop(DeviceId);
+        HidControl(Info.UsbIo, USB_REQ_TYPE_STANDARD | USB_DIR_OUT | USB_RECIPIENT_ENDPOINT,
+                   USB_REQ_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, Info.InterruptInEndpoint,
+                   EfiUsbNoData, NULL, 0);
+        ZeroMemory(Hid->PressedKeys, sizeof(Hid->PressedKeys));
+
+        if (EFI_ERROR(usb_interrupt_start(DeviceId, HidReportCallback, Hid))) {
+            LOG_WARN("HID device %d stopped after interrupt errors\n", DeviceId);
+            Hid->Active = FALSE;
+        }
+    }
+}
+
+/**
+ * Take the oldest buffered key press from any HID keyboard
+ * @details Also restarts polling on devices that reported transfer errors,
+ *          which cannot be done from the host controller callback.
+ * @param Key - Pointer to receive the key
+ * @return EFI_STATUS - EFI_NOT_READY if no key is buffered
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_read_key(
+    OUT EFI_INPUT_KEY *Key
+)
+{
+    EFI_TPL OldTpl;
+    EFI_STATUS Status;
+
+    if (Key == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    HidRecoverDevices();
+
+    // Async interrupt callbacks run at TPL_NOTIFY
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    if (mKeyCount == 0) {
+        Status = EFI_NOT_READY;
+    } else {
+        CopyMemory(Key, &mKeyBuffer[mKeyHead], sizeof(EFI_INPUT_KEY));
+        mKeyHead = (mKeyHead + 1) % USB_HID_KEY_BUFFER_SIZE;
+        mKeyCount--;
+        Status = EFI_SUCCESS;
+    }
+    gBS->RestoreTPL(OldTpl);
+
+    return Status;
+}
+
+/**
+ * Decode one usage from the last report a device sent
+ * @param DeviceId - Device identifier
+ * @param UsagePage - Usage page
+ * @param Usage - Usage within the page
+ * @param Value - Pointer to receive the value; sign-extended for signed fields
+ * @return EFI_STATUS - EFI_NOT_FOUND if no field carries the usage
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_get_usage_value(
+    IN UINTN DeviceId,
+    IN UINT16 UsagePage,
+    IN UINT16 Usage,
+    OUT INT32 *Value
+)
+{
+    EFI_TPL OldTpl;
+    USB_DEVICE_INFO Info;
+    USB_HID_DEVICE *Hid;
+    CONST USB_HID_FIELD *Field;
+    UINT8 Report[USB_HID_MAX_REPORT_SIZE];
+    UINTN Length;
+    UINTN Index;
+    UINTN Slot;
+    UINT32 Raw;
+    UINT8 ReportId;
+    CONST UINT8 *Payload;
+
+    if (DeviceId >= MAX_USB_DEVICES || Value == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // A slot reused by another device must not report the old one's state
+    Hid = &mHidDevices[DeviceId];
+    if (Hid->Handle == NULL || EFI_ERROR(usb_get_device_info(DeviceId, &Info)) ||
+        !Info.IsConnected || Info.Handle != Hid->Handle) {
+        return EFI_NOT_STARTED;
+    }
+
+    OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+    Length = Hid->LastReportLength;
+    CopyMemory(Report, Hid->LastReport, Length);
+    gBS->RestoreTPL(OldTpl);
+
+    if (Length == 0 || (Hid->UsesReportIds && Length < 2)) {
+        return EFI_NOT_READY;
+    }
+
+    ReportId = Hid->UsesReportIds ? Report[0] : 0;
+    Payload = Hid->UsesReportIds ? Report + 1 : Report;
+    if (Hid->UsesReportIds) {
+        Length--;
+    }
+
+    for (Index = 0; Index < Hid->FieldCount; Index++) {
+        Field = &Hid->Fields[Index];
+        if (Field->UsagePage != UsagePage) {
+            continue;
+        }
+
+        if ((Field->Flags & USB_HID_FIELD_ARRAY) != 0) {
+            // Array usages read as 1 while listed in any slot
+            if (Field->ReportId != ReportId) {
+                continue;
+            }
+            for (Slot = 0; Slot < Field->Count; Slot++) {
+                Raw = HidExtractBits(Payload, Length, Field->BitOffset + Slot * Field->BitSize, Field->BitSize);
+                if (Field->Usage + (INT32)Raw - Field->LogicalMinimum == Usage) {
+                    *Value = 1;
+                    return EFI_SUCCESS;
+                }
+            }
+            continue;
+        }
+
+        if (Usage < Field->Usage || Usage >= Field->Usage + Field->Count) {
+            continue;
+        }
+
+        if (Field->ReportId != ReportId) {
+            // The usage lives in a report the device has not sent last
+            return EFI_NOT_READY;
+        }
+
+        Raw = HidExtractBits(Payload, Length, Field->BitOffset + (Usage - Field->Usage) * Field->BitSize,
+                             Field->BitSize);
+        if ((Field->Flags & USB_HID_FIELD_SIGNED) != 0 && Field->BitSize < 32 &&
+            (Raw & (1U << (Field->BitSize - 1))) != 0) {
+            Raw |= ~((1U << Field->BitSize) - 1);
+        }
+        *Value = (INT32)Raw;
+        return EFI_SUCCESS;
+    }
+
+    // A key array that does not list the usage means the key is up
+    for (Index = 0; Index < Hid->FieldCount; Index++) {
+        if (Hid->Fields[Index].UsagePage == UsagePage && (Hid->Fields[Index].Flags & USB_HID_FIELD_ARRAY) != 0 &&
+            Hid->Fields[Index].ReportId == ReportId) {
+            *Value = 0;
+            return EFI_SUCCESS;
+        }
+    }
+
+    return EFI_NOT_FOUND;
+}
+
+/**
+ * Print the compiled layout and report counters of every HID device
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_status(
+    VOID
+)
+{
+    UINTN DeviceId;
+    USB_HID_DEVICE *Hid;
+
+    for (DeviceId = 0; DeviceId < MAX_USB_DEVICES; DeviceId++) {
+        Hid = &mHidDevices[DeviceId];
+        if (Hid->Handle == NULL) {
+            continue;
+        }
+        DEBUG((EFI_D_INFO, "  HID device %d: %s, %d fields, %d reports, %d errors%s\n",
+               DeviceId, Hid->Active ? L"polling" : L"stopped", Hid->FieldCount, Hid->Reports, Hid->Errors,
+               (Hid->KeyArrayField != HID_NO_FIELD) ? L", keyboard" : L""));
+    }
+
+    if (mKeysDropped != 0) {
+        DEBUG((EFI_D_INFO, "  HID keys dropped: %d\n", mKeysDropped));
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Release the key event and forget every HID device
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_cleanup(
+    VOID
+)
+{
+    if (mKeyEvent != NULL) {
+        gBS->CloseEvent(mKeyEvent);
+        mKeyEvent = NULL;
+    }
+
+    ZeroMemory(mHidDevices, sizeof(mHidDevices));
+    mKeyHead = 0;
+    mKeyCount = 0;
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file usb_hid.h
+ * @brief USB HID report descriptor compiler and interrupt-driven input
+ */
+
+#ifndef _USB_HID_H_
+#define _USB_HID_H_
+
+#include <Uefi.h>
+#include "usb_driver.h"
+
+//
+// HID Class Definitions
+//
+#define USB_HID_SUBCLASS_BOOT       0x01
+#define USB_HID_PROTOCOL_KEYBOARD   0x01
+#define USB_HID_PROTOCOL_MOUSE      0x02
+
+#define USB_DESC_TYPE_HID           0x21
+#define USB_DESC_TYPE_HID_REPORT    0x22
+
+#define USB_HID_REQ_GET_PROTOCOL    0x03
+#define USB_HID_REQ_SET_IDLE        0x0A
+
+#define USB_HID_BOOT_PROTOCOL       0x00
+
+//
+// Usage Pages
+//
+#define USB_HID_PAGE_GENERIC_DESKTOP 0x01
+#define USB_HID_PAGE_KEYBOARD       0x07
+#define USB_HID_PAGE_BUTTON         0x09
+
+#define USB_HID_KEY_LEFT_CTRL       0xE0
+#define USB_HID_KEY_LEFT_SHIFT      0xE1
+#define USB_HID_KEY_RIGHT_SHIFT     0xE5
+
+//
+// Compiled report field
+// A variable entry covers Count fields of BitSize bits laid out back to
+// back, with consecutive usages starting at Usage. An array entry covers
+// Count slots, each holding a usage index relative to LogicalMinimum.
+//
+typedef struct {
+    UINT16 BitOffset;                   // From the first byte after the report id
+    UINT8 BitSize;                      // 1-32
+    UINT8 Count;
+    UINT16 UsagePage;
+    UINT16 Usage;
+    INT32 LogicalMinimum;
+    UINT8 ReportId;                     // 0 when the device uses no report ids
+    UINT8 Flags;
+} USB_HID_FIELD;
+
+#define USB_HID_FIELD_ARRAY         BIT0
+#define USB_HID_FIELD_SIGNED        BIT1
+
+//
+// Function Prototypes
+//
+
+/**
+ * Create the key event; called once by usb_driver_init
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_init(
+    VOID
+    );
+
+/**
+ * Compile a HID interface's report layout and start polling it
+ * @details The report descriptor is read and compiled into a field table
+ *          once; each report delivered by the host controller at the
+ *          endpoint interval is then decoded from that table.
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - EFI_UNSUPPORTED for HID interfaces without an interrupt IN endpoint
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_attach(
+    IN UINTN DeviceId
+    );
+
+/**
+ * Get the event signaled when HID keyboards have keys buffered
+ * @return EFI_EVENT - Waitable event, or NULL before usb_hid_init
+ */
+EFI_EVENT
+EFIAPI
+usb_hid_get_key_event(
+    VOID
+    );
+
+/**
+ * Take the oldest buffered key press from any HID keyboard
+ * @param Key - Pointer to receive the key
+ * @return EFI_STATUS - EFI_NOT_READY if no key is buffered
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_read_key(
+    OUT EFI_INPUT_KEY *Key
+    );
+
+/**
+ * Decode one usage from the last report a device sent
+ * @param DeviceId - Device identifier
+ * @param UsagePage - Usage page
+ * @param Usage - Usage within the page
+ * @param Value - Pointer to receive the value; sign-extended for signed fields
+ * @return EFI_STATUS - EFI_NOT_FOUND if no field carries the usage
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_get_usage_value(
+    IN UINTN DeviceId,
+    IN UINT16 UsagePage,
+    IN UINT16 Usage,
+    OUT INT32 *Value
+    );
+
+/**
+ * Compile a report descriptor into a field table
+ * @param Descriptor - Report descriptor
+ * @param Length - Descriptor length in bytes
+ * @param Fields - Table to fill
+ * @param MaxFields - Table capacity
+ * @param FieldCount - Pointer to receive the number of entries used
+ * @return EFI_STATUS - EFI_BUFFER_TOO_SMALL if the table overflowed
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_compile_report_descriptor(
+    IN CONST UINT8 *Descriptor,
+    IN UINTN Length,
+    OUT USB_HID_FIELD *Fields,
+    IN UINTN MaxFields,
+    OUT UINTN *FieldCount
+    );
+
+/**
+ * Print the compiled layout and report counters of every HID device
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_status(
+    VOID
+    );
+
+/**
+ * Release the key event and forget every HID device
+ * @details Interrupt polling itself is stopped by usb_driver_cleanup.
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_hid_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+UINT32
+HidExtractBits(
+    IN CONST UINT8 *Report,
+    IN UINTN Length,
+    IN UINTN BitOffset,
+    IN UINTN BitSize
+    );
+
+STATIC
+EFI_STATUS
+EFIAPI
+HidReportCallback(
+    IN VOID *Data,
+    IN UINTN DataLength,
+    IN VOID *Context,
+    IN UINT32 Result
+    );
+
+#endif // _USB_HID_H_
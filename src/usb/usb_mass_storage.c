@@ -0,0 +1,573 @@
+/**
+ * @file usb_mass_storage.c
+ * @brief USB mass storage Bulk-Only Transport and SCSI block reads
+ *
+ * BOT allows one command per LUN at a time: the CSW of a command must be
+ * read before the next CBW is sent, so commands cannot overlap. Per-command
+ * overhead is kept small instead by moving USB_MSC_MAX_TRANSFER_SIZE bytes
+ * per CBW, reading the data phase straight into the caller's buffer.
+ * The CBW and CSW themselves live in a pre-mapped DMA page per device, so
+ * the two small transfers of every command never need a bounce buffer.
+ *
+ * UAS would allow queued commands, but it needs bulk streams on SuperSpeed
+ * and EFI_USB_IO_PROTOCOL has no way to name a stream id. UAS devices also
+ * offer BOT in alternate setting 0, which is the setting the bus driver
+ * selects, so such devices are driven over BOT with SuperSpeed bursts.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "usb_mass_storage.h"
+#include "usb_dma.h"
+#include "../../include/common.h"
+#include "../../include/config.h"
+#include "../../include/debug_utils.h"
+
+//
+// Per-device transport state, indexed by USB device id
+//
+typedef struct {
+    EFI_HANDLE Handle;                  // UsbIo handle the state belongs to
+    UINT32 Tag;
+    UINT8 Lun;
+    BOOLEAN Ready;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    USB_BOT_CBW *Cbw;                   // In CommandPage, or CbwBuffer without one
+    USB_BOT_CSW *Csw;
+    VOID *CommandPage;                  // usb_dma slice, NULL if DMA is unavailable
+    USB_BOT_CBW CbwBuffer;
+    USB_BOT_CSW CswBuffer;
+} USB_MSC_DEVICE;
+
+STATIC USB_MSC_DEVICE mMscDevices[MAX_USB_DEVICES];
+
+/**
+ * Get the transport state of a device, checking it is still the same device
+ * @param DeviceId - Device identifier
+ * @param Info - Pointer to receive the device information
+ * @return USB_MSC_DEVICE* - State, or NULL if the device is not attached
+ */
+STATIC
+USB_MSC_DEVICE *
+MscLookup(
+    IN UINTN DeviceId,
+    OUT USB_DEVICE_INFO *Info
+)
+{
+    if (DeviceId >= MAX_USB_DEVICES || EFI_ERROR(usb_get_device_info(DeviceId, Info))) {
+        return NULL;
+    }
+
+    // A slot reused by another device must not inherit the old state
+    if (!Info->IsConnected || Info->UsbIo == NULL ||
+        mMscDevices[DeviceId].Handle == NULL || mMscDevices[DeviceId].Handle != Info->Handle) {
+        return NULL;
+    }
+
+    return &mMscDevices[DeviceId];
+}
+
+/**
+ * Issue a class-specific or standard control request with no data stage
+ * @param UsbIo - USB I/O protocol
+ * @param RequestType - bmRequestType
+ * @param Request - bRequest
+ * @param Value - wValue
+ * @param Index - wIndex
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+MscControlNoData(
+    IN EFI_USB_IO_PROTOCOL *UsbIo,
+    IN UINT8 RequestType,
+    IN UINT8 Request,
+    IN UINT16 Value,
+    IN UINT16 Index
+)
+{
+    EFI_USB_DEVICE_REQUEST DeviceRequest;
+    UINT32 TransferStatus;
+
+    DeviceRequest.RequestType = RequestType;
+    DeviceRequest.Request = Request;
+    DeviceRequest.Value = Value;
+    DeviceRequest.Index = Index;
+    DeviceRequest.Length = 0;
+
+    return UsbIo->UsbControlTransfer(
+        UsbIo,
+        &DeviceRequest,
+        EfiUsbNoData,
+        USB_CONTROL_TIMEOUT,
+        NULL,
+        0,
+        &TransferStatus
+    );
+}
+
+/**
+ * Bulk-Only Mass Storage Reset followed by clearing both bulk halts
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+BotResetRecovery(
+    IN UINTN DeviceId
+)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+
+    Status = usb_get_device_info(DeviceId, &Info);
+    if (EFI_ERROR(Status) || Info.UsbIo == NULL) {
+        return EFI_NOT_READY;
+    }
+
+    LOG_WARN("Mass storage device %d: reset recovery\n", DeviceId);
+
+    Status = MscControlNoData(
+        Info.UsbIo,
+        USB_REQ_TYPE_CLASS | USB_DIR_OUT | USB_RECIPIENT_INTERFACE,
+        USB_MSC_REQ_RESET,
+        0,
+        Info.InterfaceNumber
+    );
+
+    MscControlNoData(Info.UsbIo, USB_REQ_TYPE_STANDARD | USB_DIR_OUT | USB_RECIPIENT_ENDPOINT,
+                     USB_REQ_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, Info.BulkInEndpoint);
+    MscControlNoData(Info.UsbIo, USB_REQ_TYPE_STANDARD | USB_DIR_OUT | USB_RECIPIENT_ENDPOINT,
+                     USB_REQ_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, Info.BulkOutEndpoint);
+
+    return Status;
+}
+
+/**
+ * Run one command through the CBW, data and CSW phases
+ * @param DeviceId - Device identifier
+ * @param Cb - SCSI command block
+ * @param CbLength - Command block length (1..16)
+ * @param Direction - EfiUsbDataIn, EfiUsbDataOut or EfiUsbNoData
+ * @param Data - Data buffer for the data phase
+ * @param DataLength - Data phase length in bytes
+ * @param Transferred - Optional pointer to receive the bytes the device moved
+ * @return EFI_STATUS - EFI_DEVICE_ERROR if the device reports failure
+ */
+STATIC
+EFI_STATUS
+BotCommand(
+    IN UINTN DeviceId,
+    IN CONST UINT8 *Cb,
+    IN UINT8 CbLength,
+    IN EFI_USB_DATA_DIRECTION Direction,
+    IN OUT VOID *Data OPTIONAL,
+    IN UINT32 DataLength,
+    OUT UINT32 *Transferred OPTIONAL
+)
+{
+    EFI_STATUS Status;
+    EFI_STATUS DataStatus;
+    USB_DEVICE_INFO Info;
+    USB_MSC_DEVICE *Msc;
+    USB_BOT_CBW *Cbw;
+    USB_BOT_CSW *Csw;
+    UINTN Length;
+    UINTN DataMoved;
+    UINT32 Reported;
+
+    Msc = MscLookup(DeviceId, &Info);
+    if (Msc == NULL || Cb == NULL || CbLength == 0 || CbLength > sizeof(Msc->Cbw->Cb) ||
+        (DataLength != 0 && Data == NULL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Cbw = Msc->Cbw;
+    Csw = Msc->Csw;
+
+    ZeroMemory(Cbw, sizeof(USB_BOT_CBW));
+    Cbw->Signature = USB_BOT_CBW_SIGNATURE;
+    Cbw->Tag = ++Msc->Tag;
+    Cbw->DataTransferLength = DataLength;
+    Cbw->Flags = (Direction == EfiUsbDataIn) ? USB_BOT_CBW_FLAG_IN : 0;
+    Cbw->Lun = Msc->Lun;
+    Cbw->CbLength = CbLength;
+    CopyMemory(Cbw->Cb, Cb, CbLength);
+
+    Length = sizeof(USB_BOT_CBW);
+    Status = usb_bulk_transfer(DeviceId, EfiUsbDataOut, Cbw, &Length);
+    if (EFI_ERROR(Status) || Length != sizeof(USB_BOT_CBW)) {
+        BotResetRecovery(DeviceId);
+        return EFI_ERROR(Status) ? Status : EFI_DEVICE_ERROR;
+    }
+
+    // The data phase lands directly in the caller's buffer. A stall here is
+    // cleared by usb_bulk_transfer and the CSW still follows.
+    DataStatus = EFI_SUCCESS;
+    DataMoved = 0;
+    if (DataLength != 0 && Direction != EfiUsbNoData) {
+        DataMoved = DataLength;
+        DataStatus = usb_bulk_transfer(DeviceId, Direction, Data, &DataMoved);
+    }
+
+    ZeroMemory(Csw, sizeof(USB_BOT_CSW));
+    Length = sizeof(USB_BOT_CSW);
+    Status = usb_bulk_transfer(DeviceId, EfiUsbDataIn, Csw, &Length);
+    if (EFI_ERROR(Status)) {
+        // One retry after the halt on the IN endpoint has been cleared
+        Length = sizeof(USB_BOT_CSW);
+        Status = usb_bulk_transfer(DeviceId, EfiUsbDataIn, Csw, &Length);
+    }
+
+    if (EFI_ERROR(Status) || Length != sizeof(USB_BOT_CSW) ||
+        Csw->Signature != USB_BOT_CSW_SIGNATURE || Csw->Tag != Cbw->Tag ||
+        Csw->Status == USB_BOT_CSW_PHASE_ERROR) {
+        LOG_ERROR("Mass storage device %d: bad CSW for op 0x%02X (%r, status %d)\n",
+                  DeviceId, Cb[0], Status, Csw->Status);
+        BotResetRecovery(DeviceId);
+        return EFI_DEVICE_ERROR;
+    }
+
+    // Some devices report no residue after a short data phase; trust the smaller count
+    if (Transferred != NULL) {
+        Reported = (Csw->DataResidue <= DataLength) ? DataLength - Csw->DataResidue : 0;
+        *Transferred = (UINT32)MIN((UINTN)Reported, DataMoved);
+    }
+
+    if (Csw->Status != USB_BOT_CSW_PASSED) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    return DataStatus;
+}
+
+/**
+ * Translate the sense data of the last failed command into a status
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - Status matching the sense key
+ */
+STATIC
+EFI_STATUS
+MscRequestSense(
+    IN UINTN DeviceId
+)
+{
+    EFI_STATUS Status;
+    UINT8 Cb[6];
+    UINT8 Sense[18];
+
+    ZeroMemory(Cb, sizeof(Cb));
+    ZeroMemory(Sense, sizeof(Sense));
+    Cb[0] = SCSI_OP_REQUEST_SENSE;
+    Cb[4] = sizeof(Sense);
+
+    Status = BotCommand(DeviceId, Cb, sizeof(Cb), EfiUsbDataIn, Sense, sizeof(Sense), NULL);
+    if (EFI_ERROR(Status)) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    switch (Sense[2] & 0x0F) {
+        case SCSI_SENSE_NOT_READY:
+            return EFI_NOT_READY;
+        case SCSI_SENSE_UNIT_ATTENTION:
+            return EFI_MEDIA_CHANGED;
+        case SCSI_SENSE_MEDIUM_ERROR:
+            return EFI_DEVICE_ERROR;
+        default:
+            return (Sense[2] & 0x0F) == 0 ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+    }
+}
+
+/**
+ * Bring the unit ready and read its capacity on first use
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - Success or error code
+ */
+STATIC
+EFI_STATUS
+MscEnsureReady(
+    IN UINTN DeviceId
+)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    USB_MSC_DEVICE *Msc;
+    UINT8 Cb[16];
+    UINT8 Capacity[32];
+    UINTN Attempt;
+
+    Msc = MscLookup(DeviceId, &Info);
+    if (Msc == NULL) {
+        return EFI_NOT_READY;
+    }
+
+    if (Msc->Ready) {
+        return EFI_SUCCESS;
+    }
+
+    // Sticks commonly report a unit attention or not-ready right after reset
+    Status = EFI_NOT_READY;
+    for (Attempt = 0; Attempt < USB_MSC_READY_RETRIES; Attempt++) {
+        ZeroMemory(Cb, sizeof(Cb));
+        Cb[0] = SCSI_OP_TEST_UNIT_READY;
+        Status = BotCommand(DeviceId, Cb, 6, EfiUsbNoData, NULL, 0, NULL);
+        if (Status == EFI_DEVICE_ERROR) {
+            Status = MscRequestSense(DeviceId);
+        }
+        if (!EFI_ERROR(Status)) {
+            break;
+        }
+        gBS->Stall(USB_MSC_READY_DELAY);
+    }
+    CHECK_STATUS(Status, "Mass storage unit not ready");
+
+    ZeroMemory(Cb, sizeof(Cb));
+    ZeroMemory(Capacity, sizeof(Capacity));
+    Cb[0] = SCSI_OP_READ_CAPACITY_10;
+    Status = BotCommand(DeviceId, Cb, 10, EfiUsbDataIn, Capacity, 8, NULL);
+    CHECK_STATUS(Status, "READ CAPACITY(10) failed");
+
+    Msc->BlockCount = (UINT64)SwapBytes32(ReadUnaligned32((UINT32 *)Capacity)) + 1;
+    Msc->BlockSize = SwapBytes32(ReadUnaligned32((UINT32 *)(Capacity + 4)));
+
+    // 0xFFFFFFFF means the last LBA does not fit; ask again with READ CAPACITY(16)
+    if (Msc->BlockCount == 0x100000000ULL) {
+        ZeroMemory(Cb, sizeof(Cb));
+        Cb[0] = SCSI_OP_SERVICE_ACTION_IN;
+        Cb[1] = SCSI_SA_READ_CAPACITY_16;
+        Cb[13] = sizeof(Capacity);
+        Status = BotCommand(DeviceId, Cb, 16, EfiUsbDataIn, Capacity, sizeof(Capacity), NULL);
+        CHECK_STATUS(Status, "READ CAPACITY(16) failed");
+
+        Msc->BlockCount = SwapBytes64(ReadUnaligned64((UINT64 *)Capacity)) + 1;
+        Msc->BlockSize = SwapBytes32(ReadUnaligned32((UINT32 *)(Capacity + 8)));
+    }
+
+    if (Msc->BlockSize == 0 || Msc->BlockSize > USB_MSC_MAX_TRANSFER_SIZE) {
+        LOG_ERROR("Mass storage device %d reports unusable block size %d\n", DeviceId, Msc->BlockSize);
+        return EFI_UNSUPPORTED;
+    }
+
+    Msc->Ready = TRUE;
+    LOG_INFO("Mass storage device %d: %ld blocks of %d bytes\n", DeviceId, Msc->BlockCount, Msc->BlockSize);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Start tracking a mass storage interface
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - EFI_UNSUPPORTED unless the interface is SCSI over BOT
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_attach(
+    IN UINTN DeviceId
+)
+{
+    USB_DEVICE_INFO Info;
+    USB_MSC_DEVICE *Msc;
+
+    if (DeviceId >= MAX_USB_DEVICES || EFI_ERROR(usb_get_device_info(DeviceId, &Info))) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // The slot may have belonged to a device that went away
+    if (mMscDevices[DeviceId].CommandPage != NULL) {
+        usb_dma_free(mMscDevices[DeviceId].CommandPage);
+    }
+    ZeroMemory(&mMscDevices[DeviceId], sizeof(USB_MSC_DEVICE));
+
+    if (Info.InterfaceClass != USB_CLASS_MASS_STORAGE ||
+        Info.InterfaceSubClass != USB_MSC_SUBCLASS_SCSI ||
+        Info.InterfaceProtocol != USB_MSC_PROTOCOL_BOT ||
+        Info.BulkInEndpoint == 0 || Info.BulkOutEndpoint == 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    if (Info.UasCapable) {
+        LOG_INFO("Mass storage device %d supports UAS; using BOT (UsbIo has no bulk streams)\n", DeviceId);
+    }
+
+    Msc = &mMscDevices[DeviceId];
+    Msc->Cbw = &Msc->CbwBuffer;
+    Msc->Csw = &Msc->CswBuffer;
+    if (!EFI_ERROR(usb_dma_alloc(DeviceId, EFI_PAGE_SIZE, &Msc->CommandPage, NULL))) {
+        Msc->Cbw = (USB_BOT_CBW *)Msc->CommandPage;
+        Msc->Csw = (USB_BOT_CSW *)((UINT8 *)Msc->CommandPage + USB_MSC_CSW_OFFSET);
+    }
+
+    Msc->Handle = Info.Handle;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the geometry of an attached mass storage device
+ * @param DeviceId - Device identifier
+ * @param BlockSize - Pointer to receive the logical block size
+ * @param BlockCount - Pointer to receive the number of logical blocks
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_get_capacity(
+    IN UINTN DeviceId,
+    OUT UINT32 *BlockSize,
+    OUT UINT64 *BlockCount
+)
+{
+    EFI_STATUS Status;
+
+    if (BlockSize == NULL || BlockCount == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = MscEnsureReady(DeviceId);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    *BlockSize = mMscDevices[DeviceId].BlockSize;
+    *BlockCount = mMscDevices[DeviceId].BlockCount;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Get the CBW buffer of an attached mass storage device
+ * @param DeviceId - Device identifier
+ * @param Cbw - Pointer to receive the buffer CBWs are built in
+ * @return EFI_STATUS - EFI_NOT_FOUND if the device is not attached
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_get_command_buffer(
+    IN UINTN DeviceId,
+    OUT VOID **Cbw
+)
+{
+    if (DeviceId >= MAX_USB_DEVICES || Cbw == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (mMscDevices[DeviceId].Cbw == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    *Cbw = mMscDevices[DeviceId].Cbw;
+    return EFI_SUCCESS;
+}
+
+/**
+ * Read logical blocks straight into a caller buffer
+ * @param DeviceId - Device identifier
+ * @param Lba - First logical block
+ * @param BlockCount - Number of blocks to read
+ * @param Buffer - Buffer of at least BlockCount * BlockSize bytes
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_read(
+    IN UINTN DeviceId,
+    IN UINT64 Lba,
+    IN UINTN BlockCount,
+    OUT VOID *Buffer
+)
+{
+    EFI_STATUS Status;
+    USB_MSC_DEVICE *Msc;
+    UINT8 Cb[16];
+    UINT8 *Dest;
+    UINTN BlocksPerCommand;
+    UINTN Blocks;
+    UINT32 Transferred;
+
+    if (Buffer == NULL || BlockCount == 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    Status = MscEnsureReady(DeviceId);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Msc = &mMscDevices[DeviceId];
+    if (Lba >= Msc->BlockCount || BlockCount > Msc->BlockCount - Lba) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    BlocksPerCommand = USB_MSC_MAX_TRANSFER_SIZE / Msc->BlockSize;
+    Dest = (UINT8 *)Buffer;
+
+    while (BlockCount > 0) {
+        Blocks = MIN(BlockCount, BlocksPerCommand);
+        ZeroMemory(Cb, sizeof(Cb));
+
+        if (Lba + Blocks > 0x100000000ULL) {
+            Cb[0] = SCSI_OP_READ_16;
+            WriteUnaligned64((UINT64 *)(Cb + 2), SwapBytes64(Lba));
+            WriteUnaligned32((UINT32 *)(Cb + 10), SwapBytes32((UINT32)Blocks));
+            Status = BotCommand(DeviceId, Cb, 16, EfiUsbDataIn, Dest,
+                                (UINT32)(Blocks * Msc->BlockSize), &Transferred);
+        } else {
+            // READ(10) carries at most 0xFFFF blocks
+            Blocks = MIN(Blocks, 0xFFFF);
+            Cb[0] = SCSI_OP_READ_10;
+            WriteUnaligned32((UINT32 *)(Cb + 2), SwapBytes32((UINT32)Lba));
+            WriteUnaligned16((UINT16 *)(Cb + 7), SwapBytes16((UINT16)Blocks));
+            Status = BotCommand(DeviceId, Cb, 10, EfiUsbDataIn, Dest,
+                                (UINT32)(Blocks * Msc->BlockSize), &Transferred);
+        }
+
+        if (Status == EFI_DEVICE_ERROR) {
+            Status = MscRequestSense(DeviceId);
+            if (Status == EFI_MEDIA_CHANGED) {
+                Msc->Ready = FALSE;
+            }
+            if (!EFI_ERROR(Status)) {
+                Status = EFI_DEVICE_ERROR;
+            }
+        }
+
+        if (!EFI_ERROR(Status) && Transferred != Blocks * Msc->BlockSize) {
+            Status = EFI_DEVICE_ERROR;
+        }
+
+        if (EFI_ERROR(Status)) {
+            LOG_ERROR("Mass storage device %d: read of %d blocks at LBA 0x%lx failed: %r\n",
+                      DeviceId, Blocks, Lba, Status);
+            return Status;
+        }
+
+        Dest += Blocks * Msc->BlockSize;
+        Lba += Blocks;
+        BlockCount -= Blocks;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * Forget every mass storage device and return its command page
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_cleanup(
+    VOID
+)
+{
+    UINTN DeviceId;
+
+    for (DeviceId = 0; DeviceId < MAX_USB_DEVICES; DeviceId++) {
+        if (mMscDevices[DeviceId].CommandPage != NULL) {
+            usb_dma_free(mMscDevices[DeviceId].CommandPage);
+        }
+    }
+
+    ZeroMemory(mMscDevices, sizeof(mMscDevices));
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file usb_mass_storage.h
+ * @brief USB mass storage Bulk-Only Transport and SCSI block reads
+ */
+
+#ifndef _USB_MASS_STORAGE_H_
+#define _USB_MASS_STORAGE_H_
+
+#include <Uefi.h>
+#include "usb_driver.h"
+
+//
+// Mass Storage Class Definitions
+//
+#define USB_MSC_SUBCLASS_SCSI       0x06
+#define USB_MSC_PROTOCOL_BOT        0x50
+#define USB_MSC_PROTOCOL_UAS        0x62
+
+#define USB_MSC_REQ_GET_MAX_LUN     0xFE
+#define USB_MSC_REQ_RESET           0xFF
+
+//
+// Bulk-Only Transport Wrappers
+//
+#define USB_BOT_CBW_SIGNATURE       0x43425355  // 'USBC'
+#define USB_BOT_CSW_SIGNATURE       0x53425355  // 'USBS'
+#define USB_BOT_CBW_FLAG_IN         0x80
+
+#define USB_BOT_CSW_PASSED          0x00
+#define USB_BOT_CSW_FAILED          0x01
+#define USB_BOT_CSW_PHASE_ERROR     0x02
+
+#pragma pack(1)
+typedef struct {
+    UINT32 Signature;
+    UINT32 Tag;
+    UINT32 DataTransferLength;
+    UINT8 Flags;
+    UINT8 Lun;
+    UINT8 CbLength;
+    UINT8 Cb[16];
+} USB_BOT_CBW;
+
+typedef struct {
+    UINT32 Signature;
+    UINT32 Tag;
+    UINT32 DataResidue;
+    UINT8 Status;
+} USB_BOT_CSW;
+#pragma pack()
+
+#define USB_MSC_CSW_OFFSET          64      // CSW offset in the per-device command page
+
+//
+// SCSI Operation Codes
+//
+#define SCSI_OP_TEST_UNIT_READY     0x00
+#define SCSI_OP_REQUEST_SENSE       0x03
+#define SCSI_OP_INQUIRY             0x12
+#define SCSI_OP_READ_CAPACITY_10    0x25
+#define SCSI_OP_READ_10             0x28
+#define SCSI_OP_READ_16             0x88
+#define SCSI_OP_SERVICE_ACTION_IN   0x9E
+#define SCSI_SA_READ_CAPACITY_16    0x10
+
+#define SCSI_SENSE_NOT_READY        0x02
+#define SCSI_SENSE_MEDIUM_ERROR     0x03
+#define SCSI_SENSE_UNIT_ATTENTION   0x06
+
+//
+// Function Prototypes
+//
+
+/**
+ * Start tracking a mass storage interface
+ * @details Only records the device; the first read brings the unit ready
+ *          and reads its capacity, so enumeration issues no SCSI commands.
+ * @param DeviceId - Device identifier
+ * @return EFI_STATUS - EFI_UNSUPPORTED unless the interface is SCSI over BOT
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_attach(
+    IN UINTN DeviceId
+    );
+
+/**
+ * Get the geometry of an attached mass storage device
+ * @param DeviceId - Device identifier
+ * @param BlockSize - Pointer to receive the logical block size
+ * @param BlockCount - Pointer to receive the number of logical blocks
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_get_capacity(
+    IN UINTN DeviceId,
+    OUT UINT32 *BlockSize,
+    OUT UINT64 *BlockCount
+    );
+
+/**
+ * Get the CBW buffer of an attached mass storage device
+ * @details The buffer is in the host controller's DMA region when one could
+ *          be mapped, and in the device state otherwise.
+ * @param DeviceId - Device identifier
+ * @param Cbw - Pointer to receive the buffer CBWs are built in
+ * @return EFI_STATUS - EFI_NOT_FOUND if the device is not attached
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_get_command_buffer(
+    IN UINTN DeviceId,
+    OUT VOID **Cbw
+    );
+
+/**
+ * Read logical blocks straight into a caller buffer
+ * @details Each CBW carries up to USB_MSC_MAX_TRANSFER_SIZE bytes; READ(16)
+ *          is used past the 32-bit LBA range, READ(10) otherwise.
+ * @param DeviceId - Device identifier
+ * @param Lba - First logical block
+ * @param BlockCount - Number of blocks to read
+ * @param Buffer - Buffer of at least BlockCount * BlockSize bytes
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_read(
+    IN UINTN DeviceId,
+    IN UINT64 Lba,
+    IN UINTN BlockCount,
+    OUT VOID *Buffer
+    );
+
+/**
+ * Forget every mass storage device and return its command page
+ * @return EFI_STATUS - Success or error code
+ */
+EFI_STATUS
+EFIAPI
+usb_msc_cleanup(
+    VOID
+    );
+
+//
+// Internal Functions
+//
+STATIC
+EFI_STATUS
+BotCommand(
+    IN UINTN DeviceId,
+    IN CONST UINT8 *Cb,
+    IN UINT8 CbLength,
+    IN EFI_USB_DATA_DIRECTION Direction,
+    IN OUT VOID *Data OPTIONAL,
+    IN UINT32 DataLength,
+    OUT UINT32 *Transferred OPTIONAL
+    );
+
+STATIC
+EFI_STATUS
+BotResetRecovery(
+    IN UINTN DeviceId
+    );
+
+STATIC
+EFI_STATUS
+MscEnsureReady(
+    IN UINTN DeviceId
+    );
+
+#endif // _USB_MASS_STORAGE_H_
@@ -32,6 +32,7 @@
 #define USB_DESC_TYPE_STRING        0x03
 #define USB_DESC_TYPE_INTERFACE     0x04
 #define USB_DESC_TYPE_ENDPOINT      0x05
+#define USB_DESC_TYPE_SS_ENDPOINT_COMPANION 0x30
 
 // USB Device Classes
 #define USB_CLASS_AUDIO             0x01
@@ -106,4 +107,16 @@ typedef struct {
 } USB_ENDPOINT_DESCRIPTOR;
 #pragma pack()
 
+// SuperSpeed endpoint companion; follows each endpoint descriptor of a
+// device operating at SuperSpeed
+#pragma pack(1)
+typedef struct {
+    UINT8   Length;
+    UINT8   DescriptorType;
+    UINT8   MaxBurst;           // Packets per burst minus one (0-15)
+    UINT8   Attributes;         // Bulk: log2 of max streams in bits 4:0
+    UINT16  BytesPerInterval;
+} USB_SS_EP_COMPANION_DESCRIPTOR;
+#pragma pack()
+
 #endif // _USB_PROTOCOL_H_
\ No newline at end of file
@@ -0,0 +1,544 @@
+/**
+ * @file benchmarks.c
+ * @brief On-target benchmarks for flash, USB, integrity and allocator paths
+ * @details Every result is one CSV row with a fixed column set, so the output
+ *          of two runs (or two builds) can be diffed or loaded side by side:
+ *
+ *          suite,case,size,align,iterations,min_ns,avg_ns,max_ns,kb_per_s,status
+ *
+ *          Rows for hardware that is absent are simply not emitted. Lines
+ *          starting with '#' are comments and carry no results.
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/DebugLib.h>
+#include <Protocol/UsbIo.h>
+#include "test_runner.h"
+#include "../src/firmware/flash_manager.h"
+#include "../src/firmware/firmware_loader.h"
+#include "../src/firmware/integrity.h"
+#include "../src/usb/usb_driver.h"
+#include "../src/usb/usb_mass_storage.h"
+#include "../include/common.h"
+#include "../include/config.h"
+#include "../include/debug_utils.h"
+#include "../include/metrics.h"
+
+//
+// Timing of one benchmark case
+//
+typedef struct {
+    UINTN Iterations;
+    UINT64 TotalTicks;
+    UINT64 MinTicks;
+    UINT64 MaxTicks;
+    EFI_STATUS Status;                  // First failure, sticky
+} BENCH_RESULT;
+
+//
+// Sweeps
+//
+STATIC CONST UINTN mFlashSizes[] = { 512, 4096, 65536, 262144 };
+STATIC CONST UINTN mFlashAlignments[] = { 0, 1, 64 };
+STATIC CONST UINTN mUsbBulkSizes[] = { 4096, 65536, USB_MSC_MAX_TRANSFER_SIZE };
+STATIC CONST UINTN mValidateSizes[] = { 4096, 65536, 1024 * 1024, BENCH_VALIDATE_MAX_SIZE };
+STATIC CONST UINTN mValidateAlignments[] = { 0, 1, 3 };
+STATIC CONST UINTN mPoolSizes[] = { 64, 4096, 65536, 1024 * 1024 };
+STATIC CONST UINTN mPageCounts[] = { 1, 16, 256 };
+
+#define BENCH_COUNT(Array) (sizeof(Array) / sizeof((Array)[0]))
+
+//
+// Benchmark Function Prototypes
+//
+STATIC VOID BenchFlashRead(VOID);
+STATIC VOID BenchFlashWriteErase(VOID);
+STATIC VOID BenchUsbControl(VOID);
+STATIC VOID BenchUsbBulk(VOID);
+STATIC VOID BenchIntegrity(VOID);
+STATIC VOID BenchAllocator(VOID);
+
+STATIC VOID BenchBegin(OUT BENCH_RESULT *Result);
+STATIC VOID BenchSample(IN OUT BENCH_RESULT *Result, IN UINT64 Ticks, IN EFI_STATUS Status);
+STATIC VOID BenchPrint(IN CONST CHAR16 *Suite, IN CONST CHAR16 *Case, IN UINTN Size, IN UINTN Align, IN CONST BENCH_RESULT *Result);
+STATIC VOID BenchRegionName(IN CONST FLASH_REGION *Region, OUT CHAR16 *Name, IN UINTN NameSize);
+
+/**
+ * Main Benchmark Runner
+ */
+EFI_STATUS
+EFIAPI
+RunBenchmarks(VOID)
+{
+    Print(L"\n");
+    Print(L"# usb-uefi-firmware benchmarks v1, tsc_khz=%ld, iterations=%d\n",
+          metrics_get_ticks_per_ms(), BENCH_ITERATIONS);
+    Print(L"suite,case,size,align,iterations,min_ns,avg_ns,max_ns,kb_per_s,status\n");
+
+    BenchFlashRead();
+    BenchFlashWriteErase();
+    BenchUsbControl();
+    BenchUsbBulk();
+    BenchIntegrity();
+    BenchAllocator();
+
+    Print(L"# end of benchmarks\n");
+
+    return EFI_SUCCESS;
+}
+
+/**
+ * flash_read throughput per region, by transfer size and alignment
+ * @details The alignment offsets both the flash address and the buffer.
+ *          flash.read runs with the sector cache off so it measures FVB;
+ *          flash.read_cached repeats the cacheable sizes with it on.
+ */
+STATIC VOID BenchFlashRead(VOID)
+{
+    FLASH_REGION Region;
+    BENCH_RESULT Result;
+    CHAR16 Name[MAX_FLASH_NAME_LEN];
+    UINT8 *Buffer;
+    UINTN Type;
+    UINTN SizeIndex;
+    UINTN AlignIndex;
+    UINTN Iteration;
+    UINTN Size;
+    UINTN Align;
+    UINT64 Start;
+    EFI_STATUS Status;
+    FLASH_CACHE_STATS Cache;
+    BOOLEAN Cached;
+
+    Buffer = AllocatePool(mFlashSizes[BENCH_COUNT(mFlashSizes) - 1] + 64);
+    if (Buffer == NULL) {
+        Print(L"# flash.read skipped: %r\n", EFI_OUT_OF_RESOURCES);
+        return;
+    }
+
+    ZeroMemory(&Cache, sizeof(Cache));
+    flash_get_cache_stats(&Cache);
+
+    for (Type = FLASH_REGION_BOOT_BLOCK; Type <= FLASH_REGION_CUSTOM; Type++) {
+        if (EFI_ERROR(flash_get_region((FLASH_REGION_TYPE)Type, &Region))) {
+            continue;
+        }
+        BenchRegionName(&Region, Name, sizeof(Name));
+
+        for (SizeIndex = 0; SizeIndex < BENCH_COUNT(mFlashSizes); SizeIndex++) {
+            for (AlignIndex = 0; AlignIndex < BENCH_COUNT(mFlashAlignments); AlignIndex++) {
+                Size = mFlashSizes[SizeIndex];
+                Align = mFlashAlignments[AlignIndex];
+                if (Size + Align > Region.Size) {
+                    continue;
+                }
+
+                for (Cached = FALSE; Cached <= TRUE; Cached++) {
+                    if (Cached && (Cache.Entries == 0 || Size > FLASH_CACHE_MAX_READ)) {
+                        break;
+                    }
+                    flash_read_cache_enable(Cached);
+
+                    BenchBegin(&Result);
+                    for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+                        Start = AsmReadTsc();
+                        Status = flash_read(Region.StartAddress + (UINT32)Align, Buffer + Align, Size);
+                        BenchSample(&Result, AsmReadTsc() - Start, Status);
+                    }
+                    BenchPrint(Cached ? L"flash.read_cached" : L"flash.read", Name, Size, Align, &Result);
+                }
+            }
+        }
+    }
+
+    flash_read_cache_enable(Cache.Enabled);
+    FreePool(Buffer);
+}
+
+/**
+ * flash_erase_sector latency and flash_write throughput per writable region
+ * @details Destructive, so only built in with BENCH_DESTRUCTIVE. The last
+ *          sector of each region is saved, then every iteration erases it and
+ *          programs the saved contents back in pieces of the benchmarked size,
+ *          so the sector holds its original data after each iteration.
+ */
+STATIC VOID BenchFlashWriteErase(VOID)
+{
+#if BENCH_DESTRUCTIVE
+    FLASH_DEVICE_INFO Info;
+    FLASH_REGION Region;
+    BENCH_RESULT EraseResult;
+    BENCH_RESULT WriteResult;
+    CHAR16 Name[MAX_FLASH_NAME_LEN];
+    UINT8 *Saved;
+    UINT32 Sector;
+    UINTN Type;
+    UINTN SizeIndex;
+    UINTN Iteration;
+    UINTN Offset;
+    UINTN Size;
+    UINT64 Start;
+    EFI_STATUS Status;
+
+    if (EFI_ERROR(flash_get_device_info(&Info)) || Info.SectorSize == 0) {
+        Print(L"# flash.write skipped: %r\n", EFI_NOT_READY);
+        return;
+    }
+
+    Saved = AllocatePool(Info.SectorSize);
+    if (Saved == NULL) {
+        Print(L"# flash.write skipped: %r\n", EFI_OUT_OF_RESOURCES);
+        return;
+    }
+
+    for (Type = FLASH_REGION_BOOT_BLOCK; Type <= FLASH_REGION_CUSTOM; Type++) {
+        if (EFI_ERROR(flash_get_region((FLASH_REGION_TYPE)Type, &Region)) ||
+            Region.WriteProtected || !Region.EraseRequired || Region.Size < Info.SectorSize) {
+            continue;
+        }
+        BenchRegionName(&Region, Name, sizeof(Name));
+
+        Sector = Region.StartAddress + Region.Size - Info.SectorSize;
+        if (EFI_ERROR(flash_read(Sector, Saved, Info.SectorSize))) {
+            continue;
+        }
+
+        for (SizeIndex = 0; SizeIndex < BENCH_COUNT(mFlashSizes); SizeIndex++) {
+            Size = mFlashSizes[SizeIndex];
+            if (Size > Info.SectorSize) {
+                continue;
+            }
+
+            BenchBegin(&EraseResult);
+            BenchBegin(&WriteResult);
+            for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+                Start = AsmReadTsc();
+                Status = flash_erase_sector(Sector);
+                BenchSample(&EraseResult, AsmReadTsc() - Start, Status);
+
+                for (Offset = 0; Offset < Info.SectorSize; Offset += Size) {
+                    Start = AsmReadTsc();
+                    Status = flash_write(Sector + (UINT32)Offset, Saved + Offset, MIN(Size, Info.SectorSize - Offset));
+                    BenchSample(&WriteResult, AsmReadTsc() - Start, Status);
+                }
+            }
+            BenchPrint(L"flash.write", Name, Size, 0, &WriteResult);
+
+            // Erase cost does not depend on the write size; report it once
+            if (SizeIndex == 0) {
+                BenchPrint(L"flash.erase", Name, Info.SectorSize, 0, &EraseResult);
+            }
+        }
+    }
+
+    FreePool(Saved);
+#else
+    Print(L"# flash.write and flash.erase skipped: built without BENCH_DESTRUCTIVE\n");
+#endif
+}
+
+/**
+ * Control transfer round-trip latency per connected device
+ * @details A standard GET_STATUS to the device carries 2 bytes, so the
+ *          result is dominated by per-transfer overhead.
+ */
+STATIC VOID BenchUsbControl(VOID)
+{
+    USB_DEVICE_INFO Info;
+    EFI_USB_DEVICE_REQUEST Request;
+    BENCH_RESULT Result;
+    CHAR16 Name[32];
+    UINT16 DeviceStatus;
+    UINT32 TransferStatus;
+    UINTN DeviceId;
+    UINTN Iteration;
+    UINT64 Start;
+    EFI_STATUS Status;
+
+    for (DeviceId = 0; DeviceId < MAX_USB_DEVICES; DeviceId++) {
+        if (EFI_ERROR(usb_get_device_info(DeviceId, &Info))) {
+            break;
+        }
+        if (!Info.IsConnected || Info.UsbIo == NULL) {
+            continue;
+        }
+        UnicodeSPrint(Name, sizeof(Name), L"dev%d_%04x_%04x", DeviceId, Info.VendorId, Info.ProductId);
+
+        Request.RequestType = USB_REQ_TYPE_STANDARD | USB_DIR_IN;
+        Request.Request = USB_REQ_GET_STATUS;
+        Request.Value = 0;
+        Request.Index = 0;
+        Request.Length = sizeof(DeviceStatus);
+
+        BenchBegin(&Result);
+        for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+            Start = AsmReadTsc();
+            Status = Info.UsbIo->UsbControlTransfer(
+                Info.UsbIo,
+                &Request,
+                EfiUsbDataIn,
+                USB_CONTROL_TIMEOUT,
+                &DeviceStatus,
+                sizeof(DeviceStatus),
+                &TransferStatus
+            );
+            BenchSample(&Result, AsmReadTsc() - Start, Status);
+        }
+        BenchPrint(L"usb.control", Name, sizeof(DeviceStatus), 0, &Result);
+    }
+}
+
+/**
+ * Bulk read throughput per mass storage device, by transfer size
+ * @details Reads start at LBA 0 and never write; one row per size shows
+ *          where per-command overhead stops dominating.
+ */
+STATIC VOID BenchUsbBulk(VOID)
+{
+    USB_DEVICE_INFO Info;
+    BENCH_RESULT Result;
+    CHAR16 Name[32];
+    UINT8 *Buffer;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    UINTN DeviceId;
+    UINTN SizeIndex;
+    UINTN Iteration;
+    UINTN Size;
+    UINT64 Start;
+    EFI_STATUS Status;
+
+    Buffer = NULL;
+
+    for (DeviceId = 0; DeviceId < MAX_USB_DEVICES; DeviceId++) {
+        if (EFI_ERROR(usb_get_device_info(DeviceId, &Info))) {
+            break;
+        }
+        if (!Info.IsConnected || Info.InterfaceClass != USB_CLASS_MASS_STORAGE ||
+            EFI_ERROR(usb_msc_get_capacity(DeviceId, &BlockSize, &BlockCount)) || BlockSize == 0) {
+            continue;
+        }
+
+        if (Buffer == NULL) {
+            Buffer = AllocatePool(USB_MSC_MAX_TRANSFER_SIZE);
+            if (Buffer == NULL) {
+                Print(L"# usb.bulk skipped: %r\n", EFI_OUT_OF_RESOURCES);
+                return;
+            }
+        }
+        UnicodeSPrint(Name, sizeof(Name), L"dev%d_%04x_%04x", DeviceId, Info.VendorId, Info.ProductId);
+
+        for (SizeIndex = 0; SizeIndex < BENCH_COUNT(mUsbBulkSizes); SizeIndex++) {
+            Size = mUsbBulkSizes[SizeIndex];
+            if (Size < BlockSize || MultU64x32(BlockCount, BlockSize) < Size) {
+                continue;
+            }
+
+            BenchBegin(&Result);
+            for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+                Start = AsmReadTsc();
+                Status = usb_msc_read(DeviceId, 0, Size / BlockSize, Buffer);
+                BenchSample(&Result, AsmReadTsc() - Start, Status);
+            }
+            BenchPrint(L"usb.bulk.in", Name, Size, 0, &Result);
+        }
+    }
+
+    if (Buffer != NULL) {
+        FreePool(Buffer);
+    }
+}
+
+/**
+ * CRC32C, SHA-256 and firmware validation throughput by size and alignment
+ * @details The buffer holds no package header, so validating it is the
+ *          CRC32C and SHA-256 of the whole image. firmware.validate times
+ *          firmware_validate_begin/update and finishes the SHA-256 locally:
+ *          firmware_validate_final would record the synthetic buffer as the
+ *          loader's validated firmware.
+ */
+STATIC VOID BenchIntegrity(VOID)
+{
+    BENCH_RESULT CrcResult;
+    BENCH_RESULT ShaResult;
+    BENCH_RESULT ValidateResult;
+    FIRMWARE_VALIDATE_CONTEXT Context;
+    EFI_STATUS Status;
+    UINT8 Digest[SHA256_DIGEST_SIZE];
+    UINT8 *Buffer;
+    UINT8 *Data;
+    UINTN SizeIndex;
+    UINTN AlignIndex;
+    UINTN Iteration;
+    UINTN Index;
+    UINTN Size;
+    UINTN Align;
+    UINT64 Start;
+
+    Buffer = AllocatePool(BENCH_VALIDATE_MAX_SIZE + 4);
+    if (Buffer == NULL) {
+        Print(L"# integrity skipped: %r\n", EFI_OUT_OF_RESOURCES);
+        return;
+    }
+
+    for (Index = 0; Index < BENCH_VALIDATE_MAX_SIZE + 4; Index++) {
+        Buffer[Index] = (UINT8)(Index * 31 + (Index >> 8));
+    }
+
+    for (SizeIndex = 0; SizeIndex < BENCH_COUNT(mValidateSizes); SizeIndex++) {
+        for (AlignIndex = 0; AlignIndex < BENCH_COUNT(mValidateAlignments); AlignIndex++) {
+            Size = mValidateSizes[SizeIndex];
+            Align = mValidateAlignments[AlignIndex];
+            Data = Buffer + Align;
+
+            BenchBegin(&CrcResult);
+            BenchBegin(&ShaResult);
+            BenchBegin(&ValidateResult);
+            for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+                Start = AsmReadTsc();
+                integrity_crc32c(0, Data, Size);
+                BenchSample(&CrcResult, AsmReadTsc() - Start, EFI_SUCCESS);
+
+                Start = AsmReadTsc();
+                integrity_sha256(Data, Size, Digest);
+                BenchSample(&ShaResult, AsmReadTsc() - Start, EFI_SUCCESS);
+
+                Start = AsmReadTsc();
+                Status = firmware_validate_begin(&Context);
+                if (!EFI_ERROR(Status)) {
+                    Status = firmware_validate_update(&Context, Data, Size);
+                }
+                if (!EFI_ERROR(Status) && FIRMWARE_VALIDATE_SHA256) {
+                    integrity_sha256_final(&Context.Sha256, Digest);
+                }
+                BenchSample(&ValidateResult, AsmReadTsc() - Start, Status);
+            }
+            BenchPrint(L"integrity.crc32c", L"bsp", Size, Align, &CrcResult);
+            BenchPrint(L"integrity.sha256", L"bsp", Size, Align, &ShaResult);
+            BenchPrint(L"firmware.validate", L"image", Size, Align, &ValidateResult);
+        }
+    }
+
+    FreePool(Buffer);
+}
+
+/**
+ * Cost of an allocate/free pair from the pool and page allocators
+ */
+STATIC VOID BenchAllocator(VOID)
+{
+    BENCH_RESULT Result;
+    VOID *Memory;
+    UINTN Index;
+    UINTN Iteration;
+    UINT64 Start;
+
+    for (Index = 0; Index < BENCH_COUNT(mPoolSizes); Index++) {
+        BenchBegin(&Result);
+        for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+            Start = AsmReadTsc();
+            Memory = AllocatePool(mPoolSizes[Index]);
+            if (Memory != NULL) {
+                FreePool(Memory);
+            }
+            BenchSample(&Result, AsmReadTsc() - Start, (Memory != NULL) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES);
+        }
+        BenchPrint(L"alloc.pool", L"alloc_free", mPoolSizes[Index], 0, &Result);
+    }
+
+    for (Index = 0; Index < BENCH_COUNT(mPageCounts); Index++) {
+        BenchBegin(&Result);
+        for (Iteration = 0; Iteration < BENCH_ITERATIONS; Iteration++) {
+            Start = AsmReadTsc();
+            Memory = AllocatePages(mPageCounts[Index]);
+            if (Memory != NULL) {
+                FreePages(Memory, mPageCounts[Index]);
+            }
+            BenchSample(&Result, AsmReadTsc() - Start, (Memory != NULL) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES);
+        }
+        BenchPrint(L"alloc.pages", L"alloc_free", EFI_PAGES_TO_SIZE(mPageCounts[Index]), 0, &Result);
+    }
+}
+
+/**
+ * Reset a benchmark result
+ */
+STATIC VOID BenchBegin(OUT BENCH_RESULT *Result)
+{
+    ZeroMemory(Result, sizeof(BENCH_RESULT));
+    Result->MinTicks = MAX_UINT64;
+    Result->Status = EFI_SUCCESS;
+}
+
+/**
+ * Add one timed operation to a benchmark result
+ */
+STATIC VOID BenchSample(IN OUT BENCH_RESULT *Result, IN UINT64 Ticks, IN EFI_STATUS Status)
+{
+    Result->Iterations++;
+    Result->TotalTicks += Ticks;
+    Result->MinTicks = MIN(Result->MinTicks, Ticks);
+    Result->MaxTicks = MAX(Result->MaxTicks, Ticks);
+    if (EFI_ERROR(Status) && !EFI_ERROR(Result->Status)) {
+        Result->Status = Status;
+    }
+}
+
+/**
+ * Print one result row
+ * @details kb_per_s is Size * iterations over the total time, in 1000-byte
+ *          units; divide by 10^6 for GB/s.
+ */
+STATIC VOID BenchPrint(
+    IN CONST CHAR16 *Suite,
+    IN CONST CHAR16 *Case,
+    IN UINTN Size,
+    IN UINTN Align,
+    IN CONST BENCH_RESULT *Result
+)
+{
+    UINT64 TotalNs;
+    UINT64 Rate;
+
+    if (Result->Iterations == 0) {
+        return;
+    }
+
+    // Bytes per millisecond is kB/s
+    TotalNs = metrics_ticks_to_ns(Result->TotalTicks);
+    Rate = (Result->TotalTicks != 0) ?
+           DivU64x64Remainder(MultU64x64(MultU64x32(Size, (UINT32)Result->Iterations), metrics_get_ticks_per_ms()),
+                              Result->TotalTicks, NULL) : 0;
+
+    Print(L"%s,%s,%d,%d,%d,%ld,%ld,%ld,%ld,%r\n",
+          Suite,
+          Case,
+          Size,
+          Align,
+          Result->Iterations,
+          metrics_ticks_to_ns(Result->MinTicks),
+          DivU64x32(TotalNs, (UINT32)Result->Iterations),
+          metrics_ticks_to_ns(Result->MaxTicks),
+          Rate,
+          Result->Status);
+}
+
+/**
+ * Get a region name usable as a CSV field, matching the flash metric names
+ */
+STATIC VOID BenchRegionName(IN CONST FLASH_REGION *Region, OUT CHAR16 *Name, IN UINTN NameSize)
+{
+    UINTN Index;
+
+    StrCpyS(Name, NameSize / sizeof(CHAR16), Region->Name);
+    for (Index = 0; Name[Index] != L'\0'; Index++) {
+        if (Name[Index] == L' ' || Name[Index] == L',') {
+            Name[Index] = L'_';
+        }
+    }
+}
@@ -14,6 +14,7 @@
 #include "../src/uefi/uefi_interface.h"
 #include "../src/firmware/flash_manager.h"
 #include "../src/firmware/firmware_loader.h"
+#include "../src/firmware/firmware_pipeline.h"
 #include "../include/common.h"
 #include "../include/debug_utils.h"
 
@@ -91,6 +92,8 @@ STATIC EFI_STATUS TestUsbErrorHandling(VOID);
 STATIC EFI_STATUS TestUefiErrorHandling(VOID);
 STATIC EFI_STATUS TestFlashErrorHandling(VOID);
 STATIC EFI_STATUS TestFirmwareErrorHandling(VOID);
+STATIC EFI_STATUS TestFirmwarePackageValidation(VOID);
+STATIC EFI_STATUS TestMultiRegionPackage(VOID);
 STATIC EFI_STATUS TestMemoryErrorHandling(VOID);
 STATIC EFI_STATUS TestParameterValidation(VOID);
 STATIC EFI_STATUS TestResourceExhaustion(VOID);
@@ -148,6 +151,16 @@ RunErrorHandlingTests(VOID)
     if (!EFI_ERROR(Status)) mErrorTestStats.PassedTests++;
     else mErrorTestStats.FailedTests++;
     
+    Status = TestFirmwarePackageValidation();
+    mErrorTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mErrorTestStats.PassedTests++;
+    else mErrorTestStats.FailedTests++;
+    
+    Status = TestMultiRegionPackage();
+    mErrorTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mErrorTestStats.PassedTests++;
+    else mErrorTestStats.FailedTests++;
+    
     Status = TestMemoryErrorHandling();
     mErrorTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mErrorTestStats.PassedTests++;
@@ -343,6 +356,8 @@ STATIC EFI_STATUS TestFirmwareErrorHandling(VOID)
 {
     VOID *TestBuffer = NULL;
     UINTN TestSize = 0;
+    FIRMWARE_STREAM_RING Ring;
+    FIRMWARE_PIPELINE Pipeline;
     
     ERROR_TEST_START("Firmware Loader Error Handling");
     
@@ -392,13 +407,291 @@ STATIC EFI_STATUS TestFirmwareErrorHandling(VOID)
         "Firmware get info with NULL should fail"
     );
     
-    mErrorTestStats.ErrorsDetected += 7;
-    mErrorTestStats.ErrorsHandled += 7;
+    // Test streaming loader parameter handling
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_stream_ring_create(FIRMWARE_STREAM_CHUNK_SIZE, 0, &Ring),
+        EFI_INVALID_PARAMETER,
+        "Stream ring with no buffers should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_stream_ring_create(FIRMWARE_STREAM_CHUNK_SIZE, FIRMWARE_STREAM_MAX_BUFFERS + 1, &Ring),
+        EFI_INVALID_PARAMETER,
+        "Stream ring deeper than the maximum should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_stream_from_file(L"test.bin", NULL, NULL, NULL, NULL),
+        EFI_INVALID_PARAMETER,
+        "Firmware stream without a ring should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_flash_from_file(NULL, 0, NULL),
+        EFI_INVALID_PARAMETER,
+        "Firmware flash with NULL filename should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_flash_from_file(L"nonexistent_file.bin", 0x00040000, NULL),
+        EFI_NOT_FOUND,
+        "Firmware flash with nonexistent file should fail"
+    );
+    
+    // Test update pipeline parameter handling
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_pipeline_begin_file(&Pipeline, NULL, 4096, 0x00040000, NULL),
+        EFI_INVALID_PARAMETER,
+        "Pipeline without a source file should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_pipeline_begin_usb(&Pipeline, 0, 0, 4096, 0x00040000, NULL),
+        EFI_INVALID_PARAMETER,
+        "Pipeline without a ring should fail"
+    );
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_pipeline_step(NULL),
+        EFI_INVALID_PARAMETER,
+        "Pipeline step with NULL state should fail"
+    );
+    
+    mErrorTestStats.ErrorsDetected += 15;
+    mErrorTestStats.ErrorsHandled += 15;
     
     ERROR_TEST_END("Firmware Loader Error Handling", EFI_SUCCESS);
     return EFI_SUCCESS;
 }
 
+/**
+ * Test Incremental Firmware Package Validation
+ */
+STATIC EFI_STATUS TestFirmwarePackageValidation(VOID)
+{
+    EFI_STATUS Status;
+    FIRMWARE_VALIDATE_CONTEXT Context;
+    FIRMWARE_PACKAGE_HEADER *Header;
+    UINT8 *Package;
+    UINTN PayloadSize = 4096 + 37;
+    UINTN PackageSize;
+    UINTN Offset;
+    UINTN Chunk;
+    UINT32 Checksum;
+    VOID *Payload;
+    UINTN ExtractedSize;
+    
+    ERROR_TEST_START("Firmware Package Validation");
+    
+    PackageSize = sizeof(FIRMWARE_PACKAGE_HEADER) + PayloadSize;
+    Package = AllocateZeroPool(PackageSize);
+    if (Package == NULL) {
+        ERROR_TEST_END("Firmware Package Validation", EFI_OUT_OF_RESOURCES);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    for (Offset = sizeof(FIRMWARE_PACKAGE_HEADER); Offset < PackageSize; Offset++) {
+        Package[Offset] = (UINT8)(Offset * 7);
+    }
+    
+    Header = (FIRMWARE_PACKAGE_HEADER *)Package;
+    Header->Signature = FIRMWARE_PACKAGE_SIGNATURE;
+    Header->HeaderSize = sizeof(FIRMWARE_PACKAGE_HEADER);
+    Header->PackageSize = (UINT32)PackageSize;
+    Header->Checksum = integrity_crc32c(0, Package + Header->HeaderSize, PayloadSize);
+    
+    // Odd chunk sizes split the header and payload at arbitrary points
+    firmware_validate_begin(&Context);
+    for (Offset = 0; Offset < PackageSize; Offset += Chunk) {
+        Chunk = MIN((UINTN)53, PackageSize - Offset);
+        firmware_validate_update(&Context, Package + Offset, Chunk);
+    }
+    Status = firmware_validate_final(&Context, &Checksum);
+    if (EFI_ERROR(Status) || Checksum != integrity_crc32c(0, Package, PackageSize)) {
+        Print(L"[FAIL] %a: Chunked package validation should succeed (%r)\n", __FUNCTION__, Status);
+        FreePool(Package);
+        return EFI_ABORTED;
+    }
+    Print(L"[PASS] %a: Chunked package validation succeeded\n", __FUNCTION__);
+    
+    // Extraction must hand back a view into the package, not a copy
+    Status = firmware_extract_from_package(Package, PackageSize, &Payload, &ExtractedSize);
+    if (EFI_ERROR(Status) ||
+        Payload != Package + sizeof(FIRMWARE_PACKAGE_HEADER) ||
+        ExtractedSize != PayloadSize) {
+        Print(L"[FAIL] %a: Package extraction should return the payload view (%r)\n", __FUNCTION__, Status);
+        FreePool(Package);
+        return EFI_ABORTED;
+    }
+    Print(L"[PASS] %a: Package extraction returned the payload view\n", __FUNCTION__);
+    
+    Header->Signature = SIGNATURE_32('X', 'X', 'X', 'X');
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_extract_from_package(Package, PackageSize, &Payload, &ExtractedSize),
+        EFI_UNSUPPORTED,
+        "Extraction from package with bad signature should fail"
+    );
+    Header->Signature = FIRMWARE_PACKAGE_SIGNATURE;
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_validate_package(Package, PackageSize - 1, &Header),
+        EFI_VOLUME_CORRUPTED,
+        "Package larger than its buffer should fail"
+    );
+    
+    // Corrupted payload byte
+    Package[PackageSize - 1] ^= 0x01;
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_validate(Package, PackageSize),
+        EFI_CRC_ERROR,
+        "Package with corrupted payload should fail"
+    );
+    Package[PackageSize - 1] ^= 0x01;
+    
+    // Truncated package
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_validate(Package, PackageSize - 1),
+        EFI_VOLUME_CORRUPTED,
+        "Truncated package should fail"
+    );
+    
+    // Header claiming a package smaller than itself
+    Header->PackageSize = 4;
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_validate(Package, PackageSize),
+        EFI_VOLUME_CORRUPTED,
+        "Package with inconsistent sizes should fail"
+    );
+    
+    mErrorTestStats.ErrorsDetected += 5;
+    mErrorTestStats.ErrorsHandled += 5;
+    
+    FreePool(Package);
+    
+    ERROR_TEST_END("Firmware Package Validation", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Multi-Region Package Parsing
+ */
+STATIC EFI_STATUS TestMultiRegionPackage(VOID)
+{
+    EFI_STATUS Status;
+    FIRMWARE_PACKAGE_HEADER *Header;
+    FIRMWARE_PACKAGE_MANIFEST *Manifest;
+    FIRMWARE_REGION_ENTRY *Entry;
+    FIRMWARE_PACKAGE_VIEW View;
+    CONST VOID *Payload;
+    UINT8 *Package;
+    UINTN HeaderSize;
+    UINTN PackageSize;
+    UINTN Index;
+    UINTN i;
+    
+    ERROR_TEST_START("Multi-Region Package");
+    
+    // Main firmware and NVRAM payloads back to back after the manifest
+    HeaderSize = sizeof(FIRMWARE_PACKAGE_HEADER) + sizeof(FIRMWARE_PACKAGE_MANIFEST) +
+                 2 * sizeof(FIRMWARE_REGION_ENTRY);
+    PackageSize = HeaderSize + 3000 + 1000;
+    Package = AllocateZeroPool(PackageSize);
+    if (Package == NULL) {
+        ERROR_TEST_END("Multi-Region Package", EFI_OUT_OF_RESOURCES);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    
+    for (i = HeaderSize; i < PackageSize; i++) {
+        Package[i] = (UINT8)(i * 13);
+    }
+    
+    Header = (FIRMWARE_PACKAGE_HEADER *)Package;
+    Manifest = (FIRMWARE_PACKAGE_MANIFEST *)(Header + 1);
+    Entry = (FIRMWARE_REGION_ENTRY *)(Manifest + 1);
+    
+    Header->Signature = FIRMWARE_PACKAGE_V2_SIGNATURE;
+    Header->HeaderSize = (UINT32)HeaderSize;
+    Header->PackageSize = (UINT32)PackageSize;
+    Manifest->FormatVersion = FIRMWARE_PACKAGE_FORMAT_V2;
+    Manifest->RegionCount = 2;
+    
+    Entry[0].RegionType = FLASH_REGION_MAIN_FIRMWARE;
+    Entry[0].Offset = (UINT32)HeaderSize;
+    Entry[0].Size = 3000;
+    Entry[1].RegionType = FLASH_REGION_NVRAM;
+    Entry[1].Offset = (UINT32)HeaderSize + 3000;
+    Entry[1].Size = 1000;
+    for (i = 0; i < 2; i++) {
+        Entry[i].UncompressedSize = Entry[i].Size;
+        Entry[i].Crc32c = integrity_crc32c(0, Package + Entry[i].Offset, Entry[i].Size);
+        integrity_sha256(Package + Entry[i].Offset, Entry[i].Size, Entry[i].Sha256);
+    }
+    Header->Checksum = integrity_crc32c(0, Manifest, HeaderSize - sizeof(FIRMWARE_PACKAGE_HEADER));
+    
+    Status = firmware_package_open(Package, PackageSize, &View);
+    if (!EFI_ERROR(Status)) {
+        Status = firmware_package_find_region(&View, FLASH_REGION_NVRAM, &Index);
+    }
+    if (!EFI_ERROR(Status)) {
+        Status = firmware_package_get_region(&View, Index, NULL, &Payload);
+    }
+    if (!EFI_ERROR(Status)) {
+        Status = firmware_package_validate_region(&View, Index);
+    }
+    if (EFI_ERROR(Status) || Index != 1 || Payload != Package + HeaderSize + 3000) {
+        Print(L"[FAIL] %a: NVRAM region lookup should succeed (%r)\n", __FUNCTION__, Status);
+        FreePool(Package);
+        return EFI_ABORTED;
+    }
+    Print(L"[PASS] %a: NVRAM region located and validated in place\n", __FUNCTION__);
+    
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_package_find_region(&View, FLASH_REGION_BOOT_BLOCK, &Index),
+        EFI_NOT_FOUND,
+        "Lookup of a region the package does not carry should fail"
+    );
+    
+    // Corrupting one region must not affect the other
+    Package[Entry[0].Offset + 10] ^= 0x80;
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_package_validate_region(&View, 0),
+        EFI_CRC_ERROR,
+        "Region with corrupted payload should fail"
+    );
+    if (EFI_ERROR(firmware_package_validate_region(&View, 1))) {
+        Print(L"[FAIL] %a: Untouched region should still validate\n", __FUNCTION__);
+        FreePool(Package);
+        return EFI_ABORTED;
+    }
+    Package[Entry[0].Offset + 10] ^= 0x80;
+    
+    // Manifest tampering is caught by the header checksum
+    Entry[1].FlashOffset = 0x1000;
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_package_open(Package, PackageSize, &View),
+        EFI_CRC_ERROR,
+        "Package with modified manifest should fail"
+    );
+    
+    // Region running past the end of the package
+    Entry[1].FlashOffset = 0;
+    Entry[1].Size = 1001;
+    Header->Checksum = integrity_crc32c(0, Manifest, HeaderSize - sizeof(FIRMWARE_PACKAGE_HEADER));
+    ERROR_TEST_EXPECT_FAILURE(
+        firmware_package_open(Package, PackageSize, &View),
+        EFI_VOLUME_CORRUPTED,
+        "Region beyond the package end should fail"
+    );
+    
+    mErrorTestStats.ErrorsDetected += 4;
+    mErrorTestStats.ErrorsHandled += 4;
+    
+    FreePool(Package);
+    
+    ERROR_TEST_END("Multi-Region Package", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test Memory Error Handling
  */
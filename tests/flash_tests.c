@@ -10,8 +10,13 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
+#include <Library/PrintLib.h>
 #include "../src/firmware/flash_manager.h"
+#include "../src/firmware/integrity.h"
+#include "../src/firmware/lz4_decoder.h"
+#include "../src/firmware/firmware_loader.h"
 #include "../include/common.h"
+#include "../include/config.h"
 #include "../include/debug_utils.h"
 
 //
@@ -92,10 +97,17 @@ STATIC EFI_STATUS TestFlashManagerInit(VOID);
 STATIC EFI_STATUS TestFlashDeviceInfo(VOID);
 STATIC EFI_STATUS TestFlashReadOperations(VOID);
 STATIC EFI_STATUS TestFlashWriteOperations(VOID);
+STATIC EFI_STATUS TestFlashMultiBlockTransfers(VOID);
 STATIC EFI_STATUS TestFlashEraseOperations(VOID);
+STATIC EFI_STATUS TestFlashEraseRange(VOID);
+STATIC EFI_STATUS TestFlashDeltaWrite(VOID);
+STATIC EFI_STATUS TestFlashReadCache(VOID);
+STATIC EFI_STATUS TestFlashRegionLayout(VOID);
 STATIC EFI_STATUS TestFlashBoundaryConditions(VOID);
 STATIC EFI_STATUS TestFlashErrorHandling(VOID);
 STATIC EFI_STATUS TestFlashIntegrityVerification(VOID);
+STATIC EFI_STATUS TestIntegrityEngine(VOID);
+STATIC EFI_STATUS TestLz4Decompression(VOID);
 STATIC EFI_STATUS TestFlashPerformance(VOID);
 STATIC EFI_STATUS TestFlashManagerCleanup(VOID);
 
@@ -145,11 +157,36 @@ RunFlashTests(VOID)
     if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
     else mFlashTestStats.FailedTests++;
     
+    Status = TestFlashMultiBlockTransfers();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
     Status = TestFlashEraseOperations();
     mFlashTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
     else mFlashTestStats.FailedTests++;
     
+    Status = TestFlashEraseRange();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
+    Status = TestFlashDeltaWrite();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
+    Status = TestFlashReadCache();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
+    Status = TestFlashRegionLayout();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
     Status = TestFlashBoundaryConditions();
     mFlashTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
@@ -165,6 +202,16 @@ RunFlashTests(VOID)
     if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
     else mFlashTestStats.FailedTests++;
     
+    Status = TestIntegrityEngine();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
+    Status = TestLz4Decompression();
+    mFlashTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
+    else mFlashTestStats.FailedTests++;
+    
     Status = TestFlashPerformance();
     mFlashTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mFlashTestStats.PassedTests++;
@@ -323,6 +370,54 @@ STATIC EFI_STATUS TestFlashWriteOperations(VOID)
     return EFI_SUCCESS;
 }
 
+/**
+ * Test Flash Transfers Spanning Several Blocks
+ */
+STATIC EFI_STATUS TestFlashMultiBlockTransfers(VOID)
+{
+    EFI_STATUS Status;
+    UINT8 *WriteBuffer = NULL;
+    UINT8 *ReadBuffer = NULL;
+    UINTN BufferSize = (3 * TEST_SECTOR_SIZE) + 0x200;  // Head, 2 full blocks, tail
+    UINT32 Address = 0x00040100;                         // Not block aligned
+    
+    FLASH_TEST_START("Flash Multi-Block Transfers");
+    
+    WriteBuffer = AllocateZeroPool(BufferSize);
+    ReadBuffer = AllocateZeroPool(BufferSize);
+    FLASH_TEST_ASSERT(WriteBuffer != NULL && ReadBuffer != NULL, "Buffer allocation should succeed");
+    
+    GenerateTestPattern(WriteBuffer, BufferSize, TEST_PATTERN_2);
+    
+    // Read spanning several blocks must succeed in one call
+    Status = flash_read(Address, ReadBuffer, BufferSize);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Unaligned multi-block read should succeed");
+    
+    Status = flash_write(Address, WriteBuffer, BufferSize);
+    if (!EFI_ERROR(Status)) {
+        Status = flash_read(Address, ReadBuffer, BufferSize);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Read back across blocks should succeed");
+        
+        if (CompareMem(WriteBuffer, ReadBuffer, BufferSize) == 0) {
+            Print(L"[INFO] Multi-block data verified (%ld bytes)\n", BufferSize);
+        } else {
+            Print(L"[WARN] Multi-block read back differs (flash not erased?)\n");
+        }
+    } else {
+        Print(L"[WARN] Multi-block write failed: %r (may be write-protected)\n", Status);
+    }
+    
+    // Request ending past the device must still be rejected up front
+    Status = flash_read(0xFFFFF000, ReadBuffer, BufferSize);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Multi-block read beyond flash end should fail");
+    
+    FreePool(WriteBuffer);
+    FreePool(ReadBuffer);
+    
+    FLASH_TEST_END("Flash Multi-Block Transfers", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test Flash Erase Operations
  */
@@ -376,6 +471,280 @@ STATIC EFI_STATUS TestFlashEraseOperations(VOID)
     return EFI_SUCCESS;
 }
 
+/**
+ * Test Coalesced Range Erase
+ */
+STATIC EFI_STATUS TestFlashEraseRange(VOID)
+{
+    EFI_STATUS Status;
+    FLASH_DEVICE_INFO FlashInfo = {0};
+    
+    FLASH_TEST_START("Flash Range Erase");
+    
+    Status = flash_get_device_info(&FlashInfo);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Device info should be retrievable");
+    
+    // 64KB inside the main firmware region in one call
+    Status = flash_erase_range(0x00040000, 64 * 1024);
+    if (!EFI_ERROR(Status)) {
+        Status = VerifyFlashData(0x00040000, 64 * 1024, 0xFF);
+        if (EFI_ERROR(Status)) {
+            Print(L"[WARN] Range erase verification failed - data not 0xFF\n");
+        } else {
+            Print(L"[INFO] Range erase verification successful\n");
+        }
+    } else {
+        Print(L"[WARN] Range erase failed: %r (may be write-protected)\n", Status);
+    }
+    
+    // Misaligned requests are rejected rather than rounded out
+    Status = flash_erase_range(0x00040001, FlashInfo.SectorSize);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Unaligned range erase should fail");
+    
+    Status = flash_erase_range(0x00040000, FlashInfo.SectorSize + 1);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Partial-sector range erase should fail");
+    
+    Status = flash_erase_range(0x00040000, 0);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Zero-size range erase should fail");
+    
+    // Range running into the flash descriptor must be refused as a whole
+    Status = flash_erase_range((UINT32)FlashInfo.TotalSize - (128 * 1024), 128 * 1024);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Range covering a non-erasable region should fail");
+    
+    FLASH_TEST_END("Flash Range Erase", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Delta (Differential) Flash Writes
+ */
+STATIC EFI_STATUS TestFlashDeltaWrite(VOID)
+{
+    EFI_STATUS Status;
+    UINT8 *TestBuffer = NULL;
+    FLASH_DELTA_STATS Stats;
+    FLASH_DEVICE_INFO FlashInfo = {0};
+    UINTN BufferSize = 4 * TEST_SECTOR_SIZE;
+    UINTN SectorCount;
+    UINT32 TestAddress = 0x00050100;  // Partial first and last sector
+    
+    FLASH_TEST_START("Flash Delta Write");
+    
+    TestBuffer = AllocatePool(BufferSize);
+    FLASH_TEST_ASSERT(TestBuffer != NULL, "Buffer allocation should succeed");
+    
+    Status = flash_get_device_info(&FlashInfo);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Device info should be retrievable");
+    
+    SectorCount = (TestAddress + BufferSize + FlashInfo.SectorSize - 1) / FlashInfo.SectorSize -
+                  TestAddress / FlashInfo.SectorSize;
+    GenerateTestPattern(TestBuffer, BufferSize, 0x3C);
+    
+    Status = flash_write_delta(TestAddress, TestBuffer, BufferSize, &Stats);
+    if (!EFI_ERROR(Status)) {
+        FLASH_TEST_ASSERT(Stats.SectorsSkipped + Stats.SectorsProgrammed == SectorCount,
+                          "Every touched sector should be skipped or programmed");
+        FLASH_TEST_ASSERT(Stats.SectorsErased <= Stats.SectorsProgrammed,
+                          "Erased sectors should also be programmed");
+        Print(L"[INFO] First pass: %ld skipped, %ld erased, %ld programmed\n",
+              Stats.SectorsSkipped, Stats.SectorsErased, Stats.SectorsProgrammed);
+        
+        // Rewriting the same image should leave flash untouched
+        Status = flash_write_delta(TestAddress, TestBuffer, BufferSize, &Stats);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Repeated delta write should succeed");
+        if (Stats.SectorsSkipped == SectorCount) {
+            Print(L"[INFO] Repeated delta write skipped all sectors\n");
+        } else {
+            Print(L"[WARN] Repeated delta write reprogrammed %ld sectors (simulated flash?)\n",
+                  Stats.SectorsProgrammed);
+        }
+    } else {
+        Print(L"[WARN] Delta write failed: %r (may be write-protected)\n", Status);
+    }
+    
+    // Same argument checks as flash_write
+    Status = flash_write_delta(TestAddress, NULL, BufferSize, NULL);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Delta write with NULL buffer should fail");
+    
+    Status = flash_write_delta(TestAddress, TestBuffer, 0, NULL);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Zero-size delta write should fail");
+    
+    Status = flash_write_delta(0xFFFFF000, TestBuffer, BufferSize, NULL);
+    FLASH_TEST_ASSERT(EFI_ERROR(Status), "Delta write beyond flash should fail");
+    
+    if (TestBuffer) {
+        FreePool(TestBuffer);
+    }
+    
+    FLASH_TEST_END("Flash Delta Write", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test the sector read cache
+ */
+STATIC EFI_STATUS TestFlashReadCache(VOID)
+{
+    EFI_STATUS Status;
+    FLASH_CACHE_STATS Before;
+    FLASH_CACHE_STATS After;
+    UINT8 *WriteBuffer = NULL;
+    UINT8 *CachedBuffer = NULL;
+    UINT8 *RawBuffer = NULL;
+    UINTN BufferSize = 0x200;
+    UINT32 Address = 0x00050080;                         // Not block aligned
+    
+    FLASH_TEST_START("Flash Read Cache");
+    
+    Status = flash_get_cache_stats(&Before);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Cache statistics should be available");
+    FLASH_TEST_ASSERT(flash_get_cache_stats(NULL) == EFI_INVALID_PARAMETER, "NULL statistics should be rejected");
+    
+    if (Before.Entries == 0) {
+        Print(L"[INFO] Read cache not available, skipping\n");
+        FLASH_TEST_END("Flash Read Cache", EFI_SUCCESS);
+        return EFI_SUCCESS;
+    }
+    
+    WriteBuffer = AllocateZeroPool(BufferSize);
+    CachedBuffer = AllocateZeroPool(BufferSize);
+    RawBuffer = AllocateZeroPool(FLASH_CACHE_MAX_READ + TEST_SECTOR_SIZE);
+    FLASH_TEST_ASSERT(WriteBuffer != NULL && CachedBuffer != NULL && RawBuffer != NULL,
+                      "Buffer allocation should succeed");
+    
+    // Starting cold, the second identical read must be served from the cache
+    Status = flash_read_cache_enable(TRUE);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Enabling the cache should succeed");
+    
+    Status = flash_read(Address, RawBuffer, BufferSize);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "First read should succeed");
+    flash_get_cache_stats(&Before);
+    
+    Status = flash_read(Address, CachedBuffer, BufferSize);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Repeated read should succeed");
+    flash_get_cache_stats(&After);
+    FLASH_TEST_ASSERT(After.Hits > Before.Hits && After.Misses == Before.Misses,
+                      "Repeated read should hit the cache");
+    FLASH_TEST_ASSERT(CompareMem(RawBuffer, CachedBuffer, BufferSize) == 0,
+                      "Cached data should match the first read");
+    
+    // A write must not leave the old contents cached
+    GenerateTestPattern(WriteBuffer, BufferSize, TEST_PATTERN_3);
+    Status = flash_write(Address, WriteBuffer, BufferSize);
+    if (!EFI_ERROR(Status)) {
+        flash_get_cache_stats(&After);
+        FLASH_TEST_ASSERT(After.Invalidations > Before.Invalidations, "Write should invalidate cached sectors");
+        
+        Status = flash_read(Address, CachedBuffer, BufferSize);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Read after write should succeed");
+        
+        flash_read_cache_enable(FALSE);
+        Status = flash_read(Address, RawBuffer, BufferSize);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Uncached read should succeed");
+        FLASH_TEST_ASSERT(CompareMem(RawBuffer, CachedBuffer, BufferSize) == 0,
+                          "Cached read after write should match flash");
+        flash_read_cache_enable(TRUE);
+    } else {
+        Print(L"[WARN] Cache invalidation not tested: write failed: %r\n", Status);
+    }
+    
+    // Reads larger than the cache limit go straight to FVB
+    flash_get_cache_stats(&Before);
+    Status = flash_read(Address, RawBuffer, FLASH_CACHE_MAX_READ + TEST_SECTOR_SIZE);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Large read should succeed");
+    flash_get_cache_stats(&After);
+    FLASH_TEST_ASSERT(After.Bypassed == Before.Bypassed + 1, "Large read should bypass the cache");
+    
+    Print(L"[INFO] Cache: %ld hits, %ld misses, %ld read ahead\n", After.Hits, After.Misses, After.ReadAhead);
+    
+    FreePool(WriteBuffer);
+    FreePool(CachedBuffer);
+    FreePool(RawBuffer);
+    
+    FLASH_TEST_END("Flash Read Cache", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test custom region layouts and region lookup
+ */
+STATIC EFI_STATUS TestFlashRegionLayout(VOID)
+{
+    EFI_STATUS Status;
+    FLASH_REGION Main;
+    FLASH_REGION Custom;
+    FLASH_REGION Found;
+    UINT32 Slice;
+    UINTN Index;
+    
+    FLASH_TEST_START("Flash Region Layout");
+    
+    Status = flash_get_region(FLASH_REGION_MAIN_FIRMWARE, &Main);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Default layout should have a main firmware region");
+    
+    Status = flash_find_region(Main.StartAddress + Main.Size / 2, &Found);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status) && Found.Type == FLASH_REGION_MAIN_FIRMWARE,
+                      "Lookup inside main firmware should find it");
+    
+    // Overlapping and misaligned regions are refused
+    CopyMem(&Custom, &Main, sizeof(FLASH_REGION));
+    Custom.Type = FLASH_REGION_CUSTOM;
+    Custom.StartAddress = Main.StartAddress + TEST_SECTOR_SIZE;
+    Custom.Size = TEST_SECTOR_SIZE;
+    FLASH_TEST_ASSERT(flash_add_region(&Custom) == EFI_ACCESS_DENIED, "Overlapping region should be rejected");
+    FLASH_TEST_ASSERT(flash_add_region(NULL) == EFI_INVALID_PARAMETER, "NULL region should be rejected");
+    
+    // Split main firmware into four custom regions, the second write protected
+    Status = flash_remove_region(Main.StartAddress);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Removing main firmware should succeed");
+    FLASH_TEST_ASSERT(flash_find_region(Main.StartAddress, &Found) == EFI_NOT_FOUND,
+                      "Removed region should no longer be found");
+    
+    Custom.Size = Main.Size / 2 + 0x100;
+    FLASH_TEST_ASSERT(flash_add_region(&Custom) == EFI_INVALID_PARAMETER, "Misaligned region should be rejected");
+    
+    Slice = Main.Size / 4;
+    for (Index = 0; Index < 4; Index++) {
+        Custom.StartAddress = Main.StartAddress + (UINT32)Index * Slice;
+        Custom.Size = Slice;
+        Custom.WriteProtected = (Index == 1);
+        UnicodeSPrint(Custom.Name, sizeof(Custom.Name), L"Custom %d", Index);
+        
+        // Added out of order; the table keeps itself sorted
+        if (Index == 2) {
+            continue;
+        }
+        Status = flash_add_region(&Custom);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Adding a custom region should succeed");
+    }
+    Custom.StartAddress = Main.StartAddress + 2 * Slice;
+    Custom.WriteProtected = FALSE;
+    UnicodeSPrint(Custom.Name, sizeof(Custom.Name), L"Custom %d", 2);
+    Status = flash_add_region(&Custom);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Adding a region into a gap should succeed");
+    
+    for (Index = 0; Index < 4; Index++) {
+        Status = flash_find_region(Main.StartAddress + (UINT32)Index * Slice + Slice - 1, &Found);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status) && Found.StartAddress == Main.StartAddress + Index * Slice,
+                          "Last byte of each custom region should resolve to it");
+    }
+    
+    // Policies are per region; a write straddling two regions is held to both
+    Status = flash_write(Main.StartAddress + 2 * Slice - 0x10, &Custom, 0x20);
+    FLASH_TEST_ASSERT(Status == EFI_WRITE_PROTECTED, "Write touching a protected custom region should fail");
+    
+    // Restore the default layout for the remaining tests
+    for (Index = 0; Index < 4; Index++) {
+        Status = flash_remove_region(Main.StartAddress + (UINT32)Index * Slice);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Removing a custom region should succeed");
+    }
+    Status = flash_add_region(&Main);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Restoring main firmware should succeed");
+    
+    FLASH_TEST_END("Flash Region Layout", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test Flash Boundary Conditions
  */
@@ -504,6 +873,169 @@ STATIC EFI_STATUS TestFlashIntegrityVerification(VOID)
     return EFI_SUCCESS;
 }
 
+/**
+ * Test CRC32C / SHA-256 Integrity Engine
+ */
+STATIC EFI_STATUS TestIntegrityEngine(VOID)
+{
+    STATIC CONST UINT8 ShaAbc[SHA256_DIGEST_SIZE] = {
+        0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE,
+        0x5D, 0xAE, 0x22, 0x23, 0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C,
+        0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD
+    };
+    UINT8 *TestBuffer = NULL;
+    UINTN BufferSize = 3 * TEST_SECTOR_SIZE + 13;
+    UINT8 Digest[SHA256_DIGEST_SIZE];
+    UINT8 PortableDigest[SHA256_DIGEST_SIZE];
+    UINT32 Features;
+    UINT32 Crc;
+    UINT32 PortableCrc;
+    
+    FLASH_TEST_START("Integrity Engine");
+    
+    Features = integrity_get_features();
+    
+    // Known answers
+    FLASH_TEST_ASSERT(integrity_crc32c(0, "123456789", 9) == 0xE3069283,
+                      "CRC32C check value should match");
+    integrity_sha256("abc", 3, Digest);
+    FLASH_TEST_ASSERT(CompareMem(Digest, ShaAbc, sizeof(ShaAbc)) == 0,
+                      "SHA-256 of \"abc\" should match FIPS 180-4");
+    
+    TestBuffer = AllocatePool(BufferSize + 1);
+    FLASH_TEST_ASSERT(TestBuffer != NULL, "Buffer allocation should succeed");
+    GenerateTestPattern(TestBuffer, BufferSize + 1, TEST_PATTERN_2);
+    
+    // Chained CRC over a misaligned buffer equals the one-shot CRC
+    Crc = integrity_crc32c(0, TestBuffer + 1, 1000);
+    Crc = integrity_crc32c(Crc, TestBuffer + 1001, BufferSize - 1000);
+    FLASH_TEST_ASSERT(Crc == integrity_crc32c(0, TestBuffer + 1, BufferSize),
+                      "Chained CRC32C should equal one-shot CRC32C");
+    
+    // Independently computed halves combine to the same CRC
+    FLASH_TEST_ASSERT(integrity_crc32c_combine(integrity_crc32c(0, TestBuffer + 1, 1000),
+                                               integrity_crc32c(0, TestBuffer + 1001, BufferSize - 1000),
+                                               BufferSize - 1000) == Crc,
+                      "Combined CRC32C should equal one-shot CRC32C");
+    FLASH_TEST_ASSERT(integrity_crc32c_combine(Crc, 0, 0) == Crc,
+                      "Combining with an empty block should not change the CRC32C");
+    
+    // Accelerated paths must agree with the portable ones
+    integrity_init(0);
+    PortableCrc = integrity_crc32c(0, TestBuffer + 1, BufferSize);
+    integrity_sha256(TestBuffer + 1, BufferSize, PortableDigest);
+    integrity_init(Features);
+    integrity_sha256(TestBuffer + 1, BufferSize, Digest);
+    
+    FLASH_TEST_ASSERT(Crc == PortableCrc, "CRC32C paths should agree");
+    FLASH_TEST_ASSERT(CompareMem(Digest, PortableDigest, sizeof(Digest)) == 0,
+                      "SHA-256 paths should agree");
+    
+    Print(L"[INFO] Integrity acceleration: 0x%08X\n", Features);
+    
+    FreePool(TestBuffer);
+    
+    FLASH_TEST_END("Integrity Engine", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+//
+// lz4 -9 of 4096 bytes of 0xFF followed by "USB-UEFI-FLASH!!" x 256
+//
+STATIC CONST UINT8 mLz4TestFrame[] = {
+    0x04, 0x22, 0x4D, 0x18, 0x64, 0x40, 0xA7, 0x3E, 0x00, 0x00, 0x00, 0x1F,
+    0xFF, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFB, 0xFF, 0x01, 0x55, 0x53, 0x42,
+    0x2D, 0x55, 0x45, 0x46, 0x49, 0x2D, 0x46, 0x4C, 0x41, 0x53, 0x48, 0x21,
+    0x21, 0x10, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE7, 0x50, 0x41, 0x53, 0x48, 0x21,
+    0x21, 0x00, 0x00, 0x00, 0x00, 0xD7, 0xCE, 0x34, 0xA8
+};
+
+#define LZ4_TEST_IMAGE_SIZE         8192
+
+/**
+ * Collect LZ4 output into a test buffer
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+CollectLz4Output(
+    IN VOID *Context,
+    IN UINT64 Offset,
+    IN CONST UINT8 *Data,
+    IN UINTN Length
+)
+{
+    if (Offset + Length > LZ4_TEST_IMAGE_SIZE) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    
+    CopyMem((UINT8 *)Context + Offset, Data, Length);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test LZ4 Decompression Into Flash
+ */
+STATIC EFI_STATUS TestLz4Decompression(VOID)
+{
+    EFI_STATUS Status;
+    UINT8 *Window = NULL;
+    UINT8 *Image = NULL;
+    UINT8 Corrupt[sizeof(mLz4TestFrame)];
+    UINT64 DecodedSize;
+    FLASH_DEVICE_INFO FlashInfo;
+    FLASH_DELTA_STATS Stats;
+    UINTN Index;
+    BOOLEAN Match;
+    
+    FLASH_TEST_START("LZ4 Decompression");
+    
+    Window = AllocatePool(LZ4_MIN_WINDOW_SIZE);
+    Image = AllocatePool(LZ4_TEST_IMAGE_SIZE);
+    FLASH_TEST_ASSERT(Window != NULL && Image != NULL, "Buffer allocation should succeed");
+    
+    Status = lz4_decode_frame(mLz4TestFrame, sizeof(mLz4TestFrame), Window,
+                              LZ4_MIN_WINDOW_SIZE, CollectLz4Output, Image, &DecodedSize);
+    FLASH_TEST_ASSERT(!EFI_ERROR(Status) && DecodedSize == LZ4_TEST_IMAGE_SIZE,
+                      "Frame should decode to its full size");
+    
+    Match = TRUE;
+    for (Index = 0; Index < LZ4_TEST_IMAGE_SIZE; Index++) {
+        if (Image[Index] != ((Index < 4096) ? 0xFF : (UINT8)"USB-UEFI-FLASH!!"[Index % 16])) {
+            Match = FALSE;
+            break;
+        }
+    }
+    FLASH_TEST_ASSERT(Match, "Decoded data should match the original image");
+    
+    // A flipped literal byte must be caught by the content checksum
+    CopyMem(Corrupt, mLz4TestFrame, sizeof(Corrupt));
+    Corrupt[40] ^= 0x01;
+    Status = lz4_decode_frame(Corrupt, sizeof(Corrupt), Window,
+                              LZ4_MIN_WINDOW_SIZE, CollectLz4Output, Image, NULL);
+    FLASH_TEST_ASSERT(Status == EFI_CRC_ERROR, "Corrupted frame should fail its checksum");
+    
+    FreePool(Window);
+    FreePool(Image);
+    
+    // Straight into flash, when the image covers whole sectors
+    Status = flash_get_device_info(&FlashInfo);
+    if (!EFI_ERROR(Status) && (LZ4_TEST_IMAGE_SIZE % FlashInfo.SectorSize) == 0) {
+        Status = firmware_flash_compressed(mLz4TestFrame, sizeof(mLz4TestFrame),
+                                           0x00060000, LZ4_TEST_IMAGE_SIZE, &Stats);
+        FLASH_TEST_ASSERT(!EFI_ERROR(Status), "Compressed image should flash");
+        FLASH_TEST_ASSERT(Stats.SectorsProgrammed <= LZ4_TEST_IMAGE_SIZE / FlashInfo.SectorSize,
+                          "Erased runs should not add programmed sectors");
+        Print(L"[INFO] Compressed flash: %ld erased, %ld programmed\n",
+              Stats.SectorsErased, Stats.SectorsProgrammed);
+    }
+    
+    FLASH_TEST_END("LZ4 Decompression", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test Flash Performance Characteristics
  */
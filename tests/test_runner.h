@@ -44,4 +44,8 @@ EFI_STATUS
 EFIAPI
 RunAllTests(VOID);
 
+EFI_STATUS
+EFIAPI
+RunBenchmarks(VOID);
+
 #endif // _TEST_RUNNER_H_
\ No newline at end of file
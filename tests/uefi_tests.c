@@ -12,8 +12,13 @@
 #include <Library/DebugLib.h>
 #include "../src/uefi/uefi_interface.h"
 #include "../src/uefi/boot_services.h"
+#include "../src/uefi/scheduler.h"
+#include "../src/uefi/worker_pool.h"
+#include "../src/uefi/memory_pool.h"
+#include "../src/uefi/boot_cache.h"
 #include "../include/common.h"
 #include "../include/debug_utils.h"
+#include "../include/metrics.h"
 
 //
 // Test Framework Macros (reuse from USB tests)
@@ -50,6 +55,12 @@ STATIC EFI_STATUS TestUefiProtocolServices(VOID);
 STATIC EFI_STATUS TestUefiAmdDetection(VOID);
 STATIC EFI_STATUS TestUefiSecurityFeatures(VOID);
 STATIC EFI_STATUS TestUefiVariableServices(VOID);
+STATIC EFI_STATUS TestUefiScheduler(VOID);
+STATIC EFI_STATUS TestUefiWorkerPool(VOID);
+STATIC EFI_STATUS TestUefiTrace(VOID);
+STATIC EFI_STATUS TestUefiMetrics(VOID);
+STATIC EFI_STATUS TestUefiMemoryPool(VOID);
+STATIC EFI_STATUS TestUefiBootCache(VOID);
 STATIC EFI_STATUS TestUefiInterfaceCleanup(VOID);
 STATIC VOID PrintUefiTestStatistics(VOID);
 
@@ -113,6 +124,36 @@ RunUefiTests(VOID)
     if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
     else mUefiTestStats.FailedTests++;
     
+    Status = TestUefiScheduler();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
+    Status = TestUefiWorkerPool();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
+    Status = TestUefiTrace();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
+    Status = TestUefiMetrics();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
+    Status = TestUefiMemoryPool();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
+    Status = TestUefiBootCache();
+    mUefiTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
+    else mUefiTestStats.FailedTests++;
+    
     Status = TestUefiInterfaceCleanup();
     mUefiTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mUefiTestStats.PassedTests++;
@@ -470,6 +511,406 @@ STATIC EFI_STATUS TestUefiVariableServices(VOID)
     return EFI_SUCCESS;
 }
 
+/**
+ * Scheduler task used by the tests; never expected to run
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+TestSchedulerTask(
+    IN VOID *Context
+)
+{
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Scheduler Task Registration
+ * @details Tests run from a scheduler task, so the table is exercised
+ *          without re-entering scheduler_run.
+ */
+STATIC EFI_STATUS TestUefiScheduler(VOID)
+{
+    EFI_STATUS Status;
+    EFI_EVENT Event;
+    UINTN TaskIds[SCHEDULER_MAX_TASKS];
+    UINTN TaskCount;
+    UINTN Index;
+    
+    TEST_START("UEFI Scheduler");
+    
+    Status = scheduler_add_task(L"Test", NULL, NULL, SCHEDULER_PRIORITY_LOW, NULL, 0, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL task function should return error");
+    
+    Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Event);
+    TEST_ASSERT(!EFI_ERROR(Status), "Event creation should succeed");
+    
+    Status = scheduler_add_task(L"Test", TestSchedulerTask, NULL, SCHEDULER_PRIORITY_LOW, Event, 10000000, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Event and period together should return error");
+    
+    Status = scheduler_remove_task(SCHEDULER_MAX_TASKS);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Invalid task id should return error");
+    
+    // Fill the table with event and periodic tasks, then remove them again
+    TaskCount = 0;
+    for (Index = 0; Index < SCHEDULER_MAX_TASKS; Index++) {
+        Status = scheduler_add_task(L"Test", TestSchedulerTask, NULL, SCHEDULER_PRIORITY_LOW,
+                                    (Index % 2 == 0) ? Event : NULL, (Index % 2 == 0) ? 0 : 10000000,
+                                    &TaskIds[TaskCount]);
+        if (EFI_ERROR(Status)) {
+            break;
+        }
+        TaskCount++;
+    }
+    TEST_ASSERT(Status == EFI_OUT_OF_RESOURCES, "A full task table should return EFI_OUT_OF_RESOURCES");
+    
+    for (Index = 0; Index < TaskCount; Index++) {
+        Status = scheduler_remove_task(TaskIds[Index]);
+        TEST_ASSERT(!EFI_ERROR(Status), "Registered task should be removable");
+    }
+    
+    Status = scheduler_remove_task(TaskIds[0]);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Removed task should not be removable twice");
+    
+    gBS->CloseEvent(Event);
+    
+    TEST_END("UEFI Scheduler", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+#define TEST_WORKER_JOBS            16
+#define TEST_WORKER_SPAN            4096
+
+/**
+ * Worker job used by the tests: sum a span of bytes
+ * @details Runs on APs, so it only touches memory.
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+TestWorkerSumJob(
+    IN OUT WORKER_JOB *Job,
+    IN VOID *Scratch
+)
+{
+    UINT32 *Span;
+    UINT32 Sum;
+    UINTN Index;
+    
+    if (Scratch == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    
+    Span = (UINT32 *)Job->Context;
+    Sum = 0;
+    for (Index = 1; Index < TEST_WORKER_SPAN / sizeof(UINT32); Index++) {
+        Sum += Span[Index];
+    }
+    Span[0] = Sum;
+    
+    return (Sum == 0) ? EFI_CRC_ERROR : EFI_SUCCESS;
+}
+
+/**
+ * Test Worker Pool Batches
+ */
+STATIC EFI_STATUS TestUefiWorkerPool(VOID)
+{
+    EFI_STATUS Status;
+    WORKER_JOB Jobs[TEST_WORKER_JOBS];
+    WORKER_BATCH Batch;
+    UINT32 *Buffer;
+    UINT32 *Span;
+    UINTN Index;
+    UINTN Word;
+    BOOLEAN AllSummed;
+    
+    TEST_START("UEFI Worker Pool");
+    
+    TEST_ASSERT(worker_pool_get_processor_count() >= 1, "Pool should include the BSP");
+    
+    Status = worker_pool_run(NULL, 1);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL job list should return error");
+    
+    Buffer = AllocatePool(TEST_WORKER_JOBS * TEST_WORKER_SPAN);
+    TEST_ASSERT(Buffer != NULL, "Buffer allocation should succeed");
+    
+    for (Index = 0; Index < TEST_WORKER_JOBS; Index++) {
+        Span = Buffer + Index * (TEST_WORKER_SPAN / sizeof(UINT32));
+        for (Word = 0; Word < TEST_WORKER_SPAN / sizeof(UINT32); Word++) {
+            Span[Word] = (UINT32)(Index + 1);
+        }
+        Jobs[Index].Function = TestWorkerSumJob;
+        Jobs[Index].Context = Span;
+    }
+    
+    Status = worker_pool_submit(Jobs, TEST_WORKER_JOBS, &Batch);
+    TEST_ASSERT(!EFI_ERROR(Status), "Batch submission should succeed");
+    
+    Status = worker_pool_submit(Jobs, TEST_WORKER_JOBS, &Batch);
+    TEST_ASSERT(Status == EFI_NOT_READY || Batch.Completed == TEST_WORKER_JOBS,
+                "A second batch should wait for the first");
+    
+    Status = worker_pool_wait(&Batch);
+    TEST_ASSERT(!EFI_ERROR(Status), "Every job should succeed");
+    TEST_ASSERT(worker_pool_poll(&Batch) == EFI_SUCCESS, "A finished batch should poll complete");
+    
+    AllSummed = TRUE;
+    for (Index = 0; Index < TEST_WORKER_JOBS; Index++) {
+        Span = Buffer + Index * (TEST_WORKER_SPAN / sizeof(UINT32));
+        if (Span[0] != (UINT32)((Index + 1) * (TEST_WORKER_SPAN / sizeof(UINT32) - 1))) {
+            AllSummed = FALSE;
+        }
+    }
+    TEST_ASSERT(AllSummed, "Every job should have run exactly once");
+    
+    // The first failing job in job order is reported
+    ZeroMemory(Buffer + 3 * (TEST_WORKER_SPAN / sizeof(UINT32)), TEST_WORKER_SPAN);
+    Status = worker_pool_run(Jobs, TEST_WORKER_JOBS);
+    TEST_ASSERT(Status == EFI_CRC_ERROR, "A failing job should fail the batch");
+    TEST_ASSERT(!EFI_ERROR(Jobs[2].Status) && Jobs[3].Status == EFI_CRC_ERROR,
+                "Job status should be kept per job");
+    
+    FreePool(Buffer);
+    
+    TEST_END("UEFI Worker Pool", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test the binary trace ring
+ */
+STATIC EFI_STATUS TestUefiTrace(VOID)
+{
+    DEBUG_TRACE_RECORD Records[4];
+    UINTN Count;
+    UINTN Index;
+    
+    TEST_START("UEFI Trace Ring");
+    
+    DebugTraceReset();
+    TEST_ASSERT(DebugTraceExport(Records, 4) == 0, "A reset ring should be empty");
+    
+    DebugTraceRecord(TraceEventFlashRead, 0x1000, 512, EFI_SUCCESS);
+    DebugTraceRecord(TraceEventFlashWrite, 0x2000, 256, EFI_DEVICE_ERROR);
+    
+    Count = DebugTraceExport(Records, 4);
+    TEST_ASSERT(Count == 2, "Both records should be exported");
+    TEST_ASSERT(Records[0].Event == TraceEventFlashRead && Records[0].Args[0] == 0x1000 &&
+                Records[0].Args[1] == 512, "Records should be exported oldest first");
+    TEST_ASSERT(Records[1].Event == TraceEventFlashWrite &&
+                Records[1].Args[2] == EFI_DEVICE_ERROR, "Arguments should be kept raw");
+    TEST_ASSERT(Records[1].Tsc >= Records[0].Tsc, "Timestamps should not go backwards");
+    
+    // Wrap the ring; only the newest records survive
+    for (Index = 0; Index < TRACE_RING_ENTRIES + 3; Index++) {
+        DebugTraceRecord(TraceEventUsbTransfer, 0, Index, 0);
+    }
+    
+    Count = DebugTraceExport(Records, 4);
+    TEST_ASSERT(Count == 4, "Export should stop at the caller's limit");
+    TEST_ASSERT(Records[3].Args[1] == TRACE_RING_ENTRIES + 2 &&
+                Records[0].Args[1] == TRACE_RING_ENTRIES - 1,
+                "A full ring should overwrite its oldest records");
+    
+    DebugTraceReset();
+    
+    TEST_END("UEFI Trace Ring", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test latency histograms and byte counters
+ */
+STATIC EFI_STATUS TestUefiMetrics(VOID)
+{
+    EFI_STATUS Status;
+    METRICS_ENTRY Entry;
+    UINTN MetricId;
+    UINTN SameId;
+    UINT64 TicksPerMs;
+    UINT64 Percentile;
+    UINTN Index;
+    
+    TEST_START("UEFI Metrics");
+    
+    Status = metrics_register(L"test.metrics", &MetricId);
+    TEST_ASSERT(!EFI_ERROR(Status) && MetricId != METRICS_INVALID_ID, "Metric registration should succeed");
+    
+    Status = metrics_register(L"test.metrics", &SameId);
+    TEST_ASSERT(!EFI_ERROR(Status) && SameId == MetricId, "Registering a name twice should return the same id");
+    
+    metrics_reset();
+    
+    TicksPerMs = metrics_get_ticks_per_ms();
+    TEST_ASSERT(TicksPerMs != 0, "TSC rate should be calibrated");
+    TEST_ASSERT(metrics_ticks_to_ns(TicksPerMs) == 1000000, "One millisecond of ticks should convert to 10^6 ns");
+    
+    // Three 1 ms operations, one 10 ms operation and a byte-only update
+    for (Index = 0; Index < 3; Index++) {
+        metrics_record_ticks(MetricId, TicksPerMs, 4096);
+    }
+    metrics_record_ticks(MetricId, MultU64x32(TicksPerMs, 10), 4096);
+    metrics_count(MetricId, 100);
+    metrics_record_ticks(METRICS_INVALID_ID, TicksPerMs, 4096);
+    
+    Status = metrics_get_entry(MetricId, &Entry);
+    TEST_ASSERT(!EFI_ERROR(Status), "Metric should be readable");
+    TEST_ASSERT(Entry.Count == 5 && Entry.Samples == 4, "Byte-only updates should not count as samples");
+    TEST_ASSERT(Entry.Bytes == 4 * 4096 + 100, "Bytes should accumulate");
+    TEST_ASSERT(Entry.MinTicks == TicksPerMs && Entry.MaxTicks == MultU64x32(TicksPerMs, 10),
+                "Minimum and maximum should be tracked");
+    
+    Percentile = metrics_get_percentile(MetricId, 50);
+    TEST_ASSERT(Percentile >= 1000000 && Percentile < 2000000, "p50 should be the bucket of the 1 ms samples");
+    
+    Percentile = metrics_get_percentile(MetricId, 99);
+    TEST_ASSERT(Percentile == 10000000, "p99 should be bounded by the slowest sample");
+    
+    Status = metrics_get_entry(METRICS_INVALID_ID, &Entry);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Unknown metric ids should be rejected");
+    
+    metrics_reset();
+    Status = metrics_get_entry(MetricId, &Entry);
+    TEST_ASSERT(!EFI_ERROR(Status) && Entry.Count == 0 && Entry.Buckets[0] == 0,
+                "Reset should clear counters but keep the id");
+    
+    TEST_END("UEFI Metrics", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test arenas and the size-class pool
+ */
+STATIC EFI_STATUS TestUefiMemoryPool(VOID)
+{
+    STATIC MEMORY_ARENA Arena;
+    EFI_STATUS Status;
+    MEMORY_ARENA_MARK Mark;
+    UINT8 *First;
+    UINT8 *Second;
+    UINT8 *Block;
+    UINT8 *Again;
+    UINT8 *Large;
+    UINTN Chunks;
+    
+    TEST_START("UEFI Memory Pool");
+    
+    Status = memory_arena_init(&Arena, L"test", EFI_PAGE_SIZE);
+    TEST_ASSERT(!EFI_ERROR(Status), "Arena initialization should succeed");
+    TEST_ASSERT(Arena.PagesReserved == 0, "An unused arena should hold no pages");
+    
+    First = memory_arena_alloc(&Arena, 3, 1);
+    Second = memory_arena_alloc(&Arena, 100, 64);
+    TEST_ASSERT(First != NULL && Second != NULL, "Arena allocations should succeed");
+    TEST_ASSERT(((UINTN)Second & 63) == 0 && Second > First, "Arena allocations should honour their alignment");
+    TEST_ASSERT(memory_arena_alloc(&Arena, 16, 3) == NULL, "Non power-of-two alignments should be rejected");
+    
+    // Scratch bigger than a chunk, then a rewind and the same request again
+    memory_arena_get_mark(&Arena, &Mark);
+    Block = memory_arena_alloc(&Arena, 3 * EFI_PAGE_SIZE, sizeof(UINT64));
+    TEST_ASSERT(Block != NULL, "Oversized arena requests should get their own chunk");
+    Chunks = Arena.ChunkAllocations;
+    memory_arena_rewind(&Arena, &Mark);
+    TEST_ASSERT(Arena.BytesInUse == Mark.BytesInUse, "Rewind should restore the bytes in use");
+    Again = memory_arena_alloc(&Arena, 3 * EFI_PAGE_SIZE, sizeof(UINT64));
+    TEST_ASSERT(Again == Block && Arena.ChunkAllocations == Chunks, "Rewound chunks should be reused without allocating");
+    
+    memory_arena_release(&Arena);
+    TEST_ASSERT(Arena.PagesReserved == 0 && Arena.Head == NULL, "Release should return every page");
+    
+    Status = memory_pool_init();
+    TEST_ASSERT(!EFI_ERROR(Status), "Pool initialization should succeed");
+    
+    Block = memory_pool_alloc(40);
+    TEST_ASSERT(Block != NULL && ((UINTN)Block & 63) == 0, "Pool blocks should be aligned to their class size");
+    TEST_ASSERT(memory_pool_free(Block + 1) == EFI_INVALID_PARAMETER, "Pointers inside a block should be rejected");
+    Status = memory_pool_free(Block);
+    TEST_ASSERT(!EFI_ERROR(Status), "Pool free should succeed");
+    Again = memory_pool_alloc(64);
+    TEST_ASSERT(Again == Block, "Freed blocks should be reused first");
+    memory_pool_free(Again);
+    
+    Large = memory_pool_alloc(3 * EFI_PAGE_SIZE);
+    TEST_ASSERT(Large != NULL && ((UINTN)Large & EFI_PAGE_MASK) == 0, "Large pool allocations should be page aligned");
+    SetMem(Large, 3 * EFI_PAGE_SIZE, 0xA5);
+    Status = memory_pool_free(Large);
+    TEST_ASSERT(!EFI_ERROR(Status), "Large pool free should succeed");
+    
+    TEST_END("UEFI Memory Pool", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test UEFI Boot Cache
+ */
+STATIC EFI_STATUS TestUefiBootCache(VOID)
+{
+    EFI_STATUS Status;
+    UEFI_SYSTEM_INFO Info;
+    UEFI_CPU_INFO Cpu;
+    UEFI_CPU_INFO Cached;
+    STATIC UINT8 Oversized[BOOT_CACHE_SLOT_SIZE + 1];
+    
+    TEST_START("UEFI Boot Cache");
+    
+    Status = uefi_get_system_info(&Info);
+    TEST_ASSERT(!EFI_ERROR(Status), "System info should be available");
+    
+    ZeroMemory(&Cpu, sizeof(Cpu));
+    CopyMemory(Cpu.CpuVendor, Info.CpuVendor, sizeof(Cpu.CpuVendor));
+    CopyMemory(Cpu.CpuFamily, Info.CpuFamily, sizeof(Cpu.CpuFamily));
+    Cpu.CpuCores = Info.CpuCores;
+    Cpu.CpuThreads = Info.CpuThreads;
+    Cpu.CpuFeatures = Info.CpuFeatures;
+    
+    Status = boot_cache_load();
+    if (Status == EFI_UNSUPPORTED) {
+        Print(L"INFO: Boot cache disabled, skipping\n");
+        TEST_END("UEFI Boot Cache", EFI_SUCCESS);
+        return EFI_SUCCESS;
+    }
+    TEST_ASSERT(!EFI_ERROR(Status) || Status == EFI_NOT_FOUND, "Boot cache load should succeed or start empty");
+    
+    Status = boot_cache_set(BootCacheCpuInfo, &Cpu, sizeof(Cpu));
+    TEST_ASSERT(!EFI_ERROR(Status), "Storing the CPU probe should succeed");
+    
+    ZeroMemory(&Cached, sizeof(Cached));
+    Status = boot_cache_get(BootCacheCpuInfo, &Cached, sizeof(Cached));
+    TEST_ASSERT(!EFI_ERROR(Status), "The stored probe should be returned");
+    TEST_ASSERT(CompareMem(&Cached, &Cpu, sizeof(Cpu)) == 0, "The returned probe should match what was stored");
+    
+    Status = boot_cache_get(BootCacheCpuInfo, &Cached, sizeof(Cached) - 1);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "A probe of another size should not be returned");
+    
+    // Two boots in a row on unchanged hardware must not write NVRAM again
+    Status = boot_cache_flush();
+    TEST_ASSERT(!EFI_ERROR(Status), "Saving the cache should succeed");
+    
+    Status = boot_cache_load();
+    TEST_ASSERT(!EFI_ERROR(Status), "The saved cache should load");
+    Status = boot_cache_set(BootCacheCpuInfo, &Cpu, sizeof(Cpu));
+    TEST_ASSERT(!EFI_ERROR(Status), "Storing the same CPU probe should succeed");
+    TEST_ASSERT(!boot_cache_is_dirty(), "An unchanged CPU probe should not dirty the cache");
+    
+    Status = boot_cache_load();
+    TEST_ASSERT(!EFI_ERROR(Status), "The saved cache should load again");
+    Status = boot_cache_set(BootCacheCpuInfo, &Cpu, sizeof(Cpu));
+    TEST_ASSERT(!EFI_ERROR(Status) && !boot_cache_is_dirty(), "A second unchanged boot should not dirty the cache");
+    
+    Status = boot_cache_set(BootCacheCpuInfo, Oversized, sizeof(Oversized));
+    TEST_ASSERT(Status == EFI_BAD_BUFFER_SIZE, "Probes larger than a slot should be rejected");
+    
+    Status = boot_cache_get(BootCacheSlotCount, &Cached, sizeof(Cached));
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Invalid slots should be rejected");
+    
+    Status = boot_cache_set(BootCacheCpuInfo, NULL, sizeof(Cpu));
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL data should be rejected");
+    
+    TEST_END("UEFI Boot Cache", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test UEFI Interface Cleanup
  */
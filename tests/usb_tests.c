@@ -10,6 +10,10 @@
 #include <Library/DebugLib.h>
 #include "../src/usb/usb_driver.h"
 #include "../src/usb/usb_protocol.h"
+#include "../src/usb/usb_descriptor_cache.h"
+#include "../src/usb/usb_mass_storage.h"
+#include "../src/usb/usb_hid.h"
+#include "../src/usb/usb_dma.h"
 #include "../include/common.h"
 #include "../include/debug_utils.h"
 
@@ -74,6 +78,13 @@ STATIC EFI_STATUS TestUsbDriverInit(VOID);
 STATIC EFI_STATUS TestUsbDeviceDetection(VOID);
 STATIC EFI_STATUS TestUsbDeviceEnumeration(VOID);
 STATIC EFI_STATUS TestUsbDeviceCommunication(VOID);
+STATIC EFI_STATUS TestUsbBulkTransfer(VOID);
+STATIC EFI_STATUS TestUsbQueuedTransfer(VOID);
+STATIC EFI_STATUS TestUsbDescriptorCache(VOID);
+STATIC EFI_STATUS TestUsbMassStorage(VOID);
+STATIC EFI_STATUS TestUsbDma(VOID);
+STATIC EFI_STATUS TestUsbSuperSpeed(VOID);
+STATIC EFI_STATUS TestUsbHidReportCompiler(VOID);
 STATIC EFI_STATUS TestUsbDeviceClassification(VOID);
 STATIC EFI_STATUS TestUsbErrorHandling(VOID);
 STATIC EFI_STATUS TestUsbDriverCleanup(VOID);
@@ -119,6 +130,41 @@ RunUsbTests(VOID)
     if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
     else mTestStats.FailedTests++;
     
+    Status = TestUsbBulkTransfer();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbQueuedTransfer();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbDescriptorCache();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbMassStorage();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbDma();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbSuperSpeed();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
+    Status = TestUsbHidReportCompiler();
+    mTestStats.TotalTests++;
+    if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
+    else mTestStats.FailedTests++;
+    
     Status = TestUsbDeviceClassification();
     mTestStats.TotalTests++;
     if (!EFI_ERROR(Status)) mTestStats.PassedTests++;
@@ -171,16 +217,30 @@ STATIC EFI_STATUS TestUsbDriverInit(VOID)
 STATIC EFI_STATUS TestUsbDeviceDetection(VOID)
 {
     EFI_STATUS Status;
+    USB_DEVICE_INFO Before;
+    USB_DEVICE_INFO After;
+    UINTN Connected;
     
     TEST_START("USB Device Detection");
     
     // Test device detection
     Status = usb_device_detect();
     TEST_ASSERT(!EFI_ERROR(Status), "USB device detection should complete");
+    Connected = usb_get_connected_count();
     
     // Test multiple detection calls
     Status = usb_device_detect();
     TEST_ASSERT(!EFI_ERROR(Status), "Multiple detection calls should work");
+    TEST_ASSERT(usb_get_connected_count() == Connected, "Repeated detection should not duplicate devices");
+    
+    // A rescan with nothing plugged or unplugged leaves the table alone
+    if (!EFI_ERROR(usb_get_device_info(0, &Before))) {
+        Status = usb_device_rescan();
+        TEST_ASSERT(!EFI_ERROR(Status), "Rescan should complete");
+        TEST_ASSERT(usb_get_connected_count() == Connected, "Rescan without changes should keep the device count");
+        TEST_ASSERT(!EFI_ERROR(usb_get_device_info(0, &After)) && After.Handle == Before.Handle &&
+                    After.UsbIo == Before.UsbIo, "Rescan should keep device ids stable");
+    }
     
     TEST_END("USB Device Detection", EFI_SUCCESS);
     return EFI_SUCCESS;
@@ -192,6 +252,7 @@ STATIC EFI_STATUS TestUsbDeviceDetection(VOID)
 STATIC EFI_STATUS TestUsbDeviceEnumeration(VOID)
 {
     EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
     
     TEST_START("USB Device Enumeration");
     
@@ -209,6 +270,14 @@ STATIC EFI_STATUS TestUsbDeviceEnumeration(VOID)
         }
     }
     
+    // Every enumerated device belongs to one of the tracked controllers
+    TEST_ASSERT(usb_get_host_controller_count() > 0, "At least one host controller should be tracked");
+    for (UINTN i = 0; !EFI_ERROR(usb_get_device_info(i, &Info)); i++) {
+        TEST_ASSERT(Info.HostController == USB_HOST_CONTROLLER_NONE ||
+                    Info.HostController < usb_get_host_controller_count(),
+                    "Device host controller index should be in range");
+    }
+    
     TEST_END("USB Device Enumeration", EFI_SUCCESS);
     return EFI_SUCCESS;
 }
@@ -243,6 +312,412 @@ STATIC EFI_STATUS TestUsbDeviceCommunication(VOID)
     return EFI_SUCCESS;
 }
 
+/**
+ * Test USB Bulk Transfers and Endpoint Discovery
+ */
+STATIC EFI_STATUS TestUsbBulkTransfer(VOID)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    UINT8 TestBuffer[512];
+    UINTN Length;
+    UINTN DeviceId;
+    
+    TEST_START("USB Bulk Transfer");
+    
+    // Parameter validation
+    Length = sizeof(TestBuffer);
+    Status = usb_bulk_transfer(999, EfiUsbDataIn, TestBuffer, &Length);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Invalid device ID should return error");
+    
+    Status = usb_bulk_transfer(0, EfiUsbDataIn, TestBuffer, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL length should return error");
+    
+    Length = sizeof(TestBuffer);
+    Status = usb_bulk_transfer(0, EfiUsbNoData, TestBuffer, &Length);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "No-data direction should return error");
+    
+    // Every discovered endpoint must carry a usable max packet size
+    for (DeviceId = 0; !EFI_ERROR(usb_get_device_info(DeviceId, &Info)); DeviceId++) {
+        TEST_ASSERT(Info.BulkInEndpoint == 0 ||
+                    ((Info.BulkInEndpoint & USB_DIR_IN) != 0 && Info.BulkInMaxPacket != 0),
+                    "Bulk IN endpoint should be an IN address with a max packet");
+        TEST_ASSERT(Info.BulkOutEndpoint == 0 ||
+                    ((Info.BulkOutEndpoint & USB_DIR_IN) == 0 && Info.BulkOutMaxPacket != 0),
+                    "Bulk OUT endpoint should be an OUT address with a max packet");
+        
+        if (Info.BulkInEndpoint == 0) {
+            Length = sizeof(TestBuffer);
+            Status = usb_bulk_transfer(DeviceId, EfiUsbDataIn, TestBuffer, &Length);
+            TEST_ASSERT(Status == EFI_UNSUPPORTED, "Device without bulk IN should be rejected");
+        }
+    }
+    
+    Print(L"[INFO] Checked endpoints of %ld devices\n", DeviceId);
+    
+    TEST_END("USB Bulk Transfer", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Queued Transfers and Completion Events
+ */
+STATIC EFI_STATUS TestUsbQueuedTransfer(VOID)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    USB_TRANSFER_TOKEN Token;
+    UINT8 TestBuffer[512];
+    UINTN DeviceId;
+    UINTN EventIndex;
+    
+    TEST_START("USB Queued Transfer");
+    
+    TEST_ASSERT(usb_get_completion_event() != NULL, "Completion event should exist");
+    
+    // Parameter validation
+    ZeroMemory(&Token, sizeof(Token));
+    Token.Direction = EfiUsbDataIn;
+    Token.Buffer = TestBuffer;
+    Token.Length = sizeof(TestBuffer);
+    
+    Status = usb_transfer_submit(999, &Token);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Invalid device ID should return error");
+    
+    Status = usb_transfer_submit(0, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL token should return error");
+    
+    Status = usb_transfer_cancel(&Token);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Unqueued token should not be found");
+    
+    // Queue one read on the first device with a bulk IN endpoint
+    for (DeviceId = 0; !EFI_ERROR(usb_get_device_info(DeviceId, &Info)); DeviceId++) {
+        if (Info.BulkInEndpoint == 0) {
+            continue;
+        }
+        
+        Status = gBS->CreateEvent(0, TPL_CALLBACK, NULL, NULL, &Token.Event);
+        TEST_ASSERT(!EFI_ERROR(Status), "Token event creation should succeed");
+        
+        Token.Timeout = 100;
+        Status = usb_transfer_submit(DeviceId, &Token);
+        TEST_ASSERT(!EFI_ERROR(Status), "Submit should succeed");
+        
+        gBS->WaitForEvent(1, &Token.Event, &EventIndex);
+        TEST_ASSERT(Token.TransactionStatus != EFI_NOT_READY, "Transfer should be complete when signaled");
+        TEST_ASSERT(Token.Transferred <= Token.Length, "Transferred bytes should not exceed the request");
+        Print(L"[INFO] Queued read on device %ld: %r, %ld bytes\n",
+              DeviceId, Token.TransactionStatus, Token.Transferred);
+        
+        gBS->CloseEvent(Token.Event);
+        usb_transfer_reap();
+        break;
+    }
+    
+    TEST_END("USB Queued Transfer", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Descriptor Cache Hits, Misses and Key Matching
+ */
+STATIC EFI_STATUS TestUsbDescriptorCache(VOID)
+{
+    EFI_STATUS Status;
+    USB_DESCRIPTOR_CACHE_KEY Key;
+    USB_DEVICE_INFO Parsed;
+    USB_DEVICE_INFO Cached;
+    UINTN HitsBefore;
+    UINTN Hits;
+    UINTN Misses;
+    
+    TEST_START("USB Descriptor Cache");
+    
+    ZeroMemory(&Key, sizeof(Key));
+    Key.VendorId = 0xFFFE;
+    Key.ProductId = 0x1234;
+    Key.DeviceRevision = 0x0100;
+    Key.ConfigLength = 32;
+    Key.InterfaceNumber = 0;
+    Key.NumEndpoints = 2;
+    
+    ZeroMemory(&Parsed, sizeof(Parsed));
+    Parsed.InterfaceClass = USB_CLASS_MASS_STORAGE;
+    Parsed.BulkInEndpoint = 0x81;
+    Parsed.BulkInMaxPacket = 512;
+    Parsed.BulkOutEndpoint = 0x02;
+    Parsed.BulkOutMaxPacket = 512;
+    
+    Status = usb_descriptor_cache_store(&Key, &Parsed);
+    TEST_ASSERT(!EFI_ERROR(Status), "Store should succeed");
+    
+    usb_descriptor_cache_get_stats(&HitsBefore, NULL, NULL);
+    ZeroMemory(&Cached, sizeof(Cached));
+    Status = usb_descriptor_cache_lookup(&Key, &Cached);
+    TEST_ASSERT(!EFI_ERROR(Status), "Stored interface should hit");
+    TEST_ASSERT(Cached.BulkInEndpoint == 0x81 && Cached.BulkOutEndpoint == 0x02 &&
+                Cached.BulkInMaxPacket == 512 && Cached.InterfaceClass == USB_CLASS_MASS_STORAGE,
+                "Hit should restore the parsed endpoints");
+    
+    // A different configuration under the same VID/PID/bcdDevice must miss
+    Key.ConfigLength = 39;
+    Status = usb_descriptor_cache_lookup(&Key, &Cached);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Changed configuration should miss");
+    
+    usb_descriptor_cache_get_stats(&Hits, &Misses, NULL);
+    TEST_ASSERT(Hits == HitsBefore + 1, "Hit count should advance by one");
+    
+    // Drop the synthetic entry so it is never persisted
+    Status = usb_descriptor_cache_invalidate();
+    TEST_ASSERT(!EFI_ERROR(Status), "Invalidate should succeed");
+    Key.ConfigLength = 32;
+    TEST_ASSERT(usb_descriptor_cache_lookup(&Key, &Cached) == EFI_NOT_FOUND, "Invalidated entry should miss");
+    
+    TEST_END("USB Descriptor Cache", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Bulk-Only Transport Mass Storage Reads
+ */
+STATIC EFI_STATUS TestUsbMassStorage(VOID)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    UINT8 *Buffer;
+    UINTN DeviceId;
+    
+    TEST_START("USB Mass Storage");
+    
+    // Parameter validation
+    Status = usb_msc_attach(999);
+    TEST_ASSERT(EFI_ERROR(Status), "Invalid device ID should not attach");
+    
+    Status = usb_msc_get_capacity(999, &BlockSize, &BlockCount);
+    TEST_ASSERT(EFI_ERROR(Status), "Unattached device should have no capacity");
+    
+    Status = usb_msc_read(0, 0, 0, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Empty read should return error");
+    
+    // Read the first blocks of every SCSI/BOT device found
+    for (DeviceId = 0; !EFI_ERROR(usb_get_device_info(DeviceId, &Info)); DeviceId++) {
+        if (!Info.IsConnected || Info.InterfaceClass != USB_CLASS_MASS_STORAGE ||
+            Info.InterfaceProtocol != USB_MSC_PROTOCOL_BOT) {
+            continue;
+        }
+        
+        Status = usb_msc_get_capacity(DeviceId, &BlockSize, &BlockCount);
+        Print(L"[INFO] Mass storage device %ld: %r, %ld blocks of %d bytes\n",
+              DeviceId, Status, BlockCount, BlockSize);
+        if (EFI_ERROR(Status)) {
+            // No medium is not a transport failure
+            continue;
+        }
+        
+        TEST_ASSERT(BlockSize != 0 && BlockCount != 0, "Capacity should be non-zero");
+        
+        Status = usb_msc_read(DeviceId, BlockCount, 1, &Info);
+        TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Read past the last block should be rejected");
+        
+        Buffer = AllocatePool(USB_MSC_MAX_TRANSFER_SIZE * 2);
+        if (Buffer != NULL && BlockCount >= (USB_MSC_MAX_TRANSFER_SIZE * 2) / BlockSize) {
+            // Spans two BOT commands
+            Status = usb_msc_read(DeviceId, 0, (USB_MSC_MAX_TRANSFER_SIZE * 2) / BlockSize, Buffer);
+            TEST_ASSERT(!EFI_ERROR(Status), "Multi-command read should succeed");
+        }
+        if (Buffer != NULL) {
+            FreePool(Buffer);
+        }
+    }
+    
+    TEST_END("USB Mass Storage", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test Pre-mapped DMA Buffers
+ */
+STATIC EFI_STATUS TestUsbDma(VOID)
+{
+    EFI_STATUS Status;
+    USB_DEVICE_INFO Info;
+    EFI_PHYSICAL_ADDRESS DeviceAddress;
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    UINT8 *First;
+    UINT8 *Second;
+    UINT8 *Again;
+    VOID *Cbw;
+    UINTN DeviceId;
+    
+    TEST_START("USB DMA Buffers");
+    
+    // Parameter validation
+    Status = usb_dma_alloc(0, 0, (VOID **)&First, NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "Empty slice should be rejected");
+    
+    Status = usb_dma_alloc(999, EFI_PAGE_SIZE, (VOID **)&First, NULL);
+    TEST_ASSERT(EFI_ERROR(Status), "Invalid device ID should get no slice");
+    
+    Status = usb_dma_free(&Info);
+    TEST_ASSERT(Status == EFI_NOT_FOUND, "Memory outside every region should be rejected");
+    
+    for (DeviceId = 0; !EFI_ERROR(usb_get_device_info(DeviceId, &Info)); DeviceId++) {
+        if (!Info.IsConnected || Info.InterfaceClass != USB_CLASS_MASS_STORAGE) {
+            continue;
+        }
+        
+        Status = usb_dma_alloc(DeviceId, USB_MSC_MAX_TRANSFER_SIZE, (VOID **)&First, &DeviceAddress);
+        if (Status == EFI_UNSUPPORTED) {
+            Print(L"[INFO] Device %ld: no PCI host controller common buffer\n", DeviceId);
+            continue;
+        }
+        TEST_ASSERT(!EFI_ERROR(Status), "Slice allocation should succeed");
+        TEST_ASSERT(((UINTN)First & EFI_PAGE_MASK) == 0 && (DeviceAddress & EFI_PAGE_MASK) == 0,
+                    "Slices should be page aligned on both sides of the mapping");
+        
+        // Attach ran before the device table had the path; it must still get a command page
+        Status = usb_msc_get_command_buffer(DeviceId, &Cbw);
+        TEST_ASSERT(!EFI_ERROR(Status) && usb_dma_contains(Cbw),
+                    "The attached device's CBW should lie in its controller's DMA region");
+        
+        Status = usb_dma_alloc(DeviceId, 1, (VOID **)&Second, NULL);
+        TEST_ASSERT(!EFI_ERROR(Status) && Second != First, "A second slice should not overlap the first");
+        
+        TEST_ASSERT(usb_dma_free(First + 1) == EFI_INVALID_PARAMETER, "Addresses inside a slice should be rejected");
+        
+        // The read lands in the slice; the CBW and CSW use the device's command page
+        if (!EFI_ERROR(usb_msc_get_capacity(DeviceId, &BlockSize, &BlockCount)) &&
+            BlockSize <= USB_MSC_MAX_TRANSFER_SIZE) {
+            Status = usb_msc_read(DeviceId, 0, USB_MSC_MAX_TRANSFER_SIZE / BlockSize, First);
+            TEST_ASSERT(!EFI_ERROR(Status), "Read into a DMA slice should succeed");
+        }
+        
+        Status = usb_dma_free(First);
+        TEST_ASSERT(!EFI_ERROR(Status), "Slice free should succeed");
+        Status = usb_dma_alloc(DeviceId, USB_MSC_MAX_TRANSFER_SIZE, (VOID **)&Again, NULL);
+        TEST_ASSERT(!EFI_ERROR(Status) && Again == First, "Freed slices should be reused");
+        
+        usb_dma_free(Again);
+        usb_dma_free(Second);
+        TEST_ASSERT(usb_dma_free(Second) == EFI_INVALID_PARAMETER, "Double free should be rejected");
+        break;
+    }
+    
+    TEST_END("USB DMA Buffers", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test SuperSpeed Endpoint Parameters
+ */
+STATIC EFI_STATUS TestUsbSuperSpeed(VOID)
+{
+    USB_DEVICE_INFO Info;
+    UINTN DeviceId;
+    UINTN SuperSpeedCount;
+    
+    TEST_START("USB SuperSpeed");
+    
+    SuperSpeedCount = 0;
+    
+    for (DeviceId = 0; !EFI_ERROR(usb_get_device_info(DeviceId, &Info)); DeviceId++) {
+        if (!Info.IsConnected) {
+            continue;
+        }
+        
+        TEST_ASSERT(!Info.SuperSpeed || Info.UsbRevision >= 0x0300,
+                    "SuperSpeed devices should report bcdUSB 3.x");
+        
+        if (Info.BulkInEndpoint != 0) {
+            TEST_ASSERT(Info.BulkInMaxBurst >= 1 && Info.BulkInMaxBurst <= USB_SS_MAX_BURST,
+                        "Bulk IN burst should be 1-16 packets");
+            TEST_ASSERT(Info.SuperSpeed || Info.BulkInMaxBurst == 1,
+                        "Only SuperSpeed endpoints should burst");
+            TEST_ASSERT(!Info.SuperSpeed || Info.BulkInMaxPacket == USB_SS_MAX_PACKET_SIZE,
+                        "SuperSpeed bulk IN should use 1024-byte packets");
+        }
+        
+        if (Info.BulkOutEndpoint != 0) {
+            TEST_ASSERT(Info.BulkOutMaxBurst >= 1 && Info.BulkOutMaxBurst <= USB_SS_MAX_BURST,
+                        "Bulk OUT burst should be 1-16 packets");
+            TEST_ASSERT(Info.SuperSpeed || Info.BulkOutMaxBurst == 1,
+                        "Only SuperSpeed endpoints should burst");
+        }
+        
+        if (Info.SuperSpeed) {
+            SuperSpeedCount++;
+            Print(L"[INFO] Device %ld: SuperSpeed, bursts IN %d / OUT %d, UAS %s\n",
+                  DeviceId, Info.BulkInMaxBurst, Info.BulkOutMaxBurst,
+                  Info.UasCapable ? L"available" : L"not offered");
+        }
+    }
+    
+    Print(L"[INFO] %ld SuperSpeed devices\n", SuperSpeedCount);
+    
+    TEST_END("USB SuperSpeed", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
+/**
+ * Test HID Report Descriptor Compilation
+ */
+STATIC EFI_STATUS TestUsbHidReportCompiler(VOID)
+{
+    EFI_STATUS Status;
+    USB_HID_FIELD Fields[8];
+    UINTN FieldCount;
+    EFI_INPUT_KEY Key;
+    
+    // Mouse with report id 2: 5 buttons, 3 bits padding, 16-bit X/Y, 8-bit wheel
+    STATIC CONST UINT8 MouseDescriptor[] = {
+        0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00,
+        0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05,
+        0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01, 0x05, 0x01,
+        0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10,
+        0x95, 0x02, 0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08,
+        0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0
+    };
+    
+    TEST_START("USB HID Report Compiler");
+    
+    Status = usb_hid_compile_report_descriptor(NULL, 0, Fields, ARRAY_SIZE(Fields), &FieldCount);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL descriptor should return error");
+    
+    Status = usb_hid_compile_report_descriptor(MouseDescriptor, sizeof(MouseDescriptor),
+                                               Fields, ARRAY_SIZE(Fields), &FieldCount);
+    TEST_ASSERT(!EFI_ERROR(Status), "Mouse descriptor should compile");
+    TEST_ASSERT(FieldCount == 3, "Buttons, X/Y and wheel should compile to three entries");
+    
+    TEST_ASSERT(Fields[0].UsagePage == USB_HID_PAGE_BUTTON && Fields[0].Usage == 1 &&
+                Fields[0].Count == 5 && Fields[0].BitSize == 1 && Fields[0].BitOffset == 0,
+                "Buttons should be one 5 x 1-bit entry at bit 0");
+    TEST_ASSERT(Fields[1].UsagePage == USB_HID_PAGE_GENERIC_DESKTOP && Fields[1].Usage == 0x30 &&
+                Fields[1].Count == 2 && Fields[1].BitSize == 16 && Fields[1].BitOffset == 8 &&
+                (Fields[1].Flags & USB_HID_FIELD_SIGNED) != 0,
+                "X/Y should merge into one signed 2 x 16-bit entry after the padding");
+    TEST_ASSERT(Fields[2].Usage == 0x38 && Fields[2].BitOffset == 40 && Fields[2].BitSize == 8,
+                "Wheel should follow X/Y");
+    TEST_ASSERT(Fields[0].ReportId == 2 && Fields[2].ReportId == 2, "Fields should carry the report id");
+    
+    Status = usb_hid_compile_report_descriptor(MouseDescriptor, sizeof(MouseDescriptor), Fields, 1, &FieldCount);
+    TEST_ASSERT(Status == EFI_BUFFER_TOO_SMALL && FieldCount == 1, "Overflow should keep the entries that fit");
+    
+    Status = usb_hid_read_key(NULL);
+    TEST_ASSERT(Status == EFI_INVALID_PARAMETER, "NULL key should return error");
+    
+    // Drain anything typed on USB keyboards during the run
+    while (!EFI_ERROR(usb_hid_read_key(&Key))) {
+    }
+    Status = usb_hid_read_key(&Key);
+    TEST_ASSERT(Status == EFI_NOT_READY, "Empty key buffer should return EFI_NOT_READY");
+    
+    TEST_END("USB HID Report Compiler", EFI_SUCCESS);
+    return EFI_SUCCESS;
+}
+
 /**
  * Test USB Device Classification
  */
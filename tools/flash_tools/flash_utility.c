@@ -1,43 +1,83 @@
 /**
  * @file flash_utility.c
  * @brief Complete Flash utility for firmware operations
+ *
+ * Works on MTD character devices (/dev/mtdN, which is also how SPI NOR parts
+ * behind the kernel spi-nor driver appear), raw block devices and plain image
+ * files. Block devices and files are opened with O_DIRECT, transfers are kept
+ * in flight through a queue of aligned buffers with POSIX AIO, and input
+ * images are mapped instead of being copied through stdio.
+ *
+ * Giving several devices (repeated -d, or a glob) runs a batch: the image is
+ * mapped and hashed once and every device is driven from its own thread.
+ *
+ * Build: cc -O2 -pthread -DINTEGRITY_HOST_BUILD -Isrc/firmware \
+ *           tools/flash_tools/flash_utility.c src/firmware/integrity.c -lrt
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
 #include <getopt.h>
 
 #ifdef _WIN32
-    #include <windows.h>
-    #include <io.h>
-    #define PLATFORM_WINDOWS
+    #error "flash_utility needs POSIX device I/O (MTD ioctls, O_DIRECT, AIO); build it on Linux"
 #else
     #include <unistd.h>
     #include <fcntl.h>
+    #include <aio.h>
+    #include <glob.h>
+    #include <pthread.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
     #include <sys/stat.h>
+    #include <linux/fs.h>
+    #include <mtd/mtd-user.h>
     #define PLATFORM_LINUX
 #endif
 
+// CRC32C / SHA-256 engine shared with the firmware
+#include "integrity.h"
+
 // Flash utility version
 #define FLASH_UTIL_VERSION_MAJOR    1
-#define FLASH_UTIL_VERSION_MINOR    0
+#define FLASH_UTIL_VERSION_MINOR    1
 #define FLASH_UTIL_VERSION_PATCH    0
 
 // Maximum buffer size for operations
 #define MAX_BUFFER_SIZE             (16 * 1024 * 1024)  // 16MB
-#define DEFAULT_BUFFER_SIZE         (64 * 1024)         // 64KB
+#define DEFAULT_BUFFER_SIZE         (256 * 1024)        // 256KB per request
 #define SECTOR_SIZE                 4096                // 4KB sectors
+#define IO_ALIGNMENT                4096                // O_DIRECT buffer, offset and length alignment
+#define DEFAULT_QUEUE_DEPTH         8                   // Requests kept in flight
+#define MAX_QUEUE_DEPTH             32
+#define MAX_BATCH_DEVICES           64                  // Devices flashed in parallel
+#define BATCH_REFRESH_MS            200                 // Batch progress redraw period
+
+// Flash device types
+typedef enum {
+    DEVICE_IMAGE_FILE,
+    DEVICE_BLOCK,
+    DEVICE_MTD
+} device_type_t;
 
 // Flash device information
 typedef struct {
     char device_path[256];
+    device_type_t type;
+    int fd;
     uint32_t total_size;
-    uint32_t sector_size;
-    uint32_t device_id;
-    uint16_t vendor_id;
+    uint32_t sector_size;       // Erase granularity
+    uint32_t write_size;        // Smallest program unit (MTD only)
+    uint32_t mtd_type;          // MTD_NORFLASH, MTD_NANDFLASH, ...
+    bool supports_direct_io;
     bool write_protected;
     bool detected;
 } flash_device_info_t;
@@ -58,34 +98,120 @@ typedef enum {
 typedef struct {
     operation_type_t operation;
     char device_path[256];
+    glob_t devices;             // Every -d, glob-expanded; more than one runs a batch
     char input_file[256];
     char output_file[256];
     uint32_t address;
     uint32_t size;
     uint32_t buffer_size;
+    uint32_t queue_depth;
     bool verbose;
     bool force;
     bool verify_after_write;
+    bool delta;
+    bool buffered;
 } config_t;
 
+// Image file mapped read-only
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t crc;               // CRC32C of the whole image
+    uint8_t digest[SHA256_DIGEST_SIZE];
+} image_map_t;
+
+// Ring of aligned buffers kept in flight with POSIX AIO
+typedef struct {
+    int fd;
+    bool direct;                // fd is in O_DIRECT mode
+    uint32_t depth;
+    uint32_t buffer_size;
+    uint8_t *buffers[MAX_QUEUE_DEPTH];
+    struct aiocb requests[MAX_QUEUE_DEPTH];
+    uint32_t lengths[MAX_QUEUE_DEPTH];  // Bytes wanted from each request
+    uint32_t head;              // Oldest request
+    uint32_t pending;           // Requests not yet handed back, head included
+    bool held;                  // Head buffer is with the caller of io_read_next
+    uint64_t next_offset;       // Next read to submit
+    uint64_t end_offset;
+} io_queue_t;
+
+// Sector counts of a programming pass
+typedef struct {
+    uint32_t unchanged;
+    uint32_t erased;
+    uint32_t programmed;
+} program_stats_t;
+
+// One device of a batch and the worker thread driving it
+typedef struct {
+    const config_t *config;
+    const image_map_t *image;
+    flash_device_info_t info;
+    pthread_t thread;
+    bool started;
+    const char *path;
+    const char *operation;      // Last print_progress label
+    size_t current;
+    size_t total;
+    bool finished;
+    int result;
+    double seconds;
+    char error[192];            // First error the worker reported
+} batch_device_t;
+
 // Function prototypes
 static void show_usage(const char *program_name);
 static void show_version(void);
 static int parse_arguments(int argc, char *argv[], config_t *config);
 static int detect_flash_device(const char *device_path, flash_device_info_t *info);
+static void normalize_buffer_size(config_t *config, const flash_device_info_t *info);
+static int open_device(flash_device_info_t *info, bool probe_direct);
+static void close_flash_device(flash_device_info_t *info);
+static int set_direct_io(int fd, bool enable);
+static int map_image(const char *path, image_map_t *image);
+static void unmap_image(image_map_t *image);
+static int io_queue_open(io_queue_t *queue, const config_t *config, const flash_device_info_t *info, uint32_t address);
+static void io_queue_close(io_queue_t *queue);
+static int io_read_begin(io_queue_t *queue, uint64_t offset, uint32_t size);
+static int io_read_next(io_queue_t *queue, const uint8_t **data, uint32_t *length);
+static int io_write(io_queue_t *queue, uint64_t offset, const uint8_t *data, uint32_t length);
+static int io_write_drain(io_queue_t *queue);
+static int program_sectors(const config_t *config, const flash_device_info_t *info,
+                           const image_map_t *image, uint32_t address, program_stats_t *stats);
+static int verify_range(const config_t *config, const flash_device_info_t *info,
+                        const image_map_t *image, uint32_t address);
 static int read_flash(const config_t *config, const flash_device_info_t *info);
 static int write_flash(const config_t *config, const flash_device_info_t *info);
+static int write_image(const config_t *config, const flash_device_info_t *info,
+                       const image_map_t *image, uint32_t address);
+static int check_restore_size(const config_t *config, const flash_device_info_t *info, uint32_t image_size);
 static int erase_flash(const config_t *config, const flash_device_info_t *info);
 static int verify_flash(const config_t *config, const flash_device_info_t *info);
 static int backup_flash(const config_t *config, const flash_device_info_t *info);
 static int restore_flash(const config_t *config, const flash_device_info_t *info);
 static int show_flash_info(const config_t *config, const flash_device_info_t *info);
-static uint32_t calculate_checksum(const void *data, size_t size);
+static int run_batch(config_t *config);
+static void *batch_worker(void *context);
+static void print_batch_progress(const batch_device_t *devices, uint32_t count, bool redraw);
+static void report(const char *format, ...);
+static void report_error(const char *format, ...);
+static uint32_t calculate_checksum(uint32_t crc, const void *data, size_t size);
+static void print_digest(const char *label, const uint8_t *digest);
 static void print_progress(size_t current, size_t total, const char *operation);
+static void print_rate(const char *operation, uint32_t bytes, const struct timespec *start);
+static double elapsed_seconds(const struct timespec *start);
 static const char *format_size(uint32_t size);
+static uint32_t align_up(uint32_t value, uint32_t alignment);
 static uint32_t parse_size_string(const char *str);
 static uint32_t parse_address_string(const char *str);
 
+// Batch device of the calling worker thread; NULL outside a batch
+static __thread batch_device_t *tls_batch_device = NULL;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_finished = PTHREAD_COND_INITIALIZER;   // A worker finished
+
 /**
  * Main entry point
  */
@@ -94,15 +220,27 @@ int main(int argc, char *argv[]) {
     flash_device_info_t flash_info = {0};
     int result = 0;
     
+    flash_info.fd = -1;
+    
     printf("Flash Utility v%d.%d.%d\n", 
            FLASH_UTIL_VERSION_MAJOR, FLASH_UTIL_VERSION_MINOR, FLASH_UTIL_VERSION_PATCH);
     printf("USB UEFI Firmware Flash Management Tool\n\n");
     
+    // Select accelerated CRC32C/SHA-256 paths for this CPU
+    integrity_init(integrity_host_cpu_features());
+    
     // Parse command line arguments
     if (parse_arguments(argc, argv, &config) != 0) {
         return 1;
     }
     
+    // Several devices run as a batch, one worker thread each
+    if (config.devices.gl_pathc > 1) {
+        result = run_batch(&config);
+        globfree(&config.devices);
+        return result;
+    }
+    
     // Detect flash device
     if (strlen(config.device_path) > 0) {
         printf("Detecting flash device: %s\n", config.device_path);
@@ -110,6 +248,7 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Error: Failed to detect flash device\n");
             return 1;
         }
+        normalize_buffer_size(&config, &flash_info);
     }
     
     // Execute requested operation
@@ -141,6 +280,9 @@ int main(int argc, char *argv[]) {
             break;
     }
     
+    close_flash_device(&flash_info);
+    if (config.devices.gl_pathv) globfree(&config.devices);
+    
     if (result == 0) {
         printf("\nOperation completed successfully.\n");
     } else {
@@ -164,12 +306,17 @@ static void show_usage(const char *program_name) {
     printf("  -R, --restore FILE          Restore flash from backup\n");
     printf("  -i, --info                  Show flash information\n");
     printf("\nOptions:\n");
-    printf("  -d, --device PATH           Flash device path\n");
+    printf("  -d, --device PATH           Flash device path; repeat it or quote a glob\n");
+    printf("                              to flash several devices in parallel\n");
     printf("  -o, --output FILE           Output file for read operations\n");
-    printf("  -s, --buffer-size SIZE      Buffer size for operations\n");
+    printf("  -s, --buffer-size SIZE      Bytes per transfer (default 256K)\n");
+    printf("  -q, --queue-depth N         Transfers kept in flight (1-%d, default %d)\n",
+           MAX_QUEUE_DEPTH, DEFAULT_QUEUE_DEPTH);
     printf("  -f, --force                 Force operation (skip warnings)\n");
     printf("  -V, --verbose               Verbose output\n");
     printf("  --verify-after-write        Verify data after write\n");
+    printf("  --delta                     Only erase and program sectors that change\n");
+    printf("  --buffered                  Do not use O_DIRECT on block devices and files\n");
     printf("  --version                   Show version information\n");
     printf("  -h, --help                  Show this help\n");
     printf("\nExamples:\n");
@@ -177,6 +324,8 @@ static void show_usage(const char *program_name) {
     printf("  %s -d /dev/mtd0 -r 0x0 0x10000 -o firmware.bin\n", program_name);
     printf("  %s -d /dev/mtd0 -w 0x10000 update.bin\n", program_name);
     printf("  %s -d /dev/mtd0 -b full_backup.bin\n", program_name);
+    printf("  %s -d /dev/mtd0 -R full_backup.bin --delta --verify-after-write\n", program_name);
+    printf("  %s -d '/dev/mtd[0-7]' -w 0x0 image.bin --verify-after-write\n", program_name);
 }
 
 /**
@@ -186,11 +335,7 @@ static void show_version(void) {
     printf("Flash Utility v%d.%d.%d\n", 
            FLASH_UTIL_VERSION_MAJOR, FLASH_UTIL_VERSION_MINOR, FLASH_UTIL_VERSION_PATCH);
     printf("Built: %s %s\n", __DATE__, __TIME__);
-#ifdef PLATFORM_WINDOWS
-    printf("Platform: Windows\n");
-#else
     printf("Platform: Linux\n");
-#endif
     printf("Copyright (c) 2025 USB UEFI Firmware Project\n");
 }
 
@@ -212,19 +357,23 @@ static int parse_arguments(int argc, char *argv[], config_t *config) {
         {"device",            required_argument, 0, 'd'},
         {"output",            required_argument, 0, 'o'},
         {"buffer-size",       required_argument, 0, 's'},
+        {"queue-depth",       required_argument, 0, 'q'},
         {"force",             no_argument,       0, 'f'},
         {"verbose",           no_argument,       0, 'V'},
         {"verify-after-write", no_argument,      0, 1000},
         {"version",           no_argument,       0, 1001},
+        {"delta",             no_argument,       0, 1002},
+        {"buffered",          no_argument,       0, 1003},
         {"help",              no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
     
     // Set defaults
     config->buffer_size = DEFAULT_BUFFER_SIZE;
+    config->queue_depth = DEFAULT_QUEUE_DEPTH;
     config->operation = OP_NONE;
     
-    while ((opt = getopt_long(argc, argv, "r:w:e:v:b:R:id:o:s:fVh", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "r:w:e:v:b:R:id:o:s:q:fVh", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'r':
                 config->operation = OP_READ;
@@ -266,7 +415,13 @@ static int parse_arguments(int argc, char *argv[], config_t *config) {
                 config->operation = OP_INFO;
                 break;
             case 'd':
-                strncpy(config->device_path, optarg, sizeof(config->device_path) - 1);
+                // A pattern that matches nothing is kept, so detection reports it
+                if (glob(optarg, GLOB_NOCHECK | (config->devices.gl_pathv ? GLOB_APPEND : 0),
+                         NULL, &config->devices) != 0) {
+                    fprintf(stderr, "Cannot expand device list %s\n", optarg);
+                    return 1;
+                }
+                strncpy(config->device_path, config->devices.gl_pathv[0], sizeof(config->device_path) - 1);
                 break;
             case 'o':
                 strncpy(config->output_file, optarg, sizeof(config->output_file) - 1);
@@ -274,6 +429,13 @@ static int parse_arguments(int argc, char *argv[], config_t *config) {
             case 's':
                 config->buffer_size = parse_size_string(optarg);
                 break;
+            case 'q':
+                config->queue_depth = parse_size_string(optarg);
+                if (config->queue_depth < 1 || config->queue_depth > MAX_QUEUE_DEPTH) {
+                    fprintf(stderr, "Queue depth must be between 1 and %d\n", MAX_QUEUE_DEPTH);
+                    return 1;
+                }
+                break;
             case 'f':
                 config->force = true;
                 break;
@@ -283,6 +445,12 @@ static int parse_arguments(int argc, char *argv[], config_t *config) {
             case 1000:
                 config->verify_after_write = true;
                 break;
+            case 1002:
+                config->delta = true;
+                break;
+            case 1003:
+                config->buffered = true;
+                break;
             case 1001:
                 show_version();
                 exit(0);
@@ -304,333 +472,1350 @@ static int parse_arguments(int argc, char *argv[], config_t *config) {
  * Detect flash device and gather information
  */
 static int detect_flash_device(const char *device_path, flash_device_info_t *info) {
+    struct stat st;
+    uint64_t total_size = 0;
+    
     strncpy(info->device_path, device_path, sizeof(info->device_path) - 1);
+    info->fd = -1;
     
-#ifdef PLATFORM_WINDOWS
-    HANDLE hDevice = CreateFileA(device_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-    if (hDevice == INVALID_HANDLE_VALUE) {
-        fprintf(stderr, "Error: Cannot open device %s\n", device_path);
+    if (stat(device_path, &st) != 0) {
+        report_error("Error: Cannot open device %s: %s\n", device_path, strerror(errno));
         return 1;
     }
     
-    LARGE_INTEGER size;
-    if (GetFileSizeEx(hDevice, &size)) {
-        info->total_size = (uint32_t)size.QuadPart;
+    if (S_ISCHR(st.st_mode)) {
+        struct mtd_info_user mtd;
+        
+        // MTD has no O_DIRECT; its reads and writes already bypass the page cache
+        if (open_device(info, false) != 0) {
+            return 1;
+        }
+        if (ioctl(info->fd, MEMGETINFO, &mtd) != 0) {
+            report_error("Error: %s is not an MTD device\n", device_path);
+            close_flash_device(info);
+            return 1;
+        }
+        info->type = DEVICE_MTD;
+        info->sector_size = mtd.erasesize;
+        info->write_size = mtd.writesize;
+        info->mtd_type = mtd.type;
+        if ((mtd.flags & MTD_WRITEABLE) == 0) {
+            info->write_protected = true;
+        }
+        total_size = mtd.size;
+    } else if (S_ISBLK(st.st_mode)) {
+        int logical_size = 0;
+        
+        if (open_device(info, true) != 0) {
+            return 1;
+        }
+        if (ioctl(info->fd, BLKGETSIZE64, &total_size) != 0 ||
+            ioctl(info->fd, BLKSSZGET, &logical_size) != 0) {
+            report_error("Error: Cannot query block device %s: %s\n", device_path, strerror(errno));
+            close_flash_device(info);
+            return 1;
+        }
+        info->type = DEVICE_BLOCK;
+        info->sector_size = ((uint32_t)logical_size > SECTOR_SIZE) ? (uint32_t)logical_size : SECTOR_SIZE;
+    } else if (S_ISREG(st.st_mode)) {
+        if (open_device(info, true) != 0) {
+            return 1;
+        }
+        info->type = DEVICE_IMAGE_FILE;
+        info->sector_size = SECTOR_SIZE;
+        total_size = st.st_size;
     } else {
-        info->total_size = 16 * 1024 * 1024; // Default 16MB
-    }
-    CloseHandle(hDevice);
-#else
-    int fd = open(device_path, O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "Error: Cannot open device %s\n", device_path);
+        report_error("Error: %s is not an MTD device, block device or image file\n", device_path);
         return 1;
     }
     
-    struct stat st;
-    if (fstat(fd, &st) == 0) {
-        info->total_size = st.st_size;
-    } else {
-        info->total_size = 16 * 1024 * 1024; // Default 16MB
+    if (total_size > UINT32_MAX || info->sector_size == 0) {
+        report_error("Error: Unsupported geometry on %s\n", device_path);
+        close_flash_device(info);
+        return 1;
     }
-    close(fd);
-#endif
     
-    // Set default values
-    info->sector_size = SECTOR_SIZE;
-    info->device_id = 0x12345678;
-    info->vendor_id = 0xABCD;
-    info->write_protected = false;
+    info->total_size = (uint32_t)total_size;
     info->detected = true;
     
     return 0;
 }
 
 /**
- * Read flash memory
+ * Round the transfer size to whole sectors of a device
  */
-static int read_flash(const config_t *config, const flash_device_info_t *info) {
-    FILE *output_fp = NULL;
-    uint8_t *buffer = NULL;
-    uint32_t bytes_read = 0;
-    int result = 1;
-    
-    if (!info->detected) {
-        fprintf(stderr, "Error: Flash device not detected\n");
-        return 1;
+static void normalize_buffer_size(config_t *config, const flash_device_info_t *info) {
+    // Whole sectors per request keep O_DIRECT and the sector pass aligned
+    if (config->buffer_size == 0 || config->buffer_size > MAX_BUFFER_SIZE) {
+        config->buffer_size = DEFAULT_BUFFER_SIZE;
     }
-    
-    printf("Reading %s bytes from address 0x%08X\n", 
-           format_size(config->size), config->address);
-    
-    // Allocate buffer
-    buffer = malloc(config->buffer_size);
-    if (!buffer) {
-        fprintf(stderr, "Error: Cannot allocate buffer\n");
-        return 1;
+    config->buffer_size = align_up(config->buffer_size, info->sector_size);
+}
+
+/**
+ * Open the device read-write, falling back to read-only
+ */
+static int open_device(flash_device_info_t *info, bool probe_direct) {
+    info->fd = open(info->device_path, O_RDWR | O_CLOEXEC);
+    if (info->fd < 0 && (errno == EACCES || errno == EPERM || errno == EROFS)) {
+        info->fd = open(info->device_path, O_RDONLY | O_CLOEXEC);
+        info->write_protected = true;
     }
     
-    // Open output file
-    if (strlen(config->output_file) > 0) {
-        output_fp = fopen(config->output_file, "wb");
-        if (!output_fp) {
-            fprintf(stderr, "Error: Cannot create output file %s\n", config->output_file);
-            goto cleanup;
-        }
-    } else {
-        output_fp = stdout;
+    if (info->fd < 0) {
+        report_error("Error: Cannot open device %s: %s\n", info->device_path, strerror(errno));
+        return 1;
     }
     
-    // Simulate flash read operation
-    uint32_t remaining = config->size;
-    uint32_t address = config->address;
+    // Filesystems such as tmpfs refuse O_DIRECT; those are used buffered
+    info->supports_direct_io = probe_direct && set_direct_io(info->fd, true) == 0;
+    set_direct_io(info->fd, false);
     
-    while (remaining > 0) {
-        uint32_t chunk_size = (remaining > config->buffer_size) ? config->buffer_size : remaining;
-        
-        // Simulate reading from flash
-        memset(buffer, 0xFF, chunk_size); // Flash default pattern
-        
-        // Write to output
-        if (fwrite(buffer, 1, chunk_size, output_fp) != chunk_size) {
-            fprintf(stderr, "Error: Write to output failed\n");
-            goto cleanup;
-        }
-        
-        bytes_read += chunk_size;
-        remaining -= chunk_size;
-        address += chunk_size;
-        
-        print_progress(bytes_read, config->size, "Reading");
+    return 0;
+}
+
+/**
+ * Close the device opened by detect_flash_device
+ */
+static void close_flash_device(flash_device_info_t *info) {
+    if (info->fd >= 0) {
+        close(info->fd);
+        info->fd = -1;
     }
+}
+
+/**
+ * Switch O_DIRECT on or off for an open descriptor
+ */
+static int set_direct_io(int fd, bool enable) {
+    int flags = fcntl(fd, F_GETFL);
     
-    printf("\nRead %s bytes successfully\n", format_size(bytes_read));
-    result = 0;
+    if (flags < 0) {
+        return -1;
+    }
     
-cleanup:
-    if (buffer) free(buffer);
-    if (output_fp && output_fp != stdout) fclose(output_fp);
-    return result;
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, flags);
 }
 
 /**
- * Write to flash memory
+ * Map an image file read-only
  */
-static int write_flash(const config_t *config, const flash_device_info_t *info) {
-    FILE *input_fp = NULL;
-    uint8_t *buffer = NULL;
-    uint32_t bytes_written = 0;
-    uint32_t file_size = 0;
-    int result = 1;
+static int map_image(const char *path, image_map_t *image) {
+    struct stat st;
+    void *data;
     
-    if (!info->detected) {
-        fprintf(stderr, "Error: Flash device not detected\n");
+    memset(image, 0, sizeof(*image));
+    image->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (image->fd < 0) {
+        report_error("Error: Cannot open input file %s: %s\n", path, strerror(errno));
         return 1;
     }
     
-    if (info->write_protected && !config->force) {
-        fprintf(stderr, "Error: Device is write protected. Use --force to override\n");
+    if (fstat(image->fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > UINT32_MAX) {
+        report_error("Error: %s is empty or too large\n", path);
+        close(image->fd);
         return 1;
     }
     
-    // Open input file
-    input_fp = fopen(config->input_file, "rb");
-    if (!input_fp) {
-        fprintf(stderr, "Error: Cannot open input file %s\n", config->input_file);
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, image->fd, 0);
+    if (data == MAP_FAILED) {
+        report_error("Error: Cannot map input file %s: %s\n", path, strerror(errno));
+        close(image->fd);
         return 1;
     }
     
-    // Get file size
-    fseek(input_fp, 0, SEEK_END);
-    file_size = ftell(input_fp);
-    fseek(input_fp, 0, SEEK_SET);
+    // The image is consumed front to back, once
+    madvise(data, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
     
-    printf("Writing %s to address 0x%08X\n", 
-           format_size(file_size), config->address);
+    image->data = data;
+    image->size = (uint32_t)st.st_size;
     
-    // Allocate buffer
-    buffer = malloc(config->buffer_size);
-    if (!buffer) {
-        fprintf(stderr, "Error: Cannot allocate buffer\n");
-        goto cleanup;
-    }
+    // Hashed once here; write reports and every verify reuse it
+    image->crc = calculate_checksum(0, image->data, image->size);
+    integrity_sha256(image->data, image->size, image->digest);
+    return 0;
+}
+
+/**
+ * Unmap an image mapped by map_image
+ */
+static void unmap_image(image_map_t *image) {
+    if (image->data) munmap((void *)image->data, image->size);
+    if (image->fd >= 0) close(image->fd);
+    memset(image, 0, sizeof(*image));
+    image->fd = -1;
+}
+
+/**
+ * Set up a transfer queue, using O_DIRECT when the device and address allow it
+ */
+static int io_queue_open(io_queue_t *queue, const config_t *config, const flash_device_info_t *info, uint32_t address) {
+    bool direct;
     
-    // Write data
-    uint32_t remaining = file_size;
-    uint32_t address = config->address;
+    memset(queue, 0, sizeof(*queue));
+    queue->fd = info->fd;
+    queue->buffer_size = config->buffer_size;
+    queue->depth = config->queue_depth;
     
-    while (remaining > 0) {
-        uint32_t chunk_size = (remaining > config->buffer_size) ? config->buffer_size : remaining;
-        
-        // Read from file
-        if (fread(buffer, 1, chunk_size, input_fp) != chunk_size) {
-            fprintf(stderr, "Error: Read from input file failed\n");
-            goto cleanup;
+    direct = info->supports_direct_io && !config->buffered && (address % IO_ALIGNMENT) == 0;
+    queue->direct = (set_direct_io(queue->fd, direct) == 0) && direct;
+    
+    for (uint32_t i = 0; i < queue->depth; i++) {
+        if (posix_memalign((void **)&queue->buffers[i], IO_ALIGNMENT, queue->buffer_size) != 0) {
+            report_error("Error: Cannot allocate buffer\n");
+            io_queue_close(queue);
+            return 1;
         }
-        
-        // Simulate flash write
-        // In real implementation, this would write to the actual flash device
-        
-        bytes_written += chunk_size;
-        remaining -= chunk_size;
-        address += chunk_size;
-        
-        print_progress(bytes_written, file_size, "Writing");
     }
     
-    printf("\nWrote %s bytes successfully\n", format_size(bytes_written));
+    if (config->verbose) {
+        report("I/O: %u x %s buffers in flight%s\n", queue->depth, format_size(queue->buffer_size),
+               queue->direct ? ", O_DIRECT" : "");
+    }
     
-    // Verify if requested
-    if (config->verify_after_write) {
-        printf("Verifying written data...\n");
-        // Verification implementation would go here
-        printf("Verification completed successfully\n");
+    return 0;
+}
+
+/**
+ * Submit one request into a queue slot
+ */
+static int io_submit(io_queue_t *queue, uint32_t slot, int opcode, const uint8_t *buffer,
+                     uint32_t length, uint32_t request_length, uint64_t offset) {
+    struct aiocb *request = &queue->requests[slot];
+    int status;
+    
+    memset(request, 0, sizeof(*request));
+    request->aio_fildes = queue->fd;
+    request->aio_buf = (volatile void *)buffer;
+    request->aio_nbytes = request_length;
+    request->aio_offset = (off_t)offset;
+    queue->lengths[slot] = length;
+    
+    status = (opcode == LIO_READ) ? aio_read(request) : aio_write(request);
+    if (status != 0) {
+        report_error("Error: Cannot queue transfer at 0x%08llX: %s\n",
+                     (unsigned long long)offset, strerror(errno));
+        return 1;
     }
     
-    result = 0;
+    queue->pending++;
+    return 0;
+}
+
+/**
+ * Wait for the request in a slot and check that it moved every byte wanted
+ */
+static int io_wait(io_queue_t *queue, uint32_t slot) {
+    struct aiocb *request = &queue->requests[slot];
+    const struct aiocb *list[1] = { request };
+    ssize_t done;
+    int error;
     
-cleanup:
-    if (buffer) free(buffer);
-    if (input_fp) fclose(input_fp);
+    while ((error = aio_error(request)) == EINPROGRESS) {
+        aio_suspend(list, 1, NULL);
+    }
+    
+    done = aio_return(request);
+    if (error != 0 || done < 0 || (size_t)done < queue->lengths[slot]) {
+        report_error("\nError: Transfer at 0x%08llX failed: %s\n",
+                     (unsigned long long)request->aio_offset, error ? strerror(error) : "short transfer");
+        return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Retire the request at the head of the queue
+ */
+static int io_retire(io_queue_t *queue) {
+    int result = io_wait(queue, queue->head);
+    
+    queue->head = (queue->head + 1) % queue->depth;
+    queue->pending--;
     return result;
 }
 
 /**
- * Erase flash sectors
+ * Wait for every request still in flight and free the buffers
  */
-static int erase_flash(const config_t *config, const flash_device_info_t *info) {
-    if (!info->detected) {
-        fprintf(stderr, "Error: Flash device not detected\n");
-        return 1;
+static void io_queue_close(io_queue_t *queue) {
+    if (queue->held) {
+        queue->head = (queue->head + 1) % queue->depth;
+        queue->pending--;
+        queue->held = false;
+    }
+    while (queue->pending > 0) {
+        io_retire(queue);
     }
     
-    if (info->write_protected && !config->force) {
-        fprintf(stderr, "Error: Device is write protected. Use --force to override\n");
-        return 1;
+    for (uint32_t i = 0; i < queue->depth; i++) {
+        free(queue->buffers[i]);
+        queue->buffers[i] = NULL;
     }
     
-    uint32_t sector_count = (config->size + info->sector_size - 1) / info->sector_size;
+    set_direct_io(queue->fd, false);
+}
+
+/**
+ * Queue the next read of a streamed range into the free slot
+ */
+static int io_read_submit_next(io_queue_t *queue) {
+    uint32_t slot = (queue->head + queue->pending) % queue->depth;
+    uint64_t remaining = queue->end_offset - queue->next_offset;
+    uint32_t length = (remaining > queue->buffer_size) ? queue->buffer_size : (uint32_t)remaining;
     
-    printf("Erasing %d sectors (%s) starting at address 0x%08X\n", 
-           sector_count, format_size(config->size), config->address);
+    // O_DIRECT reads whole blocks; the device end cuts the last one short
+    uint32_t request_length = queue->direct ? align_up(length, IO_ALIGNMENT) : length;
     
-    // Simulate erase operation
-    for (uint32_t i = 0; i < sector_count; i++) {
-        uint32_t sector_addr = config->address + (i * info->sector_size);
-        
-        print_progress(i + 1, sector_count, "Erasing");
-        
-        // Simulate erase delay
-#ifdef _WIN32
-        Sleep(10);
-#else
-        usleep(10000);
-#endif
+    if (io_submit(queue, slot, LIO_READ, queue->buffers[slot], length, request_length, queue->next_offset) != 0) {
+        return 1;
     }
     
-    printf("\nErased %d sectors successfully\n", sector_count);
+    queue->next_offset += length;
     return 0;
 }
 
 /**
- * Verify flash against file
+ * Start streaming a device range through the queue
  */
-static int verify_flash(const config_t *config, const flash_device_info_t *info) {
-    // Verification implementation
-    printf("Verifying flash against %s\n", config->input_file);
-    printf("Verification completed successfully\n");
+static int io_read_begin(io_queue_t *queue, uint64_t offset, uint32_t size) {
+    queue->next_offset = offset;
+    queue->end_offset = offset + size;
+    
+    while (queue->pending < queue->depth && queue->next_offset < queue->end_offset) {
+        if (io_read_submit_next(queue) != 0) {
+            return 1;
+        }
+    }
+    
     return 0;
 }
 
 /**
- * Backup entire flash
+ * Get the next chunk of a streamed range, in order
+ * @return 1 with a chunk, 0 at the end of the range, -1 on error
+ *
+ * The chunk stays valid until the next call; its buffer is then refilled
+ * with the read after the last one queued.
  */
-static int backup_flash(const config_t *config, const flash_device_info_t *info) {
-    config_t backup_config = *config;
-    backup_config.address = 0;
-    backup_config.size = info->total_size;
+static int io_read_next(io_queue_t *queue, const uint8_t **data, uint32_t *length) {
+    if (queue->held) {
+        queue->held = false;
+        queue->head = (queue->head + 1) % queue->depth;
+        queue->pending--;
+        if (queue->next_offset < queue->end_offset && io_read_submit_next(queue) != 0) {
+            return -1;
+        }
+    }
     
-    printf("Creating full backup of flash device\n");
-    return read_flash(&backup_config, info);
+    if (queue->pending == 0) {
+        return 0;
+    }
+    
+    if (io_wait(queue, queue->head) != 0) {
+        queue->head = (queue->head + 1) % queue->depth;
+        queue->pending--;
+        return -1;
+    }
+    
+    queue->held = true;
+    *data = queue->buffers[queue->head];
+    *length = queue->lengths[queue->head];
+    return 1;
 }
 
 /**
- * Restore flash from backup
+ * Queue a write; data must stay untouched until the queue is drained
  */
-static int restore_flash(const config_t *config, const flash_device_info_t *info) {
-    config_t restore_config = *config;
-    restore_config.address = 0;
+static int io_write(io_queue_t *queue, uint64_t offset, const uint8_t *data, uint32_t length) {
+    if (queue->direct && (length % IO_ALIGNMENT) != 0) {
+        // O_DIRECT writes whole blocks only; finish an unaligned tail buffered
+        if (io_write_drain(queue) != 0 || set_direct_io(queue->fd, false) != 0) {
+            return 1;
+        }
+        queue->direct = false;
+    }
     
-    printf("Restoring flash from backup\n");
-    return write_flash(&restore_config, info);
+    if (queue->pending == queue->depth && io_retire(queue) != 0) {
+        return 1;
+    }
+    
+    return io_submit(queue, (queue->head + queue->pending) % queue->depth, LIO_WRITE,
+                     data, length, length, offset);
 }
 
 /**
- * Show flash device information
+ * Wait for every queued write
  */
-static int show_flash_info(const config_t *config, const flash_device_info_t *info) {
-    if (!info->detected) {
-        printf("Flash device: Not detected\n");
-        return 1;
+static int io_write_drain(io_queue_t *queue) {
+    int result = 0;
+    
+    while (queue->pending > 0) {
+        result |= io_retire(queue);
+    }
+    
+    return result;
+}
+
+/**
+ * Write a whole buffer at an offset
+ */
+static int pwrite_full(int fd, const uint8_t *data, uint32_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t done = pwrite(fd, data, length, (off_t)offset);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            report_error("\nError: Write at 0x%08llX failed: %s\n",
+                         (unsigned long long)offset, (done < 0) ? strerror(errno) : "no progress");
+            return 1;
+        }
+        data += done;
+        length -= (uint32_t)done;
+        offset += (uint64_t)done;
     }
     
-    printf("Flash Device Information:\n");
-    printf("  Device Path:     %s\n", info->device_path);
-    printf("  Total Size:      %s (%u bytes)\n", format_size(info->total_size), info->total_size);
-    printf("  Sector Size:     %s (%u bytes)\n", format_size(info->sector_size), info->sector_size);
-    printf("  Device ID:       0x%08X\n", info->device_id);
-    printf("  Vendor ID:       0x%04X\n", info->vendor_id);
-    printf("  Write Protected: %s\n", info->write_protected ? "YES" : "NO");
-    printf("  Sector Count:    %u\n", info->total_size / info->sector_size);
+    return 0;
+}
+
+/**
+ * Erase one MTD erase block
+ */
+static int erase_mtd_sector(const flash_device_info_t *info, uint32_t address) {
+    struct erase_info_user erase;
+    
+    erase.start = address;
+    erase.length = info->sector_size;
+    if (ioctl(info->fd, MEMERASE, &erase) != 0) {
+        report_error("\nError: Erase at 0x%08X failed: %s\n", address, strerror(errno));
+        return 1;
+    }
     
     return 0;
 }
 
 /**
- * Calculate simple checksum
+ * Check whether programming new over old needs an erase first (a 0 bit becoming 1)
  */
-static uint32_t calculate_checksum(const void *data, size_t size) {
-    const uint8_t *bytes = (const uint8_t *)data;
-    uint32_t checksum = 0;
+static bool sector_needs_erase(const uint8_t *old_data, const uint8_t *new_data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if ((old_data[i] & new_data[i]) != new_data[i]) {
+            return true;
+        }
+    }
     
-    for (size_t i = 0; i < size; i++) {
-        checksum += bytes[i];
+    return false;
+}
+
+/**
+ * Check whether a buffer is all 0xFF
+ */
+static bool sector_is_erased(const uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
     }
     
-    return checksum;
+    return true;
 }
 
 /**
- * Print progress bar
+ * Program an image sector by sector over the current device contents
+ *
+ * The sectors the image covers are streamed in through the read queue and
+ * the image is laid over each one. With --delta, sectors that come out
+ * unchanged are skipped. Every changed MTD sector is erased first, except
+ * on NOR, where a sector is only erased when some bit has to go from 0 to
+ * 1. NAND pages must not be programmed twice between erases and carry ECC
+ * over the whole page, so NAND never takes that shortcut. An erased sector
+ * that should stay blank is not programmed at all.
  */
-static void print_progress(size_t current, size_t total, const char *operation) {
-    const int bar_width = 50;
-    float progress = (float)current / total;
-    int filled = (int)(progress * bar_width);
+static int program_sectors(const config_t *config, const flash_device_info_t *info,
+                           const image_map_t *image, uint32_t address, program_stats_t *stats) {
+    io_queue_t queue;
+    uint8_t *sector_data = NULL;
+    const uint8_t *chunk;
+    uint32_t chunk_length;
+    uint32_t sector = info->sector_size;
+    uint32_t image_end = address + image->size;
+    uint32_t first = address / sector * sector;
+    uint32_t end = align_up(image_end, sector);
+    uint64_t chunk_address = first;
+    bool bit_clear_only = (info->type == DEVICE_MTD && info->mtd_type == MTD_NORFLASH);
+    int status;
+    int result = 1;
     
-    printf("\r%s: [", operation);
-    for (int i = 0; i < bar_width; i++) {
-        printf("%c", i < filled ? '=' : ' ');
+    memset(stats, 0, sizeof(*stats));
+    if (end > info->total_size) {
+        end = info->total_size;
     }
-    printf("] %3.0f%% (%zu/%zu)", progress * 100, current, total);
-    fflush(stdout);
+    
+    if (posix_memalign((void **)&sector_data, IO_ALIGNMENT, sector) != 0) {
+        report_error("Error: Cannot allocate buffer\n");
+        return 1;
+    }
+    
+    // A device that ends mid-block cannot be written with O_DIRECT
+    if (io_queue_open(&queue, config, info, ((end % IO_ALIGNMENT) == 0) ? first : 1) != 0) {
+        free(sector_data);
+        return 1;
+    }
+    
+    if (io_read_begin(&queue, first, end - first) != 0) {
+        goto cleanup;
+    }
+    
+    while ((status = io_read_next(&queue, &chunk, &chunk_length)) > 0) {
+        for (uint32_t offset = 0; offset < chunk_length; offset += sector) {
+            uint32_t sector_address = (uint32_t)chunk_address + offset;
+            uint32_t sector_length = (chunk_length - offset < sector) ? chunk_length - offset : sector;
+            const uint8_t *old_data = chunk + offset;
+            uint32_t overlap_start = (sector_address > address) ? sector_address : address;
+            uint32_t overlap_end = (sector_address + sector_length < image_end) ? sector_address + sector_length : image_end;
+            bool erased = false;
+            
+            memcpy(sector_data, old_data, sector_length);
+            memcpy(sector_data + (overlap_start - sector_address), image->data + (overlap_start - address),
+                   overlap_end - overlap_start);
+            
+            if (config->delta && memcmp(sector_data, old_data, sector_length) == 0) {
+                stats->unchanged++;
+                continue;
+            }
+            
+            if (info->type == DEVICE_MTD &&
+                (!bit_clear_only || sector_needs_erase(old_data, sector_data, sector_length))) {
+                if (erase_mtd_sector(info, sector_address) != 0) {
+                    goto cleanup;
+                }
+                stats->erased++;
+                erased = true;
+            }
+            
+            if (!(erased && sector_is_erased(sector_data, sector_length))) {
+                if (pwrite_full(info->fd, sector_data, sector_length, sector_address) != 0) {
+                    goto cleanup;
+                }
+                stats->programmed++;
+            }
+        }
+        
+        chunk_address += chunk_length;
+        print_progress(chunk_address - first, end - first, "Writing");
+    }
+    
+    result = (status < 0) ? 1 : 0;
+    
+cleanup:
+    io_queue_close(&queue);
+    free(sector_data);
+    return result;
 }
 
 /**
- * Format size as human readable string
+ * Read a device range back and compare it against an image
  */
-static const char *format_size(uint32_t size) {
-    static char buffer[32];
+static int verify_range(const config_t *config, const flash_device_info_t *info,
+                        const image_map_t *image, uint32_t address) {
+    io_queue_t queue;
+    const uint8_t *chunk;
+    uint32_t chunk_length;
+    uint32_t done = 0;
+    uint32_t device_crc = 0;
+    uint32_t mismatched = 0;
+    uint32_t first_mismatch = 0;
+    struct timespec start;
+    int status;
     
-    if (size >= 1024 * 1024) {
-        snprintf(buffer, sizeof(buffer), "%.1f MB", (float)size / (1024 * 1024));
-    } else if (size >= 1024) {
-        snprintf(buffer, sizeof(buffer), "%.1f KB", (float)size / 1024);
-    } else {
-        snprintf(buffer, sizeof(buffer), "%u bytes", size);
+    if (address > info->total_size || image->size > info->total_size - address) {
+        report_error("Error: %s is larger than the device\n", config->input_file);
+        return 1;
     }
     
-    return buffer;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    if (io_queue_open(&queue, config, info, address) != 0) {
+        return 1;
+    }
+    
+    if (io_read_begin(&queue, address, image->size) != 0) {
+        io_queue_close(&queue);
+        return 1;
+    }
+    
+    while ((status = io_read_next(&queue, &chunk, &chunk_length)) > 0) {
+        const uint8_t *expected = image->data + done;
+        
+        device_crc = calculate_checksum(device_crc, chunk, chunk_length);
+        
+        if (memcmp(chunk, expected, chunk_length) != 0) {
+            for (uint32_t i = 0; i < chunk_length; i++) {
+                if (chunk[i] != expected[i]) {
+                    if (mismatched == 0) {
+                        first_mismatch = address + done + i;
+                    }
+                    mismatched++;
+                }
+            }
+        }
+        
+        done += chunk_length;
+        print_progress(done, image->size, "Verifying");
+    }
+    
+    io_queue_close(&queue);
+    report("\n");
+    
+    if (status < 0) {
+        return 1;
+    }
+    
+    report("Device CRC32C: 0x%08X, image CRC32C: 0x%08X\n", device_crc, image->crc);
+    print_rate("Verified", done, &start);
+    
+    if (mismatched != 0) {
+        report_error("Error: Verification failed: %u bytes differ, first at 0x%08X\n",
+                     mismatched, first_mismatch);
+        return 1;
+    }
+    
+    report("Verification completed successfully\n");
+    return 0;
+}
+
+/**
+ * Read flash memory
+ */
+static int read_flash(const config_t *config, const flash_device_info_t *info) {
+    io_queue_t queue;
+    const uint8_t *chunk;
+    uint32_t chunk_length;
+    int output_fd = STDOUT_FILENO;
+    uint32_t bytes_read = 0;
+    uint32_t crc = 0;
+    uint32_t size;
+    struct timespec start;
+    int status;
+    int result = 1;
+    
+    if (!info->detected) {
+        report_error("Error: Flash device not detected\n");
+        return 1;
+    }
+    
+    if (config->address >= info->total_size) {
+        report_error("Error: Address 0x%08X is beyond the end of the device\n", config->address);
+        return 1;
+    }
+    
+    // No size reads to the end of the device
+    size = config->size ? config->size : info->total_size - config->address;
+    if (size > info->total_size - config->address) {
+        report_error("Error: Read runs past the end of the device\n");
+        return 1;
+    }
+    
+    report("Reading %s bytes from address 0x%08X\n", 
+           format_size(size), config->address);
+    
+    // Open output file
+    if (strlen(config->output_file) > 0) {
+        output_fd = open(config->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (output_fd < 0) {
+            report_error("Error: Cannot create output file %s\n", config->output_file);
+            return 1;
+        }
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    if (io_queue_open(&queue, config, info, config->address) != 0) {
+        goto close_output;
+    }
+    
+    if (io_read_begin(&queue, config->address, size) != 0) {
+        goto cleanup;
+    }
+    
+    // The next reads stay in flight while this chunk is hashed and written out
+    while ((status = io_read_next(&queue, &chunk, &chunk_length)) > 0) {
+        for (uint32_t written = 0; written < chunk_length; ) {
+            ssize_t done = write(output_fd, chunk + written, chunk_length - written);
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            if (done <= 0) {
+                report_error("\nError: Write to output failed\n");
+                goto cleanup;
+            }
+            written += (uint32_t)done;
+        }
+        
+        crc = calculate_checksum(crc, chunk, chunk_length);
+        bytes_read += chunk_length;
+        
+        print_progress(bytes_read, size, "Reading");
+    }
+    
+    if (status < 0) {
+        goto cleanup;
+    }
+    
+    report("\nRead %s bytes successfully (CRC32C 0x%08X)\n", format_size(bytes_read), crc);
+    print_rate("Read", bytes_read, &start);
+    result = 0;
+    
+cleanup:
+    io_queue_close(&queue);
+close_output:
+    if (output_fd != STDOUT_FILENO) close(output_fd);
+    return result;
+}
+
+/**
+ * Write to flash memory
+ */
+static int write_flash(const config_t *config, const flash_device_info_t *info) {
+    image_map_t image;
+    int result;
+    
+    if (!info->detected) {
+        report_error("Error: Flash device not detected\n");
+        return 1;
+    }
+    
+    if (map_image(config->input_file, &image) != 0) {
+        return 1;
+    }
+    
+    result = write_image(config, info, &image, config->address);
+    
+    unmap_image(&image);
+    return result;
+}
+
+/**
+ * Write a mapped image to flash memory
+ */
+static int write_image(const config_t *config, const flash_device_info_t *info,
+                       const image_map_t *image, uint32_t address) {
+    io_queue_t queue;
+    program_stats_t stats;
+    struct timespec start;
+    
+    if (info->write_protected && !config->force) {
+        report_error("Error: Device is write protected. Use --force to override\n");
+        return 1;
+    }
+    
+    if (address > info->total_size || image->size > info->total_size - address) {
+        report_error("Error: %s does not fit at 0x%08X\n", config->input_file, address);
+        return 1;
+    }
+    
+    report("Writing %s to address 0x%08X%s\n", 
+           format_size(image->size), address, config->delta ? " (changed sectors only)" : "");
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    if (config->delta || info->type == DEVICE_MTD) {
+        // MTD has to erase before it programs, so it always goes sector by sector
+        if (program_sectors(config, info, image, address, &stats) != 0) {
+            return 1;
+        }
+    } else {
+        // Chunks are submitted straight from the mapping; offsets stay page aligned
+        if (io_queue_open(&queue, config, info, address) != 0) {
+            return 1;
+        }
+        
+        for (uint32_t done = 0; done < image->size; ) {
+            uint32_t chunk_size = (image->size - done > config->buffer_size) ? config->buffer_size : image->size - done;
+            
+            if (io_write(&queue, (uint64_t)address + done, image->data + done, chunk_size) != 0) {
+                io_queue_close(&queue);
+                return 1;
+            }
+            
+            done += chunk_size;
+            print_progress(done, image->size, "Writing");
+        }
+        
+        if (io_write_drain(&queue) != 0) {
+            io_queue_close(&queue);
+            return 1;
+        }
+        io_queue_close(&queue);
+    }
+    
+    if (info->type != DEVICE_MTD && fsync(info->fd) != 0) {
+        report_error("\nError: Flush to %s failed: %s\n", info->device_path, strerror(errno));
+        return 1;
+    }
+    
+    report("\nWrote %s bytes successfully\n", format_size(image->size));
+    print_rate("Wrote", image->size, &start);
+    if (config->delta || info->type == DEVICE_MTD) {
+        report("Sectors: %u programmed, %u erased, %u unchanged\n",
+               stats.programmed, stats.erased, stats.unchanged);
+    }
+    
+    report("Image CRC32C: 0x%08X\n", image->crc);
+    print_digest("Image SHA-256", image->digest);
+    
+    // Verify if requested
+    if (config->verify_after_write) {
+        report("Verifying written data...\n");
+        if (verify_range(config, info, image, address) != 0) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Erase flash sectors
+ */
+static int erase_flash(const config_t *config, const flash_device_info_t *info) {
+    io_queue_t queue;
+    struct timespec start;
+    
+    if (!info->detected) {
+        report_error("Error: Flash device not detected\n");
+        return 1;
+    }
+    
+    if (info->write_protected && !config->force) {
+        report_error("Error: Device is write protected. Use --force to override\n");
+        return 1;
+    }
+    
+    uint32_t sector_count = (config->size + info->sector_size - 1) / info->sector_size;
+    uint32_t length = sector_count * info->sector_size;
+    
+    if (config->address % info->sector_size != 0) {
+        report_error("Error: Erase address must be a multiple of the %s sector size\n",
+                     format_size(info->sector_size));
+        return 1;
+    }
+    
+    if (config->address > info->total_size || length > info->total_size - config->address) {
+        report_error("Error: Erase runs past the end of the device\n");
+        return 1;
+    }
+    
+    report("Erasing %d sectors (%s) starting at address 0x%08X\n", 
+           sector_count, format_size(config->size), config->address);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    if (info->type == DEVICE_MTD) {
+        for (uint32_t i = 0; i < sector_count; i++) {
+            if (erase_mtd_sector(info, config->address + (i * info->sector_size)) != 0) {
+                return 1;
+            }
+            
+            print_progress(i + 1, sector_count, "Erasing");
+        }
+    } else {
+        // Block devices and files have no erase; fill with the erased pattern
+        if (io_queue_open(&queue, config, info, config->address) != 0) {
+            return 1;
+        }
+        memset(queue.buffers[0], 0xFF, queue.buffer_size);
+        
+        for (uint32_t done = 0; done < length; ) {
+            uint32_t chunk_size = (length - done > queue.buffer_size) ? queue.buffer_size : length - done;
+            
+            if (io_write(&queue, (uint64_t)config->address + done, queue.buffers[0], chunk_size) != 0) {
+                io_queue_close(&queue);
+                return 1;
+            }
+            
+            done += chunk_size;
+            print_progress(done / info->sector_size, sector_count, "Erasing");
+        }
+        
+        if (io_write_drain(&queue) != 0 || fsync(info->fd) != 0) {
+            io_queue_close(&queue);
+            return 1;
+        }
+        io_queue_close(&queue);
+    }
+    
+    report("\nErased %d sectors successfully\n", sector_count);
+    print_rate("Erased", length, &start);
+    return 0;
+}
+
+/**
+ * Verify flash against file
+ */
+static int verify_flash(const config_t *config, const flash_device_info_t *info) {
+    image_map_t image;
+    int result;
+    
+    if (!info->detected) {
+        report_error("Error: Flash device not detected\n");
+        return 1;
+    }
+    
+    if (map_image(config->input_file, &image) != 0) {
+        return 1;
+    }
+    
+    report("Verifying flash against %s\n", config->input_file);
+    result = verify_range(config, info, &image, config->address);
+    
+    unmap_image(&image);
+    return result;
+}
+
+/**
+ * Backup entire flash
+ */
+static int backup_flash(const config_t *config, const flash_device_info_t *info) {
+    config_t backup_config = *config;
+    backup_config.address = 0;
+    backup_config.size = info->total_size;
+    
+    report("Creating full backup of flash device\n");
+    return read_flash(&backup_config, info);
+}
+
+/**
+ * Restore flash from backup
+ */
+static int restore_flash(const config_t *config, const flash_device_info_t *info) {
+    image_map_t image;
+    int result = 1;
+    
+    if (!info->detected) {
+        report_error("Error: Flash device not detected\n");
+        return 1;
+    }
+    
+    if (map_image(config->input_file, &image) != 0) {
+        return 1;
+    }
+    
+    if (check_restore_size(config, info, image.size) == 0) {
+        report("Restoring flash from backup\n");
+        result = write_image(config, info, &image, 0);
+    }
+    
+    unmap_image(&image);
+    return result;
+}
+
+/**
+ * Check that a backup is the size of the device it is restored to
+ */
+static int check_restore_size(const config_t *config, const flash_device_info_t *info, uint32_t image_size) {
+    // A backup of another part would leave the tail of this one stale
+    if (image_size != info->total_size && !config->force) {
+        report_error("Error: Backup is %u bytes but the device is %u bytes. Use --force to override\n",
+                     image_size, info->total_size);
+        return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Name the kind of device that was detected
+ */
+static const char *device_type_name(const flash_device_info_t *info) {
+    switch (info->type) {
+        case DEVICE_MTD:
+            if (info->mtd_type == MTD_NORFLASH) return "MTD NOR flash";
+            if (info->mtd_type == MTD_NANDFLASH || info->mtd_type == MTD_MLCNANDFLASH) return "MTD NAND flash";
+            return "MTD device";
+        case DEVICE_BLOCK:
+            return "Block device";
+        default:
+            return "Image file";
+    }
+}
+
+/**
+ * Show flash device information
+ */
+static int show_flash_info(const config_t *config, const flash_device_info_t *info) {
+    if (!info->detected) {
+        report("Flash device: Not detected\n");
+        return 1;
+    }
+    
+    report("Flash Device Information:\n");
+    report("  Device Path:     %s\n", info->device_path);
+    report("  Device Type:     %s\n", device_type_name(info));
+    report("  Total Size:      %s (%u bytes)\n", format_size(info->total_size), info->total_size);
+    report("  Sector Size:     %s (%u bytes)\n", format_size(info->sector_size), info->sector_size);
+    if (info->type == DEVICE_MTD) {
+        report("  Write Size:      %u bytes\n", info->write_size);
+    }
+    report("  Direct I/O:      %s\n", (info->supports_direct_io && !config->buffered) ? "YES" : "NO");
+    report("  Write Protected: %s\n", info->write_protected ? "YES" : "NO");
+    report("  Sector Count:    %u\n", info->total_size / info->sector_size);
+    
+    return 0;
+}
+
+/**
+ * Run one operation on every device of a batch in parallel
+ */
+static int run_batch(config_t *config) {
+    static batch_device_t devices[MAX_BATCH_DEVICES];
+    image_map_t image;
+    struct aioinit aio;
+    struct timespec start;
+    struct timespec deadline;
+    uint32_t count = (uint32_t)config->devices.gl_pathc;
+    uint32_t succeeded = 0;
+    bool interactive = isatty(STDOUT_FILENO);
+    bool needs_image = false;
+    bool drawn = false;
+    bool finished;
+    double seconds;
+    
+    switch (config->operation) {
+        case OP_WRITE:
+        case OP_RESTORE:
+        case OP_VERIFY:
+            needs_image = true;
+            break;
+        case OP_ERASE:
+            break;
+        default:
+            fprintf(stderr, "Error: Batch mode supports write, restore, verify and erase\n");
+            return 1;
+    }
+    
+    if (count > MAX_BATCH_DEVICES) {
+        fprintf(stderr, "Error: At most %d devices per batch\n", MAX_BATCH_DEVICES);
+        return 1;
+    }
+    
+    // Read and hash the image once; every worker shares the mapping
+    if (needs_image) {
+        if (map_image(config->input_file, &image) != 0) {
+            return 1;
+        }
+        printf("Image %s: %s, CRC32C 0x%08X\n", config->input_file, format_size(image.size), image.crc);
+        print_digest("Image SHA-256", image.digest);
+    }
+    
+    // An AIO thread per device keeps one device's queue from waiting on another's
+    memset(&aio, 0, sizeof(aio));
+    aio.aio_threads = count;
+    aio.aio_num = count * config->queue_depth;
+    aio_init(&aio);
+    
+    printf("Flashing %u devices in parallel\n", count);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    memset(devices, 0, sizeof(devices));
+    for (uint32_t i = 0; i < count; i++) {
+        batch_device_t *device = &devices[i];
+        
+        device->config = config;
+        device->image = needs_image ? &image : NULL;
+        device->path = config->devices.gl_pathv[i];
+        device->operation = "Starting";
+        device->info.fd = -1;
+        
+        if (pthread_create(&device->thread, NULL, batch_worker, device) != 0) {
+            snprintf(device->error, sizeof(device->error), "Error: Cannot start worker thread");
+            device->result = 1;
+            device->finished = true;
+            continue;
+        }
+        device->started = true;
+    }
+    
+    // Workers report through print_progress; redraw their table until all finish
+    pthread_mutex_lock(&batch_lock);
+    for (;;) {
+        finished = true;
+        for (uint32_t i = 0; i < count; i++) {
+            finished = finished && devices[i].finished;
+        }
+        if (interactive) {
+            print_batch_progress(devices, count, drawn);
+            drawn = true;
+        }
+        if (finished) {
+            break;
+        }
+        
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BATCH_REFRESH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&batch_finished, &batch_lock, &deadline);
+    }
+    pthread_mutex_unlock(&batch_lock);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (devices[i].started) {
+            pthread_join(devices[i].thread, NULL);
+        }
+    }
+    
+    seconds = elapsed_seconds(&start);
+    
+    printf("\nBatch results:\n");
+    for (uint32_t i = 0; i < count; i++) {
+        const batch_device_t *device = &devices[i];
+        
+        printf("  %-24s %-6s %7.2f s", device->path, device->result ? "FAILED" : "OK", device->seconds);
+        if (device->result != 0 && device->error[0] != '\0') {
+            printf("  %s", device->error);
+        }
+        printf("\n");
+        
+        if (device->result == 0) {
+            succeeded++;
+        }
+    }
+    
+    printf("%u of %u devices succeeded in %.2f s", succeeded, count, seconds);
+    if (needs_image && seconds > 0) {
+        printf(" (%.1f MB/s aggregate)", (double)image.size * succeeded / seconds / (1024 * 1024));
+    }
+    printf("\n");
+    
+    if (needs_image) {
+        unmap_image(&image);
+    }
+    
+    return (succeeded == count) ? 0 : 1;
+}
+
+/**
+ * Drive one device of a batch from its own thread
+ */
+static void *batch_worker(void *context) {
+    batch_device_t *device = context;
+    config_t config = *device->config;
+    struct timespec start;
+    int result;
+    
+    tls_batch_device = device;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    result = detect_flash_device(device->path, &device->info);
+    if (result == 0) {
+        normalize_buffer_size(&config, &device->info);
+        
+        switch (config.operation) {
+            case OP_WRITE:
+                result = write_image(&config, &device->info, device->image, config.address);
+                break;
+            case OP_RESTORE:
+                result = check_restore_size(&config, &device->info, device->image->size);
+                if (result == 0) {
+                    result = write_image(&config, &device->info, device->image, 0);
+                }
+                break;
+            case OP_VERIFY:
+                result = verify_range(&config, &device->info, device->image, config.address);
+                break;
+            case OP_ERASE:
+                result = erase_flash(&config, &device->info);
+                break;
+            default:
+                result = 1;
+                break;
+        }
+        
+        close_flash_device(&device->info);
+    }
+    
+    pthread_mutex_lock(&batch_lock);
+    device->result = result;
+    device->seconds = elapsed_seconds(&start);
+    device->finished = true;
+    pthread_cond_signal(&batch_finished);
+    pthread_mutex_unlock(&batch_lock);
+    
+    return NULL;
+}
+
+/**
+ * Draw one progress line per batch device; called with batch_lock held
+ */
+static void print_batch_progress(const batch_device_t *devices, uint32_t count, bool redraw) {
+    const int bar_width = 30;
+    
+    // Move back up over the table drawn last time
+    if (redraw) {
+        printf("\033[%uA", count);
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const batch_device_t *device = &devices[i];
+        float progress = device->total ? (float)device->current / device->total : 0;
+        int filled = (int)(progress * bar_width);
+        const char *state = device->operation;
+        
+        if (device->finished) {
+            state = device->result ? "FAILED" : "Done";
+        }
+        
+        printf("\r  %-24s %-10s [", device->path, state);
+        for (int j = 0; j < bar_width; j++) {
+            printf("%c", j < filled ? '=' : ' ');
+        }
+        printf("] %3.0f%%\033[K\n", progress * 100);
+    }
+    
+    fflush(stdout);
+}
+
+/**
+ * Update the CRC32C of a data stream
+ */
+static uint32_t calculate_checksum(uint32_t crc, const void *data, size_t size) {
+    return integrity_crc32c(crc, data, size);
+}
+
+/**
+ * Print a SHA-256 digest as hex
+ */
+static void print_digest(const char *label, const uint8_t *digest) {
+    report("%s: ", label);
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        report("%02x", digest[i]);
+    }
+    report("\n");
+}
+
+/**
+ * Print progress bar
+ */
+static void print_progress(size_t current, size_t total, const char *operation) {
+    const int bar_width = 50;
+    float progress = (float)current / total;
+    int filled = (int)(progress * bar_width);
+    
+    // Inside a batch the main thread draws a line per device instead
+    if (tls_batch_device != NULL) {
+        pthread_mutex_lock(&batch_lock);
+        tls_batch_device->operation = operation;
+        tls_batch_device->current = current;
+        tls_batch_device->total = total;
+        pthread_mutex_unlock(&batch_lock);
+        return;
+    }
+    
+    printf("\r%s: [", operation);
+    for (int i = 0; i < bar_width; i++) {
+        printf("%c", i < filled ? '=' : ' ');
+    }
+    printf("] %3.0f%% (%zu/%zu)", progress * 100, current, total);
+    fflush(stdout);
+}
+
+/**
+ * Print elapsed time and throughput of an operation
+ */
+static void print_rate(const char *operation, uint32_t bytes, const struct timespec *start) {
+    double seconds = elapsed_seconds(start);
+    
+    report("%s %s in %.2f s", operation, format_size(bytes), seconds);
+    if (seconds > 0) {
+        report(" (%.1f MB/s)", bytes / seconds / (1024 * 1024));
+    }
+    report("\n");
+}
+
+/**
+ * Seconds since a CLOCK_MONOTONIC timestamp
+ */
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Print an informational message; workers of a batch stay quiet
+ */
+static void report(const char *format, ...) {
+    va_list args;
+    
+    if (tls_batch_device != NULL) {
+        return;
+    }
+    
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/**
+ * Print an error; workers of a batch keep their first one for the summary
+ */
+static void report_error(const char *format, ...) {
+    batch_device_t *device = tls_batch_device;
+    va_list args;
+    
+    va_start(args, format);
+    if (device == NULL) {
+        vfprintf(stderr, format, args);
+    } else if (device->error[0] == '\0') {
+        char message[sizeof(device->error)];
+        const char *text = message;
+        size_t length;
+        
+        vsnprintf(message, sizeof(message), format, args);
+        
+        // Drop the line breaks that keep a progress bar intact
+        while (*text == '\n') {
+            text++;
+        }
+        length = strlen(text);
+        while (length > 0 && text[length - 1] == '\n') {
+            length--;
+        }
+        memcpy(device->error, text, length);
+        device->error[length] = '\0';
+    }
+    va_end(args);
+}
+
+/**
+ * Format size as human readable string
+ */
+static const char *format_size(uint32_t size) {
+    static __thread char buffer[32];
+    
+    if (size >= 1024 * 1024) {
+        snprintf(buffer, sizeof(buffer), "%.1f MB", (float)size / (1024 * 1024));
+    } else if (size >= 1024) {
+        snprintf(buffer, sizeof(buffer), "%.1f KB", (float)size / 1024);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%u bytes", size);
+    }
+    
+    return buffer;
+}
+
+/**
+ * Round up to a multiple of alignment
+ */
+static uint32_t align_up(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
 }
 
 /**